@@ -0,0 +1,160 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#include "global.h"
+#include "debug.h"
+#include "util.h"
+#include "fileutil.h"
+#include "ikconfig.h"
+#include "kerneltool.h"
+#include "testutil.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+/*
+ * Compares the IKCONFIG search of KernelTool with the search as it was
+ * done before IkconfigScanner. This is not run by default; configure
+ * with -DKDUMP_BENCHMARKS=ON to build it and add it to the tests.
+ */
+
+/**
+ * Size of the synthetic kernel image.
+ */
+#define SYNTHETIC_SIZE  (64UL << 20)
+
+// -----------------------------------------------------------------------------
+static string testConfig()
+{
+    string ret;
+    for (int i = 0; i < 2000; ++i)
+        ret += "CONFIG_OPTION_" + std::to_string(i) + "=y\n";
+    ret += "CONFIG_NR_CPUS=8192\n";
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+static double elapsed(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double, std::milli> d =
+        std::chrono::steady_clock::now() - start;
+    return d.count();
+}
+
+// -----------------------------------------------------------------------------
+// The search as it was done before IkconfigScanner, for comparison.
+static bool naiveScan(const FilePath &path)
+{
+    gzFile fp = gzopen(path.c_str(), "r");
+    if (!fp)
+        throw KError("Cannot open " + path);
+
+    const unsigned char start[] = "IKCFG_ST", end[] = "IKCFG_ED";
+    unsigned char buffer[BUFSIZ];
+    memset(buffer, 0, BUFSIZ);
+    bool haveStart = false, haveEnd = false;
+    while (!haveEnd && gzread(fp, buffer + 8, BUFSIZ - 8) > 0) {
+        if (!haveStart)
+            haveStart = Util::findBytes(buffer, BUFSIZ, start, 8) > 0;
+        else
+            haveEnd = Util::findBytes(buffer, BUFSIZ, end, 8) > 0;
+        memmove(buffer, buffer + BUFSIZ - 8, 8);
+    }
+    gzclose(fp);
+    return haveEnd;
+}
+
+// -----------------------------------------------------------------------------
+static void benchmark(const FilePath &path)
+{
+    auto start = std::chrono::steady_clock::now();
+    string result;
+    try {
+        KernelTool kt(path);
+        result = std::to_string(kt.extractKernelConfig().size()) +
+            " bytes of config";
+    } catch (KError &e) {
+        result = e.what();
+    }
+    double scanned = elapsed(start);
+
+    start = std::chrono::steady_clock::now();
+    naiveScan(path);
+    double naive = elapsed(start);
+
+    cout << std::fixed << std::setprecision(1)
+         << path.baseName() << ": " << scanned << " ms (naive "
+         << naive << " ms): " << result << endl;
+}
+
+// -----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        cerr << "Usage: " << argv[0] << " dir" << endl;
+        return EXIT_FAILURE;
+    }
+
+    Debug::debug()->setStderrLevel(Debug::DL_INFO);
+    try {
+        static const char *const images[] = {
+            "kernel-bzImage-x86_64",
+            "kernel-ELFgz-x86_64",
+            "kernel-ELF-x86_64",
+            "kernel-ELFgz-ia64",
+            "kernel-ELF-ia64",
+            "kernel-ELF-aarch64",
+            NULL
+        };
+        FilePath datadir(argv[1]);
+        for (const char *const *p = images; *p; ++p) {
+            FilePath path = datadir;
+            benchmark(path.appendPath(*p));
+        }
+
+        string config = testConfig();
+        vector<char> image = syntheticKernel(SYNTHETIC_SIZE, config,
+            SYNTHETIC_SIZE - IkconfigScanner::BUFSIZE);
+
+        TempDir tmpdir("benchikconfig");
+        FilePath vmlinux = tmpdir.file("vmlinux");
+        FilePath vmlinuxgz = tmpdir.file("vmlinux.gz");
+        writeFile(vmlinux, image);
+        writeGzipFile(vmlinuxgz, image);
+        benchmark(vmlinux);
+        benchmark(vmlinuxgz);
+
+    } catch (const std::exception &ex) {
+        cerr << "Fatal exception: " << ex.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -22,6 +22,7 @@
 #include <cstring>
 #include <cstdlib>
 #include <limits>
+#include <strings.h>
 #include <unistd.h>
 #include <dirent.h>
 
@@ -35,6 +36,8 @@
 #include "process.h"
 #include "rootdirurl.h"
 #include "stringvector.h"
+#include "nativedump.h"
+#include "zstdprovider.h"
 
 // All calculations are in KiB
 
@@ -968,6 +971,34 @@ CryptInfo::CryptInfo(std::string const& device)
 }
 
 //}}}
+
+// -----------------------------------------------------------------------------
+// Checks whether save_dump may have to run makedumpfile although the
+// NATIVE flag is set.
+static bool nativeMayFallBack(const HyperInfo &hyper)
+{
+    Configuration *config = Configuration::config();
+    const char *format = config->KDUMP_DUMPFORMAT.value().c_str();
+
+    // only kdump-compressed files are written natively
+    if (strcasecmp(format, "compressed") != 0 &&
+        strcasecmp(format, "lzo") != 0 &&
+        strcasecmp(format, "snappy") != 0)
+        return true;
+
+    // domU pages are excluded by makedumpfile
+    if (hyper.type() == "xen" &&
+        !config->kdumptoolContainsFlag("XENALLDOMAINS"))
+        return true;
+
+    // page types need the struct page layout, which is only read on x86_64
+    if ((config->KDUMP_DUMPLEVEL.value() & (2 | 4 | 8 | 16)) &&
+        Util::getArch() != "x86_64")
+        return true;
+
+    return false;
+}
+
 //{{{ Calibrate ----------------------------------------------------------------
 
 // -----------------------------------------------------------------------------
@@ -1120,7 +1151,30 @@ void Calibrate::execute()
 	if (needsnet)
 	    user += USER_NET_KB;
 
-	if (config->needsMakedumpfile()) {
+	bool native = config->needsMakedumpfile() &&
+	    config->kdumptoolContainsFlag("NATIVE");
+	if (native) {
+	    // The native dump engine works in cycles of a fixed size
+	    unsigned long threads = config->KDUMP_CPUS.value();
+	    if (!threads)
+		threads = cpus;
+	    threads = threads > 1 ? threads - 1 : 1;
+	    unsigned long buffers = shr_round_up(
+		NativeDumpProvider::memoryNeeded(threads, pagesize), 10);
+	    Debug::debug()->dbg("Native dump engine buffers: %lu KiB", buffers);
+	    user += buffers;
+	}
+#if HAVE_ZSTD
+	if (strcasecmp(config->KDUMP_DUMPFORMAT.value().c_str(), "zstd") == 0) {
+	    // Compression frames and contexts of all zstd threads
+	    unsigned long buffers = shr_round_up(
+		ZstdDataProvider::memoryNeeded(cpus), 10);
+	    Debug::debug()->dbg("Zstd compression buffers: %lu KiB", buffers);
+	    user += buffers;
+	}
+#endif
+	if (config->needsMakedumpfile() &&
+	    (!native || nativeMayFallBack(hyper))) {
 	    // Estimate bitmap size (1 bit for every RAM page)
 	    unsigned long bitmapsz = shr_round_up(memtotal / pagesize, 2);
 	    if (bitmapsz > MAX_BITMAP_KB)
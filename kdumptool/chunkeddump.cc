@@ -0,0 +1,603 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/stat.h>
+
+#include <gelf.h>
+#include <zlib.h>
+
+#include "global.h"
+#include "debug.h"
+#include "chunkeddump.h"
+#include "vmcore.h"
+#include "vmcoreinfo.h"
+#include "elfnotes.h"
+#include "progress.h"
+#include "stringutil.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+# define ELFDATA_NATIVE ELFDATA2LSB
+#else
+# define ELFDATA_NATIVE ELFDATA2MSB
+#endif
+
+typedef std::pair<uint64_t, uint64_t> PfnRange;
+
+// -----------------------------------------------------------------------------
+static void mergeRanges(vector<PfnRange> &ranges)
+{
+    std::sort(ranges.begin(), ranges.end());
+
+    vector<PfnRange> merged;
+    for (const auto &range : ranges) {
+        if (!merged.empty() && range.first <= merged.back().second)
+            merged.back().second = std::max(merged.back().second,
+                                            range.second);
+        else
+            merged.push_back(range);
+    }
+    ranges.swap(merged);
+}
+
+// -----------------------------------------------------------------------------
+static void pread_all(int fd, void *buf, size_t len, off_t offset)
+{
+    char *p = static_cast<char *>(buf);
+
+    while (len) {
+        ssize_t ret = pread(fd, p, len, offset);
+        if (ret < 0)
+            throw KSystemError("Cannot read chunked dump", errno);
+        else if (!ret)
+            throw KError("Unexpected EOF in chunked dump");
+        len -= ret;
+        p += ret;
+        offset += ret;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static void pwrite_all(int fd, const void *buf, size_t len, off_t offset)
+{
+    const char *p = static_cast<const char *>(buf);
+
+    while (len) {
+        ssize_t ret = pwrite(fd, p, len, offset);
+        if (ret < 0)
+            throw KSystemError("Cannot write ELF file", errno);
+        len -= ret;
+        p += ret;
+        offset += ret;
+    }
+}
+
+//{{{ ChunkedDataProvider ------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+ChunkedDataProvider::ChunkedDataProvider(const FilePath &dump, int dumplevel)
+    : m_dump(dump), m_dumplevel(dumplevel), m_pagesize(0),
+      m_totalPages(0), m_classified(0), m_haveClasses(false),
+      m_mapCycle(~uint64_t(0)), m_class(0), m_cycle(0), m_pfn(0),
+      m_done(false), m_outPos(0)
+{}
+
+// -----------------------------------------------------------------------------
+ChunkedDataProvider::~ChunkedDataProvider()
+{}
+
+// -----------------------------------------------------------------------------
+void ChunkedDataProvider::prepare()
+{
+    Debug::debug()->trace("ChunkedDataProvider::prepare");
+
+    AbstractDataProvider::prepare();
+
+    m_vmcore.reset(new Vmcore(m_dump));
+    ElfNotes notes(*m_vmcore);
+    m_pagesize = sysconf(_SC_PAGESIZE);
+    try {
+        m_info.reset(new Vmcoreinfo);
+        m_info->readFromNotes(notes);
+        m_pagesize = m_info->getIntValue("PAGESIZE");
+    } catch (const KError &error) {
+        Debug::debug()->info("Cannot read VMCOREINFO, pages are not "
+                             "prioritized: %s", error.what());
+        m_info.reset();
+    }
+
+    m_classifier.reset(new PageClassifier(*m_vmcore, m_info.get(),
+                                          m_pagesize));
+    m_classifier->init();
+
+    // only whole pages
+    for (const auto &seg : m_vmcore->loadSegments()) {
+        uint64_t start = (seg.paddr + m_pagesize - 1) / m_pagesize;
+        uint64_t end = (seg.paddr + seg.memsz) / m_pagesize;
+        if (start < end)
+            m_pfns.push_back(PfnRange(start, end));
+    }
+    mergeRanges(m_pfns);
+    for (const auto &range : m_pfns)
+        m_totalPages += range.second - range.first;
+    Debug::debug()->dbg("%llu pages in %zu ranges",
+                        m_totalPages, m_pfns.size());
+
+    writeHeader(notes);
+}
+
+// -----------------------------------------------------------------------------
+void ChunkedDataProvider::appendChunk(uint32_t type, uint32_t flags,
+                                      uint64_t start, uint32_t count,
+                                      uint32_t pclass,
+                                      const void *payload, size_t size)
+{
+    struct chunked_chunk hdr;
+    memset(&hdr, 0, sizeof hdr);
+    hdr.type = type;
+    hdr.flags = flags;
+    hdr.start = start;
+    hdr.count = count;
+    hdr.pclass = pclass;
+    hdr.size = size;
+
+    const char *p = reinterpret_cast<const char *>(&hdr);
+    m_out.insert(m_out.end(), p, p + sizeof hdr);
+    p = static_cast<const char *>(payload);
+    m_out.insert(m_out.end(), p, p + size);
+}
+
+// -----------------------------------------------------------------------------
+void ChunkedDataProvider::writeHeader(const ElfNotes &notes)
+{
+    struct chunked_header hdr;
+    memset(&hdr, 0, sizeof hdr);
+    memcpy(hdr.magic, CHUNKED_MAGIC, sizeof CHUNKED_MAGIC);
+    hdr.version = CHUNKED_VERSION;
+    hdr.page_size = m_pagesize;
+    hdr.elf_class = m_vmcore->isElf64() ? ELFCLASS64 : ELFCLASS32;
+    hdr.elf_machine = m_vmcore->machine();
+    const char *p = reinterpret_cast<const char *>(&hdr);
+    m_out.insert(m_out.end(), p, p + sizeof hdr);
+
+    appendChunk(CHUNK_NOTES, 0, 0, 0, 0,
+                notes.data().data(), notes.data().size());
+
+    vector<struct chunked_segment> segments;
+    for (const auto &seg : m_vmcore->loadSegments()) {
+        struct chunked_segment cs;
+        cs.vaddr = seg.vaddr;
+        cs.paddr = seg.paddr;
+        cs.memsz = seg.memsz;
+        segments.push_back(cs);
+    }
+    appendChunk(CHUNK_SEGMENTS, 0, 0, 0, 0, segments.data(),
+                segments.size() * sizeof(struct chunked_segment));
+}
+
+// -----------------------------------------------------------------------------
+bool ChunkedDataProvider::excluded(PageClassifier::Class pc) const
+{
+    return PageClassifier::excluded(pc, m_dumplevel);
+}
+
+// -----------------------------------------------------------------------------
+unsigned ChunkedDataProvider::pageClass(uint64_t pfn) const
+{
+    uint64_t idx = pfn - m_mapCycle * CYCLE_PFNS;
+    return (m_classMap[idx / 2] >> (idx % 2 * 4)) & 0xf;
+}
+
+// -----------------------------------------------------------------------------
+unsigned ChunkedDataProvider::classifyCycle(uint64_t cycle)
+{
+    uint64_t start = cycle * CYCLE_PFNS;
+    uint64_t end = std::min(start + CYCLE_PFNS, m_pfns.back().second);
+
+    // holes between the ranges get PC_MAX, which is never written
+    m_classMap.assign((end - start + 1) / 2, 0xff);
+    m_mapCycle = cycle;
+
+    unsigned classes = 0;
+    for (const auto &range : m_pfns) {
+        uint64_t first = std::max(range.first, start);
+        uint64_t last = std::min(range.second, end);
+        for (uint64_t pfn = first; pfn < last; ++pfn) {
+            uint64_t idx = pfn - start;
+            unsigned pc = m_classifier->classify(pfn);
+            m_classMap[idx / 2] &= ~(0xf << (idx % 2 * 4));
+            m_classMap[idx / 2] |= pc << (idx % 2 * 4);
+            classes |= 1U << pc;
+            if ((++m_classified & 0xffff) == 0)
+                checkAborted();
+        }
+    }
+    return classes;
+}
+
+// -----------------------------------------------------------------------------
+void ChunkedDataProvider::classifyAll()
+{
+    uint64_t cycles = m_pfns.empty() ? 0 :
+        (m_pfns.back().second + CYCLE_PFNS - 1) / CYCLE_PFNS;
+
+    m_cycleClasses.assign(cycles, 0);
+    for (uint64_t cycle = 0; cycle < cycles; ++cycle) {
+        m_cycleClasses[cycle] = classifyCycle(cycle);
+        if (getProgress())
+            getProgress()->progressed(m_classified, m_totalPages);
+    }
+    m_haveClasses = true;
+}
+
+// -----------------------------------------------------------------------------
+bool ChunkedDataProvider::nextChunk()
+{
+    if (!m_haveClasses)
+        classifyAll();
+
+    for (; m_class < PageClassifier::PC_MAX;
+         ++m_class, m_cycle = 0, m_pfn = 0) {
+        PageClassifier::Class pc = PageClassifier::Class(m_class);
+        if (excluded(pc))
+            continue;
+
+        for (; m_cycle < m_cycleClasses.size(); ++m_cycle) {
+            if (!(m_cycleClasses[m_cycle] & (1U << pc)))
+                continue;
+
+            // with a single cycle, memory is classified only once
+            if (m_mapCycle != m_cycle)
+                classifyCycle(m_cycle);
+
+            uint64_t start = m_cycle * CYCLE_PFNS;
+            uint64_t end = start + m_classMap.size() * 2;
+            m_pfn = std::max(m_pfn, start);
+
+            // skip pages of other classes
+            while (m_pfn < end && pageClass(m_pfn) != unsigned(pc))
+                ++m_pfn;
+
+            if (m_pfn < end) {
+                uint64_t first = m_pfn++;
+                while (m_pfn < end &&
+                       m_pfn - first < MAX_CHUNK_PAGES &&
+                       pageClass(m_pfn) == unsigned(pc))
+                    ++m_pfn;
+
+                writePages(first, m_pfn - first, pc);
+                return true;
+            }
+        }
+    }
+
+    if (m_done)
+        return false;
+
+    appendChunk(CHUNK_END, 0, 0, 0, 0, NULL, 0);
+    m_done = true;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+void ChunkedDataProvider::writePages(uint64_t start, uint32_t count,
+                                     PageClassifier::Class pc)
+{
+    size_t bitmapSize = (count + 7) / 8;
+    vector<char> payload(bitmapSize);
+
+    m_pages.resize(size_t(count) * m_pagesize);
+    m_vmcore->readPhys(start * m_pagesize, m_pages.data(), m_pages.size());
+
+    // keep only non-zero pages
+    size_t stored = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        const char *page = m_pages.data() + size_t(i) * m_pagesize;
+        if (Util::isZero(page, m_pagesize))
+            continue;
+        payload[i / 8] |= 1 << (i % 8);
+        if (stored != i)
+            memmove(m_pages.data() + stored * m_pagesize, page, m_pagesize);
+        ++stored;
+    }
+    size_t storedSize = stored * m_pagesize;
+
+    uint32_t flags = 0;
+    uLongf zsize = compressBound(storedSize);
+    m_zbuf.resize(zsize);
+    if (stored &&
+        compress2(reinterpret_cast<Bytef *>(m_zbuf.data()), &zsize,
+                  reinterpret_cast<const Bytef *>(m_pages.data()),
+                  storedSize, Z_BEST_SPEED) == Z_OK &&
+        zsize < storedSize) {
+        flags |= CHUNK_FLAG_ZLIB;
+        payload.insert(payload.end(), m_zbuf.begin(), m_zbuf.begin() + zsize);
+    } else
+        payload.insert(payload.end(), m_pages.begin(),
+                       m_pages.begin() + storedSize);
+
+    appendChunk(CHUNK_PAGES, flags, start, count, pc,
+                payload.data(), payload.size());
+}
+
+// -----------------------------------------------------------------------------
+size_t ChunkedDataProvider::getData(char *buffer, size_t maxread)
+{
+    checkAborted();
+
+    while (m_outPos == m_out.size()) {
+        m_out.clear();
+        m_outPos = 0;
+        if (!nextChunk())
+            return 0;
+    }
+
+    size_t size = std::min(maxread, m_out.size() - m_outPos);
+    memcpy(buffer, m_out.data() + m_outPos, size);
+    m_outPos += size;
+    addBytesProvided(size);
+
+    return size;
+}
+
+//}}}
+//{{{ ChunkedDump --------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+ChunkedDump::ChunkedDump(const FilePath &path)
+    : m_path(path), m_fd(path, O_RDONLY), m_fileSize(0), m_complete(false),
+      m_pageCount(0), m_classCount(PageClassifier::PC_MAX)
+{
+    Debug::debug()->trace("ChunkedDump::ChunkedDump(%s)", path.c_str());
+
+    struct stat st;
+    if (fstat(m_fd, &st) != 0)
+        throw KSystemError("Cannot stat " + path, errno);
+    m_fileSize = st.st_size;
+
+    if (m_fileSize < sizeof m_header)
+        throw KError(path + " is no chunked dump.");
+    pread_all(m_fd, &m_header, sizeof m_header, 0);
+    if (memcmp(m_header.magic, CHUNKED_MAGIC, sizeof CHUNKED_MAGIC))
+        throw KError(path + " is no chunked dump.");
+    if (m_header.version != CHUNKED_VERSION)
+        throw KError(path + ": unsupported version " +
+                     StringUtil::number2string(m_header.version) + ".");
+    if (!m_header.page_size)
+        throw KError(path + ": invalid page size.");
+
+    readIndex();
+}
+
+// -----------------------------------------------------------------------------
+void ChunkedDump::readIndex()
+{
+    uint64_t off = sizeof m_header;
+
+    while (off + sizeof(struct chunked_chunk) <= m_fileSize) {
+        PageChunk chunk;
+        pread_all(m_fd, &chunk.hdr, sizeof chunk.hdr, off);
+        chunk.offset = off + sizeof chunk.hdr;
+        if (chunk.hdr.size > m_fileSize - chunk.offset)
+            break;              // truncated
+
+        switch (chunk.hdr.type) {
+        case CHUNK_NOTES:
+            m_notes.resize(chunk.hdr.size);
+            pread_all(m_fd, m_notes.data(), m_notes.size(), chunk.offset);
+            break;
+
+        case CHUNK_SEGMENTS:
+            m_segments.resize(chunk.hdr.size /
+                              sizeof(struct chunked_segment));
+            pread_all(m_fd, m_segments.data(),
+                      m_segments.size() * sizeof(struct chunked_segment),
+                      chunk.offset);
+            break;
+
+        case CHUNK_PAGES:
+            m_chunks.push_back(chunk);
+            m_pageCount += chunk.hdr.count;
+            if (chunk.hdr.pclass < m_classCount.size())
+                m_classCount[chunk.hdr.pclass] += chunk.hdr.count;
+            break;
+
+        case CHUNK_END:
+            m_complete = true;
+            break;
+
+        default:
+            Debug::debug()->dbg("Skipping unknown chunk type %u",
+                                chunk.hdr.type);
+        }
+
+        if (m_complete)
+            break;
+        off = chunk.offset + chunk.hdr.size;
+    }
+
+    Debug::debug()->dbg("%s: %zu page chunks, %llu pages, %scomplete",
+                        m_path.c_str(), m_chunks.size(), m_pageCount,
+                        m_complete ? "" : "in");
+}
+
+// -----------------------------------------------------------------------------
+void ChunkedDump::readChunkPages(const PageChunk &chunk,
+                                 vector<char> &bitmap, vector<char> &data)
+{
+    size_t bitmapSize = (chunk.hdr.count + 7) / 8;
+    if (chunk.hdr.size < bitmapSize)
+        throw KError(m_path + ": invalid chunk at offset " +
+                     StringUtil::number2string(chunk.offset) + ".");
+
+    vector<char> payload(chunk.hdr.size);
+    pread_all(m_fd, payload.data(), payload.size(), chunk.offset);
+    bitmap.assign(payload.begin(), payload.begin() + bitmapSize);
+
+    size_t stored = 0;
+    for (uint32_t i = 0; i < chunk.hdr.count; ++i)
+        if (bitmap[i / 8] & (1 << (i % 8)))
+            ++stored;
+    data.resize(stored * m_header.page_size);
+
+    if (chunk.hdr.flags & CHUNK_FLAG_ZLIB) {
+        uLongf size = data.size();
+        if (uncompress(reinterpret_cast<Bytef *>(data.data()), &size,
+                       reinterpret_cast<const Bytef *>(payload.data()) +
+                       bitmapSize, payload.size() - bitmapSize) != Z_OK ||
+            size != data.size())
+            throw KError(m_path + ": corrupted chunk at offset " +
+                         StringUtil::number2string(chunk.offset) + ".");
+    } else {
+        if (payload.size() - bitmapSize != data.size())
+            throw KError(m_path + ": invalid chunk at offset " +
+                         StringUtil::number2string(chunk.offset) + ".");
+        memcpy(data.data(), payload.data() + bitmapSize, data.size());
+    }
+}
+
+// -----------------------------------------------------------------------------
+void ChunkedDump::writeElf(const FilePath &path)
+{
+    Debug::debug()->trace("ChunkedDump::writeElf(%s)", path.c_str());
+
+    uint64_t pagesize = m_header.page_size;
+
+    // page frames found in the dump
+    vector<PfnRange> present;
+    for (const auto &chunk : m_chunks)
+        present.push_back(PfnRange(chunk.hdr.start,
+                                   chunk.hdr.start + chunk.hdr.count));
+    mergeRanges(present);
+
+    // one PT_LOAD for each present range within an original segment
+    struct Load {
+        uint64_t start, end;    // page frames
+        uint64_t vaddr;
+        uint64_t offset;
+    };
+    vector<vector<Load> > loads(m_segments.size());
+    size_t numLoads = 0;
+    for (size_t i = 0; i < m_segments.size(); ++i) {
+        const struct chunked_segment &seg = m_segments[i];
+        uint64_t segStart = (seg.paddr + pagesize - 1) / pagesize;
+        uint64_t segEnd = (seg.paddr + seg.memsz) / pagesize;
+        for (const auto &range : present) {
+            Load load;
+            load.start = std::max(range.first, segStart);
+            load.end = std::min(range.second, segEnd);
+            if (load.start >= load.end)
+                continue;
+            load.vaddr = seg.vaddr + (load.start * pagesize - seg.paddr);
+            loads[i].push_back(load);
+            ++numLoads;
+        }
+    }
+    if (numLoads + 1 >= PN_XNUM)
+        throw KError("Too many memory ranges for an ELF file.");
+
+    // layout
+    uint64_t off = sizeof(Elf64_Ehdr) + (numLoads + 1) * sizeof(Elf64_Phdr);
+    uint64_t notesOffset = off;
+    off += m_notes.size();
+    off = (off + pagesize - 1) / pagesize * pagesize;
+
+    vector<Elf64_Phdr> phdrs;
+    Elf64_Phdr phdr;
+    memset(&phdr, 0, sizeof phdr);
+    phdr.p_type = PT_NOTE;
+    phdr.p_offset = notesOffset;
+    phdr.p_filesz = phdr.p_memsz = m_notes.size();
+    phdrs.push_back(phdr);
+    for (auto &segLoads : loads)
+        for (auto &load : segLoads) {
+            load.offset = off;
+            memset(&phdr, 0, sizeof phdr);
+            phdr.p_type = PT_LOAD;
+            phdr.p_flags = PF_R | PF_W | PF_X;
+            phdr.p_offset = off;
+            phdr.p_vaddr = load.vaddr;
+            phdr.p_paddr = load.start * pagesize;
+            phdr.p_filesz = phdr.p_memsz =
+                (load.end - load.start) * pagesize;
+            phdrs.push_back(phdr);
+            off += phdr.p_filesz;
+        }
+
+    Elf64_Ehdr ehdr;
+    memset(&ehdr, 0, sizeof ehdr);
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA_NATIVE;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_type = ET_CORE;
+    ehdr.e_machine = m_header.elf_machine;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_phoff = sizeof ehdr;
+    ehdr.e_ehsize = sizeof ehdr;
+    ehdr.e_phentsize = sizeof(Elf64_Phdr);
+    ehdr.e_phnum = phdrs.size();
+
+    FileDescriptor fd(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    pwrite_all(fd, &ehdr, sizeof ehdr, 0);
+    pwrite_all(fd, phdrs.data(), phdrs.size() * sizeof(Elf64_Phdr),
+               sizeof ehdr);
+    pwrite_all(fd, m_notes.data(), m_notes.size(), notesOffset);
+
+    // pages; zero pages are left as holes
+    vector<char> bitmap, data;
+    for (const auto &chunk : m_chunks) {
+        readChunkPages(chunk, bitmap, data);
+
+        size_t stored = 0;
+        for (uint32_t i = 0; i < chunk.hdr.count; ++i) {
+            if (!(bitmap[i / 8] & (1 << (i % 8))))
+                continue;
+
+            uint64_t pfn = chunk.hdr.start + i;
+            const char *page = data.data() + stored++ * pagesize;
+            for (const auto &segLoads : loads) {
+                auto it = std::upper_bound(segLoads.begin(), segLoads.end(),
+                    pfn, [](uint64_t p, const Load &l){ return p < l.start; });
+                if (it == segLoads.begin())
+                    continue;
+                --it;
+                if (pfn < it->end)
+                    pwrite_all(fd, page, pagesize,
+                               it->offset + (pfn - it->start) * pagesize);
+            }
+        }
+    }
+
+    if (ftruncate(fd, off) != 0)
+        throw KSystemError("Cannot set size of " + path, errno);
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
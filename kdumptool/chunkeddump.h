@@ -0,0 +1,253 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef CHUNKEDDUMP_H
+#define CHUNKEDDUMP_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "global.h"
+#include "fileutil.h"
+#include "dataprovider.h"
+#include "pageclassifier.h"
+
+class Vmcore;
+class Vmcoreinfo;
+class ElfNotes;
+
+//{{{ Chunked dump file format -------------------------------------------------
+
+/*
+ * A chunked dump is a file header followed by a sequence of chunks. Each
+ * chunk consists of a chunk header and its payload. All numbers are in the
+ * byte order of the dumped machine.
+ *
+ * The first chunks hold the ELF notes (incl. VMCOREINFO) and the memory
+ * layout, so the dump can be loaded after any complete chunk. Pages are
+ * written ordered by their PageClassifier class within each cycle of
+ * ChunkedDataProvider::CYCLE_PFNS page frames. A page chunk covers
+ * consecutive page frames; its payload starts with a bitmap of the pages
+ * that are stored, the other pages are zero. The stored pages may be
+ * compressed with zlib as a whole. The last chunk of a complete dump is
+ * a CHUNK_END chunk.
+ */
+
+#define CHUNKED_MAGIC           "KDCHUNK"
+#define CHUNKED_VERSION         1
+
+struct chunked_header {
+    char magic[8];              // CHUNKED_MAGIC
+    uint32_t version;           // CHUNKED_VERSION
+    uint32_t page_size;
+    uint32_t elf_class;         // ELFCLASS32 or ELFCLASS64 of the source
+    uint32_t elf_machine;       // e_machine of the source
+    uint64_t reserved[5];
+};
+
+enum {
+    CHUNK_NOTES = 1,            // contents of all PT_NOTE segments
+    CHUNK_SEGMENTS,             // array of struct chunked_segment
+    CHUNK_PAGES,                // bitmap and stored pages
+    CHUNK_END                   // end of a complete dump
+};
+
+#define CHUNK_FLAG_ZLIB         0x1     // stored pages are compressed
+
+struct chunked_chunk {
+    uint32_t type;              // CHUNK_*
+    uint32_t flags;             // CHUNK_FLAG_*
+    uint64_t start;             // first page frame (CHUNK_PAGES)
+    uint32_t count;             // number of page frames (CHUNK_PAGES)
+    uint32_t pclass;            // PageClassifier::Class (CHUNK_PAGES)
+    uint64_t size;              // payload size in bytes
+};
+
+struct chunked_segment {
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t memsz;
+};
+
+//}}}
+//{{{ ChunkedDataProvider ------------------------------------------------------
+
+/**
+ * DataProvider that reads a dump and provides it as a chunked dump,
+ * the most valuable pages first.
+ *
+ * The page frames are classified in cycles of CYCLE_PFNS, and only the
+ * set of classes found in each cycle is kept. The pages are then
+ * written class by class, and a cycle is classified again for each
+ * class it contains, so the order holds for the whole dump without a
+ * class map of all memory.
+ */
+class ChunkedDataProvider : public AbstractDataProvider {
+
+    public:
+        /**
+         * Creates a new ChunkedDataProvider.
+         *
+         * @param[in] dump the ELF dump file (e.g. /proc/vmcore)
+         * @param[in] dumplevel makedumpfile dump level; page cache, user
+         *            and free pages are left out accordingly
+         */
+        ChunkedDataProvider(const FilePath &dump, int dumplevel);
+
+        ~ChunkedDataProvider();
+
+        /**
+         * Opens the dump and classifies its pages.
+         *
+         * @see DataProvider::prepare()
+         */
+        void prepare();
+
+        /**
+         * Provides the data.
+         *
+         * @see DataProvider::getData()
+         */
+        size_t getData(char *buffer, size_t maxread);
+
+        /**
+         * Maximum number of pages in a chunk.
+         */
+        static const unsigned MAX_CHUNK_PAGES = 256;
+
+        /**
+         * Number of page frames classified at a time. The class map of
+         * a cycle takes 4 bits per page frame. Cycles are aligned to
+         * this size, so free page blocks never cross a cycle boundary.
+         */
+        static const uint64_t CYCLE_PFNS = uint64_t(1) << 23;
+
+    protected:
+        void appendChunk(uint32_t type, uint32_t flags, uint64_t start,
+                         uint32_t count, uint32_t pclass,
+                         const void *payload, size_t size);
+        void writeHeader(const ElfNotes &notes);
+        unsigned classifyCycle(uint64_t cycle);
+        void classifyAll();
+        bool nextChunk();
+        unsigned pageClass(uint64_t pfn) const;
+        void writePages(uint64_t start, uint32_t count,
+                        PageClassifier::Class pc);
+        bool excluded(PageClassifier::Class pc) const;
+
+    private:
+        FilePath m_dump;
+        int m_dumplevel;
+        std::unique_ptr<Vmcore> m_vmcore;
+        std::unique_ptr<Vmcoreinfo> m_info;
+        std::unique_ptr<PageClassifier> m_classifier;
+        unsigned long m_pagesize;
+        std::vector<std::pair<uint64_t, uint64_t> > m_pfns;
+        unsigned long long m_totalPages;
+        unsigned long long m_classified;
+
+        std::vector<uint16_t> m_cycleClasses;
+        bool m_haveClasses;
+        uint64_t m_mapCycle;
+        std::vector<unsigned char> m_classMap;
+        int m_class;
+        uint64_t m_cycle;
+        uint64_t m_pfn;
+        bool m_done;
+
+        std::vector<char> m_out;
+        size_t m_outPos;
+        std::vector<char> m_pages;
+        std::vector<char> m_zbuf;
+};
+
+//}}}
+//{{{ ChunkedDump --------------------------------------------------------------
+
+/**
+ * Reads a chunked dump, which may be truncated.
+ */
+class ChunkedDump {
+
+    public:
+        /**
+         * Opens a chunked dump and reads its index.
+         *
+         * @param[in] path the chunked dump
+         * @exception KError if the file is not a chunked dump
+         */
+        ChunkedDump(const FilePath &path);
+
+        /**
+         * Returns @c true if the dump ends with a CHUNK_END chunk.
+         */
+        bool isComplete() const
+        { return m_complete; }
+
+        /**
+         * Returns the number of pages stored in the dump.
+         */
+        unsigned long long pageCount() const
+        { return m_pageCount; }
+
+        /**
+         * Returns the number of pages stored per page class.
+         */
+        const std::vector<unsigned long long> &classCount() const
+        { return m_classCount; }
+
+        /**
+         * Writes all pages found in the dump as an ELF64 core file.
+         * Missing pages are left out; zero pages are left as holes.
+         *
+         * @param[in] path the ELF file
+         * @exception KError if reading or writing fails
+         */
+        void writeElf(const FilePath &path);
+
+    protected:
+        struct PageChunk {
+            uint64_t offset;    // of the payload
+            struct chunked_chunk hdr;
+        };
+
+        void readIndex();
+        void readChunkPages(const PageChunk &chunk,
+                            std::vector<char> &bitmap,
+                            std::vector<char> &data);
+
+    private:
+        FilePath m_path;
+        FileDescriptor m_fd;
+        uint64_t m_fileSize;
+        struct chunked_header m_header;
+        std::vector<char> m_notes;
+        std::vector<struct chunked_segment> m_segments;
+        std::vector<PageChunk> m_chunks;
+        bool m_complete;
+        unsigned long long m_pageCount;
+        std::vector<unsigned long long> m_classCount;
+};
+
+//}}}
+
+#endif /* CHUNKEDDUMP_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
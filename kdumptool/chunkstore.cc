@@ -0,0 +1,506 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <set>
+#include <algorithm>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "global.h"
+#include "debug.h"
+#include "chunkstore.h"
+#include "dataprovider.h"
+#include "stringutil.h"
+
+using std::string;
+using std::vector;
+using std::cerr;
+using std::endl;
+
+#define RECIPE_HEADER   "# kdump chunk recipe 1"
+
+// average chunk size is MIN_CHUNK + 64 KiB
+#define CUT_MASK        0xffff000000000000ULL
+
+//{{{ Sha256 -------------------------------------------------------------------
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t ror32(uint32_t x, unsigned n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+// -----------------------------------------------------------------------------
+Sha256::Sha256()
+    : m_length(0), m_used(0)
+{
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(m_state, init, sizeof m_state);
+}
+
+// -----------------------------------------------------------------------------
+void Sha256::transform(const unsigned char *block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i)
+        w[i] = uint32_t(block[4*i]) << 24 | uint32_t(block[4*i + 1]) << 16 |
+            uint32_t(block[4*i + 2]) << 8 | block[4*i + 3];
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = ror32(w[i-15], 7) ^ ror32(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = ror32(w[i-2], 17) ^ ror32(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+    uint32_t e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t s1 = ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+        uint32_t s0 = ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    m_state[0] += a; m_state[1] += b; m_state[2] += c; m_state[3] += d;
+    m_state[4] += e; m_state[5] += f; m_state[6] += g; m_state[7] += h;
+}
+
+// -----------------------------------------------------------------------------
+void Sha256::update(const void *data, size_t len)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+
+    m_length += len;
+    if (m_used) {
+        size_t n = std::min(len, sizeof m_block - m_used);
+        memcpy(m_block + m_used, p, n);
+        m_used += n;
+        p += n;
+        len -= n;
+        if (m_used < sizeof m_block)
+            return;
+        transform(m_block);
+        m_used = 0;
+    }
+    while (len >= sizeof m_block) {
+        transform(p);
+        p += sizeof m_block;
+        len -= sizeof m_block;
+    }
+    memcpy(m_block, p, len);
+    m_used = len;
+}
+
+// -----------------------------------------------------------------------------
+string Sha256::hexDigest()
+{
+    uint64_t bits = m_length * 8;
+    unsigned char pad[sizeof m_block + 8];
+    size_t padlen = (m_used < 56 ? 56 : 120) - m_used;
+    memset(pad, 0, sizeof pad);
+    pad[0] = 0x80;
+    for (int i = 0; i < 8; ++i)
+        pad[padlen + i] = bits >> (56 - 8 * i);
+    update(pad, padlen + 8);
+
+    static const char hex[] = "0123456789abcdef";
+    string ret;
+    for (int i = 0; i < 8; ++i)
+        for (int j = 28; j >= 0; j -= 4)
+            ret.push_back(hex[(m_state[i] >> j) & 0xf]);
+    return ret;
+}
+
+//}}}
+//{{{ ChunkStore ---------------------------------------------------------------
+
+const char ChunkStore::STORE_DIR[] = ".chunks";
+const char ChunkStore::RECIPE_SUFFIX[] = ".recipe";
+
+// -----------------------------------------------------------------------------
+static const uint64_t *gearTable()
+{
+    static uint64_t table[256];
+    static bool initialized;
+
+    if (!initialized) {
+        // splitmix64, so the table is the same for every build
+        uint64_t x = 0;
+        for (int i = 0; i < 256; ++i) {
+            uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            table[i] = z ^ (z >> 31);
+        }
+        initialized = true;
+    }
+    return table;
+}
+
+// -----------------------------------------------------------------------------
+ChunkStore::ChunkStore(const FilePath &savedir)
+    : m_savedir(savedir), m_dir(savedir)
+{
+    m_dir.appendPath(STORE_DIR);
+    if (!m_dir.exists())
+        m_dir.mkdir(true);
+}
+
+// -----------------------------------------------------------------------------
+size_t ChunkStore::cutPoint(const char *data, size_t len)
+{
+    if (len <= MIN_CHUNK)
+        return len;
+
+    const uint64_t *gear = gearTable();
+    size_t end = std::min(len, size_t(MAX_CHUNK));
+    uint64_t hash = 0;
+    for (size_t i = MIN_CHUNK; i < end; ++i) {
+        hash = (hash << 1) + gear[(unsigned char)data[i]];
+        if (!(hash & CUT_MASK))
+            return i + 1;
+    }
+    return end;
+}
+
+// -----------------------------------------------------------------------------
+FilePath ChunkStore::chunkPath(const string &digest) const
+{
+    FilePath ret = m_dir;
+    ret.appendPath(digest.substr(0, 2));
+    ret.appendPath(digest);
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+string ChunkStore::put(const char *data, size_t len, bool *isNew)
+{
+    Sha256 sha;
+    sha.update(data, len);
+    string digest = sha.hexDigest();
+
+    FilePath path = chunkPath(digest);
+    *isNew = !path.exists();
+    if (!*isNew)
+        return digest;
+
+    FilePath dir = path.dirName();
+    if (!dir.exists())
+        dir.mkdir(false);
+
+    // write to a temporary file, so a chunk is either complete or missing
+    FilePath tmp = path + ".tmp";
+    {
+        FileDescriptor fd(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        size_t done = 0;
+        while (done < len) {
+            ssize_t ret = write(fd, data + done, len - done);
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+                int err = errno;
+                unlink(tmp.c_str());
+                throw KSystemError("Cannot write " + tmp, err);
+            }
+            done += ret;
+        }
+    }
+    if (rename(tmp.c_str(), path.c_str()) != 0)
+        throw KSystemError("Cannot rename " + tmp, errno);
+
+    return digest;
+}
+
+// -----------------------------------------------------------------------------
+void ChunkStore::get(const string &digest, vector<char> &data)
+{
+    FilePath path = chunkPath(digest);
+    FileDescriptor fd(path, O_RDONLY);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        throw KSystemError("Cannot stat " + path, errno);
+    data.resize(st.st_size);
+
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t ret = read(fd, data.data() + done, data.size() - done);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            throw KSystemError("Cannot read " + path, errno);
+        } else if (!ret)
+            break;
+        done += ret;
+    }
+
+    Sha256 sha;
+    sha.update(data.data(), done);
+    if (done != data.size() || sha.hexDigest() != digest)
+        throw KError("Chunk " + digest + " is corrupted.");
+}
+
+// -----------------------------------------------------------------------------
+ChunkStore::Recipe ChunkStore::readRecipe(const FilePath &path)
+{
+    std::ifstream fin(path.c_str());
+    if (!fin)
+        throw KError("Cannot open " + path + ".");
+
+    string line;
+    if (!getline(fin, line) || line != RECIPE_HEADER)
+        throw KError(path + " is no chunk recipe.");
+
+    Recipe ret;
+    while (getline(fin, line)) {
+        std::istringstream ss(line);
+        string digest;
+        size_t size;
+        if (!(ss >> digest >> size) || digest.size() != 64)
+            throw KError(path + ": invalid line: " + line);
+        ret.push_back(std::make_pair(digest, size));
+    }
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+FilePath ChunkStore::forRecipe(const FilePath &recipe)
+{
+    return FilePath(FilePath(recipe.dirName()).dirName());
+}
+
+// -----------------------------------------------------------------------------
+double ChunkStore::newRatio(const FilePath &savedir)
+{
+    Debug::debug()->trace("ChunkStore::newRatio(%s)", savedir.c_str());
+
+    // recipes of the saved dumps, oldest first
+    std::vector<Recipe> recipes;
+    if (savedir.exists()) {
+        for (const auto &dump : savedir.listDir(FilterDotsAndNondirs())) {
+            if (dump[0] == '.')
+                continue;
+            FilePath dir = savedir;
+            dir.appendPath(dump);
+            for (const auto &name : dir.listDir(FilterDots())) {
+                if (!KString(name).endsWith(RECIPE_SUFFIX))
+                    continue;
+                FilePath recipe = dir;
+                recipe.appendPath(name);
+                try {
+                    recipes.push_back(readRecipe(recipe));
+                } catch (const KError &error) {
+                    Debug::debug()->dbg("%s", error.what());
+                }
+            }
+        }
+    }
+    if (recipes.size() < 2)
+        return 1.0;
+
+    std::set<string> older;
+    for (size_t i = 0; i + 1 < recipes.size(); ++i)
+        for (const auto &chunk : recipes[i])
+            older.insert(chunk.first);
+
+    // repeated chunks of the newest dump were written only once
+    std::set<string> added;
+    unsigned long long total = 0, bytesNew = 0;
+    for (const auto &chunk : recipes.back()) {
+        total += chunk.second;
+        if (!older.count(chunk.first) && added.insert(chunk.first).second)
+            bytesNew += chunk.second;
+    }
+    double ratio = total ? double(bytesNew) / total : 1.0;
+    Debug::debug()->dbg("Newest dump added %llu of %llu bytes to %s",
+                        bytesNew, total, savedir.c_str());
+    return ratio;
+}
+
+// -----------------------------------------------------------------------------
+unsigned long long ChunkStore::collectGarbage(bool dryRun)
+{
+    Debug::debug()->trace("ChunkStore::collectGarbage(%d)", dryRun);
+
+    // chunks that are still in use
+    std::set<string> used;
+    StringVector dumps = m_savedir.listDir(FilterDotsAndNondirs());
+    for (const auto &dump : dumps) {
+        if (dump[0] == '.')
+            continue;
+        FilePath dir = m_savedir;
+        dir.appendPath(dump);
+        for (const auto &name : dir.listDir(FilterDots())) {
+            if (!KString(name).endsWith(RECIPE_SUFFIX))
+                continue;
+            FilePath recipe = dir;
+            recipe.appendPath(name);
+            try {
+                for (const auto &chunk : readRecipe(recipe))
+                    used.insert(chunk.first);
+            } catch (const KError &error) {
+                // keep everything rather than break a dump
+                Debug::debug()->info("%s. Chunks are not deleted.",
+                                     error.what());
+                return 0;
+            }
+        }
+    }
+
+    unsigned long long freed = 0;
+    unsigned long chunks = 0;
+    for (const auto &sub : m_dir.listDir(FilterDotsAndNondirs())) {
+        FilePath dir = m_dir;
+        dir.appendPath(sub);
+        for (const auto &name : dir.listDir(FilterDots())) {
+            if (used.count(name))
+                continue;
+            FilePath path = dir;
+            path.appendPath(name);
+            freed += path.fileSize();
+            ++chunks;
+            if (!dryRun && unlink(path.c_str()) != 0)
+                throw KSystemError("Cannot delete " + path, errno);
+        }
+    }
+
+    Debug::debug()->info("%s %lu unused chunks (%llu bytes) in %s.",
+                         dryRun ? "Would delete" : "Deleted",
+                         chunks, freed, m_dir.c_str());
+    return freed;
+}
+
+//}}}
+//{{{ DedupTransfer ------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+DedupTransfer::DedupTransfer(const RootDirURLVector &urlv)
+    : m_dir(urlv.front().getRealPath()),
+      m_store(FilePath(m_dir).dirName()),
+      m_bytesTotal(0), m_bytesNew(0)
+{
+    if (urlv.front().getProtocol() != URLParser::PROT_FILE)
+        throw KError("The chunk store is only supported for file URLs.");
+    m_dir.mkdir(true);
+}
+
+// -----------------------------------------------------------------------------
+void DedupTransfer::perform(DataProvider *dataprovider,
+                            const StringVector &target_files,
+                            bool *directSave)
+{
+    Debug::debug()->trace("DedupTransfer::perform(%p, [ \"%s\"%s ])",
+        dataprovider, target_files.front().c_str(),
+        target_files.size() > 1 ? ", ..." : "");
+
+    if (target_files.size() > 1)
+        cerr << "WARNING: First dump target used; rest ignored." << endl;
+    if (directSave)
+        *directSave = false;
+
+    FilePath recipePath = m_dir;
+    recipePath.appendPath(target_files.front() + ChunkStore::RECIPE_SUFFIX);
+    FILE *fp = fopen(recipePath.c_str(), "w");
+    if (!fp)
+        throw KSystemError("Error in fopen for " + recipePath, errno);
+    fprintf(fp, "%s\n", RECIPE_HEADER);
+
+    vector<char> buffer(2 * ChunkStore::MAX_CHUNK);
+    size_t fill = 0;
+    bool eof = false;
+    unsigned long newChunks = 0, chunks = 0;
+
+    bool prepared = false;
+    try {
+        dataprovider->prepare();
+        prepared = true;
+
+        while (!eof || fill) {
+            while (!eof && fill < ChunkStore::MAX_CHUNK) {
+                size_t ret = dataprovider->getData(buffer.data() + fill,
+                                                   buffer.size() - fill);
+                if (!ret)
+                    eof = true;
+                fill += ret;
+            }
+
+            size_t len = ChunkStore::cutPoint(buffer.data(), fill);
+            bool isNew;
+            string digest = m_store.put(buffer.data(), len, &isNew);
+            if (fprintf(fp, "%s %zu\n", digest.c_str(), len) < 0 ||
+                fflush(fp) != 0)
+                throw KSystemError("Cannot write " + recipePath, errno);
+
+            ++chunks;
+            m_bytesTotal += len;
+            if (isNew) {
+                ++newChunks;
+                m_bytesNew += len;
+            }
+            memmove(buffer.data(), buffer.data() + len, fill - len);
+            fill -= len;
+        }
+    } catch (...) {
+        fclose(fp);
+        if (prepared)
+            dataprovider->finish();
+        throw;
+    }
+
+    if (fclose(fp) != 0)
+        throw KSystemError("Cannot write " + recipePath, errno);
+    dataprovider->finish();
+
+    Debug::debug()->info("Saved %lu chunks, %lu new (%llu of %llu bytes)",
+                         chunks, newChunks, m_bytesNew, m_bytesTotal);
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,212 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "global.h"
+#include "fileutil.h"
+#include "transfer.h"
+
+//{{{ Sha256 -------------------------------------------------------------------
+
+/**
+ * SHA-256 message digest (FIPS 180-4).
+ */
+class Sha256 {
+
+    public:
+        Sha256();
+
+        /**
+         * Adds data to the digest.
+         */
+        void update(const void *data, size_t len);
+
+        /**
+         * Finishes the digest and returns it as a hex string.
+         * The object must not be updated afterwards.
+         */
+        std::string hexDigest();
+
+    protected:
+        void transform(const unsigned char *block);
+
+    private:
+        uint32_t m_state[8];
+        uint64_t m_length;
+        unsigned char m_block[64];
+        size_t m_used;
+};
+
+//}}}
+//{{{ ChunkStore ---------------------------------------------------------------
+
+/**
+ * Content-addressed store of dump chunks.
+ *
+ * The store is the ".chunks" directory in KDUMP_SAVEDIR. Each chunk is
+ * saved once, in a file named after its SHA-256 digest. A dump is saved
+ * as a recipe file, which lists the digests and sizes of its chunks in
+ * order. Chunk boundaries are chosen by content (with a gear rolling
+ * hash), so data inserted or removed in one place only changes the
+ * chunks around it.
+ */
+class ChunkStore {
+
+    public:
+        static const size_t MIN_CHUNK = 16 << 10;
+        static const size_t MAX_CHUNK = 256 << 10;
+
+        /**
+         * Name of the store directory in KDUMP_SAVEDIR.
+         */
+        static const char STORE_DIR[];
+
+        /**
+         * Suffix of recipe files.
+         */
+        static const char RECIPE_SUFFIX[];
+
+        /**
+         * Opens (and creates) the store.
+         *
+         * @param[in] savedir the directory which contains the dumps
+         */
+        ChunkStore(const FilePath &savedir);
+
+        /**
+         * Returns the length of the first chunk in @a data. If @a len is
+         * less than MAX_CHUNK, the caller should provide more data unless
+         * it is at the end of the stream.
+         */
+        static size_t cutPoint(const char *data, size_t len);
+
+        /**
+         * Adds a chunk unless it is already in the store.
+         *
+         * @param[out] isNew set to @c true if the chunk was written
+         * @return the digest of the chunk
+         * @exception KError if writing fails
+         */
+        std::string put(const char *data, size_t len, bool *isNew);
+
+        /**
+         * Reads a chunk and verifies its digest.
+         *
+         * @exception KError if the chunk is missing or corrupted
+         */
+        void get(const std::string &digest, std::vector<char> &data);
+
+        /**
+         * Removes chunks which are not used by any recipe in the
+         * dump directories of the save directory.
+         *
+         * @param[in] dryRun only count the chunks, do not delete them
+         * @return the number of bytes freed
+         */
+        unsigned long long collectGarbage(bool dryRun);
+
+        /**
+         * Chunks of a dump as (digest, size) pairs.
+         */
+        typedef std::vector<std::pair<std::string, size_t> > Recipe;
+
+        /**
+         * Reads a recipe file.
+         *
+         * @exception KError if the file cannot be read or parsed
+         */
+        static Recipe readRecipe(const FilePath &path);
+
+        /**
+         * Returns the chunk store for a recipe file, i.e. the store in
+         * the parent directory of the dump directory.
+         */
+        static FilePath forRecipe(const FilePath &recipe);
+
+        /**
+         * Estimates which part of the next dump needs new chunks from
+         * how much the newest dump in @a savedir added to the older ones.
+         * The store is not created.
+         *
+         * @return a ratio between 0 and 1; 1 if there are fewer than two
+         *         dumps in the store
+         */
+        static double newRatio(const FilePath &savedir);
+
+    protected:
+        FilePath chunkPath(const std::string &digest) const;
+
+    private:
+        FilePath m_savedir;
+        FilePath m_dir;
+};
+
+//}}}
+//{{{ DedupTransfer ------------------------------------------------------------
+
+/**
+ * Transfer that saves the data into a ChunkStore and writes a recipe
+ * instead of the target file.
+ */
+class DedupTransfer : public Transfer {
+
+    public:
+        /**
+         * Creates a new DedupTransfer to the first target of @a urlv,
+         * which must be a file URL.
+         */
+        DedupTransfer(const RootDirURLVector &urlv);
+
+        /**
+         * Saves the data of @a dataprovider. The recipe is named after
+         * the first target file with RECIPE_SUFFIX appended.
+         */
+        void perform(DataProvider *dataprovider,
+                     const StringVector &target_files,
+                     bool *directSave);
+
+        /**
+         * Returns the total number of bytes saved.
+         */
+        unsigned long long bytesTotal() const
+        { return m_bytesTotal; }
+
+        /**
+         * Returns the number of bytes in new chunks.
+         */
+        unsigned long long bytesNew() const
+        { return m_bytesNew; }
+
+    private:
+        FilePath m_dir;
+        ChunkStore m_store;
+        unsigned long long m_bytesTotal;
+        unsigned long long m_bytesNew;
+};
+
+//}}}
+
+#endif /* CHUNKSTORE_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,82 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <iostream>
+#include <string>
+
+#include "subcommand.h"
+#include "debug.h"
+#include "convert_dump.h"
+#include "chunkeddump.h"
+#include "pageclassifier.h"
+
+using std::string;
+using std::cout;
+using std::endl;
+
+//{{{ ConvertDump --------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+ConvertDump::ConvertDump()
+{}
+
+// -----------------------------------------------------------------------------
+const char *ConvertDump::getName() const
+{
+    return "convert_dump";
+}
+
+// -----------------------------------------------------------------------------
+bool ConvertDump::needsConfigfile() const
+{
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+void ConvertDump::parseArgs(const StringVector &args)
+{
+    Debug::debug()->trace(__FUNCTION__);
+
+    if (args.size() != 2)
+        throw KError("convert_dump requires 2 arguments.");
+
+    m_input = args[0];
+    m_output = args[1];
+
+    Debug::debug()->dbg("input=%s, output=%s",
+                        m_input.c_str(), m_output.c_str());
+}
+
+// -----------------------------------------------------------------------------
+void ConvertDump::execute()
+{
+    ChunkedDump dump(m_input);
+
+    cout << "Complete: " << (dump.isComplete() ? "yes" : "no") << endl;
+    cout << "Pages: " << dump.pageCount() << endl;
+    const std::vector<unsigned long long> &count = dump.classCount();
+    for (size_t i = 0; i < count.size(); ++i)
+        cout << "  " << PageClassifier::className(PageClassifier::Class(i))
+             << ": " << count[i] << endl;
+
+    dump.writeElf(m_output);
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,69 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef CONVERT_DUMP_H
+#define CONVERT_DUMP_H
+
+#include "subcommand.h"
+
+//{{{ ConvertDump --------------------------------------------------------------
+
+/**
+ * Subcommand to convert a (possibly partial) chunked dump to ELF.
+ */
+class ConvertDump : public Subcommand {
+
+    public:
+        /**
+         * Creates a new ConvertDump object.
+         */
+        ConvertDump();
+
+    public:
+        /**
+         * Returns the name of the subcommand (convert_dump).
+         */
+        const char *getName() const;
+
+        /**
+         * Parses the non-option arguments from the command line.
+         */
+        virtual void parseArgs(const StringVector &args);
+
+        /**
+         * That command does not need a config file.
+         */
+        bool needsConfigfile() const;
+
+        /**
+         * Executes the function.
+         *
+         * @throw KError on any error. No exception indicates success.
+         */
+        void execute();
+
+    private:
+        std::string m_input;
+        std::string m_output;
+};
+
+//}}}
+
+#endif /* CONVERT_DUMP_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
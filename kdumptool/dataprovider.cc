@@ -21,8 +21,12 @@
 #include <cstring>
 #include <cerrno>
 #include <algorithm>
+#include <fstream>
+#include <sstream>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <csignal>
 
 #include "dataprovider.h"
 #include "global.h"
@@ -42,7 +46,7 @@ using std::string;
 
 // -----------------------------------------------------------------------------
 AbstractDataProvider::AbstractDataProvider()
-    : m_progress(NULL), m_error(false)
+    : m_progress(NULL), m_error(false), m_aborted(false), m_bytesProvided(0)
 {}
 
 // -----------------------------------------------------------------------------
@@ -98,6 +102,27 @@ bool AbstractDataProvider::getError() const
     return m_error;
 }
 
+// -----------------------------------------------------------------------------
+void AbstractDataProvider::abort(const string &reason)
+{
+    Debug::debug()->trace("AbstractDataProvider::abort(%s)", reason.c_str());
+
+    std::lock_guard<std::mutex> lock(m_abortLock);
+    if (!m_aborted) {
+        m_abortReason = reason;
+        m_aborted = true;
+    }
+}
+
+// -----------------------------------------------------------------------------
+void AbstractDataProvider::checkAborted() const
+{
+    if (m_aborted) {
+        std::lock_guard<std::mutex> lock(m_abortLock);
+        throw KError(m_abortReason);
+    }
+}
+
 //}}}
 //{{{ FileDataProvider ---------------------------------------------------------
 
@@ -140,6 +165,7 @@ size_t FileDataProvider::getData(char *buffer, size_t maxread)
 {
     if (!m_file)
         throw KError("File " + m_filename + " not opened.");
+    checkAborted();
 
     errno = 0;
     size_t ret = fread(buffer, 1, maxread, m_file);
@@ -154,6 +180,7 @@ size_t FileDataProvider::getData(char *buffer, size_t maxread)
         p->progressed(lseek(fileno(m_file), 0, SEEK_CUR), m_fileSize);
 
     m_currentPos += ret;
+    addBytesProvided(ret);
 
     return ret;
 }
@@ -181,6 +208,8 @@ BufferDataProvider::BufferDataProvider(const char *data, size_t size)
 // -----------------------------------------------------------------------------
 size_t BufferDataProvider::getData(char *buffer, size_t maxread)
 {
+    checkAborted();
+
     size_t size = min(maxread, m_size);
 
     // end
@@ -190,6 +219,7 @@ size_t BufferDataProvider::getData(char *buffer, size_t maxread)
     std::memcpy(buffer, m_data, size);
     m_data += size;
     m_size -= size;
+    addBytesProvided(size);
 
     return size;
 }
@@ -201,35 +231,73 @@ size_t BufferDataProvider::getData(char *buffer, size_t maxread)
 ProcessDataProvider::ProcessDataProvider(const char *pipe_cmdline,
                                          const char *direct_cmdline)
     : m_pipeCmdline(pipe_cmdline), m_directCmdline(direct_cmdline),
-      m_processFile(NULL)
+      m_pid(-1)
 {
     Debug::debug()->trace("ProcessDataProvider::ProcessDataProvider(%s, %s)",
         pipe_cmdline, direct_cmdline);
 }
 
+// -----------------------------------------------------------------------------
+ProcessDataProvider::~ProcessDataProvider()
+{
+    std::lock_guard<std::mutex> lock(m_pidLock);
+    m_pid = -1;
+}
+
+// -----------------------------------------------------------------------------
+void ProcessDataProvider::spawn(const string &cmdline)
+{
+    // let the command replace the shell, so abort() can terminate it
+    StringVector args;
+    args.push_back("-c");
+    args.push_back("exec " + cmdline);
+
+    std::lock_guard<std::mutex> lock(m_pidLock);
+    checkAborted();
+    m_process.spawn("/bin/sh", args);
+    m_pid = m_process.getChildPID();
+}
+
+// -----------------------------------------------------------------------------
+int ProcessDataProvider::wait()
+{
+    int status = m_process.wait();
+
+    std::lock_guard<std::mutex> lock(m_pidLock);
+    m_pid = -1;
+    return status;
+}
+
 // -----------------------------------------------------------------------------
 void ProcessDataProvider::prepare()
 {
     Debug::debug()->trace("ProcessDataProvider::prepare");
 
-    m_processFile = popen(m_pipeCmdline.c_str(), "r");
-    if (!m_processFile)
-        throw KSystemError("Could not start process " + m_pipeCmdline, errno);
+    m_pipe = std::make_shared<ChildToParentPipe>();
+    m_process.setChildFD(STDOUT_FILENO,
+                         std::shared_ptr<SubProcessFD>(m_pipe));
+    spawn(m_pipeCmdline);
 }
 
 // -----------------------------------------------------------------------------
 size_t ProcessDataProvider::getData(char *buffer, size_t maxread)
 {
-    if (!m_processFile)
+    if (!m_pipe)
         throw KError("Process " + m_pipeCmdline + " not started.");
+    checkAborted();
 
-    errno = 0;
-    size_t ret = fread(buffer, 1, maxread, m_processFile);
-    if (ret == 0 && errno != 0) {
+    ssize_t ret;
+    do {
+        ret = read(m_pipe->readEnd(), buffer, maxread);
+    } while (ret < 0 && errno == EINTR && !isAborted());
+    checkAborted();
+
+    if (ret < 0) {
         setError(true);
         throw KSystemError("Error reading from " + m_pipeCmdline, errno);
     }
 
+    addBytesProvided(ret);
     return ret;
 }
 
@@ -238,14 +306,59 @@ void ProcessDataProvider::finish()
 {
     Debug::debug()->trace("ProcessDataProvider::finish");
 
-    int err = pclose(m_processFile);
-    m_processFile = NULL;
+    m_pipe->close();
+    m_pipe.reset();
+    m_process.setChildFD(STDOUT_FILENO, std::shared_ptr<SubProcessFD>());
+
+    int err = wait();
+    checkAborted();
 
-    if (WEXITSTATUS(err) != 0)
+    if (!WIFEXITED(err) || WEXITSTATUS(err) != 0)
         throw KError(m_pipeCmdline + " failed (" +
             StringUtil::number2string(WEXITSTATUS(err)) +").");
 }
 
+// -----------------------------------------------------------------------------
+void ProcessDataProvider::abort(const string &reason)
+{
+    AbstractDataProvider::abort(reason);
+
+    std::lock_guard<std::mutex> lock(m_pidLock);
+    if (m_pid != -1)
+        ::kill(m_pid, SIGTERM);
+}
+
+// -----------------------------------------------------------------------------
+unsigned long long ProcessDataProvider::cpuTime()
+{
+    pid_t pid;
+    {
+        std::lock_guard<std::mutex> lock(m_pidLock);
+        pid = m_pid;
+    }
+    if (pid == -1)
+        return 0;
+
+    std::ifstream fin(("/proc/" + StringUtil::number2string(pid) +
+                       "/stat").c_str());
+    string line;
+    if (!getline(fin, line))
+        return 0;
+
+    // the command name may contain spaces, so skip past it
+    string::size_type pos = line.rfind(')');
+    if (pos == string::npos)
+        return 0;
+    std::istringstream iss(line.substr(pos + 1));
+    string field;
+    unsigned long long utime = 0, stime = 0;
+    // state is field 3, utime and stime are fields 14 and 15
+    for (int i = 3; i < 14 && iss >> field; ++i)
+        ;
+    iss >> utime >> stime;
+    return utime + stime;
+}
+
 // -----------------------------------------------------------------------------
 bool ProcessDataProvider::canSaveToFile() const
 {
@@ -267,8 +380,11 @@ void ProcessDataProvider::saveToFile(const StringVector &targets)
 
     Debug::debug()->trace("Executing '%s'", cmdline.c_str());
 
-    int err = system(cmdline.c_str());
-    if (WEXITSTATUS(err) != 0)
+    spawn(cmdline);
+    int err = wait();
+    checkAborted();
+
+    if (!WIFEXITED(err) || WEXITSTATUS(err) != 0)
         throw KError("Running " + m_directCmdline + " failed (" +
             StringUtil::number2string(WEXITSTATUS(err)) +").");
 }
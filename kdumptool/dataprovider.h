@@ -21,10 +21,14 @@
 
 #include <cstdio>
 #include <cstdarg>
+#include <atomic>
+#include <memory>
+#include <mutex>
 
 #include "global.h"
 #include "rootdirurl.h"
 #include "stringvector.h"
+#include "process.h"
 
 class Progress;
 
@@ -109,6 +113,24 @@ class DataProvider {
          * @param[in] progress the progress notifier.
          */
         virtual void setProgress(Progress *progress) = 0;
+
+        /**
+         * Aborts the data transfer. This method may be called from another
+         * thread while the transfer is in progress. Any running or later
+         * call to DataProvider::getData(), DataProvider::saveToFile() or
+         * DataProvider::finish() fails with a KError as soon as possible.
+         *
+         * @param[in] reason the error message of the resulting KError
+         */
+        virtual void abort(const std::string &reason) = 0;
+
+        /**
+         * Returns the number of bytes returned by DataProvider::getData()
+         * so far. This method may be called from another thread.
+         *
+         * @return number of bytes provided
+         */
+        virtual unsigned long long bytesProvided() const = 0;
 };
 
 //}}}
@@ -185,9 +207,48 @@ class AbstractDataProvider : public DataProvider {
          */
         bool getError() const;
 
+        /**
+         * Marks the transfer as aborted.
+         *
+         * @see DataProvider::abort()
+         */
+        virtual void abort(const std::string &reason);
+
+        /**
+         * Checks whether the transfer has been aborted.
+         *
+         * @return @c true if DataProvider::abort() has been called
+         */
+        bool isAborted() const
+        { return m_aborted; }
+
+        /**
+         * @see DataProvider::bytesProvided()
+         */
+        unsigned long long bytesProvided() const
+        { return m_bytesProvided; }
+
+    protected:
+        /**
+         * Throws a KError if the transfer has been aborted.
+         *
+         * @exception KError with the abort reason
+         */
+        void checkAborted() const;
+
+        /**
+         * Adds @p bytes to the number of bytes provided.
+         */
+        void addBytesProvided(size_t bytes)
+        { m_bytesProvided += bytes; }
+
     private:
         Progress *m_progress;
         bool m_error;
+        std::atomic<bool> m_aborted;
+        std::string m_abortReason;
+        mutable std::mutex m_abortLock;
+        std::atomic<unsigned long long> m_bytesProvided;
 };
 
 //}}}
@@ -285,6 +346,11 @@ class ProcessDataProvider : public AbstractDataProvider {
          */
         ProcessDataProvider(const char *cmdline, const char *add_cmdline="");
 
+        /**
+         * Terminates the process if it is still running.
+         */
+        ~ProcessDataProvider();
+
         /**
          * Returns @c true.
          *
@@ -322,10 +388,33 @@ class ProcessDataProvider : public AbstractDataProvider {
          */
         virtual void finish();
 
+        /**
+         * Aborts the transfer and terminates the process.
+         *
+         * @see DataProvider::abort()
+         */
+        virtual void abort(const std::string &reason);
+
+        /**
+         * Returns the CPU time used so far by the running process.
+         *
+         * @return user and system time in clock ticks, or zero if no
+         *         process is running
+         */
+        unsigned long long cpuTime();
+
+    protected:
+        void spawn(const std::string &cmdline);
+
+        int wait();
+
     private:
         std::string m_pipeCmdline;
         std::string m_directCmdline;
-        FILE *m_processFile;
+        SubProcess m_process;
+        std::shared_ptr<ChildToParentPipe> m_pipe;
+        pid_t m_pid;
+        std::mutex m_pidLock;
 };
 
 //}}}
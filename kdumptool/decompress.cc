@@ -0,0 +1,584 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "global.h"
+
+#if HAVE_LZMA
+#include <lzma.h>
+#endif
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+#if HAVE_LZ4
+#include <lz4.h>
+#include <lz4frame.h>
+#endif
+
+#include "decompress.h"
+#include "stringutil.h"
+
+using std::string;
+using std::vector;
+
+/**
+ * Maximum uncompressed size of an LZ4 legacy block.
+ */
+#define LZ4_LEGACY_BLOCKSIZE    (8 << 20)
+
+//{{{ Decompressor::Backend ----------------------------------------------------
+
+/**
+ * Common base of all formats. Keeps the input buffer.
+ */
+class Decompressor::Backend {
+
+    public:
+        Backend(int fd, vector<char> &in, size_t len)
+            : m_fd(fd), m_pos(0), m_len(len), m_eof(false)
+        { m_in.swap(in); }
+
+        virtual ~Backend()
+        { }
+
+        /**
+         * Decompresses up to @p len bytes. Returns a short count
+         * only at the end of the data.
+         */
+        virtual size_t decompress(char *out, size_t len) = 0;
+
+    protected:
+        /**
+         * Makes sure the input buffer is not empty.
+         *
+         * @return @c false at end of file
+         */
+        bool fill();
+
+        /**
+         * Copies raw input bytes.
+         *
+         * @return the number of bytes copied, less than @p len at EOF
+         */
+        size_t take(char *out, size_t len);
+
+        int m_fd;
+        vector<char> m_in;
+        size_t m_pos, m_len;
+        bool m_eof;
+};
+
+// -----------------------------------------------------------------------------
+bool Decompressor::Backend::fill()
+{
+    if (m_pos < m_len)
+        return true;
+    if (m_eof)
+        return false;
+
+    ssize_t ret;
+    do {
+        ret = ::read(m_fd, m_in.data(), m_in.size());
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0)
+        throw KSystemError("Cannot read compressed data", errno);
+
+    m_pos = 0;
+    m_len = ret;
+    if (ret == 0)
+        m_eof = true;
+    return ret > 0;
+}
+
+// -----------------------------------------------------------------------------
+size_t Decompressor::Backend::take(char *out, size_t len)
+{
+    size_t done = 0;
+    while (done < len && fill()) {
+        size_t chunk = std::min(len - done, m_len - m_pos);
+        memcpy(out + done, m_in.data() + m_pos, chunk);
+        m_pos += chunk;
+        done += chunk;
+    }
+    return done;
+}
+
+//}}}
+//{{{ PlainBackend -------------------------------------------------------------
+
+class PlainBackend : public Decompressor::Backend {
+
+    public:
+        PlainBackend(int fd, vector<char> &in, size_t len)
+            : Backend(fd, in, len)
+        { }
+
+        size_t decompress(char *out, size_t len)
+        { return take(out, len); }
+};
+
+//}}}
+//{{{ GzipBackend --------------------------------------------------------------
+
+class GzipBackend : public Decompressor::Backend {
+
+    public:
+        GzipBackend(int fd, vector<char> &in, size_t len);
+        ~GzipBackend();
+
+        size_t decompress(char *out, size_t len);
+
+    private:
+        z_stream m_stream;
+        bool m_done;
+};
+
+// -----------------------------------------------------------------------------
+GzipBackend::GzipBackend(int fd, vector<char> &in, size_t len)
+    : Backend(fd, in, len), m_done(false)
+{
+    memset(&m_stream, 0, sizeof m_stream);
+    if (inflateInit2(&m_stream, 16 + MAX_WBITS) != Z_OK)
+        throw KError("inflateInit2() failed");
+}
+
+// -----------------------------------------------------------------------------
+GzipBackend::~GzipBackend()
+{
+    inflateEnd(&m_stream);
+}
+
+// -----------------------------------------------------------------------------
+size_t GzipBackend::decompress(char *out, size_t len)
+{
+    m_stream.next_out = (Bytef *)out;
+    m_stream.avail_out = len;
+
+    while (!m_done && m_stream.avail_out && fill()) {
+        m_stream.next_in = (Bytef *)m_in.data() + m_pos;
+        m_stream.avail_in = m_len - m_pos;
+        int ret = inflate(&m_stream, Z_NO_FLUSH);
+        m_pos = m_len - m_stream.avail_in;
+
+        if (ret == Z_STREAM_END)
+            m_done = true;
+        else if (ret != Z_OK)
+            throw KError(string("Cannot decompress gzip data: ") +
+                         (m_stream.msg ? m_stream.msg : "inflate() failed"));
+    }
+
+    return len - m_stream.avail_out;
+}
+
+//}}}
+//{{{ XzBackend ----------------------------------------------------------------
+
+#if HAVE_LZMA
+
+class XzBackend : public Decompressor::Backend {
+
+    public:
+        XzBackend(int fd, vector<char> &in, size_t len);
+        ~XzBackend();
+
+        size_t decompress(char *out, size_t len);
+
+    private:
+        lzma_stream m_stream;
+        bool m_done;
+};
+
+// -----------------------------------------------------------------------------
+XzBackend::XzBackend(int fd, vector<char> &in, size_t len)
+    : Backend(fd, in, len), m_stream(LZMA_STREAM_INIT), m_done(false)
+{
+    lzma_ret ret = lzma_stream_decoder(&m_stream, UINT64_MAX, 0);
+    if (ret != LZMA_OK)
+        throw KError("lzma_stream_decoder() failed (" +
+                     StringUtil::number2string(int(ret)) + ").");
+}
+
+// -----------------------------------------------------------------------------
+XzBackend::~XzBackend()
+{
+    lzma_end(&m_stream);
+}
+
+// -----------------------------------------------------------------------------
+size_t XzBackend::decompress(char *out, size_t len)
+{
+    m_stream.next_out = (uint8_t *)out;
+    m_stream.avail_out = len;
+
+    while (!m_done && m_stream.avail_out && fill()) {
+        m_stream.next_in = (const uint8_t *)m_in.data() + m_pos;
+        m_stream.avail_in = m_len - m_pos;
+        lzma_ret ret = lzma_code(&m_stream, LZMA_RUN);
+        m_pos = m_len - m_stream.avail_in;
+
+        if (ret == LZMA_STREAM_END)
+            m_done = true;
+        else if (ret != LZMA_OK)
+            throw KError("Cannot decompress xz data (" +
+                         StringUtil::number2string(int(ret)) + ").");
+    }
+
+    return len - m_stream.avail_out;
+}
+
+#endif // HAVE_LZMA
+
+//}}}
+//{{{ ZstdBackend --------------------------------------------------------------
+
+#if HAVE_ZSTD
+
+class ZstdBackend : public Decompressor::Backend {
+
+    public:
+        ZstdBackend(int fd, vector<char> &in, size_t len);
+        ~ZstdBackend();
+
+        size_t decompress(char *out, size_t len);
+
+    private:
+        ZSTD_DStream *m_stream;
+        bool m_done;
+};
+
+// -----------------------------------------------------------------------------
+ZstdBackend::ZstdBackend(int fd, vector<char> &in, size_t len)
+    : Backend(fd, in, len), m_done(false)
+{
+    m_stream = ZSTD_createDStream();
+    if (!m_stream)
+        throw KError("ZSTD_createDStream() failed");
+
+    // kernels are compressed with --ultra -22, which needs a large window
+    ZSTD_DCtx_setParameter(m_stream, ZSTD_d_windowLogMax, 31);
+}
+
+// -----------------------------------------------------------------------------
+ZstdBackend::~ZstdBackend()
+{
+    ZSTD_freeDStream(m_stream);
+}
+
+// -----------------------------------------------------------------------------
+size_t ZstdBackend::decompress(char *out, size_t len)
+{
+    ZSTD_outBuffer output = { out, len, 0 };
+
+    while (!m_done && output.pos < output.size && fill()) {
+        ZSTD_inBuffer input = { m_in.data(), m_len, m_pos };
+        size_t ret = ZSTD_decompressStream(m_stream, &output, &input);
+        m_pos = input.pos;
+
+        if (ZSTD_isError(ret))
+            throw KError(string("Cannot decompress zstd data: ") +
+                         ZSTD_getErrorName(ret));
+        if (ret == 0)
+            m_done = true;
+    }
+
+    return output.pos;
+}
+
+#endif // HAVE_ZSTD
+
+//}}}
+//{{{ Lz4Backend ---------------------------------------------------------------
+
+#if HAVE_LZ4
+
+class Lz4Backend : public Decompressor::Backend {
+
+    public:
+        Lz4Backend(int fd, vector<char> &in, size_t len);
+        ~Lz4Backend();
+
+        size_t decompress(char *out, size_t len);
+
+    private:
+        LZ4F_dctx *m_ctx;
+        bool m_done;
+};
+
+// -----------------------------------------------------------------------------
+Lz4Backend::Lz4Backend(int fd, vector<char> &in, size_t len)
+    : Backend(fd, in, len), m_done(false)
+{
+    LZ4F_errorCode_t err = LZ4F_createDecompressionContext(&m_ctx,
+                                                           LZ4F_VERSION);
+    if (LZ4F_isError(err))
+        throw KError(string("Cannot create LZ4 context: ") +
+                     LZ4F_getErrorName(err));
+}
+
+// -----------------------------------------------------------------------------
+Lz4Backend::~Lz4Backend()
+{
+    LZ4F_freeDecompressionContext(m_ctx);
+}
+
+// -----------------------------------------------------------------------------
+size_t Lz4Backend::decompress(char *out, size_t len)
+{
+    size_t done = 0;
+
+    while (!m_done && done < len && fill()) {
+        size_t dstSize = len - done;
+        size_t srcSize = m_len - m_pos;
+        size_t ret = LZ4F_decompress(m_ctx, out + done, &dstSize,
+                                     m_in.data() + m_pos, &srcSize, NULL);
+        m_pos += srcSize;
+        done += dstSize;
+
+        if (LZ4F_isError(ret))
+            throw KError(string("Cannot decompress LZ4 data: ") +
+                         LZ4F_getErrorName(ret));
+        if (ret == 0)
+            m_done = true;
+    }
+
+    return done;
+}
+
+//}}}
+//{{{ Lz4LegacyBackend ---------------------------------------------------------
+
+/**
+ * The legacy LZ4 format is a magic number followed by blocks, each
+ * prefixed with its compressed size. There is no end marker; the data
+ * ends when the size of the next block is implausible. This also stops
+ * at the uncompressed size appended to a kernel payload.
+ */
+class Lz4LegacyBackend : public Decompressor::Backend {
+
+    public:
+        Lz4LegacyBackend(int fd, vector<char> &in, size_t len);
+
+        size_t decompress(char *out, size_t len);
+
+    protected:
+        bool nextBlock();
+
+    private:
+        vector<char> m_compressed;
+        vector<char> m_block;
+        size_t m_blockPos, m_blockLen;
+        bool m_done;
+};
+
+// -----------------------------------------------------------------------------
+Lz4LegacyBackend::Lz4LegacyBackend(int fd, vector<char> &in, size_t len)
+    : Backend(fd, in, len), m_blockPos(0), m_blockLen(0), m_done(false)
+{
+    // skip the magic number
+    m_pos = 4;
+}
+
+// -----------------------------------------------------------------------------
+bool Lz4LegacyBackend::nextBlock()
+{
+    unsigned char hdr[4];
+    if (take((char *)hdr, sizeof hdr) != sizeof hdr)
+        return false;
+
+    uint32_t size = hdr[0] | (hdr[1] << 8) | (hdr[2] << 16) |
+        (uint32_t(hdr[3]) << 24);
+    if (size == 0 || size > unsigned(LZ4_compressBound(LZ4_LEGACY_BLOCKSIZE)))
+        return false;
+
+    m_compressed.resize(size);
+    if (take(m_compressed.data(), size) != size)
+        return false;
+
+    m_block.resize(LZ4_LEGACY_BLOCKSIZE);
+    int ret = LZ4_decompress_safe(m_compressed.data(), m_block.data(),
+                                  size, m_block.size());
+    if (ret < 0)
+        throw KError("Cannot decompress LZ4 data.");
+
+    m_blockPos = 0;
+    m_blockLen = ret;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+size_t Lz4LegacyBackend::decompress(char *out, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len && !m_done) {
+        if (m_blockPos == m_blockLen && !nextBlock()) {
+            m_done = true;
+            break;
+        }
+        size_t chunk = std::min(len - done, m_blockLen - m_blockPos);
+        memcpy(out + done, m_block.data() + m_blockPos, chunk);
+        m_blockPos += chunk;
+        done += chunk;
+    }
+
+    return done;
+}
+
+#endif // HAVE_LZ4
+
+//}}}
+//{{{ Decompressor -------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+Decompressor::Format Decompressor::detect(const void *data, size_t len)
+{
+    static const unsigned char gzip[] = { 0x1f, 0x8b };
+    static const unsigned char xz[] = { 0xfd, '7', 'z', 'X', 'Z', 0x00 };
+    static const unsigned char zstd[] = { 0x28, 0xb5, 0x2f, 0xfd };
+    static const unsigned char lz4[] = { 0x04, 0x22, 0x4d, 0x18 };
+    static const unsigned char lz4legacy[] = { 0x02, 0x21, 0x4c, 0x18 };
+
+#define HAS_MAGIC(magic) \
+    (len >= sizeof(magic) && memcmp(data, magic, sizeof(magic)) == 0)
+
+    if (HAS_MAGIC(gzip))
+        return FMT_GZIP;
+    if (HAS_MAGIC(xz))
+        return FMT_XZ;
+    if (HAS_MAGIC(zstd))
+        return FMT_ZSTD;
+    if (HAS_MAGIC(lz4))
+        return FMT_LZ4;
+    if (HAS_MAGIC(lz4legacy))
+        return FMT_LZ4_LEGACY;
+
+#undef HAS_MAGIC
+
+    return FMT_PLAIN;
+}
+
+// -----------------------------------------------------------------------------
+const char *Decompressor::formatName(Format format)
+{
+    switch (format) {
+        case FMT_PLAIN:         return "plain";
+        case FMT_GZIP:          return "gzip";
+        case FMT_XZ:            return "xz";
+        case FMT_ZSTD:          return "zstd";
+        case FMT_LZ4:
+        case FMT_LZ4_LEGACY:    return "lz4";
+    }
+    return "unknown";
+}
+
+// -----------------------------------------------------------------------------
+bool Decompressor::isSupported(Format format)
+{
+    switch (format) {
+        case FMT_PLAIN:
+        case FMT_GZIP:
+            return true;
+        case FMT_XZ:
+            return HAVE_LZMA;
+        case FMT_ZSTD:
+            return HAVE_ZSTD;
+        case FMT_LZ4:
+        case FMT_LZ4_LEGACY:
+            return HAVE_LZ4;
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+Decompressor::Decompressor(int fd)
+{
+    vector<char> in(BUFSIZE);
+    ssize_t len = 0, ret;
+
+    // make sure the magic is complete, even if read() returns less
+    while (size_t(len) < MAGIC_SIZE) {
+        ret = ::read(fd, in.data() + len, in.size() - len);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            throw KSystemError("Cannot read compressed data", errno);
+        if (ret == 0)
+            break;
+        len += ret;
+    }
+
+    m_format = detect(in.data(), len);
+    switch (m_format) {
+        case FMT_PLAIN:
+            m_backend.reset(new PlainBackend(fd, in, len));
+            return;
+
+        case FMT_GZIP:
+            m_backend.reset(new GzipBackend(fd, in, len));
+            return;
+
+#if HAVE_LZMA
+        case FMT_XZ:
+            m_backend.reset(new XzBackend(fd, in, len));
+            return;
+#endif
+
+#if HAVE_ZSTD
+        case FMT_ZSTD:
+            m_backend.reset(new ZstdBackend(fd, in, len));
+            return;
+#endif
+
+#if HAVE_LZ4
+        case FMT_LZ4:
+            m_backend.reset(new Lz4Backend(fd, in, len));
+            return;
+
+        case FMT_LZ4_LEGACY:
+            m_backend.reset(new Lz4LegacyBackend(fd, in, len));
+            return;
+#endif
+
+        default:
+            break;
+    }
+
+    throw KError(string("Support for ") + formatName(m_format) +
+                 " compression is not available.");
+}
+
+// -----------------------------------------------------------------------------
+Decompressor::~Decompressor()
+{ }
+
+// -----------------------------------------------------------------------------
+size_t Decompressor::read(void *buf, size_t len)
+{
+    return m_backend->decompress(static_cast<char *>(buf), len);
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
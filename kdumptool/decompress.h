@@ -0,0 +1,124 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <memory>
+#include <sys/types.h>
+
+#include "global.h"
+
+//{{{ Decompressor -------------------------------------------------------------
+
+/**
+ * Streaming decompression of a file in any of the formats used for
+ * Linux kernel images. The format is detected from the magic bytes;
+ * data in an unknown format is passed through unchanged.
+ *
+ * Only as much of the input is read as needed to produce the requested
+ * output, so a caller which stops early does not pay for decompressing
+ * the whole file.
+ */
+class Decompressor {
+
+    public:
+        /**
+         * Compression format.
+         */
+        enum Format {
+            FMT_PLAIN,          /**< not compressed (or unknown) */
+            FMT_GZIP,           /**< gzip */
+            FMT_XZ,             /**< xz */
+            FMT_ZSTD,           /**< zstd */
+            FMT_LZ4,            /**< LZ4 frame format */
+            FMT_LZ4_LEGACY      /**< LZ4 legacy format (lz4 -l) */
+        };
+
+        /**
+         * Size of the input buffer.
+         */
+        static const size_t BUFSIZE = 128 * 1024;
+
+        /**
+         * Number of bytes needed by detect().
+         */
+        static const size_t MAGIC_SIZE = 6;
+
+        /**
+         * Detects the compression format from the first bytes of a file.
+         *
+         * @param[in] data beginning of the file
+         * @param[in] len length of @p data
+         * @return the detected format
+         */
+        static Format detect(const void *data, size_t len);
+
+        /**
+         * Returns a human-readable name of a format.
+         */
+        static const char *formatName(Format format);
+
+        /**
+         * Returns @c true if kdumptool was built with support for
+         * @p format.
+         */
+        static bool isSupported(Format format);
+
+        /**
+         * Starts decompressing the file from its current position.
+         * The file descriptor is not closed by the Decompressor.
+         *
+         * @param[in] fd the (possibly compressed) file
+         * @exception KSystemError if reading fails
+         * @exception KError if the format is not supported
+         */
+        Decompressor(int fd);
+
+        ~Decompressor();
+
+        /**
+         * Returns the detected compression format.
+         */
+        Format getFormat() const
+        { return m_format; }
+
+        /**
+         * Reads decompressed data. A short count is returned only at the
+         * end of the data. A truncated file is not an error; the data up
+         * to the truncation point is returned.
+         *
+         * @param[out] buf output buffer
+         * @param[in] len size of @p buf
+         * @return number of bytes stored in @p buf
+         * @exception KError if the compressed data is corrupted
+         */
+        size_t read(void *buf, size_t len);
+
+        class Backend;
+
+    private:
+        Format m_format;
+        std::unique_ptr<Backend> m_backend;
+};
+
+//}}}
+
+#endif /* DECOMPRESS_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
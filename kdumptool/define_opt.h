@@ -27,6 +27,9 @@ DEFINE_OPT(KDUMP_FREE_DISK_SIZE, Int, 64, DUMP)
 DEFINE_OPT(KDUMP_VERBOSE, Int, 0, KEXEC | DUMP)
 DEFINE_OPT(KDUMP_DUMPLEVEL, Int, 31, DUMP)
 DEFINE_OPT(KDUMP_DUMPFORMAT, String, "compressed", DUMP)
+DEFINE_OPT(KDUMP_TIME_BUDGET, Int, 0, DUMP)
+DEFINE_OPT(KDUMP_STALL_TIMEOUT, Int, 0, DUMP)
+DEFINE_OPT(KDUMP_MIN_THROUGHPUT, Int, 0, DUMP)
 DEFINE_OPT(KDUMP_CONTINUE_ON_ERROR, Bool, true, DUMP)
 DEFINE_OPT(KDUMP_REQUIRED_PROGRAMS, String, "", MKINITRD)
 DEFINE_OPT(KDUMP_PRESCRIPT, String, "", DUMP)
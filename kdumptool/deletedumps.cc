@@ -38,6 +38,7 @@
 #include "vmcoreinfo.h"
 #include "deletedumps.h"
 #include "stringvector.h"
+#include "chunkstore.h"
 
 using std::string;
 using std::cout;
@@ -131,6 +132,11 @@ void DeleteDumps::delete_one(const RootDirURL &url, int oldDumps)
             fp.rmdir(true);
         }
     }
+
+    FilePath store = dir;
+    store.appendPath(ChunkStore::STORE_DIR);
+    if (store.exists())
+        ChunkStore(dir).collectGarbage(m_dryRun);
 }
 
 //}}}
@@ -0,0 +1,126 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef DISKDUMP_H
+#define DISKDUMP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+//{{{ kdump-compressed format --------------------------------------------------
+
+/*
+ * The kdump-compressed format of makedumpfile (see diskdump_mod.h there),
+ * which is read by crash(8) and makedumpfile itself. The structures are
+ * written in the byte order and with the type sizes of the dumping
+ * machine.
+ *
+ * Block 0 holds the disk_dump_header, the following sub_hdr_size blocks
+ * hold the kdump_sub_header and the ELF notes of the dump. They are
+ * followed by two bitmaps of bitmap_blocks / 2 blocks each: the first has
+ * a bit set for every page frame present in memory, the second for every
+ * page frame stored in the dump. Next comes a page_desc for each stored
+ * page frame in order and finally the page data.
+ */
+
+#define KDUMP_SIGNATURE                 "KDUMP   "
+#define KDUMP_HEADER_VERSION            6
+
+#define DUMP_DH_COMPRESSED_ZLIB         0x1
+#define DUMP_DH_COMPRESSED_LZO          0x2
+#define DUMP_DH_COMPRESSED_SNAPPY       0x4
+#define DUMP_DH_COMPRESSED_INCOMPLETE   0x8
+
+#define KDUMP_UTSNAME_LEN               65
+
+struct disk_dump_header {
+    char signature[8];                  // KDUMP_SIGNATURE
+    int header_version;                 // KDUMP_HEADER_VERSION
+    char utsname[6][KDUMP_UTSNAME_LEN]; // struct new_utsname
+    struct timeval timestamp;
+    unsigned int status;                // DUMP_DH_*
+    int block_size;
+    int sub_hdr_size;                   // in blocks
+    unsigned int bitmap_blocks;
+    unsigned int max_mapnr;             // 32-bit only, see max_mapnr_64
+    unsigned int total_ram_blocks;
+    unsigned int device_blocks;
+    unsigned int written_blocks;
+    unsigned int current_cpu;
+    int nr_cpus;
+};
+
+struct kdump_sub_header {
+    unsigned long phys_base;
+    int dump_level;
+    int split;
+    unsigned long start_pfn;            // 32-bit only, see start_pfn_64
+    unsigned long end_pfn;              // 32-bit only, see end_pfn_64
+    off_t offset_vmcoreinfo;
+    unsigned long size_vmcoreinfo;
+    off_t offset_note;
+    unsigned long size_note;
+    off_t offset_eraseinfo;
+    unsigned long size_eraseinfo;
+    unsigned long long start_pfn_64;
+    unsigned long long end_pfn_64;
+    unsigned long long max_mapnr_64;
+};
+
+struct page_desc {
+    off_t offset;                       // of the page data
+    unsigned int size;                  // of the page data
+    unsigned int flags;                 // DUMP_DH_COMPRESSED_*, or 0
+    unsigned long long page_flags;
+};
+
+//}}}
+//{{{ makedumpfile flattened format --------------------------------------------
+
+/*
+ * The flattened format is written by "makedumpfile -F" to a pipe. It is
+ * a header of MDF_HEADER_SIZE bytes followed by data records, each of
+ * which is a makedumpfile_data_header and the data to be stored at that
+ * offset of the kdump-compressed file. The stream ends with a record
+ * header with both fields set to MDF_END_FLAG. All numbers are big-endian.
+ * "makedumpfile -R" turns it into a regular file.
+ */
+
+#define MDF_SIGNATURE                   "makedumpfile"
+#define MDF_TYPE_FLAT_HEADER            1
+#define MDF_VERSION_FLAT_HEADER         1
+#define MDF_HEADER_SIZE                 4096
+#define MDF_END_FLAG                    (-1)
+
+struct makedumpfile_header {
+    char signature[16];                 // MDF_SIGNATURE
+    int64_t type;                       // MDF_TYPE_FLAT_HEADER
+    int64_t version;                    // MDF_VERSION_FLAT_HEADER
+};
+
+struct makedumpfile_data_header {
+    int64_t offset;
+    int64_t buf_size;
+};
+
+//}}}
+
+#endif /* DISKDUMP_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,300 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include <zlib.h>
+
+#include "global.h"
+#if HAVE_LZO
+#   include <lzo/lzo1x.h>
+#endif
+#if HAVE_SNAPPY
+#   include <snappy-c.h>
+#endif
+#include "debug.h"
+#include "dumpestimate.h"
+#include "vmcore.h"
+#include "util.h"
+
+using std::vector;
+
+// Size of a kdump-compressed page descriptor
+#define PAGE_DESC_SIZE  24
+
+// Dump level bit for zero pages
+#define DL_EXCLUDE_ZERO 1
+
+// -----------------------------------------------------------------------------
+static size_t compressPage(DumpEstimate::Format format,
+                           const char *page, size_t pagesize,
+                           vector<char> &out, vector<char> &wrkmem)
+{
+    switch (format) {
+    case DumpEstimate::FMT_COMPRESSED: {
+        uLongf outlen = out.size();
+        if (compress2(reinterpret_cast<Bytef *>(out.data()), &outlen,
+                      reinterpret_cast<const Bytef *>(page), pagesize,
+                      Z_BEST_SPEED) != Z_OK)
+            return pagesize;
+        return outlen;
+    }
+
+#if HAVE_LZO
+    case DumpEstimate::FMT_LZO: {
+        lzo_uint outlen = out.size();
+        if (lzo1x_1_compress(reinterpret_cast<lzo_bytep>(
+                                 const_cast<char *>(page)),
+                             pagesize,
+                             reinterpret_cast<lzo_bytep>(out.data()),
+                             &outlen, wrkmem.data()) != LZO_E_OK)
+            return pagesize;
+        return outlen;
+    }
+#endif
+
+#if HAVE_SNAPPY
+    case DumpEstimate::FMT_SNAPPY: {
+        size_t outlen = out.size();
+        if (snappy_compress(page, pagesize, out.data(), &outlen) !=
+            SNAPPY_OK)
+            return pagesize;
+        return outlen;
+    }
+#endif
+
+    default:
+        return pagesize;
+    }
+}
+
+//{{{ DumpEstimate -------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+DumpEstimate::DumpEstimate(Vmcore &vmcore, unsigned long pagesize)
+    : m_vmcore(vmcore), m_pagesize(pagesize), m_totalPages(0),
+      m_samples(0), m_zeroSamples(0)
+{
+    for (const auto &seg : m_vmcore.loadSegments())
+        m_totalPages += seg.filesz / m_pagesize;
+    memset(m_classSamples, 0, sizeof m_classSamples);
+    memset(m_stats, 0, sizeof m_stats);
+}
+
+// -----------------------------------------------------------------------------
+bool DumpEstimate::haveFormat(Format format) const
+{
+    switch (format) {
+    case FMT_ELF:
+    case FMT_COMPRESSED:
+        return true;
+    case FMT_LZO:
+        return HAVE_LZO;
+    case FMT_SNAPPY:
+        return HAVE_SNAPPY;
+    default:
+        return false;
+    }
+}
+
+// -----------------------------------------------------------------------------
+const char *DumpEstimate::formatName(Format format)
+{
+    static const char *const names[FMT_MAX] = {
+        "ELF", "compressed", "lzo", "snappy"
+    };
+    return names[format];
+}
+
+// -----------------------------------------------------------------------------
+void DumpEstimate::sample(unsigned long maxSamples,
+                          PageClassifier *classifier)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    Debug::debug()->trace("DumpEstimate::sample(%lu)", maxSamples);
+
+    m_samples = m_zeroSamples = 0;
+    memset(m_classSamples, 0, sizeof m_classSamples);
+    memset(m_stats, 0, sizeof m_stats);
+    if (!m_totalPages || !maxSamples)
+        return;
+
+    if (maxSamples > m_totalPages)
+        maxSamples = m_totalPages;
+
+    vector<char> page(m_pagesize);
+    vector<char> out(compressBound(m_pagesize));
+    vector<char> wrkmem;
+#if HAVE_LZO
+    if (lzo_init() != LZO_E_OK)
+        throw KError("lzo_init() failed.");
+    wrkmem.resize(LZO1X_1_MEM_COMPRESS);
+    out.resize(std::max(out.size(),
+                        size_t(m_pagesize + m_pagesize / 16 + 64 + 3)));
+#endif
+#if HAVE_SNAPPY
+    out.resize(std::max(out.size(),
+                        snappy_max_compressed_length(m_pagesize)));
+#endif
+
+    // Take one page from each of maxSamples equally sized buckets. The
+    // position within a bucket is pseudo-random to avoid aliasing with
+    // any regular patterns in memory.
+    unsigned long seed = 1;
+    unsigned long long pfn = 0;
+    auto seg = m_vmcore.loadSegments().begin();
+    for (unsigned long i = 0; i < maxSamples; ++i) {
+        unsigned long long start = m_totalPages * i / maxSamples;
+        unsigned long long end = m_totalPages * (i + 1) / maxSamples;
+        seed = seed * 1103515245 + 12345;
+        unsigned long long next = start + (seed >> 16) % (end - start);
+
+        while (next >= pfn + seg->filesz / m_pagesize) {
+            pfn += seg->filesz / m_pagesize;
+            ++seg;
+        }
+        m_vmcore.readFile(seg->offset + (next - pfn) * m_pagesize,
+                          page.data(), m_pagesize);
+        ++m_samples;
+
+        PageClassifier::Class pc = PageClassifier::PC_OTHER;
+        if (classifier)
+            pc = classifier->classify(
+                (seg->paddr + (next - pfn) * m_pagesize) / m_pagesize);
+
+        bool zero = Util::isZero(page.data(), m_pagesize);
+        ++m_classSamples[pc][zero];
+        if (zero) {
+            ++m_zeroSamples;
+            continue;
+        }
+
+        m_stats[FMT_ELF].compressedBytes += m_pagesize;
+        for (int fmt = FMT_COMPRESSED; fmt < FMT_MAX; ++fmt) {
+            Format format = Format(fmt);
+            if (!haveFormat(format))
+                continue;
+
+            Clock::time_point t0 = Clock::now();
+            size_t outlen = compressPage(format, page.data(), m_pagesize,
+                                         out, wrkmem);
+            Clock::time_point t1 = Clock::now();
+
+            // makedumpfile stores pages uncompressed if that is smaller
+            if (outlen > m_pagesize)
+                outlen = m_pagesize;
+            m_stats[fmt].compressedBytes += outlen;
+            m_stats[fmt].seconds +=
+                std::chrono::duration<double>(t1 - t0).count();
+        }
+    }
+
+    Debug::debug()->dbg("Sampled %lu of %llu pages: %.1f%% zero",
+                        m_samples, m_totalPages, zeroFraction() * 100);
+    if (classifier)
+        Debug::debug()->dbg("%.1f%% excluded by dump level 31",
+                            (1.0 - keptFraction(31, false) -
+                             keptFraction(31, true)) * 100);
+    for (int fmt = FMT_COMPRESSED; fmt < FMT_MAX; ++fmt) {
+        Format format = Format(fmt);
+        if (haveFormat(format))
+            Debug::debug()->dbg("%s: compression ratio %.2f, %.1f MiB/s",
+                                formatName(format), compressionRatio(format),
+                                compressionSpeed(format) / (1024 * 1024));
+    }
+}
+
+// -----------------------------------------------------------------------------
+double DumpEstimate::zeroFraction() const
+{
+    return m_samples ? double(m_zeroSamples) / m_samples : 0.0;
+}
+
+// -----------------------------------------------------------------------------
+double DumpEstimate::compressionRatio(Format format) const
+{
+    unsigned long nonzero = m_samples - m_zeroSamples;
+    if (!nonzero || !haveFormat(format))
+        return 1.0;
+    return double(m_stats[format].compressedBytes) /
+        (double(nonzero) * m_pagesize);
+}
+
+// -----------------------------------------------------------------------------
+double DumpEstimate::compressionSpeed(Format format) const
+{
+    unsigned long nonzero = m_samples - m_zeroSamples;
+    if (!nonzero || !haveFormat(format) || m_stats[format].seconds <= 0)
+        return 0.0;
+    return double(nonzero) * m_pagesize / m_stats[format].seconds;
+}
+
+// -----------------------------------------------------------------------------
+double DumpEstimate::keptFraction(int dumplevel, bool zero) const
+{
+    if (!m_samples)
+        return zero ? 0.0 : 1.0;
+
+    unsigned long kept = 0;
+    for (int pc = 0; pc < PageClassifier::PC_MAX; ++pc)
+        if (!PageClassifier::excluded(PageClassifier::Class(pc), dumplevel))
+            kept += m_classSamples[pc][zero];
+    return double(kept) / m_samples;
+}
+
+// -----------------------------------------------------------------------------
+unsigned long long DumpEstimate::nonZeroBytes(int dumplevel) const
+{
+    return (unsigned long long)(m_totalPages *
+                                keptFraction(dumplevel, false)) * m_pagesize;
+}
+
+// -----------------------------------------------------------------------------
+unsigned long long DumpEstimate::estimate(int dumplevel, Format format,
+                                          bool sparse) const
+{
+    double pages = m_totalPages;
+    double nonzero = pages * keptFraction(dumplevel, false);
+    double zero = pages * keptFraction(dumplevel, true);
+    double size;
+
+    if (format != FMT_ELF) {
+        // two bitmaps, a descriptor per dumped page and the page data;
+        // all zero pages share a single data block
+        double dumped = (dumplevel & DL_EXCLUDE_ZERO) ? nonzero
+            : nonzero + zero;
+        size = 2 * pages / 8 + dumped * PAGE_DESC_SIZE +
+            nonzero * m_pagesize * compressionRatio(format) + m_pagesize;
+    } else {
+        // zero pages are either excluded or may be stored sparse
+        if ((dumplevel & DL_EXCLUDE_ZERO) || sparse)
+            size = nonzero * m_pagesize;
+        else
+            size = (nonzero + zero) * m_pagesize;
+    }
+
+    return (unsigned long long)size;
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,160 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef DUMPESTIMATE_H
+#define DUMPESTIMATE_H
+
+#include <stdint.h>
+
+#include "global.h"
+#include "pageclassifier.h"
+
+class Vmcore;
+
+//{{{ DumpEstimate -------------------------------------------------------------
+
+/**
+ * Estimates the size of a saved dump before it is written.
+ *
+ * The number of pages is taken from the PT_LOAD segments of the dump.
+ * A sample of pages spread evenly over all segments is read to find the
+ * fraction of zero pages. The rest is compressed with every compression
+ * algorithm that is available to measure its compression ratio and speed.
+ *
+ * Only zero pages can be recognized from page contents. If a
+ * PageClassifier is given, the sampled pages are also classified to
+ * estimate the effect of the other dump level bits (cache, user and free
+ * pages). Without struct page information, the estimate is an upper bound
+ * for those dump levels.
+ */
+class DumpEstimate {
+
+    public:
+        /**
+         * Dump file format.
+         */
+        enum Format {
+            FMT_ELF,            /**< ELF file (uncompressed pages) */
+            FMT_COMPRESSED,     /**< kdump-compressed with zlib */
+            FMT_LZO,            /**< kdump-compressed with LZO */
+            FMT_SNAPPY,         /**< kdump-compressed with snappy */
+            FMT_MAX
+        };
+
+        /**
+         * Creates a new estimate object.
+         *
+         * @param[in] vmcore the dump
+         * @param[in] pagesize page size of the crashed kernel
+         */
+        DumpEstimate(Vmcore &vmcore, unsigned long pagesize);
+
+        /**
+         * Reads and compresses sample pages.
+         *
+         * @param[in] maxSamples maximum number of pages to sample
+         * @param[in] classifier classifies the sampled pages, or @c NULL
+         * @exception KError if reading the dump fails
+         */
+        void sample(unsigned long maxSamples = DEFAULT_SAMPLES,
+                    PageClassifier *classifier = NULL);
+
+        /**
+         * Returns the total number of pages in the dump.
+         */
+        unsigned long long totalPages() const
+        { return m_totalPages; }
+
+        /**
+         * Returns the sampled fraction of zero pages.
+         */
+        double zeroFraction() const;
+
+        /**
+         * Checks whether a compression algorithm was measured.
+         *
+         * @param[in] format dump file format
+         * @return @c true if sample() measured @p format
+         */
+        bool haveFormat(Format format) const;
+
+        /**
+         * Returns the sampled compression ratio (compressed size divided
+         * by original size) of non-zero pages.
+         *
+         * @param[in] format dump file format
+         */
+        double compressionRatio(Format format = FMT_COMPRESSED) const;
+
+        /**
+         * Returns the sampled compression speed on a single CPU.
+         *
+         * @param[in] format dump file format
+         * @return uncompressed bytes per second, or zero if unknown
+         */
+        double compressionSpeed(Format format) const;
+
+        /**
+         * Returns the number of bytes in non-zero pages of the dump.
+         *
+         * @param[in] dumplevel makedumpfile dump level; only pages which
+         *            are not excluded by it are counted
+         */
+        unsigned long long nonZeroBytes(int dumplevel = 0) const;
+
+        /**
+         * Estimates the size of the saved dump.
+         *
+         * @param[in] dumplevel makedumpfile dump level
+         * @param[in] format dump file format
+         * @param[in] sparse @c true if zero blocks in ELF files do not
+         *            occupy disk space
+         * @return estimated size in bytes
+         */
+        unsigned long long estimate(int dumplevel, Format format,
+                                    bool sparse) const;
+
+        /**
+         * Returns the name of a format as used in KDUMP_DUMPFORMAT.
+         */
+        static const char *formatName(Format format);
+
+        static const unsigned long DEFAULT_SAMPLES = 2048;
+
+    private:
+        struct CodecStats {
+            unsigned long long compressedBytes;
+            double seconds;
+        };
+
+        double keptFraction(int dumplevel, bool zero) const;
+
+        Vmcore &m_vmcore;
+        unsigned long m_pagesize;
+        unsigned long long m_totalPages;
+        unsigned long m_samples;
+        unsigned long m_zeroSamples;
+        unsigned long m_classSamples[PageClassifier::PC_MAX][2];
+        CodecStats m_stats[FMT_MAX];
+};
+
+//}}}
+
+#endif /* DUMPESTIMATE_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
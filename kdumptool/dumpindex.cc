@@ -0,0 +1,402 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cctype>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <gelf.h>
+
+#include "global.h"
+#include "debug.h"
+#include "dumpindex.h"
+#include "fileutil.h"
+#include "stringutil.h"
+#include "vmcore.h"
+#include "elfnotes.h"
+#include "vmcoreinfo.h"
+#include "diskdump.h"
+#include "chunkeddump.h"
+#include "chunkstore.h"
+#include "parallel.h"
+
+using std::string;
+using std::vector;
+using std::ifstream;
+using std::ofstream;
+using std::istringstream;
+using std::ostringstream;
+
+/**
+ * Maximum number of threads used to read the dumps.
+ */
+#define MAXTHREADS_INDEX 8
+
+static const char INDEX_HEADER[] = "# kdump dump index 1";
+static const unsigned char ZSTD_MAGIC[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+// -----------------------------------------------------------------------------
+static bool isDumpFile(const char *name)
+{
+    if (strncmp(name, "vmcore", 6) != 0)
+        return false;
+    name += 6;
+    if (!*name)
+        return true;
+    if (strcmp(name, ChunkStore::RECIPE_SUFFIX) == 0)
+        return true;
+    // parts of a split dump
+    while (isdigit(*name))
+        ++name;
+    return !*name;
+}
+
+// -----------------------------------------------------------------------------
+static void pread_all(int fd, void *buf, size_t len, off_t offset)
+{
+    char *p = static_cast<char *>(buf);
+
+    while (len) {
+        ssize_t ret = pread(fd, p, len, offset);
+        if (ret < 0)
+            throw KSystemError("Cannot read dump", errno);
+        else if (!ret)
+            throw KError("Unexpected EOF in dump");
+        len -= ret;
+        p += ret;
+        offset += ret;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static unsigned long long mtimeNsec(const struct stat &st)
+{
+    return st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+}
+
+// -----------------------------------------------------------------------------
+static void statDump(const FilePath &dir, DumpIndex::Entry &entry)
+{
+    FilePath dumpdir(dir);
+    dumpdir.appendPath(entry.name);
+
+    struct stat st;
+    if (stat(dumpdir.c_str(), &st) != 0)
+        throw KSystemError("Cannot stat " + dumpdir, errno);
+
+    // deleting a part of a split dump changes only the directory
+    entry.mtime = mtimeNsec(st);
+    entry.size = 0;
+    entry.parts = 0;
+
+    StringVector files = dumpdir.listDir(FilterDots());
+    for (const auto &name : files) {
+        if (!isDumpFile(name.c_str()))
+            continue;
+        FilePath file(dumpdir);
+        file.appendPath(name);
+        if (stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        entry.mtime = std::max(entry.mtime, mtimeNsec(st));
+        entry.size += st.st_size;
+        ++entry.parts;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static bool readNotes(int fd, const string &format, vector<char> &notes)
+{
+    if (format == "kdump") {
+        struct disk_dump_header header;
+        struct kdump_sub_header sub;
+        pread_all(fd, &header, sizeof header, 0);
+        pread_all(fd, &sub, sizeof sub, header.block_size);
+        if (!sub.size_note)
+            return false;
+        notes.resize(sub.size_note);
+        pread_all(fd, notes.data(), notes.size(), sub.offset_note);
+        return true;
+    }
+
+    if (format == "chunked") {
+        // the notes are always the first chunk
+        struct chunked_chunk chunk;
+        pread_all(fd, &chunk, sizeof chunk, sizeof(struct chunked_header));
+        if (chunk.type != CHUNK_NOTES)
+            return false;
+        notes.resize(chunk.size);
+        pread_all(fd, notes.data(), notes.size(),
+                  sizeof(struct chunked_header) + sizeof chunk);
+        return true;
+    }
+
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+static string readmeRelease(const FilePath &dumpdir)
+{
+    FilePath readme(dumpdir);
+    readme.appendPath("README.txt");
+    ifstream fin(readme.c_str());
+
+    string line;
+    while (getline(fin, line)) {
+        KString kline(line);
+        if (!kline.startsWith("Kernel version"))
+            continue;
+        string::size_type pos = kline.find(':');
+        if (pos != string::npos)
+            return KString(kline.substr(pos + 1)).trim();
+    }
+    return string();
+}
+
+//{{{ DumpIndex ----------------------------------------------------------------
+
+const char DumpIndex::INDEX_FILE[] = ".dumpindex";
+
+// -----------------------------------------------------------------------------
+DumpIndex::DumpIndex(const FilePath &dir)
+    : m_dir(dir)
+{
+    load();
+}
+
+// -----------------------------------------------------------------------------
+void DumpIndex::load()
+{
+    FilePath path(m_dir);
+    path.appendPath(INDEX_FILE);
+
+    ifstream fin(path.c_str());
+    if (!fin)
+        return;
+
+    string line;
+    if (!getline(fin, line) || line != INDEX_HEADER) {
+        Debug::debug()->dbg("Ignoring %s: unknown format", path.c_str());
+        return;
+    }
+
+    vector<Entry> entries;
+    while (getline(fin, line)) {
+        istringstream iss(line);
+        long long crashtime;
+        Entry entry;
+        iss >> entry.mtime >> entry.size >> entry.format >> entry.parts
+            >> crashtime >> entry.release;
+        getline(iss >> std::ws, entry.name);
+        if (!iss || entry.name.empty()) {
+            Debug::debug()->dbg("Ignoring %s: corrupt line", path.c_str());
+            return;
+        }
+        entry.crashtime = crashtime;
+        if (entry.release == "-")
+            entry.release.clear();
+        entries.push_back(entry);
+    }
+
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry &a, const Entry &b) { return a.name < b.name; });
+    m_entries.swap(entries);
+}
+
+// -----------------------------------------------------------------------------
+const DumpIndex::Entry *DumpIndex::find(const string &name) const
+{
+    auto it = std::lower_bound(m_entries.begin(), m_entries.end(), name,
+        [](const Entry &e, const string &n) { return e.name < n; });
+    if (it == m_entries.end() || it->name != name)
+        return NULL;
+    return &*it;
+}
+
+// -----------------------------------------------------------------------------
+unsigned DumpIndex::update(vector<DumpIndex> &indexes, bool force)
+{
+    struct Job {
+        const FilePath *dir;
+        Entry *entry;
+    };
+
+    vector<vector<Entry> > scanned(indexes.size());
+    vector<Job> jobs;
+
+    for (size_t i = 0; i < indexes.size(); ++i) {
+        const DumpIndex &index = indexes[i];
+        vector<Entry> &entries = scanned[i];
+
+        // listDir() returns the names sorted
+        StringVector dumps = index.m_dir.listDir(FilterKdumpDirs());
+        entries.resize(dumps.size());
+        for (size_t j = 0; j < dumps.size(); ++j) {
+            Entry &entry = entries[j];
+            entry.name = dumps[j];
+            statDump(index.m_dir, entry);
+
+            const Entry *old = index.find(entry.name);
+            if (!force && old && old->mtime == entry.mtime &&
+                old->size == entry.size && old->parts == entry.parts)
+                entry = *old;
+            else
+                jobs.push_back(Job{ &index.m_dir, &entry });
+        }
+    }
+
+    Debug::debug()->dbg("%lu dumps to read", (unsigned long)jobs.size());
+
+    parallelFor(jobs.size(), MAXTHREADS_INDEX, [&jobs](size_t i) {
+        readDump(*jobs[i].dir, *jobs[i].entry);
+    });
+
+    for (size_t i = 0; i < indexes.size(); ++i)
+        indexes[i].m_entries.swap(scanned[i]);
+
+    return jobs.size();
+}
+
+// -----------------------------------------------------------------------------
+void DumpIndex::readDump(const FilePath &dir, Entry &entry)
+{
+    Debug::debug()->trace("DumpIndex::readDump(%s, %s)",
+                          dir.c_str(), entry.name.c_str());
+
+    FilePath dumpdir(dir);
+    dumpdir.appendPath(entry.name);
+
+    entry.format = "unknown";
+    entry.crashtime = 0;
+    entry.release.clear();
+
+    try {
+        FilePath recipe(dumpdir);
+        recipe.appendPath(string("vmcore") + ChunkStore::RECIPE_SUFFIX);
+
+        FilePath vmcore(dumpdir);
+        vmcore.appendPath("vmcore");
+        if (!vmcore.exists()) {
+            // parts of a split dump have the same header
+            vmcore = dumpdir;
+            vmcore.appendPath("vmcore1");
+        }
+
+        Vmcoreinfo info;
+        bool haveInfo = false;
+
+        if (!vmcore.exists() && recipe.exists()) {
+            entry.format = "dedup";
+        } else {
+            char magic[16];
+            memset(magic, 0, sizeof magic);
+            {
+                FileDescriptor fd(vmcore, O_RDONLY);
+                ssize_t ret = pread(fd, magic, sizeof magic, 0);
+                if (ret < 0)
+                    throw KSystemError("Cannot read " + vmcore, errno);
+
+                vector<char> notes;
+                if (memcmp(magic, ELFMAG, SELFMAG) == 0) {
+                    entry.format = "ELF";
+                } else if (memcmp(magic, KDUMP_SIGNATURE,
+                                  strlen(KDUMP_SIGNATURE)) == 0) {
+                    entry.format = "kdump";
+                } else if (memcmp(magic, CHUNKED_MAGIC,
+                                  sizeof CHUNKED_MAGIC) == 0) {
+                    entry.format = "chunked";
+                } else if (memcmp(magic, MDF_SIGNATURE,
+                                  strlen(MDF_SIGNATURE)) == 0) {
+                    entry.format = "flattened";
+                } else if (memcmp(magic, ZSTD_MAGIC, sizeof ZSTD_MAGIC) == 0) {
+                    entry.format = "zstd";
+                }
+
+                if (readNotes(fd, entry.format, notes)) {
+                    info.readFromNotes(ElfNotes(notes.data(), notes.size()));
+                    haveInfo = true;
+                }
+            }
+
+            if (entry.format == "ELF") {
+                Vmcore elf(vmcore);
+                info.readFromNotes(ElfNotes(elf));
+                haveInfo = true;
+            }
+        }
+
+        if (haveInfo) {
+            entry.release = info.getStringValue("OSRELEASE");
+            if (info.hasKey("CRASHTIME"))
+                entry.crashtime = info.getLLongValue("CRASHTIME");
+        }
+    } catch (const KError &e) {
+        Debug::debug()->dbg("Cannot read %s: %s", dumpdir.c_str(), e.what());
+    }
+
+    // compressed dumps can be identified only by their README
+    if (entry.release.empty())
+        entry.release = readmeRelease(dumpdir);
+}
+
+// -----------------------------------------------------------------------------
+void DumpIndex::write() const
+{
+    FilePath path(m_dir);
+    path.appendPath(INDEX_FILE);
+    ostringstream tmpName;
+    tmpName << path << ".tmp." << getpid();
+    FilePath tmp = tmpName.str();
+
+    try {
+        ofstream fout(tmp.c_str());
+        if (!fout)
+            throw KSystemError("Cannot create " + tmp, errno);
+
+        fout << INDEX_HEADER << "\n";
+        for (const auto &entry : m_entries)
+            fout << entry.mtime << " "
+                 << entry.size << " "
+                 << entry.format << " "
+                 << entry.parts << " "
+                 << (long long)entry.crashtime << " "
+                 << (entry.release.empty() ? "-" : entry.release) << " "
+                 << entry.name << "\n";
+
+        fout.close();
+        if (!fout)
+            throw KSystemError("Cannot write " + tmp, errno);
+
+        if (rename(tmp.c_str(), path.c_str()) != 0)
+            throw KSystemError("Cannot rename " + tmp, errno);
+    } catch (...) {
+        unlink(tmp.c_str());
+        throw;
+    }
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,123 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef DUMPINDEX_H
+#define DUMPINDEX_H
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "global.h"
+#include "fileutil.h"
+
+//{{{ DumpIndex ----------------------------------------------------------------
+
+/**
+ * Catalog of the dumps in a save directory.
+ *
+ * The catalog is kept in INDEX_FILE in the save directory. It has one
+ * line per dump directory with the modification time and size of the
+ * dump files, the dump format and the kernel release and crash time
+ * taken from the VMCOREINFO. A dump is read again only if the time or
+ * size of its files has changed since the index was written.
+ */
+class DumpIndex {
+
+    public:
+        /**
+         * Name of the index file in the save directory.
+         */
+        static const char INDEX_FILE[];
+
+        /**
+         * Information about one dump.
+         */
+        struct Entry {
+            std::string name;           /**< dump directory */
+            unsigned long long mtime;   /**< newest mtime of the dump in ns */
+            unsigned long long size;    /**< total size of the dump files */
+            std::string format;         /**< ELF, kdump, chunked, ... */
+            unsigned parts;             /**< number of dump files */
+            time_t crashtime;           /**< crash time, or 0 */
+            std::string release;        /**< kernel release, or empty */
+        };
+
+        /**
+         * Creates the catalog of a save directory and reads the index
+         * file if there is one. A missing or corrupt index file is
+         * treated as empty.
+         *
+         * @param[in] dir the save directory
+         */
+        DumpIndex(const FilePath &dir);
+
+        /**
+         * Returns the save directory.
+         */
+        const FilePath &getDir() const
+        { return m_dir; }
+
+        /**
+         * Returns the entries ordered by the name of the dump directory.
+         */
+        const std::vector<Entry> &getEntries() const
+        { return m_entries; }
+
+        /**
+         * Brings the entries of all catalogs up to date. The dump
+         * directories are listed first; the dumps which are new or have
+         * changed are then read in parallel.
+         *
+         * @param[in,out] indexes the catalogs
+         * @param[in] force read all dumps, even if they have not changed
+         * @return the number of dumps that have been read
+         * @exception KError if a save directory cannot be listed
+         */
+        static unsigned update(std::vector<DumpIndex> &indexes,
+                               bool force = false);
+
+        /**
+         * Writes the index file.
+         *
+         * @exception KError if the file cannot be written
+         */
+        void write() const;
+
+        /**
+         * Reads the format, kernel release and crash time of a dump.
+         *
+         * @param[in] dir the save directory
+         * @param[in,out] entry the dump; name, mtime and size must be set
+         */
+        static void readDump(const FilePath &dir, Entry &entry);
+
+    protected:
+        void load();
+        const Entry *find(const std::string &name) const;
+
+    private:
+        FilePath m_dir;
+        std::vector<Entry> m_entries;
+};
+
+//}}}
+
+#endif /* DUMPINDEX_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
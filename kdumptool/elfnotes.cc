@@ -0,0 +1,147 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <string>
+#include <cstring>
+
+#include <gelf.h>
+
+#include "global.h"
+#include "debug.h"
+#include "elfnotes.h"
+#include "vmcore.h"
+
+using std::string;
+using std::vector;
+
+#define NOTE_NAME_CORE          "CORE"
+
+// -----------------------------------------------------------------------------
+static inline size_t noteAlign(size_t n)
+{
+    return (n + 3) & ~size_t(3);
+}
+
+//{{{ ElfNotes -----------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+ElfNotes::ElfNotes(Vmcore &vmcore)
+{
+    uint64_t total = 0;
+    for (const auto &seg : vmcore.noteSegments())
+        total += seg.second;
+    m_data.resize(total);
+
+    size_t pos = 0;
+    for (const auto &seg : vmcore.noteSegments()) {
+        vmcore.readFile(seg.first, m_data.data() + pos, seg.second);
+        parse(pos, pos + seg.second);
+        pos += seg.second;
+    }
+
+    Debug::debug()->dbg("%zu ELF notes in %zu PT_NOTE segments",
+                        m_notes.size(), vmcore.noteSegments().size());
+}
+
+// -----------------------------------------------------------------------------
+ElfNotes::ElfNotes(const char *data, size_t len)
+    : m_data(data, data + len)
+{
+    parse(0, len);
+}
+
+// -----------------------------------------------------------------------------
+void ElfNotes::parse(size_t start, size_t end)
+{
+    // Elf32_Nhdr and Elf64_Nhdr have the same layout
+    size_t off = start;
+    while (off + sizeof(Elf64_Nhdr) <= end) {
+        Elf64_Nhdr nhdr;
+        memcpy(&nhdr, m_data.data() + off, sizeof nhdr);
+
+        // an empty note terminates the list
+        if (!nhdr.n_namesz && !nhdr.n_descsz && !nhdr.n_type)
+            break;
+
+        size_t name = off + sizeof nhdr;
+        size_t desc = name + noteAlign(nhdr.n_namesz);
+        size_t next = desc + noteAlign(nhdr.n_descsz);
+        if (desc < name || next < desc || next > end) {
+            Debug::debug()->dbg("Truncated ELF note at offset %zu", off);
+            break;
+        }
+
+        Note note;
+        note.name.assign(m_data.data() + name,
+                         strnlen(m_data.data() + name, nhdr.n_namesz));
+        note.type = nhdr.n_type;
+        note.offset = desc;
+        note.size = nhdr.n_descsz;
+
+        m_index[Key(note.name, note.type)].push_back(m_notes.size());
+        m_notes.push_back(note);
+
+        off = next;
+    }
+}
+
+// -----------------------------------------------------------------------------
+const ElfNotes::Note *ElfNotes::find(const string &name, uint32_t type,
+                                     size_t n) const
+{
+    auto it = m_index.find(Key(name, type));
+    if (it == m_index.end() || n >= it->second.size())
+        return nullptr;
+    return &m_notes[it->second[n]];
+}
+
+// -----------------------------------------------------------------------------
+const ElfNotes::Note *ElfNotes::find(const string &name) const
+{
+    const Note *ret = nullptr;
+    for (auto it = m_index.lower_bound(Key(name, 0));
+         it != m_index.end() && it->first.first == name; ++it) {
+        const Note *note = &m_notes[it->second.front()];
+        if (!ret || note < ret)
+            ret = note;
+    }
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+size_t ElfNotes::count(const string &name, uint32_t type) const
+{
+    auto it = m_index.find(Key(name, type));
+    return it == m_index.end() ? 0 : it->second.size();
+}
+
+// -----------------------------------------------------------------------------
+size_t ElfNotes::numCpus() const
+{
+    return count(NOTE_NAME_CORE, NT_PRSTATUS);
+}
+
+// -----------------------------------------------------------------------------
+const ElfNotes::Note *ElfNotes::prstatus(size_t cpu) const
+{
+    return find(NOTE_NAME_CORE, NT_PRSTATUS, cpu);
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
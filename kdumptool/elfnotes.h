@@ -0,0 +1,141 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef ELFNOTES_H
+#define ELFNOTES_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "global.h"
+
+class Vmcore;
+
+//{{{ ElfNotes -----------------------------------------------------------------
+
+/**
+ * Index of all ELF notes in a dump.
+ *
+ * The contents of all PT_NOTE segments are read once and kept in memory.
+ * Every note is indexed by its owner name and type, so consumers can look
+ * up VMCOREINFO, the per-CPU NT_PRSTATUS notes or Xen notes without
+ * parsing the segments again.
+ */
+class ElfNotes {
+
+    public:
+        /**
+         * A single note.
+         */
+        struct Note {
+            std::string name;   /**< owner name, e.g. "CORE" */
+            uint32_t type;      /**< note type, e.g. NT_PRSTATUS */
+            size_t offset;      /**< offset of the descriptor in data() */
+            size_t size;        /**< size of the descriptor */
+        };
+
+        /**
+         * Reads and indexes all PT_NOTE segments of a dump.
+         *
+         * @param[in] vmcore the dump
+         * @exception KError if reading a segment fails
+         */
+        ElfNotes(Vmcore &vmcore);
+
+        /**
+         * Indexes notes that are already in memory.
+         *
+         * @param[in] data contents of a PT_NOTE segment
+         * @param[in] len size of @p data
+         */
+        ElfNotes(const char *data, size_t len);
+
+        /**
+         * Returns the contents of all PT_NOTE segments, concatenated.
+         */
+        const std::vector<char> &data() const
+        { return m_data; }
+
+        /**
+         * Returns all notes in file order.
+         */
+        const std::vector<Note> &notes() const
+        { return m_notes; }
+
+        /**
+         * Finds a note by owner name and type.
+         *
+         * @param[in] name owner name
+         * @param[in] type note type
+         * @param[in] n return the n-th matching note (counting from zero)
+         * @return the note, or @c nullptr if there is no such note
+         */
+        const Note *find(const std::string &name, uint32_t type,
+                         size_t n = 0) const;
+
+        /**
+         * Finds the first note with a given owner name, regardless of type.
+         *
+         * @param[in] name owner name
+         * @return the note, or @c nullptr if there is no such note
+         */
+        const Note *find(const std::string &name) const;
+
+        /**
+         * Returns the number of notes with a given owner name and type.
+         */
+        size_t count(const std::string &name, uint32_t type) const;
+
+        /**
+         * Returns a pointer to the descriptor of a note.
+         */
+        const char *desc(const Note &note) const
+        { return m_data.data() + note.offset; }
+
+        /**
+         * Returns the number of CPUs, i.e. NT_PRSTATUS notes.
+         */
+        size_t numCpus() const;
+
+        /**
+         * Returns the NT_PRSTATUS note of a CPU. The descriptor is the
+         * kernel's struct elf_prstatus, including the saved registers.
+         *
+         * @param[in] cpu CPU number in note order
+         * @return the note, or @c nullptr if @p cpu is out of range
+         */
+        const Note *prstatus(size_t cpu) const;
+
+    protected:
+        void parse(size_t start, size_t end);
+
+    private:
+        typedef std::pair<std::string, uint32_t> Key;
+
+        std::vector<char> m_data;
+        std::vector<Note> m_notes;
+        std::map<Key, std::vector<size_t> > m_index;
+};
+
+//}}}
+
+#endif /* ELFNOTES_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
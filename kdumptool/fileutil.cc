@@ -49,10 +49,10 @@ using std::free;
 //{{{ FileDescriptor -----------------------------------------------------------
 
 // -----------------------------------------------------------------------------
-FileDescriptor::FileDescriptor(const char *path, int flags)
+FileDescriptor::FileDescriptor(const char *path, int flags, mode_t mode)
     : m_fd(-1)
 {
-    m_fd = open(path, flags);
+    m_fd = open(path, flags, mode);
     if (m_fd < 0)
         throw KSystemError(string("Cannot open ") + path, errno);
 }
@@ -476,6 +476,16 @@ bool FilterKdumpDirs::test(int dirfd, const struct dirent *d) const
     struct stat mystat;
     FilePath vmcore(d->d_name);
     vmcore.appendPath("vmcore");
+    if (fstatat(dirfd, vmcore.c_str(), &mystat, 0) == 0)
+        return true;
+
+    // split dumps
+    vmcore += "1";
+    if (fstatat(dirfd, vmcore.c_str(), &mystat, 0) == 0)
+        return true;
+
+    // dumps saved in the chunk store
+    vmcore.replace(vmcore.size() - 1, 1, ".recipe");
     return fstatat(dirfd, vmcore.c_str(), &mystat, 0) == 0;
 }
 //}}}
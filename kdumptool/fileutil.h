@@ -19,6 +19,8 @@
 #ifndef FILEUTIL_H
 #define FILEUTIL_H
 
+#include <sys/types.h>
+
 #include "global.h"
 #include "stringutil.h"
 #include "stringvector.h"
@@ -29,9 +31,9 @@ class FileDescriptor {
 	int m_fd;
 
     public:
-        FileDescriptor(const char *path, int flags);
-        FileDescriptor(std::string const& path, int flags)
-	    : FileDescriptor(path.c_str(), flags)
+        FileDescriptor(const char *path, int flags, mode_t mode = 0);
+        FileDescriptor(std::string const& path, int flags, mode_t mode = 0)
+	    : FileDescriptor(path.c_str(), flags, mode)
         { }
 
 	~FileDescriptor();
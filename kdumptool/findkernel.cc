@@ -23,6 +23,9 @@
 #include <gelf.h>
 #include <cerrno>
 #include <fcntl.h>
+#include <exception>
+#include <map>
+#include <vector>
 
 #include "subcommand.h"
 #include "debug.h"
@@ -35,6 +38,8 @@
 #include "kconfig.h"
 #include "stringvector.h"
 #include "kernelpath.h"
+#include "kernelinfo.h"
+#include "parallel.h"
 
 using std::string;
 using std::cout;
@@ -54,6 +59,11 @@ using std::list;
  */
 #define MAXCPUS_KDUMP 1024
 
+/**
+ * Maximum number of threads used to examine kernel images.
+ */
+#define MAXTHREADS_FIND 4
+
 //{{{ FindKernel ---------------------------------------------------------------
 
 // -----------------------------------------------------------------------------
@@ -132,7 +142,7 @@ void FindKernel::execute()
 // -----------------------------------------------------------------------------
 bool FindKernel::suitableForKdump(const string &kernelImage, bool strict)
 {
-    KernelTool kt(kernelImage);
+    KernelInfo info(kernelImage);
 
     // if that's not a special kdump kernel, it must be relocatable
     // TODO: check about start address, don't trust the naming
@@ -140,7 +150,7 @@ bool FindKernel::suitableForKdump(const string &kernelImage, bool strict)
         Debug::debug()->dbg("%s is kdump kernel, no need for relocatable check",
             kernelImage.c_str());
     } else {
-        bool relocatable = kt.isRelocatable();
+        bool relocatable = info.isRelocatable();
         Debug::debug()->dbg("%s is %s", kernelImage.c_str(),
             relocatable ? "relocatable" : "not relocatable");
         if (!relocatable) {
@@ -148,24 +158,22 @@ bool FindKernel::suitableForKdump(const string &kernelImage, bool strict)
         }
     }
 
-    Kconfig *kconfig = kt.retrieveKernelConfig();
     KconfigValue kv;
     bool isxen;
 
     // Avoid Xenlinux kernels, because they do not run on bare metal
-    kv = kconfig->get("CONFIG_X86_64_XEN");
+    kv = info.getConfig("CONFIG_X86_64_XEN");
     isxen = (kv.getType() == KconfigValue::T_TRISTATE &&
              kv.getTristateValue() == KconfigValue::ON);
     if (!isxen) {
-        kv = kconfig->get("CONFIG_X86_XEN");
+        kv = info.getConfig("CONFIG_X86_XEN");
         isxen = (kv.getType() == KconfigValue::T_TRISTATE &&
                  kv.getTristateValue() == KconfigValue::ON);
     }
     if (isxen) {
         Debug::debug()->dbg("%s is a Xen kernel. Avoid.",
             kernelImage.c_str());
-	delete kconfig;
-	return false;
+        return false;
     }
 
     if (strict) {
@@ -174,28 +182,24 @@ bool FindKernel::suitableForKdump(const string &kernelImage, bool strict)
         // avoid large number of CPUs on x86 since that increases
         // memory size constraints of the capture kernel
         if (arch == "i386" || arch == "x86_64") {
-            kv = kconfig->get("CONFIG_NR_CPUS");
+            kv = info.getConfig("CONFIG_NR_CPUS");
             if (kv.getType() == KconfigValue::T_INTEGER &&
                     kv.getIntValue() > MAXCPUS_KDUMP) {
                 Debug::debug()->dbg("NR_CPUS of %s is %d >= %d. Avoid.",
                     kernelImage.c_str(), kv.getIntValue(), MAXCPUS_KDUMP);
-                delete kconfig;
                 return false;
             }
         }
 
         // avoid realtime kernels
-        kv = kconfig->get("CONFIG_PREEMPT_RT");
+        kv = info.getConfig("CONFIG_PREEMPT_RT");
         if (kv.getType() != KconfigValue::T_INVALID) {
             Debug::debug()->dbg("%s is realtime kernel. Avoid.",
                 kernelImage.c_str());
-            delete kconfig;
             return false;
         }
     }
 
-    delete kconfig;
-
     return true;
 }
 
@@ -232,86 +236,123 @@ FilePath FindKernel::findKernelAuto()
     
     // $(uname -r) == KERNELVERSION
     // KERNELVERSION := BASEVERSION + '-' + FLAVOUR
-
-    // 1. Use BASEVERSION-kdump
     StringVector elements = runningkernel.split('-');
     elements[elements.size()-1] = "kdump";
-    string testkernel = elements.join('-');
-    Debug::debug()->dbg("---------------");
-    Debug::debug()->dbg("findKernelAuto: Trying %s", testkernel.c_str());
-    FilePath testkernelimage = findForVersion(testkernel);
-    if (testkernelimage.size() > 0 && suitableForKdump(testkernelimage, true)) {
-        return testkernelimage;
-    }
-
-    // 2. Use kdump
-    testkernel = "kdump";
-    Debug::debug()->dbg("---------------");
-    Debug::debug()->dbg("findKernelAuto: Trying %s", testkernel.c_str());
-    testkernelimage = findForVersion(testkernel);
-    if (testkernelimage.size() > 0 && suitableForKdump(testkernelimage, true)) {
-        return testkernelimage;
-    }
-
-    // 3. Use KERNELVERSION
-    testkernel = runningkernel;
-    Debug::debug()->dbg("---------------");
-    Debug::debug()->dbg("findKernelAuto: Trying %s", testkernel.c_str());
-    testkernelimage = findForVersion(testkernel);
-    if (testkernelimage.size() > 0 && suitableForKdump(testkernelimage, true)) {
-        return testkernelimage;
-    }
-
-    // 4. Use BASEVERSION-default
-    elements = runningkernel.split('-');
+    string kdumpversion = elements.join('-');
     elements[elements.size()-1] = "default";
-    testkernel = elements.join('-');
-    Debug::debug()->dbg("---------------");
-    Debug::debug()->dbg("findKernelAuto: Trying %s", testkernel.c_str());
-    testkernelimage = findForVersion(testkernel);
-    if (testkernelimage.size() > 0 && suitableForKdump(testkernelimage, true)) {
-        return testkernelimage;
-    }
-
-    // 5. Use ""
-    testkernel = "";
-    Debug::debug()->dbg("---------------");
-    Debug::debug()->dbg("findKernelAuto: Trying %s", testkernel.c_str());
-    testkernelimage = findForVersion(testkernel);
-    if (testkernelimage.size() > 0 && suitableForKdump(testkernelimage, true)) {
-        return testkernelimage;
-    }
-
-    // 6. Use KERNELVERSION unstrict
-    testkernel = runningkernel;
-    Debug::debug()->dbg("---------------");
-    Debug::debug()->dbg("findKernelAuto: Trying %s", testkernel.c_str());
-    testkernelimage = findForVersion(testkernel);
-    if (testkernelimage.size() > 0 && suitableForKdump(testkernelimage, false)) {
-        return testkernelimage;
-    }
+    string defaultversion = elements.join('-');
+
+    // candidates in the order of preference
+    const struct {
+        string version;
+        bool strict;
+    } order[] = {
+        { kdumpversion, true },         // 1. Use BASEVERSION-kdump
+        { "kdump", true },              // 2. Use kdump
+        { runningkernel, true },        // 3. Use KERNELVERSION
+        { defaultversion, true },       // 4. Use BASEVERSION-default
+        { "", true },                   // 5. Use ""
+        { runningkernel, false },       // 6. Use KERNELVERSION unstrict
+        { defaultversion, false },      // 7. Use BASEVERSION-default unstrict
+        { "", false },                  // 8. Use "" unstrict
+    };
+
+    // each image is examined only once, even if it matches several times;
+    // an error is raised only at a candidate which needs that check
+    struct Check {
+        bool needed;
+        bool suitable;
+        std::exception_ptr error;
+    };
+    struct Evaluation {
+        FilePath image;
+        Check strict, unstrict;
+    };
+    struct Candidate {
+        string version;
+        FilePath image;
+        size_t index;
+        bool strict;
+    };
+    std::vector<Evaluation> images;
+    std::vector<Candidate> candidates;
+    std::map<string, size_t> seen;
+
+    for (const auto &o : order) {
+        FilePath image = findForVersion(o.version);
+        if (image.empty())
+            continue;
+
+        string resolved;
+        try {
+            resolved = image.getCanonicalPath();
+        } catch (const KError &) {
+            resolved = image;
+        }
 
-    // 7. Use BASEVERSION-default unstrict
-    elements = runningkernel.split('-');
-    elements[elements.size()-1] = "default";
-    testkernel = elements.join('-');
-    Debug::debug()->dbg("---------------");
-    Debug::debug()->dbg("findKernelAuto: Trying %s", testkernel.c_str());
-    testkernelimage = findForVersion(testkernel);
-    if (testkernelimage.size() > 0 && suitableForKdump(testkernelimage, false)) {
-        return testkernelimage;
+        auto it = seen.find(resolved);
+        if (it == seen.end()) {
+            it = seen.insert(std::make_pair(resolved, images.size())).first;
+            images.push_back(Evaluation{ image,
+                                         { false, false, nullptr },
+                                         { false, false, nullptr } });
+        }
+        Evaluation &e = images[it->second];
+        (o.strict ? e.strict : e.unstrict).needed = true;
+        candidates.push_back(Candidate{ o.version, image, it->second,
+                                        o.strict });
     }
-
-    // 8. Use "" unstrict
-    testkernel = "";
-    Debug::debug()->dbg("---------------");
-    Debug::debug()->dbg("findKernelAuto: Trying %s", testkernel.c_str());
-    testkernelimage = findForVersion(testkernel);
-    if (testkernelimage.size() > 0 && suitableForKdump(testkernelimage, false)) {
-        return testkernelimage;
+    if (images.empty())
+        return "";
+
+    // examine the images in the background, most preferred first
+    ParallelFor pool(images.size(), MAXTHREADS_FIND,
+                     [this, &images](size_t i) {
+        Evaluation &e = images[i];
+        if (e.strict.needed) {
+            try {
+                e.strict.suitable = suitableForKdump(e.image, true);
+            } catch (...) {
+                e.strict.error = std::current_exception();
+            }
+        }
+        if (e.unstrict.needed) {
+            try {
+                // the strict checks include the unstrict ones
+                e.unstrict.suitable = e.strict.suitable ||
+                    suitableForKdump(e.image, false);
+            } catch (...) {
+                e.unstrict.error = std::current_exception();
+            }
+        }
+    });
+
+    // pick the first suitable candidate in the order of preference
+    FilePath ret;
+    std::exception_ptr error;
+    for (const auto &c : candidates) {
+        Debug::debug()->dbg("---------------");
+        Debug::debug()->dbg("findKernelAuto: Trying %s%s",
+                            c.version.c_str(),
+                            c.strict ? "" : " (unstrict)");
+
+        pool.wait(c.index);
+        const Evaluation &e = images[c.index];
+        const Check &check = c.strict ? e.strict : e.unstrict;
+        if (check.error) {
+            error = check.error;
+            break;
+        }
+        if (check.suitable) {
+            ret = c.image;
+            break;
+        }
     }
+    pool.cancel();
 
-    return "";
+    if (error)
+        std::rethrow_exception(error);
+    return ret;
 }
 
 // -----------------------------------------------------------------------------
@@ -17,20 +17,73 @@
  * 02110-1301, USA.
  */
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <cerrno>
+#include <sys/stat.h>
 
 #include "subcommand.h"
 #include "debug.h"
 #include "identifykernel.h"
 #include "util.h"
 #include "kerneltool.h"
+#include "kernelinfo.h"
+#include "kernelbatch.h"
+#include "stringutil.h"
 
 using std::string;
 using std::cout;
 using std::cerr;
 using std::endl;
 
+// -----------------------------------------------------------------------------
+static const char *typeName(KernelTool::KernelType type)
+{
+    switch (type) {
+        case KernelTool::KT_X86:
+            return "x86";
+        case KernelTool::KT_ELF:
+            return "ELF";
+        case KernelTool::KT_ELF_GZ:
+            return "ELF gzip";
+        case KernelTool::KT_ELF_XZ:
+            return "ELF xz";
+        case KernelTool::KT_ELF_ZSTD:
+            return "ELF zstd";
+        case KernelTool::KT_ELF_LZ4:
+            return "ELF lz4";
+        case KernelTool::KT_S390:
+            return "S390";
+        case KernelTool::KT_AARCH64:
+            return "Aarch64";
+        default:
+            return NULL;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static string jsonConfigValue(const KconfigValue &value)
+{
+    switch (value.getType()) {
+        case KconfigValue::T_STRING:
+            return StringUtil::jsonString(value.getStringValue());
+        case KconfigValue::T_INTEGER:
+            return StringUtil::jsonString(
+                StringUtil::number2string(value.getIntValue()));
+        case KconfigValue::T_TRISTATE:
+            switch (value.getTristateValue()) {
+                case KconfigValue::ON:
+                    return "\"y\"";
+                case KconfigValue::MODULE:
+                    return "\"m\"";
+                default:
+                    return "\"n\"";
+            }
+        default:
+            return "null";
+    }
+}
+
 //{{{ IdentifyKernel -----------------------------------------------------------
 
 // -----------------------------------------------------------------------------
@@ -41,6 +94,8 @@ IdentifyKernel::IdentifyKernel()
         "Check if the kernel is relocatable"));
     m_options.push_back(new FlagOption("type", 't', &m_checkType,
         "Print the type of the kernel"));
+    m_options.push_back(new StringOption("config", 'c', &m_configOptions,
+        "Comma-separated list of config options to report in batch mode"));
 }
 
 // -----------------------------------------------------------------------------
@@ -54,6 +109,19 @@ void IdentifyKernel::parseArgs(const StringVector &args)
 {
     Debug::debug()->trace(__FUNCTION__);
 
+    bool batch = args.size() > 1;
+    if (args.size() == 1) {
+        struct stat st;
+        batch = stat(args[0].c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+
+    if (batch) {
+        m_batchPaths = args;
+        Debug::debug()->dbg("batch mode, %lu paths",
+                            (unsigned long)m_batchPaths.size());
+        return;
+    }
+
     if (!m_checkType && !m_checkRelocatable)
         throw KError("You have to specify either the -r or the -t flag.");
 
@@ -66,37 +134,92 @@ void IdentifyKernel::parseArgs(const StringVector &args)
     Debug::debug()->dbg("kernelimage = " + m_kernelImage);
 }
 
+// -----------------------------------------------------------------------------
+string IdentifyKernel::batchRecord(const string &image) const
+{
+    KernelInfo info(image);
+
+    const char *type;
+    try {
+        type = typeName(info.getKernelType());
+    } catch (const KError &e) {
+        Debug::debug()->dbg("%s: %s", image.c_str(), e.what());
+        type = NULL;
+    }
+    if (!type)
+        return string();
+
+    std::ostringstream ss;
+    ss << "{\"image\": " << StringUtil::jsonString(image)
+       << ", \"type\": " << StringUtil::jsonString(type)
+       << ", \"arch\": " << StringUtil::jsonString(info.getArch());
+
+    try {
+        ss << ", \"relocatable\": "
+           << (info.isRelocatable() ? "true" : "false");
+    } catch (const KSystemError &) {
+        throw;
+    } catch (const KError &e) {
+        ss << "null, \"relocatable_error\": "
+           << StringUtil::jsonString(e.what());
+    }
+
+    StringVector options;
+    if (m_configOptions.empty()) {
+        for (const char *const *p = KernelInfo::CONFIG_OPTIONS; *p; ++p)
+            options.push_back(*p);
+    } else
+        options = KString(m_configOptions).split(',');
+
+    try {
+        std::ostringstream config;
+        for (const auto &option : options) {
+            string name = option;
+            if (name.compare(0, 7, "CONFIG_") != 0)
+                name = "CONFIG_" + name;
+            if (config.tellp() > 0)
+                config << ", ";
+            config << StringUtil::jsonString(name) << ": "
+                   << jsonConfigValue(info.getConfig(name));
+        }
+        ss << ", \"config\": {" << config.str() << "}";
+    } catch (const KSystemError &) {
+        throw;
+    } catch (const KError &e) {
+        ss << ", \"config\": null, \"config_error\": "
+           << StringUtil::jsonString(e.what());
+    }
+
+    ss << "}";
+    return ss.str();
+}
+
 // -----------------------------------------------------------------------------
 void IdentifyKernel::execute()
 {
     Debug::debug()->trace(__FUNCTION__);
 
-    KernelTool kt(m_kernelImage);
+    if (!m_batchPaths.empty()) {
+        KernelBatch batch(m_batchPaths);
+        unsigned errors = batch.run(
+            [this](const string &image) { return batchRecord(image); },
+            cout);
+        if (errors)
+            setErrorCode(NOT_A_KERNEL);
+        return;
+    }
+
+    KernelInfo info(m_kernelImage);
 
     if (m_checkType) {
-        switch (kt.getKernelType()) {
-            case KernelTool::KT_X86:
-                cout << "x86" << endl;
-                break;
-            case KernelTool::KT_ELF:
-                cout << "ELF" << endl;
-                break;
-            case KernelTool::KT_ELF_GZ:
-                cout << "ELF gzip" << endl;
-                break;
-            case KernelTool::KT_S390:
-                cout << "S390" << endl;
-                break;
-            case KernelTool::KT_AARCH64:
-                cout << "Aarch64" << endl;
-                break;
-            default:
-                throw KError("The specified file is not a kernel image.");
-        }
+        const char *type = typeName(info.getKernelType());
+        if (!type)
+            throw KError("The specified file is not a kernel image.");
+        cout << type << endl;
     }
 
     if (m_checkRelocatable) {
-        if (kt.isRelocatable())
+        if (info.isRelocatable())
             cout << "Relocatable" << endl;
         else {
             cout << "Not relocatable" << endl;
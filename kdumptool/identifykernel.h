@@ -74,10 +74,18 @@ class IdentifyKernel : public Subcommand {
 
         bool isArchAlwaysRelocatable(const char *machine);
 
+        /**
+         * Returns the JSON record for one kernel image in batch mode,
+         * or an empty string if the image is not a kernel.
+         */
+        std::string batchRecord(const std::string &image) const;
+
     private:
         bool m_checkRelocatable;
         bool m_checkType;
         std::string m_kernelImage;
+        StringVector m_batchPaths;
+        std::string m_configOptions;
 };
 
 //}}}
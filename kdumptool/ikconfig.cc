@@ -0,0 +1,124 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+#include "ikconfig.h"
+
+using std::string;
+
+#define MAGIC_START         "IKCFG_ST"
+#define MAGIC_END           "IKCFG_ED"
+#define MAGIC_LEN           8
+
+//{{{ PatternScanner -----------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+PatternScanner::PatternScanner(const void *pattern, size_t len)
+    : m_pattern(static_cast<const char *>(pattern), len),
+      m_offset(0), m_match(-1)
+{ }
+
+// -----------------------------------------------------------------------------
+ssize_t PatternScanner::scan(const char *data, size_t len)
+{
+    const size_t plen = m_pattern.size();
+    const char *p;
+
+    // a match which starts in the previous chunk
+    if (!m_tail.empty()) {
+        string window = m_tail + string(data, std::min(len, plen - 1));
+        p = static_cast<const char *>(
+            memmem(window.data(), window.size(), m_pattern.data(), plen));
+        if (p) {
+            size_t pos = p - window.data();
+            m_match = m_offset - m_tail.size() + pos;
+            m_offset += len;
+            return pos + plen - m_tail.size();
+        }
+    }
+
+    p = static_cast<const char *>(memmem(data, len, m_pattern.data(), plen));
+    if (p) {
+        m_match = m_offset + (p - data);
+        m_offset += len;
+        return p - data + plen;
+    }
+
+    // keep the bytes which may start a match in the next chunk
+    if (len >= plen - 1) {
+        m_tail.assign(data + len - (plen - 1), plen - 1);
+    } else {
+        m_tail.append(data, len);
+        if (m_tail.size() > plen - 1)
+            m_tail.erase(0, m_tail.size() - (plen - 1));
+    }
+    m_offset += len;
+    return -1;
+}
+
+//}}}
+//{{{ IkconfigScanner ----------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+IkconfigScanner::IkconfigScanner()
+    : m_start(MAGIC_START, MAGIC_LEN), m_inside(false), m_found(false),
+      m_searched(0)
+{ }
+
+// -----------------------------------------------------------------------------
+bool IkconfigScanner::feed(const char *data, size_t len)
+{
+    if (m_found)
+        return true;
+
+    if (!m_inside) {
+        ssize_t pos = m_start.scan(data, len);
+        if (pos < 0)
+            return false;
+        m_inside = true;
+        data += pos;
+        len -= pos;
+    }
+
+    m_data.append(data, len);
+
+    // the end marker may start in the previously searched data
+    size_t from = m_searched > MAGIC_LEN - 1
+        ? m_searched - (MAGIC_LEN - 1)
+        : 0;
+    const char *p = static_cast<const char *>(
+        memmem(m_data.data() + from, m_data.size() - from,
+               MAGIC_END, MAGIC_LEN));
+    if (p) {
+        m_data.resize(p - m_data.data());
+        m_found = true;
+    } else if (m_data.size() > MAX_SIZE) {
+        throw KError("IKCFG_ED not found after IKCFG_ST.");
+    } else {
+        m_searched = m_data.size();
+    }
+
+    return m_found;
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,126 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef IKCONFIG_H
+#define IKCONFIG_H
+
+#include <string>
+#include <sys/types.h>
+
+#include "global.h"
+
+//{{{ PatternScanner -----------------------------------------------------------
+
+/**
+ * Finds a byte pattern in a stream which is passed in chunks of any size.
+ * A match may span two (or more) chunks.
+ */
+class PatternScanner {
+
+    public:
+        /**
+         * Creates a scanner for the given pattern.
+         *
+         * @param[in] pattern the bytes to search for
+         * @param[in] len length of @p pattern, must not be zero
+         */
+        PatternScanner(const void *pattern, size_t len);
+
+        /**
+         * Scans the next chunk of the stream.
+         *
+         * @param[in] data the chunk
+         * @param[in] len length of @p data
+         * @return offset in @p data just past the first match,
+         *         or -1 if there is no match (yet)
+         */
+        ssize_t scan(const char *data, size_t len);
+
+        /**
+         * Returns the stream offset of the first matching byte, or -1
+         * if scan() has not found the pattern.
+         */
+        off_t matchOffset() const
+        { return m_match; }
+
+    private:
+        std::string m_pattern;
+        std::string m_tail;
+        off_t m_offset;
+        off_t m_match;
+};
+
+//}}}
+//{{{ IkconfigScanner ----------------------------------------------------------
+
+/**
+ * Finds the kernel configuration embedded with CONFIG_IKCONFIG in an
+ * uncompressed kernel image. The image is scanned in a single pass.
+ */
+class IkconfigScanner {
+
+    public:
+        /**
+         * Recommended size of the chunks passed to feed().
+         */
+        static const size_t BUFSIZE = 1 << 20;
+
+        /**
+         * Upper limit for the size of the embedded configuration.
+         */
+        static const size_t MAX_SIZE = 4 << 20;
+
+        IkconfigScanner();
+
+        /**
+         * Scans the next chunk of the kernel image.
+         *
+         * @param[in] data the chunk
+         * @param[in] len length of @p data
+         * @return @c true if the whole configuration has been found;
+         *         further data is ignored
+         * @exception KError if the end marker is not found within
+         *            MAX_SIZE bytes of the start marker
+         */
+        bool feed(const char *data, size_t len);
+
+        /**
+         * Returns @c true if the whole configuration has been found.
+         */
+        bool found() const
+        { return m_found; }
+
+        /**
+         * Returns the gzip data between the IKCFG_ST and IKCFG_ED markers.
+         */
+        const std::string &data() const
+        { return m_data; }
+
+    private:
+        PatternScanner m_start;
+        bool m_inside;
+        bool m_found;
+        std::string m_data;
+        size_t m_searched;
+};
+
+//}}}
+
+#endif /* IKCONFIG_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
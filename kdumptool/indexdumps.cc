@@ -0,0 +1,133 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "subcommand.h"
+#include "debug.h"
+#include "indexdumps.h"
+#include "dumpindex.h"
+#include "configuration.h"
+#include "rootdirurl.h"
+#include "fileutil.h"
+#include "stringutil.h"
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+//{{{ IndexDumps ---------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+IndexDumps::IndexDumps()
+    : m_force(false), m_noWrite(false)
+{
+    Debug::debug()->trace("IndexDumps::IndexDumps()");
+
+    m_options.push_back(new StringOption("root", 'R', &m_rootdir,
+        "Use the specified root directory instead of /"));
+    m_options.push_back(new FlagOption("force", 'f', &m_force,
+        "Read all dumps, even if the index is up to date"));
+    m_options.push_back(new FlagOption("dry-run", 'y', &m_noWrite,
+        "Don't write the index file, just print out the dumps"));
+}
+
+// -----------------------------------------------------------------------------
+const char *IndexDumps::getName() const
+{
+    return "index_dumps";
+}
+
+// -----------------------------------------------------------------------------
+bool IndexDumps::needsConfigfile() const
+{
+    return m_dirs.empty();
+}
+
+// -----------------------------------------------------------------------------
+void IndexDumps::parseArgs(const StringVector &args)
+{
+    Debug::debug()->trace(__FUNCTION__);
+
+    m_dirs = args;
+}
+
+// -----------------------------------------------------------------------------
+void IndexDumps::execute()
+{
+    Debug::debug()->trace("IndexDumps::execute()");
+
+    StringVector dirs = m_dirs;
+    if (dirs.empty()) {
+        Configuration *config = Configuration::config();
+        std::istringstream iss(config->KDUMP_SAVEDIR.value());
+        string elem;
+        while (iss >> elem) {
+            RootDirURL url(elem, m_rootdir);
+            if (url.getProtocol() != URLParser::PROT_FILE) {
+                cerr << "Skipping " << elem
+                     << ": dumps can be indexed only on local disk." << endl;
+                continue;
+            }
+            dirs.push_back(url.getRealPath());
+        }
+    }
+
+    vector<DumpIndex> indexes;
+    for (const auto &dir : dirs) {
+        FilePath fp(dir);
+        if (!fp.exists()) {
+            cerr << "Nothing to index in " << dir << "." << endl;
+            continue;
+        }
+        indexes.push_back(DumpIndex(fp));
+    }
+
+    unsigned count = DumpIndex::update(indexes, m_force);
+    Debug::debug()->dbg("Read %u dumps", count);
+
+    for (const auto &index : indexes) {
+        if (!m_noWrite)
+            index.write();
+
+        cout << index.getDir() << ":" << endl;
+        for (const auto &entry : index.getEntries()) {
+            cout << "  " << std::left << std::setw(24) << entry.name << " "
+                 << std::setw(20) << (entry.release.empty()
+                                      ? "-" : entry.release) << " "
+                 << std::setw(16) << (entry.crashtime
+                     ? StringUtil::formatUnixTime("%Y-%m-%d %H:%M",
+                                                  entry.crashtime)
+                     : "-") << " "
+                 << std::setw(9) << entry.format << " "
+                 << std::right << std::setw(3) << entry.parts << " "
+                 << std::setw(8) << bytes_to_megabytes(entry.size) << " MiB"
+                 << endl;
+        }
+    }
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,71 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef INDEXDUMPS_H
+#define INDEXDUMPS_H
+
+#include "subcommand.h"
+
+//{{{ IndexDumps ---------------------------------------------------------------
+
+/**
+ * Subcommand to update the catalog of saved dumps.
+ */
+class IndexDumps : public Subcommand {
+
+    public:
+        /**
+         * Creates a new IndexDumps object.
+         */
+        IndexDumps();
+
+    public:
+        /**
+         * Returns the name of the subcommand (index_dumps).
+         */
+        const char *getName() const;
+
+        /**
+         * The configuration is needed only if no directories are given.
+         */
+        bool needsConfigfile() const;
+
+        /**
+         * Parses the non-option arguments from the command line.
+         */
+        virtual void parseArgs(const StringVector &args);
+
+        /**
+         * Executes the function.
+         *
+         * @throw KError on any error. No exception indicates success.
+         */
+        void execute();
+
+    private:
+        std::string m_rootdir;
+        bool m_force;
+        bool m_noWrite;
+        StringVector m_dirs;
+};
+
+//}}}
+
+#endif /* INDEXDUMPS_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
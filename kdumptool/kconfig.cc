@@ -24,6 +24,7 @@
 #include <cstring>
 #include <memory>
 #include <cerrno>
+#include <algorithm>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -219,33 +220,36 @@ ostream& operator<<(ostream& os, const KconfigValue& v)
 //}}}
 //{{{ Kconfig ------------------------------------------------------------------
 
+// -----------------------------------------------------------------------------
+Kconfig::Kconfig()
+    : m_indexed(false)
+{ }
+
 // -----------------------------------------------------------------------------
 void Kconfig::readFromConfig(const string &configFile)
 {
     Debug::debug()->trace("Kconfig::readFromConfig(%s)", configFile.c_str());
 
     gzFile fp;
-    char line[BUFSIZ];
+    char buffer[BUFSIZ];
+    string text;
+    int len;
 
     fp = gzopen(configFile.c_str(), "r");
     if (!fp) {
         throw KError(string("Opening '") + configFile + string("' failed."));
     }
 
-    try {
-        while (gzgets(fp, line, BUFSIZ) != NULL) {
-            string name;
-            KconfigValue val = KconfigValue::fromString(line, name);
-            if (val.getType() != KconfigValue::T_INVALID) {
-                m_configs[name] = val;
-            }
-        }
-    } catch (...) {
-        gzclose(fp);
-        throw;
+    while ((len = gzread(fp, buffer, BUFSIZ)) > 0) {
+        text.append(buffer, len);
     }
-
     gzclose(fp);
+
+    if (len < 0) {
+        throw KError(string("Reading '") + configFile + string("' failed."));
+    }
+
+    readFromString(text);
 }
 
 // -----------------------------------------------------------------------------
@@ -253,17 +257,7 @@ void Kconfig::readFromKernel(const KernelTool &kt)
 {
     Debug::debug()->trace("Kconfig::readFromKernel(%s)", kt.toString().c_str());
 
-    stringstream ss;
-    ss << kt.extractKernelConfig();
-
-    string line;
-    while (getline(ss, line)) {
-        string name;
-        KconfigValue val = KconfigValue::fromString(line, name);
-        if (val.getType() != KconfigValue::T_INVALID) {
-            m_configs[name] = val;
-        }
-    }
+    readFromString(kt.extractKernelConfig());
 }
 
 // -----------------------------------------------------------------------------
@@ -271,15 +265,109 @@ void Kconfig::readFromKernel(const string &kernelImage)
 {
     Debug::debug()->trace("Kconfig::readFromKernel(%s)", kernelImage.c_str());
 
-    stringstream ss;
     KernelTool kt(kernelImage);
     return readFromKernel(kt);
 }
 
 // -----------------------------------------------------------------------------
-KconfigValue Kconfig::get(const string &option)
+void Kconfig::readFromString(const string &text)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // later lines override earlier ones, so just append
+    if (!m_text.empty() && m_text[m_text.size() - 1] != '\n')
+        m_text += '\n';
+    m_text += text;
+
+    m_index.clear();
+    m_indexed = false;
+}
+
+// -----------------------------------------------------------------------------
+void Kconfig::buildIndex() const
+{
+    const char *text = m_text.data();
+    size_t pos = 0, end = m_text.size();
+
+    while (pos < end) {
+        const char *eol = static_cast<const char *>(
+            memchr(text + pos, '\n', end - pos));
+        size_t lineEnd = eol ? eol - text : end;
+        size_t lineLen = lineEnd - pos;
+        const char *line = text + pos;
+
+        // the same rules as KconfigValue::fromString()
+        IndexEntry entry;
+        entry.line = pos;
+        entry.lineLen = lineLen;
+        entry.nameLen = 0;
+        if (lineLen > 2 && line[0] == '#') {
+            if (line[1] == ' ' && isalpha(line[2]) &&
+                memmem(line, lineLen, "is not set", 10)) {
+                const char *space = static_cast<const char *>(
+                    memchr(line + 2, ' ', lineLen - 2));
+                if (space) {
+                    entry.name = pos + 2;
+                    entry.nameLen = space - line - 2;
+                }
+            }
+        } else if (lineLen > 0 && line[0] != '#') {
+            const char *equal = static_cast<const char *>(
+                memchr(line, '=', lineLen));
+            if (equal) {
+                entry.name = pos;
+                entry.nameLen = equal - line;
+            }
+        }
+        if (entry.nameLen)
+            m_index.push_back(entry);
+
+        pos = lineEnd + 1;
+    }
+
+    // sort by name; among duplicates, the last line comes last
+    std::sort(m_index.begin(), m_index.end(),
+              [text](const IndexEntry &a, const IndexEntry &b) {
+                  int cmp = memcmp(text + a.name, text + b.name,
+                                   std::min(a.nameLen, b.nameLen));
+                  if (cmp != 0)
+                      return cmp < 0;
+                  if (a.nameLen != b.nameLen)
+                      return a.nameLen < b.nameLen;
+                  return a.line < b.line;
+              });
+
+    m_indexed = true;
+    Debug::debug()->dbg("Indexed %zu kernel config options", m_index.size());
+}
+
+// -----------------------------------------------------------------------------
+KconfigValue Kconfig::get(const string &option) const
 {
-    return m_configs[option];
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_indexed)
+        buildIndex();
+
+    const char *text = m_text.data();
+    auto it = std::upper_bound(m_index.begin(), m_index.end(), option,
+        [text](const string &name, const IndexEntry &e) {
+            int cmp = memcmp(name.data(), text + e.name,
+                             std::min(size_t(e.nameLen), name.size()));
+            if (cmp != 0)
+                return cmp < 0;
+            return name.size() < e.nameLen;
+        });
+    if (it == m_index.begin())
+        return KconfigValue();
+
+    --it;
+    if (option.compare(0, string::npos, text + it->name, it->nameLen) != 0)
+        return KconfigValue();
+
+    string name;
+    return KconfigValue::fromString(m_text.substr(it->line, it->lineLen),
+                                    name);
 }
 
 //}}}
@@ -21,6 +21,10 @@
 
 #include <iostream>
 #include <ctime>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <stdint.h>
 
 #include "global.h"
 #include "kerneltool.h"
@@ -141,11 +145,17 @@ std::ostream& operator<<(std::ostream& os, const KconfigValue& v);
 
 /**
  * Represents the kernel configuration (.config).
+ *
+ * The configuration is kept as raw text. An index of the option names
+ * is built on the first call to get(), and a value is parsed only when
+ * it is queried. All methods may be called from multiple threads.
  */
 class Kconfig {
 
     public:
 
+        Kconfig();
+
         /**
          * Deletes the Vmcoreinfo object.
          */
@@ -180,6 +190,14 @@ class Kconfig {
          */
         void readFromKernel(const KernelTool &kt);
 
+        /**
+         * Adds configuration in the .config format. Options which are
+         * already present are overridden.
+         *
+         * @param[in] text the configuration
+         */
+        void readFromString(const std::string &text);
+
         /**
          * Returns the configuration value for a specific option.
          *
@@ -189,11 +207,26 @@ class Kconfig {
          *            in the .config file.
          * @return the configuration option value, the function returns
          *         a KconfigValue with type T_INVALID.
+         * @exception KError if the line of the option is invalid
          */
-        KconfigValue get(const std::string &option);
+        KconfigValue get(const std::string &option) const;
+
+    protected:
+        void buildIndex() const;
 
     private:
-        std::map<std::string, KconfigValue> m_configs;
+        /**
+         * Location of one option in m_text.
+         */
+        struct IndexEntry {
+            uint32_t name, nameLen;
+            uint32_t line, lineLen;
+        };
+
+        std::string m_text;
+        mutable std::vector<IndexEntry> m_index;
+        mutable bool m_indexed;
+        mutable std::mutex m_mutex;
 };
 
 //}}}
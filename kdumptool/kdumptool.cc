@@ -30,6 +30,7 @@
 #include "util.h"
 #include "configuration.h"
 #include "optionparser.h"
+#include "kernelinfo.h"
 #include "config.h"
 
 using std::list;
@@ -58,7 +59,8 @@ static void close_file(int error, void *arg)
 // -----------------------------------------------------------------------------
 KdumpTool::KdumpTool()
     : m_subcommand(NULL), m_errorcode(false), m_background(false),
-      m_configfile(DEFAULT_CONFIG), m_kernel_cmdline()
+      m_configfile(DEFAULT_CONFIG), m_kernel_cmdline(),
+      m_cachedir(KernelInfo::DEFAULT_CACHE_DIR)
 {}
 
 // -----------------------------------------------------------------------------
@@ -102,6 +104,9 @@ void KdumpTool::parseCommandline(int argc, char *argv[])
     StringOption cmdlineOption(
         "cmdline", 'C', &m_kernel_cmdline,
         "Also parse kernel parameters from a given file (e.g. /proc/cmdline)");
+    StringOption cacheDirOption(
+        "cachedir", 'K', &m_cachedir,
+        "Cache kernel image properties in the specified directory");
 
     // add global options
     optionParser.addGlobalOption(&helpOption);
@@ -111,6 +116,7 @@ void KdumpTool::parseCommandline(int argc, char *argv[])
     optionParser.addGlobalOption(&logFileOption);
     optionParser.addGlobalOption(&configFileOption);
     optionParser.addGlobalOption(&cmdlineOption);
+    optionParser.addGlobalOption(&cacheDirOption);
 
     optionParser.addSubcommands(m_subcommandList);
 
@@ -136,6 +142,9 @@ void KdumpTool::parseCommandline(int argc, char *argv[])
     } else if (debugEnabled)
         Debug::debug()->setStderrLevel(Debug::DL_TRACE);
 
+    if (cacheDirOption.isSet())
+        KernelInfo::setCacheDir(m_cachedir);
+
     // get subcommand
     m_subcommand = optionParser.getSubcommand();
     if (!m_subcommand)
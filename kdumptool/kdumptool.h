@@ -86,6 +86,7 @@ class KdumpTool {
         bool m_background;
         std::string m_configfile;
         std::string m_kernel_cmdline;
+        std::string m_cachedir;
 };
 
 //}}}
@@ -0,0 +1,144 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "global.h"
+#include "debug.h"
+#include "kernelbatch.h"
+#include "fileutil.h"
+#include "stringutil.h"
+#include "parallel.h"
+
+using std::string;
+using std::vector;
+
+/**
+ * Maximum number of threads used to process the images.
+ */
+#define MAXTHREADS_BATCH 8
+
+//{{{ RegularFileFilter --------------------------------------------------------
+
+class RegularFileFilter : public ListDirFilter {
+
+    public:
+        virtual ~RegularFileFilter()
+        {}
+
+        bool test(int dirfd, const struct dirent *d) const
+        {
+            struct stat st;
+            if (d->d_name[0] == '.')
+                return false;
+            if (fstatat(dirfd, d->d_name, &st, 0) != 0)
+                return false;
+            return S_ISREG(st.st_mode);
+        }
+};
+
+//}}}
+//{{{ KernelBatch --------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+KernelBatch::KernelBatch(const StringVector &paths)
+{
+    for (const auto &path : paths) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            throw KSystemError("Cannot stat " + path, errno);
+
+        if (!S_ISDIR(st.st_mode)) {
+            m_images.push_back(path);
+            m_fromDir.push_back(false);
+            continue;
+        }
+
+        FilePath dir(path);
+        StringVector files = dir.listDir(RegularFileFilter());
+        for (const auto &name : files) {
+            FilePath file(dir);
+            file.appendPath(name);
+            m_images.push_back(file);
+            m_fromDir.push_back(true);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+string KernelBatch::errorRecord(const string &image, const string &message)
+{
+    return "{\"image\": " + StringUtil::jsonString(image) +
+        ", \"error\": " + StringUtil::jsonString(message) + "}";
+}
+
+// -----------------------------------------------------------------------------
+unsigned KernelBatch::run(const Handler &handler, std::ostream &os)
+{
+    struct Result {
+        string record;
+        bool error;
+        bool skip;
+    };
+    vector<Result> results(m_images.size(), Result{ string(), false, false });
+
+    ParallelFor pool(m_images.size(), MAXTHREADS_BATCH,
+                     [this, &handler, &results](size_t i) {
+        Result &r = results[i];
+        try {
+            r.record = handler(m_images[i]);
+            if (r.record.empty()) {
+                if (m_fromDir[i]) {
+                    Debug::debug()->dbg("Skipping %s: not a kernel image",
+                                        m_images[i].c_str());
+                    r.skip = true;
+                } else {
+                    r.record = errorRecord(m_images[i],
+                        "The specified file is not a kernel image.");
+                    r.error = true;
+                }
+            }
+        } catch (const std::exception &e) {
+            r.record = errorRecord(m_images[i], e.what());
+            r.error = true;
+        }
+    });
+
+    // write the records in input order
+    unsigned errors = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        pool.wait(i);
+        if (results[i].error)
+            ++errors;
+        if (results[i].skip)
+            continue;
+        os << results[i].record << std::endl;
+    }
+    pool.join();
+
+    return errors;
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
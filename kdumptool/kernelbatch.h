@@ -0,0 +1,97 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef KERNELBATCH_H
+#define KERNELBATCH_H
+
+#include <string>
+#include <ostream>
+#include <functional>
+#include <vector>
+
+#include "global.h"
+#include "stringvector.h"
+
+//{{{ KernelBatch --------------------------------------------------------------
+
+/**
+ * Processes a list of kernel images in parallel.
+ *
+ * Each image produces one record (a single line of JSON). The records
+ * are written in the order of the input list, each as soon as it and
+ * all its predecessors are complete.
+ */
+class KernelBatch {
+
+    public:
+        /**
+         * Function that creates the record for one image.
+         *
+         * It returns an empty string if the image is not a kernel.
+         */
+        typedef std::function<std::string(const std::string &image)> Handler;
+
+        /**
+         * Creates the list of images.
+         *
+         * Directories are replaced by the regular files found in them
+         * (in alphabetical order). The files are not examined here;
+         * see run() for files which are not a kernel.
+         *
+         * @param[in] paths kernel images and/or directories
+         * @exception KError if a path does not exist
+         */
+        KernelBatch(const StringVector &paths);
+
+        /**
+         * Returns the expanded list of kernel images.
+         */
+        const StringVector &getImages() const
+        { return m_images; }
+
+        /**
+         * Runs @p handler for all images and writes the records to @p os.
+         *
+         * If the handler throws an exception, an error record of the
+         * form {"image": ..., "error": ...} is written instead. If the
+         * handler finds that the image is not a kernel, the image is
+         * skipped if it was found in a directory, and an error record
+         * is written if it was given explicitly.
+         *
+         * @param[in] handler record generator
+         * @param[in] os output stream
+         * @return the number of images which produced an error record
+         */
+        unsigned run(const Handler &handler, std::ostream &os);
+
+        /**
+         * Returns the error record for an image.
+         */
+        static std::string errorRecord(const std::string &image,
+                                       const std::string &message);
+
+    private:
+        StringVector m_images;
+        std::vector<bool> m_fromDir;
+};
+
+//}}}
+
+#endif /* KERNELBATCH_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,376 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kernelinfo.h"
+#include "debug.h"
+#include "stringutil.h"
+
+using std::string;
+using std::ifstream;
+using std::ofstream;
+using std::ostringstream;
+
+/**
+ * First line of a cache file. Bump the version whenever the format
+ * or the meaning of any field changes, so stale entries are recomputed.
+ */
+#define CACHE_HEADER    "# kdump kernel info 3"
+
+/**
+ * Prefix of a cached kernel configuration line.
+ */
+#define KCONFIG_PREFIX  "kconfig "
+
+//{{{ KernelInfo ---------------------------------------------------------------
+
+const char KernelInfo::DEFAULT_CACHE_DIR[] = "/var/cache/kdump/kernels";
+
+const char *const KernelInfo::CONFIG_OPTIONS[] = {
+    "CONFIG_X86_64_XEN",
+    "CONFIG_X86_XEN",
+    "CONFIG_NR_CPUS",
+    "CONFIG_PREEMPT_RT",
+    "CONFIG_RELOCATABLE",
+    NULL
+};
+
+string KernelInfo::s_cacheDir = KernelInfo::DEFAULT_CACHE_DIR;
+
+// -----------------------------------------------------------------------------
+static string configLine(const string &name, const KconfigValue &value)
+{
+    ostringstream ss;
+
+    switch (value.getType()) {
+        case KconfigValue::T_INTEGER:
+            ss << name << "=" << value.getIntValue();
+            break;
+
+        case KconfigValue::T_STRING:
+            ss << name << "=\"" << value.getStringValue() << "\"";
+            break;
+
+        case KconfigValue::T_TRISTATE:
+            switch (value.getTristateValue()) {
+                case KconfigValue::ON:
+                    ss << name << "=y";
+                    break;
+                case KconfigValue::MODULE:
+                    ss << name << "=m";
+                    break;
+                case KconfigValue::OFF:
+                    ss << "# " << name << " is not set";
+                    break;
+            }
+            break;
+
+        case KconfigValue::T_INVALID:
+            break;
+    }
+
+    return ss.str();
+}
+
+// -----------------------------------------------------------------------------
+static string oneLine(string msg)
+{
+    for (string::iterator it = msg.begin(); it != msg.end(); ++it)
+        if (*it == '\n')
+            *it = ' ';
+    return msg;
+}
+
+// -----------------------------------------------------------------------------
+KernelInfo::KernelInfo(const string &image)
+    : m_image(image), m_cached(false),
+      m_haveType(false), m_type(KernelTool::KT_NONE),
+      m_haveRelocatable(false), m_relocatable(false),
+      m_haveConfig(false)
+{
+    struct stat st;
+    if (stat(image.c_str(), &st) != 0)
+        throw KSystemError("Cannot stat " + image, errno);
+
+    m_dev = st.st_dev;
+    m_ino = st.st_ino;
+    m_size = st.st_size;
+
+    ostringstream ss;
+    ss << st.st_mtim.tv_sec << "." << st.st_mtim.tv_nsec;
+    m_mtime = ss.str();
+
+    m_cached = load();
+    Debug::debug()->dbg("%s: kernel info %s", image.c_str(),
+                        m_cached ? "cached" : "not cached");
+}
+
+// -----------------------------------------------------------------------------
+void KernelInfo::setCacheDir(const string &dir)
+{
+    s_cacheDir = dir;
+}
+
+// -----------------------------------------------------------------------------
+FilePath KernelInfo::cacheFile() const
+{
+    ostringstream ss;
+    ss << std::hex << "kernel-" << m_dev << "-" << m_ino;
+
+    FilePath path = s_cacheDir;
+    return path.appendPath(ss.str());
+}
+
+// -----------------------------------------------------------------------------
+KernelTool &KernelInfo::tool()
+{
+    if (!m_tool)
+        m_tool.reset(new KernelTool(m_image));
+    return *m_tool;
+}
+
+// -----------------------------------------------------------------------------
+KernelTool::KernelType KernelInfo::getKernelType()
+{
+    if (!m_haveType) {
+        m_type = tool().getKernelType();
+        m_haveType = true;
+        store();
+    }
+    return m_type;
+}
+
+// -----------------------------------------------------------------------------
+string KernelInfo::getArch()
+{
+    if (m_arch.empty()) {
+        m_arch = tool().getKernelArch();
+        store();
+    }
+    return m_arch;
+}
+
+// -----------------------------------------------------------------------------
+bool KernelInfo::isRelocatable()
+{
+    if (!m_haveRelocatable) {
+        try {
+            m_relocatable = tool().isRelocatable();
+        } catch (const KSystemError &) {
+            // I/O errors may be transient; do not remember them
+            throw;
+        } catch (const KError &e) {
+            m_relocatableError = oneLine(e.what());
+        }
+        m_haveRelocatable = true;
+        store();
+    }
+
+    if (!m_relocatableError.empty())
+        throw KError(m_relocatableError);
+    return m_relocatable;
+}
+
+// -----------------------------------------------------------------------------
+KconfigValue KernelInfo::getConfig(const string &option)
+{
+    const char *const *p;
+    for (p = CONFIG_OPTIONS; *p; ++p)
+        if (option == *p)
+            break;
+    bool cachedOption = (*p != NULL);
+
+    if (!m_haveConfig) {
+        try {
+            std::shared_ptr<const Kconfig> kconfig = tool().retrieveKernelConfig();
+            for (p = CONFIG_OPTIONS; *p; ++p) {
+                string line = configLine(*p, kconfig->get(*p));
+                if (!line.empty())
+                    m_config[*p] = line;
+            }
+        } catch (const KSystemError &) {
+            throw;
+        } catch (const KError &e) {
+            m_configError = oneLine(e.what());
+        }
+        m_haveConfig = true;
+        store();
+    }
+
+    if (!m_configError.empty())
+        throw KError(m_configError);
+
+    if (!cachedOption)
+        return tool().retrieveKernelConfig()->get(option);
+
+    std::map<string, string>::const_iterator it = m_config.find(option);
+    if (it == m_config.end())
+        return KconfigValue();
+
+    string name;
+    return KconfigValue::fromString(it->second, name);
+}
+
+// -----------------------------------------------------------------------------
+bool KernelInfo::load()
+{
+    if (s_cacheDir.empty())
+        return false;
+
+    ifstream fin(cacheFile().c_str());
+    if (!fin)
+        return false;
+
+    string line;
+    if (!getline(fin, line) || line != CACHE_HEADER)
+        return false;
+
+    bool sizeOk = false, mtimeOk = false;
+    try {
+        while (getline(fin, line)) {
+            if (line.compare(0, sizeof(KCONFIG_PREFIX) - 1,
+                             KCONFIG_PREFIX) == 0) {
+                string value = line.substr(sizeof(KCONFIG_PREFIX) - 1);
+                string name;
+                KconfigValue kv = KconfigValue::fromString(value, name);
+                if (kv.getType() != KconfigValue::T_INVALID)
+                    m_config[name] = value;
+                continue;
+            }
+
+            string::size_type eq = line.find('=');
+            if (eq == string::npos)
+                continue;
+            string key = line.substr(0, eq);
+            KString value = line.substr(eq + 1);
+
+            if (key == "size") {
+                if (strtoll(value.c_str(), NULL, 10) != m_size)
+                    return false;
+                sizeOk = true;
+            } else if (key == "mtime") {
+                if (value != m_mtime)
+                    return false;
+                mtimeOk = true;
+            } else if (key == "type") {
+                m_type = static_cast<KernelTool::KernelType>(value.asInt());
+                m_haveType = true;
+            } else if (key == "arch") {
+                m_arch = value;
+            } else if (key == "relocatable") {
+                m_relocatable = value.asInt() != 0;
+                m_haveRelocatable = true;
+            } else if (key == "relocatable_error") {
+                m_relocatableError = value;
+                m_haveRelocatable = true;
+            } else if (key == "config") {
+                m_haveConfig = true;
+            } else if (key == "config_error") {
+                m_configError = value;
+                m_haveConfig = true;
+            }
+        }
+    } catch (const KError &e) {
+        Debug::debug()->dbg("Ignoring bad cache file %s: %s",
+                            cacheFile().c_str(), e.what());
+        sizeOk = false;
+    }
+
+    if (!sizeOk || !mtimeOk) {
+        m_haveType = m_haveRelocatable = m_haveConfig = false;
+        m_arch.clear();
+        m_relocatableError.clear();
+        m_configError.clear();
+        m_config.clear();
+        return false;
+    }
+
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+void KernelInfo::store()
+{
+    if (s_cacheDir.empty())
+        return;
+
+    FilePath path = cacheFile();
+    // several threads may update the same file in batch mode
+    ostringstream tmpName;
+    tmpName << path << ".tmp." << getpid() << "." << std::this_thread::get_id();
+    FilePath tmp = tmpName.str();
+
+    try {
+        FilePath dir = s_cacheDir;
+        if (!dir.exists())
+            dir.mkdir(true);
+
+        {
+            ofstream fout(tmp.c_str());
+            if (!fout)
+                throw KSystemError("Cannot create " + tmp, errno);
+
+            fout << CACHE_HEADER << "\n";
+            fout << "size=" << m_size << "\n";
+            fout << "mtime=" << m_mtime << "\n";
+            if (m_haveType)
+                fout << "type=" << int(m_type) << "\n";
+            if (!m_arch.empty())
+                fout << "arch=" << m_arch << "\n";
+            if (m_haveRelocatable) {
+                if (m_relocatableError.empty())
+                    fout << "relocatable=" << int(m_relocatable) << "\n";
+                else
+                    fout << "relocatable_error=" << m_relocatableError << "\n";
+            }
+            if (m_haveConfig) {
+                if (m_configError.empty()) {
+                    fout << "config=1\n";
+                    std::map<string, string>::const_iterator it;
+                    for (it = m_config.begin(); it != m_config.end(); ++it)
+                        fout << KCONFIG_PREFIX << it->second << "\n";
+                } else
+                    fout << "config_error=" << m_configError << "\n";
+            }
+
+            fout.close();
+            if (!fout)
+                throw KSystemError("Cannot write " + tmp, errno);
+        }
+
+        if (rename(tmp.c_str(), path.c_str()) != 0)
+            throw KSystemError("Cannot rename " + tmp, errno);
+    } catch (const KError &e) {
+        // the cache is only an optimization
+        unlink(tmp.c_str());
+        Debug::debug()->dbg("Cannot update kernel info cache: %s", e.what());
+    }
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,141 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef KERNELINFO_H
+#define KERNELINFO_H
+
+#include <string>
+#include <map>
+#include <memory>
+#include <sys/types.h>
+
+#include "global.h"
+#include "fileutil.h"
+#include "kerneltool.h"
+#include "kconfig.h"
+
+//{{{ KernelInfo ---------------------------------------------------------------
+
+/**
+ * Kernel image metadata with a persistent cache.
+ *
+ * Finding out whether a kernel is suitable for kdump requires reading
+ * (and often decompressing) the whole image. The results are stored in
+ * a small file per image, keyed by device and inode number, and reused
+ * as long as the size and modification time of the image do not change.
+ * Each property is computed only when it is first needed.
+ */
+class KernelInfo {
+
+    public:
+        /**
+         * Default directory for the cache files.
+         */
+        static const char DEFAULT_CACHE_DIR[];
+
+        /**
+         * NULL-terminated list of configuration options that are kept
+         * in the cache.
+         */
+        static const char *const CONFIG_OPTIONS[];
+
+        /**
+         * Looks up the metadata of a kernel image.
+         *
+         * @param[in] image path to the kernel image
+         * @exception KSystemError if the image cannot be stat'ed
+         */
+        KernelInfo(const std::string &image);
+
+        /**
+         * Sets the cache directory. An empty path disables the cache.
+         */
+        static void setCacheDir(const std::string &dir);
+
+        /**
+         * Returns the kernel type, see KernelTool::getKernelType().
+         */
+        KernelTool::KernelType getKernelType();
+
+        /**
+         * Checks if the kernel is relocatable, see
+         * KernelTool::isRelocatable().
+         *
+         * @exception KError if the relocatability cannot be determined
+         */
+        bool isRelocatable();
+
+        /**
+         * Returns the architecture of the kernel, see
+         * KernelTool::getKernelArch().
+         */
+        std::string getArch();
+
+        /**
+         * Returns the value of a kernel configuration option.
+         * Options that are not in CONFIG_OPTIONS are looked up in the
+         * kernel configuration every time and never stored in the cache.
+         *
+         * @param[in] option name of the option, e.g. "CONFIG_NR_CPUS"
+         * @return the value (T_INVALID if the option is not set at all)
+         * @exception KError if the kernel configuration is not available
+         */
+        KconfigValue getConfig(const std::string &option);
+
+        /**
+         * Returns true if the metadata was found in the cache.
+         */
+        bool isCached() const
+        { return m_cached; }
+
+    protected:
+        FilePath cacheFile() const;
+        KernelTool &tool();
+        bool load();
+        void store();
+
+    private:
+        std::string m_image;
+        dev_t m_dev;
+        ino_t m_ino;
+        off_t m_size;
+        std::string m_mtime;
+        bool m_cached;
+        std::unique_ptr<KernelTool> m_tool;
+
+        bool m_haveType;
+        KernelTool::KernelType m_type;
+
+        std::string m_arch;
+
+        bool m_haveRelocatable;
+        bool m_relocatable;
+        std::string m_relocatableError;
+
+        bool m_haveConfig;
+        std::string m_configError;
+        std::map<std::string, std::string> m_config;
+
+        static std::string s_cacheDir;
+};
+
+//}}}
+
+#endif /* KERNELINFO_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
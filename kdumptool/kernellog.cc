@@ -0,0 +1,352 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+
+#include "global.h"
+#include "debug.h"
+#include "kernellog.h"
+#include "vmcore.h"
+#include "vmcoreinfo.h"
+#include "stringutil.h"
+
+using std::string;
+using std::vector;
+
+// Descriptor states of the lockless ring buffer (kernel/printk_ringbuffer.h)
+#define DESC_COMMITTED          1
+#define DESC_FINALIZED          2
+
+// Sanity limit for buffer sizes read from the dump
+#define MAX_LOG_BUF_SIZE        (1UL << 30)
+
+// -----------------------------------------------------------------------------
+static uint64_t get_long(const char *p, size_t size)
+{
+    if (size == 8) {
+        uint64_t val;
+        memcpy(&val, p, sizeof val);
+        return val;
+    } else {
+        uint32_t val;
+        memcpy(&val, p, sizeof val);
+        return val;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static uint64_t get_u64(const char *p)
+{
+    uint64_t val;
+    memcpy(&val, p, sizeof val);
+    return val;
+}
+
+// -----------------------------------------------------------------------------
+static uint32_t get_u32(const char *p)
+{
+    uint32_t val;
+    memcpy(&val, p, sizeof val);
+    return val;
+}
+
+// -----------------------------------------------------------------------------
+static uint16_t get_u16(const char *p)
+{
+    uint16_t val;
+    memcpy(&val, p, sizeof val);
+    return val;
+}
+
+// -----------------------------------------------------------------------------
+static void check_bounds(size_t off, size_t len, size_t size)
+{
+    if (off > size || len > size - off)
+        throw KError("Kernel log record out of bounds.");
+}
+
+// -----------------------------------------------------------------------------
+static void append_record(string &out, uint64_t ts_nsec,
+                          const char *text, size_t len)
+{
+    char buf[64];
+
+    snprintf(buf, sizeof buf, "[%5llu.%06lu] ",
+             (unsigned long long)(ts_nsec / 1000000000ULL),
+             (unsigned long)(ts_nsec % 1000000000ULL / 1000));
+    out += buf;
+
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = text[i];
+        if (isprint(c) || isspace(c))
+            out += c;
+        else {
+            snprintf(buf, sizeof buf, "\\x%02x", c);
+            out += buf;
+        }
+    }
+    out += '\n';
+}
+
+//{{{ KernelLog ----------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+bool KernelLog::hasKey(const string &key) const
+{
+    return m_info.hasKey(key.c_str());
+}
+
+// -----------------------------------------------------------------------------
+uint64_t KernelLog::symbol(const char *name) const
+{
+    return m_info.symbol(name);
+}
+
+// -----------------------------------------------------------------------------
+unsigned long KernelLog::offset(const char *name) const
+{
+    return m_info.offset(name);
+}
+
+// -----------------------------------------------------------------------------
+unsigned long KernelLog::size(const char *name) const
+{
+    return m_info.size(name);
+}
+
+// -----------------------------------------------------------------------------
+string KernelLog::dump()
+{
+    Debug::debug()->trace("KernelLog::dump()");
+
+    if (hasKey("SYMBOL(prb)"))
+        return dumpLockless();
+    else if (hasKey("SIZE(printk_log)") || hasKey("SIZE(log)"))
+        return dumpRecords();
+    else if (hasKey("SYMBOL(log_end)"))
+        return dumpPlain();
+
+    throw KError("VMCOREINFO does not describe the kernel log buffer.");
+}
+
+// -----------------------------------------------------------------------------
+string KernelLog::dumpLockless()
+{
+    Debug::debug()->trace("KernelLog::dumpLockless()");
+
+    size_t longsz = hasKey("SIZE(long)")
+        ? size("long")
+        : m_vmcore.pointerSize();
+    unsigned long counter = offset("atomic_long_t.counter");
+
+    uint64_t rb = m_vmcore.readPointer(symbol("prb"));
+    uint64_t desc_ring = rb + offset("printk_ringbuffer.desc_ring");
+    uint64_t text_ring = rb + offset("printk_ringbuffer.text_data_ring");
+
+    vector<char> buf(size("prb_desc_ring"));
+    m_vmcore.readVirt(desc_ring, buf.data(), buf.size());
+    unsigned count_bits = get_u32(&buf[offset("prb_desc_ring.count_bits")]);
+    uint64_t descs_addr = get_long(&buf[offset("prb_desc_ring.descs")], longsz);
+    uint64_t infos_addr = get_long(&buf[offset("prb_desc_ring.infos")], longsz);
+    uint64_t head_id = get_long(
+        &buf[offset("prb_desc_ring.head_id") + counter], longsz);
+    uint64_t tail_id = get_long(
+        &buf[offset("prb_desc_ring.tail_id") + counter], longsz);
+
+    buf.resize(size("prb_data_ring"));
+    m_vmcore.readVirt(text_ring, buf.data(), buf.size());
+    unsigned size_bits = get_u32(&buf[offset("prb_data_ring.size_bits")]);
+    uint64_t data_addr = get_long(&buf[offset("prb_data_ring.data")], longsz);
+
+    if (count_bits >= 8 * longsz || size_bits >= 8 * longsz)
+        throw KError("Invalid printk ring buffer size.");
+
+    size_t desc_count = size_t(1) << count_bits;
+    size_t data_size = size_t(1) << size_bits;
+    size_t desc_size = size("prb_desc");
+    size_t info_size = size("printk_info");
+    if (!desc_size || !info_size)
+        throw KError("Invalid printk ring buffer descriptor size.");
+    if (data_size > MAX_LOG_BUF_SIZE ||
+        desc_count > MAX_LOG_BUF_SIZE / desc_size ||
+        desc_count > MAX_LOG_BUF_SIZE / info_size)
+        throw KError("printk ring buffer is too large.");
+
+    Debug::debug()->dbg("printk ring buffer: %zu descriptors, %zu data bytes",
+                        desc_count, data_size);
+
+    vector<char> descs(desc_count * desc_size);
+    m_vmcore.readVirt(descs_addr, descs.data(), descs.size());
+    vector<char> infos(desc_count * info_size);
+    m_vmcore.readVirt(infos_addr, infos.data(), infos.size());
+    vector<char> data(data_size);
+    m_vmcore.readVirt(data_addr, data.data(), data.size());
+
+    unsigned long off_state = offset("prb_desc.state_var") + counter;
+    unsigned long off_text_blk = offset("prb_desc.text_blk_lpos");
+    unsigned long off_begin = offset("prb_data_blk_lpos.begin");
+    unsigned long off_next = offset("prb_data_blk_lpos.next");
+    unsigned long off_ts = offset("printk_info.ts_nsec");
+    unsigned long off_text_len = offset("printk_info.text_len");
+
+    unsigned sv_bits = 8 * longsz;
+    uint64_t id_mask = (sv_bits == 64 ? ~0ULL : (1ULL << sv_bits) - 1) >> 2;
+    uint64_t lpos_mask = sv_bits == 64 ? ~0ULL : (1ULL << sv_bits) - 1;
+
+    string out;
+    uint64_t id = tail_id & id_mask;
+    for (size_t n = 0; n < desc_count; ++n, id = (id + 1) & id_mask) {
+        size_t idx = id & (desc_count - 1);
+        const char *desc = &descs[idx * desc_size];
+        const char *info = &infos[idx * info_size];
+
+        uint64_t sv = get_long(desc + off_state, longsz);
+        unsigned state = (sv >> (sv_bits - 2)) & 3;
+        if ((sv & id_mask) == id &&
+            (state == DESC_COMMITTED || state == DESC_FINALIZED)) {
+
+            uint64_t begin = get_long(desc + off_text_blk + off_begin, longsz);
+            uint64_t next = get_long(desc + off_text_blk + off_next, longsz);
+
+            // data-less records have both positions odd
+            if (!((begin & 1) && (next & 1))) {
+                const char *text = NULL;
+                size_t len = 0;
+
+                if ((begin >> size_bits) == (next >> size_bits) &&
+                    begin < next) {
+                    text = &data[begin & (data_size - 1)];
+                    len = next - begin;
+                } else if ((((begin + data_size) & lpos_mask) >> size_bits) ==
+                           (next >> size_bits)) {
+                    text = &data[0];
+                    len = next & (data_size - 1);
+                }
+
+                // skip the block ID
+                if (text && len >= longsz) {
+                    text += longsz;
+                    len -= longsz;
+                    size_t text_len = get_u16(info + off_text_len);
+                    if (text_len < len)
+                        len = text_len;
+                    check_bounds(text - &data[0], len, data_size);
+                    append_record(out, get_u64(info + off_ts), text, len);
+                }
+            }
+        }
+
+        if (id == (head_id & id_mask))
+            break;
+    }
+
+    return out;
+}
+
+// -----------------------------------------------------------------------------
+string KernelLog::dumpRecords()
+{
+    Debug::debug()->trace("KernelLog::dumpRecords()");
+
+    // the structure was called "struct log" before Linux 3.11
+    string prefix = hasKey("SIZE(printk_log)") ? "printk_log" : "log";
+    size_t hdr_size = size(prefix.c_str());
+    if (!hdr_size)
+        throw KError("Invalid printk record size.");
+    unsigned long off_ts = offset((prefix + ".ts_nsec").c_str());
+    unsigned long off_len = offset((prefix + ".len").c_str());
+    unsigned long off_text_len = offset((prefix + ".text_len").c_str());
+
+    uint64_t log_buf = m_vmcore.readPointer(symbol("log_buf"));
+    uint32_t log_buf_len = m_vmcore.readU32(symbol("log_buf_len"));
+    uint32_t idx = m_vmcore.readU32(symbol("log_first_idx"));
+    uint32_t next_idx = m_vmcore.readU32(symbol("log_next_idx"));
+
+    if (log_buf_len > MAX_LOG_BUF_SIZE)
+        throw KError("Kernel log buffer is too large.");
+
+    Debug::debug()->dbg("printk log buffer: %u bytes", log_buf_len);
+
+    vector<char> buf(log_buf_len);
+    m_vmcore.readVirt(log_buf, buf.data(), buf.size());
+
+    string out;
+    size_t nrec = 0;
+    while (idx != next_idx) {
+        // every record is at least one header long
+        if (++nrec > buf.size() / hdr_size + 1)
+            throw KError("Kernel log records form a loop.");
+
+        check_bounds(idx, hdr_size, buf.size());
+        const char *rec = &buf[idx];
+
+        // a zero length record means wrap-around
+        uint16_t len = get_u16(rec + off_len);
+        if (!len) {
+            if (!idx)
+                break;
+            idx = 0;
+            continue;
+        }
+
+        size_t text_len = get_u16(rec + off_text_len);
+        check_bounds(idx + hdr_size, text_len, buf.size());
+        append_record(out, get_u64(rec + off_ts), rec + hdr_size, text_len);
+
+        idx += len;
+        if (idx >= buf.size())
+            throw KError("Kernel log record out of bounds.");
+    }
+
+    return out;
+}
+
+// -----------------------------------------------------------------------------
+string KernelLog::dumpPlain()
+{
+    Debug::debug()->trace("KernelLog::dumpPlain()");
+
+    uint64_t log_buf = m_vmcore.readPointer(symbol("log_buf"));
+    uint32_t log_buf_len = m_vmcore.readU32(symbol("log_buf_len"));
+    uint32_t log_end = m_vmcore.readU32(symbol("log_end"));
+
+    if (!log_buf_len || log_buf_len > MAX_LOG_BUF_SIZE)
+        throw KError("Invalid kernel log buffer size.");
+
+    vector<char> buf(log_buf_len);
+    m_vmcore.readVirt(log_buf, buf.data(), buf.size());
+
+    string out;
+    if (log_end < log_buf_len)
+        out.assign(buf.begin(), buf.begin() + log_end);
+    else {
+        size_t start = log_end % log_buf_len;
+        out.assign(buf.begin() + start, buf.end());
+        out.append(buf.begin(), buf.begin() + start);
+    }
+    return out;
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,85 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef KERNELLOG_H
+#define KERNELLOG_H
+
+#include <stdint.h>
+#include <string>
+
+#include "global.h"
+
+class Vmcore;
+class Vmcoreinfo;
+
+//{{{ KernelLog ----------------------------------------------------------------
+
+/**
+ * Extracts the kernel log buffer (dmesg) from a dump.
+ *
+ * The printk buffer is located using VMCOREINFO and read directly from
+ * the dump. Three buffer formats are supported:
+ *
+ *  - the lockless ring buffer (Linux 5.10 and later),
+ *  - variable-length records (struct printk_log, Linux 3.5 to 5.9),
+ *  - the plain character buffer of older kernels.
+ *
+ * The output format is the same as "makedumpfile --dump-dmesg".
+ */
+class KernelLog {
+
+    public:
+        /**
+         * Creates a new KernelLog object.
+         *
+         * @param[in] vmcore dump file to read memory from
+         * @param[in] info VMCOREINFO of the dump
+         */
+        KernelLog(Vmcore &vmcore, const Vmcoreinfo &info)
+            : m_vmcore(vmcore), m_info(info)
+        { }
+
+        /**
+         * Reads and formats the kernel log.
+         *
+         * @return the kernel log as text
+         * @exception KError if VMCOREINFO lacks the necessary symbols
+         *            or the log buffer cannot be read
+         */
+        std::string dump();
+
+    protected:
+        std::string dumpLockless();
+        std::string dumpRecords();
+        std::string dumpPlain();
+
+        uint64_t symbol(const char *name) const;
+        unsigned long offset(const char *name) const;
+        unsigned long size(const char *name) const;
+        bool hasKey(const std::string &key) const;
+
+    private:
+        Vmcore &m_vmcore;
+        const Vmcoreinfo &m_info;
+};
+
+//}}}
+
+#endif /* KERNELLOG_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -22,9 +22,12 @@
 #include <memory>
 #include <sstream>
 #include <list>
+#include <map>
+#include <mutex>
 
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <endian.h>
 
@@ -38,6 +41,8 @@
 #include "debug.h"
 #include "stringutil.h"
 #include "fileutil.h"
+#include "ikconfig.h"
+#include "decompress.h"
 #include "kconfig.h"
 #include "kernelpath.h"
 
@@ -53,6 +58,12 @@ using std::list;
 #define X86_HEADER_OFF_RELOCATABLE  0x0234
 #define X86_HEADER_OFF_MAGIC        0x53726448
 #define X86_HEADER_RELOCATABLE_VER  0x0205
+#define X86_HEADER_OFF_SETUP_SECTS  0x01f1
+#define X86_HEADER_OFF_PAYLOAD      0x0248
+#define X86_HEADER_PAYLOAD_VER      0x0208
+#define X86_HEADER_OFF_XLOADFLAGS   0x0236
+#define X86_HEADER_XLOADFLAGS_VER   0x020c
+#define X86_XLF_KERNEL_64           0x0001
 
 /* S/390 VM boot image */
 #define S390_HEADER_OFF_IPLSTART    4
@@ -90,13 +101,6 @@ static const unsigned char S390_HEADER[] = {
   0x02, 0x00, 0x06, 0xe0, 0x20, 0x00, 0x00, 0x50,
 };
 
-#define MAGIC_START         "IKCFG_ST"
-#define MAGIC_END           "IKCFG_ED"
-#define MAGIC_LEN           8
-
-const static unsigned char magic_start[] = MAGIC_START;
-const static unsigned char magic_end[] = MAGIC_END;
-
 // -----------------------------------------------------------------------------
 KernelTool::KernelTool(const std::string &image)
     : m_kernel(image), m_fd(-1)
@@ -120,10 +124,25 @@ KernelTool::~KernelTool()
 KernelTool::KernelType KernelTool::getKernelType() const
 {
     if (Util::isElfFile(m_fd)) {
-        if (Util::isGzipFile(m_fd))
-            return KT_ELF_GZ;
-        else
-            return KT_ELF;
+        unsigned char magic[Decompressor::MAGIC_SIZE];
+        ssize_t ret = pread(m_fd, magic, sizeof magic, 0);
+        if (ret < 0) {
+            throw KSystemError("Cannot read " + m_kernel, errno);
+        }
+
+        switch (Decompressor::detect(magic, ret)) {
+            case Decompressor::FMT_GZIP:
+                return KT_ELF_GZ;
+            case Decompressor::FMT_XZ:
+                return KT_ELF_XZ;
+            case Decompressor::FMT_ZSTD:
+                return KT_ELF_ZSTD;
+            case Decompressor::FMT_LZ4:
+            case Decompressor::FMT_LZ4_LEGACY:
+                return KT_ELF_LZ4;
+            default:
+                return KT_ELF;
+        }
     } else if (Util::isX86(Util::getArch())) {
         if (isX86Kernel())
             return KT_X86;
@@ -149,6 +168,9 @@ bool KernelTool::isRelocatable() const
     switch (getKernelType()) {
         case KernelTool::KT_ELF:
         case KernelTool::KT_ELF_GZ:
+        case KernelTool::KT_ELF_XZ:
+        case KernelTool::KT_ELF_ZSTD:
+        case KernelTool::KT_ELF_LZ4:
             return elfIsRelocatable();
 
         case KernelTool::KT_X86:
@@ -167,6 +189,56 @@ bool KernelTool::isRelocatable() const
     }
 }
 
+// -----------------------------------------------------------------------------
+string KernelTool::getKernelArch() const
+{
+    switch (getKernelType()) {
+        case KernelTool::KT_ELF:
+        case KernelTool::KT_ELF_GZ:
+        case KernelTool::KT_ELF_XZ:
+        case KernelTool::KT_ELF_ZSTD:
+        case KernelTool::KT_ELF_LZ4:
+            return archFromElfMachine(elfMachine());
+
+        case KernelTool::KT_X86:
+            return x86Arch();
+
+        case KernelTool::KT_S390:
+            return "s390x";
+
+        case KernelTool::KT_AARCH64:
+            return "aarch64";
+
+        default:
+            return "unknown";
+    }
+}
+
+// -----------------------------------------------------------------------------
+string KernelTool::x86Arch() const
+{
+    unsigned char hdr[X86_HEADER_OFF_XLOADFLAGS + 2];
+
+    ssize_t ret = pread(m_fd, hdr, sizeof hdr, 0);
+    if (ret < 0) {
+        throw KSystemError("Cannot read " + m_kernel, errno);
+    }
+    if (size_t(ret) < sizeof hdr) {
+        return "x86";
+    }
+
+    // boot protocol 2.12+ tells if this is a 64-bit kernel
+    uint16_t version = hdr[X86_HEADER_OFF_VERSION] |
+        (hdr[X86_HEADER_OFF_VERSION + 1] << 8);
+    if (version < X86_HEADER_XLOADFLAGS_VER) {
+        return "x86";
+    }
+
+    return (hdr[X86_HEADER_OFF_XLOADFLAGS] & X86_XLF_KERNEL_64)
+        ? "x86_64"
+        : "i386";
+}
+
 // -----------------------------------------------------------------------------
 bool KernelTool::isX86Kernel() const
 {
@@ -303,70 +375,61 @@ bool KernelTool::x86isRelocatable() const
 }
 
 // -----------------------------------------------------------------------------
-bool KernelTool::elfIsRelocatable() const
+unsigned short KernelTool::elfMachine() const
 {
-    unsigned char e_ident[EI_NIDENT];
+    union {
+        unsigned char e_ident[EI_NIDENT];
+        Elf32_Ehdr hdr32;
+        Elf64_Ehdr hdr64;
+    } hdr;
 
     off_t oret = lseek(m_fd, 0, SEEK_SET);
     if (oret == off_t(-1)) {
         throw KSystemError("lseek() failed", errno);
     }
 
-    gzFile fp = gzdopen(dup(m_fd), "r");
-    if (!fp) {
-        throw KSystemError("check_elf_file: Failed to open file", errno);
-    }
-
-    int ret = gzread(fp, e_ident, EI_NIDENT);
-    if (ret != EI_NIDENT) {
-        gzclose(fp);
-        throw KSystemError("check_elf_file: Failed to read", errno);
-    }
-
-    if (gzseek(fp, 0, SEEK_SET) == (off_t)-1) {
-        gzclose(fp);
-        throw KSystemError("Seek failed", errno);
+    // only the ELF header is decompressed
+    Decompressor dec(m_fd);
+    size_t len = dec.read(&hdr, sizeof hdr);
+    if (len < EI_NIDENT) {
+        throw KError("check_elf_file: Failed to read");
     }
 
     unsigned short machine;
-    string arch;
-    if (e_ident[EI_CLASS] == ELFCLASS32) {
-        Elf32_Ehdr hdr;
-
-        ret = gzread(fp, (unsigned char *)&hdr, sizeof(Elf32_Ehdr));
-        if (ret != sizeof(Elf32_Ehdr)) {
-            gzclose(fp);
-            throw KSystemError("Couldn't read ELF header", errno);
+    if (hdr.e_ident[EI_CLASS] == ELFCLASS32) {
+        if (len < sizeof(Elf32_Ehdr)) {
+            throw KError("Couldn't read ELF header");
         }
 
-	if (e_ident[EI_DATA] == ELFDATA2LSB)
-	    machine = le16toh(hdr.e_machine);
-	else if (e_ident[EI_DATA] == ELFDATA2MSB)
-	    machine = be16toh(hdr.e_machine);
+	if (hdr.e_ident[EI_DATA] == ELFDATA2LSB)
+	    machine = le16toh(hdr.hdr32.e_machine);
+	else if (hdr.e_ident[EI_DATA] == ELFDATA2MSB)
+	    machine = be16toh(hdr.hdr32.e_machine);
 	else
 	    throw KError("elfIsRelocatable(): Invalid ELF data encoding");
 
-    } else if (e_ident[EI_CLASS] == ELFCLASS64) {
-        Elf64_Ehdr hdr;
-
-        ret = gzread(fp, (unsigned char *)&hdr, sizeof(Elf64_Ehdr));
-        if (ret != sizeof(Elf64_Ehdr)) {
-            gzclose(fp);
-            throw KSystemError("Couldn't read ELF header", errno);
+    } else if (hdr.e_ident[EI_CLASS] == ELFCLASS64) {
+        if (len < sizeof(Elf64_Ehdr)) {
+            throw KError("Couldn't read ELF header");
         }
 
-	if (e_ident[EI_DATA] == ELFDATA2LSB)
-	    machine = le16toh(hdr.e_machine);
-	else if (e_ident[EI_DATA] == ELFDATA2MSB)
-	    machine = be16toh(hdr.e_machine);
+	if (hdr.e_ident[EI_DATA] == ELFDATA2LSB)
+	    machine = le16toh(hdr.hdr64.e_machine);
+	else if (hdr.e_ident[EI_DATA] == ELFDATA2MSB)
+	    machine = be16toh(hdr.hdr64.e_machine);
 	else
 	    throw KError("elfIsRelocatable(): Invalid ELF data encoding");
     } else {
         throw KError("elfIsRelocatable(): Invalid ELF class");
     }
-    arch = archFromElfMachine(machine);
 
-    gzclose(fp);
+    return machine;
+}
+
+// -----------------------------------------------------------------------------
+bool KernelTool::elfIsRelocatable() const
+{
+    string arch = archFromElfMachine(elfMachine());
 
     Debug::debug()->dbg("Detected arch %s", arch.c_str());
 
@@ -390,7 +453,7 @@ bool KernelTool::hasConfigRelocatable(const string &machine) const
 bool KernelTool::isConfigRelocatable() const
 {
     try {
-    Kconfig *kconfig = retrieveKernelConfig();
+    std::shared_ptr<const Kconfig> kconfig = retrieveKernelConfig();
     KconfigValue kv = kconfig->get("CONFIG_RELOCATABLE");
     return (kv.getType() == KconfigValue::T_TRISTATE &&
 	    kv.getTristateValue() == KconfigValue::ON);
@@ -416,31 +479,59 @@ string KernelTool::archFromElfMachine(unsigned long long et_machine) const
 }
 
 // -----------------------------------------------------------------------------
-Kconfig *KernelTool::retrieveKernelConfig() const
+static std::mutex configCacheMutex;
+static std::map<string, std::shared_ptr<const Kconfig> > configCache;
+
+// -----------------------------------------------------------------------------
+static string fileIdentity(const struct stat &st)
 {
-    Kconfig *kconfig = new Kconfig();
+    stringstream ss;
+    ss << st.st_dev << ":" << st.st_ino << ":" << st.st_size << ":"
+       << st.st_mtim.tv_sec << "." << st.st_mtim.tv_nsec;
+    return ss.str();
+}
 
-    // delete the object if we throw an exception
-    try {
-        // at first, search for the config on disk
-        KernelPath kpath(m_kernel);
-        if (!kpath.version().empty()) {
-            FilePath config = kpath.configPath();
-            Debug::debug()->dbg("Trying %s for config", config.c_str());
-            if (config.exists()) {
-                kconfig->readFromConfig(config);
-                return kconfig;
-            }
-        }
+// -----------------------------------------------------------------------------
+std::shared_ptr<const Kconfig> KernelTool::retrieveKernelConfig() const
+{
+    struct stat st;
+    FilePath config;
+    string key;
+
+    // at first, search for the config on disk
+    KernelPath kpath(m_kernel);
+    if (!kpath.version().empty()) {
+        config = kpath.configPath();
+        Debug::debug()->dbg("Trying %s for config", config.c_str());
+        if (stat(config.c_str(), &st) == 0)
+            key = fileIdentity(st);
+        else
+            config.clear();
+    }
 
-        // and then extract the configuration
-        kconfig->readFromKernel(*this);
-        return kconfig;
+    // and then extract the configuration
+    if (key.empty()) {
+        if (fstat(m_fd, &st) != 0)
+            throw KSystemError("Cannot stat " + m_kernel, errno);
+        key = fileIdentity(st);
+    }
 
-    } catch (...) {
-        delete kconfig;
-        throw;
+    {
+        std::lock_guard<std::mutex> lock(configCacheMutex);
+        auto it = configCache.find(key);
+        if (it != configCache.end())
+            return it->second;
     }
+
+    std::shared_ptr<Kconfig> kconfig(new Kconfig());
+    if (!config.empty())
+        kconfig->readFromConfig(config);
+    else
+        kconfig->readFromKernel(*this);
+
+    std::lock_guard<std::mutex> lock(configCacheMutex);
+    configCache[key] = kconfig;
+    return kconfig;
 }
 
 // -----------------------------------------------------------------------------
@@ -487,6 +578,30 @@ string KernelTool::extractFromIKconfigBuffer(const char *buffer, size_t buflen)
     return string((const char *)uncompressed.get());
 }
 
+// -----------------------------------------------------------------------------
+static string scanKernelConfig(Decompressor &dec, const string &kernel)
+{
+    Debug::debug()->dbg("Scanning %s data of %s for IKCFG",
+                        Decompressor::formatName(dec.getFormat()),
+                        kernel.c_str());
+
+    // decompression stops as soon as the configuration is complete
+    IkconfigScanner scanner;
+    unique_ptr<char[]> buffer(new char[IkconfigScanner::BUFSIZE]);
+    size_t chars_read;
+    while (!scanner.found() &&
+           (chars_read = dec.read(buffer.get(),
+                                  IkconfigScanner::BUFSIZE)) > 0)
+        scanner.feed(buffer.get(), chars_read);
+
+    // skip the gzip header
+    if (!scanner.found() || scanner.data().size() <= 10) {
+        throw KError("Cannot read configuration from " + kernel + ".");
+    }
+
+    return scanner.data().substr(10);
+}
+
 // -----------------------------------------------------------------------------
 string KernelTool::extractKernelConfigELF() const
 {
@@ -497,59 +612,40 @@ string KernelTool::extractKernelConfigELF() const
         throw KSystemError("lseek() failed", errno);
     }
 
-    gzFile fp = gzdopen(dup(m_fd), "r");
-    if (!fp) {
-        throw KError(string("Opening '") + m_kernel + string("' failed."));
-    }
+    Decompressor dec(m_fd);
+    string kernelconfig = scanKernelConfig(dec, m_kernel);
+    return extractFromIKconfigBuffer(kernelconfig.data(), kernelconfig.size());
+}
 
-    // we overlap the reads, that way searching for the pattern is easier
-    unsigned char buffer[BUFSIZ];
-    memset(buffer, 0, BUFSIZ);
+// -----------------------------------------------------------------------------
+off_t KernelTool::x86PayloadOffset() const
+{
+    unsigned char hdr[X86_HEADER_OFF_PAYLOAD + 4];
 
-    // search for the begin and end offests first
-    off_t fileoffset = 0;
-    ssize_t chars_read;
-    off_t begin_offset = -1, end_offset = -1;
-    while ((chars_read = gzread(fp, buffer+MAGIC_LEN, BUFSIZ-MAGIC_LEN)) > 0) {
-        if (begin_offset < 0) {
-            ssize_t pos = Util::findBytes(buffer, BUFSIZ, magic_start, MAGIC_LEN);
-            if (pos > 0) {
-                begin_offset = fileoffset + pos - MAGIC_LEN;
-            }
-        } else if (end_offset < 0) {
-            ssize_t pos = Util::findBytes(buffer, BUFSIZ, magic_end, MAGIC_LEN);
-            if (pos > 0) {
-                end_offset = fileoffset + pos - MAGIC_LEN;
-            }
-        } else {
-            break;
-        }
-        fileoffset += chars_read;
-        memmove(buffer, buffer+BUFSIZ-MAGIC_LEN, MAGIC_LEN);
+    ssize_t ret = pread(m_fd, hdr, sizeof hdr, 0);
+    if (ret < 0) {
+        throw KSystemError("Cannot read " + m_kernel, errno);
     }
-
-    if (begin_offset < 0 || end_offset < 0) {
-        gzclose(fp);
-        throw KError("Cannot read configuration from " + m_kernel + ".");
+    if (size_t(ret) < sizeof hdr) {
+        return -1;
     }
 
-    // we need to read after the MAGIC_START and the gzip header
-    begin_offset += MAGIC_LEN + 10;
-
-    // read the configuration to a buffer
-    if (gzseek(fp, begin_offset, SEEK_SET) == -1) {
-        throw KError("gzseek() failed.");
+    uint16_t version = hdr[X86_HEADER_OFF_VERSION] |
+        (hdr[X86_HEADER_OFF_VERSION + 1] << 8);
+    if (version < X86_HEADER_PAYLOAD_VER) {
+        return -1;
     }
-    ssize_t kernelconfig_len = end_offset - begin_offset;
-    unique_ptr<char[]> kernelconfig(new char[kernelconfig_len]);
 
-    chars_read = gzread(fp, kernelconfig.get(), kernelconfig_len);
-    gzclose(fp);
-    if (chars_read != kernelconfig_len) {
-        throw KError("Cannot read IKCONFIG.");
+    unsigned setup_sects = hdr[X86_HEADER_OFF_SETUP_SECTS];
+    if (setup_sects == 0) {
+        setup_sects = 4;
     }
+    uint32_t payload = hdr[X86_HEADER_OFF_PAYLOAD] |
+        (hdr[X86_HEADER_OFF_PAYLOAD + 1] << 8) |
+        (hdr[X86_HEADER_OFF_PAYLOAD + 2] << 16) |
+        (uint32_t(hdr[X86_HEADER_OFF_PAYLOAD + 3]) << 24);
 
-    return extractFromIKconfigBuffer(kernelconfig.get(), kernelconfig_len);
+    return off_t(setup_sects + 1) * 512 + payload;
 }
 
 // -----------------------------------------------------------------------------
@@ -560,93 +656,49 @@ string KernelTool::extractKernelConfigbzImage() const
     // that script helped me a lot
     // http://www.cs.caltech.edu/~weixl/research/fast-mon/scripts/extract-ikconfig
 
-    unsigned char searchfor[4] = { 0x1f, 0x8b, 0x08, 0x0 };
-    unsigned char buffer[BUFSIZ];
-    ssize_t chars_read;
+    // boot protocol 2.08+ tells where the compressed kernel is
+    off_t begin_offset = x86PayloadOffset();
 
-    off_t oret = lseek(m_fd, 0, SEEK_SET);
-    if (oret == (off_t)-1) {
-        throw KSystemError("lseek() failed", errno);
-    }
+    if (begin_offset < 0) {
+        // older kernels are always compressed with gzip
+        const unsigned char searchfor[4] = { 0x1f, 0x8b, 0x08, 0x0 };
+        PatternScanner gzipMagic(searchfor, sizeof searchfor);
+        unique_ptr<char[]> buffer(new char[IkconfigScanner::BUFSIZE]);
+        ssize_t chars_read;
 
-    // because of overlapping
-    memset(buffer, 0, BUFSIZ);
+        off_t oret = lseek(m_fd, 0, SEEK_SET);
+        if (oret == (off_t)-1) {
+            throw KSystemError("lseek() failed", errno);
+        }
 
-    off_t fileoffset = 0;
-    off_t begin_offset = 0;
-    while ((chars_read = read(m_fd, buffer+4, BUFSIZ-4)) > 0) {
-        ssize_t pos = Util::findBytes(buffer, BUFSIZ, searchfor, 4);
-        if (pos > 0) {
-            begin_offset = fileoffset + pos - MAGIC_LEN;
-            break;
+        while ((chars_read = read(m_fd, buffer.get(),
+                                  IkconfigScanner::BUFSIZE)) > 0) {
+            if (gzipMagic.scan(buffer.get(), chars_read) >= 0)
+                break;
+        }
+        if (chars_read < 0) {
+            throw KSystemError("read() failed", errno);
         }
-        memmove(buffer, buffer+BUFSIZ-MAGIC_LEN, MAGIC_LEN);
-        fileoffset += chars_read;
-    }
 
-    if (begin_offset == 0) {
-        throw KError("Magic 0x1f 0x8b 0x08 0x0 not found.");
+        begin_offset = gzipMagic.matchOffset();
+        if (begin_offset < 0) {
+            throw KError("Magic 0x1f 0x8b 0x08 0x0 not found.");
+        }
     }
 
-    begin_offset += 4;
-
     off_t ret = lseek(m_fd, begin_offset, SEEK_SET);
     if (ret == (off_t)-1) {
         throw KSystemError("lseek() failed", errno);
     }
 
-    gzFile fp = gzdopen(dup(m_fd), "r");
-    if (!fp) {
-        throw KError("gzdopen() failed");
-    }
-
-    // we overlap the reads, that way searching for the pattern is easier
-    memset(buffer, 0, BUFSIZ);
-
-    // search for the begin and end offests first
-    off_t end_offset = 0;
-    begin_offset = 0;
-    fileoffset = 0;
-    while ((chars_read = gzread(fp, buffer+MAGIC_LEN, BUFSIZ-MAGIC_LEN)) > 0) {
-        if (begin_offset == 0) {
-            ssize_t pos = Util::findBytes(buffer, BUFSIZ, magic_start, MAGIC_LEN);
-            if (pos > 0) {
-                begin_offset = fileoffset + pos - MAGIC_LEN;
-            }
-        } else if (end_offset == 0) {
-            ssize_t pos = Util::findBytes(buffer, BUFSIZ, magic_end, MAGIC_LEN);
-            if (pos > 0) {
-                end_offset = fileoffset + pos - MAGIC_LEN;
-            }
-        } else {
-            break;
-        }
-        fileoffset += chars_read;
-        memmove(buffer, buffer+BUFSIZ-MAGIC_LEN, MAGIC_LEN);
-    }
-
-    if (begin_offset < 0 || end_offset < 0) {
-        gzclose(fp);
-        throw KError("Cannot read configuration from " + m_kernel + ".");
-    }
-
-    // we need to read after the MAGIC_START and the gzip header
-    begin_offset += MAGIC_LEN + 10;
-
-    // read the configuration to a buffer
-    if (gzseek(fp, begin_offset, SEEK_SET) == -1) {
-        throw KError("gzseek() failed.");
-    }
-    ssize_t kernelconfig_len = end_offset - begin_offset;
-    unique_ptr<char[]> kernelconfig(new char[kernelconfig_len]);
-
-    chars_read = gzread(fp, kernelconfig.get(), kernelconfig_len);
-    gzclose(fp);
-    if (chars_read != kernelconfig_len) {
-        throw KError("Cannot read IKCONFIG.");
+    Decompressor dec(m_fd);
+    if (dec.getFormat() == Decompressor::FMT_PLAIN) {
+        throw KError("Unknown compression of the kernel payload in " +
+                     m_kernel + ".");
     }
 
-    return extractFromIKconfigBuffer(kernelconfig.get(), kernelconfig_len);
+    string kernelconfig = scanKernelConfig(dec, m_kernel);
+    return extractFromIKconfigBuffer(kernelconfig.data(), kernelconfig.size());
 }
 
 // -----------------------------------------------------------------------------
@@ -657,6 +709,9 @@ string KernelTool::extractKernelConfig() const
     switch (getKernelType()) {
         case KernelTool::KT_ELF:
         case KernelTool::KT_ELF_GZ:
+        case KernelTool::KT_ELF_XZ:
+        case KernelTool::KT_ELF_ZSTD:
+        case KernelTool::KT_ELF_LZ4:
         case KernelTool::KT_S390:
         case KernelTool::KT_AARCH64:
             return extractKernelConfigELF();
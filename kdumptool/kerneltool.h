@@ -20,6 +20,7 @@
 #define KERNELTOOL_H
 
 #include <string>
+#include <memory>
 
 #include "global.h"
 #include "fileutil.h"
@@ -40,6 +41,9 @@ class KernelTool {
         enum KernelType {
             KT_ELF,
             KT_ELF_GZ,
+            KT_ELF_XZ,
+            KT_ELF_ZSTD,
+            KT_ELF_LZ4,
             KT_X86,
             KT_S390,
             KT_AARCH64,
@@ -75,9 +79,19 @@ class KernelTool {
          */
         bool isRelocatable() const;
 
+        /**
+         * Returns the architecture of the kernel, such as "x86_64".
+         * For bzImages older than boot protocol 2.12, the result is "x86".
+         *
+         * @return the architecture, or "unknown" if this is not a kernel
+         * @exception KError if reading of the kernel image failed
+         */
+        std::string getKernelArch() const;
+
         /**
          * Extracts the kernel configuration from a kernel image. The kernel
-         * image can be of type ELF, ELF.gz and bzImage.
+         * image can be of type ELF (also compressed with gzip, xz, zstd or
+         * lz4) and bzImage.
          *
          * @return the embedded kernel configuration
          * @exception KError if reading of the kernel image failed
@@ -98,11 +112,14 @@ class KernelTool {
          * If it is not possible to read the configuration (from the file and/or
          * for the kernel image), then a KError is thrown.
          *
-         * @return a Kconfig object that has to be freed by the caller
-         *         (it's a pointer to avoid a cyclic dependency between
-         *         Kconfig and KernelTool)
+         * The parsed configuration is kept for the lifetime of the
+         * process and shared by all KernelTool objects for the same file
+         * (identified by device, inode, size and modification time).
+         *
+         * @return the Kconfig object (it's a pointer to avoid a cyclic
+         *         dependency between Kconfig and KernelTool)
          */
-        Kconfig *retrieveKernelConfig() const;
+        std::shared_ptr<const Kconfig> retrieveKernelConfig() const;
 
         /**
          * String representation of kerneltool.
@@ -153,6 +170,20 @@ class KernelTool {
          */
         bool elfIsRelocatable() const;
 
+        /**
+         * Reads the ELF machine type from the (possibly compressed) ELF
+         * header of the kernel image.
+         *
+         * @return the ELF machine type such as EM_X86_64
+         * @exception KError if the ELF header is invalid
+         */
+        unsigned short elfMachine() const;
+
+        /**
+         * Returns the architecture of a bzImage.
+         */
+        std::string x86Arch() const;
+
         /**
          * Checks if the kernel is a x86 kernel.
          *
@@ -202,6 +233,14 @@ class KernelTool {
          */
         std::string extractKernelConfigbzImage() const;
 
+        /**
+         * Returns the file offset of the compressed kernel in a bzImage.
+         *
+         * @return the offset, or -1 if the boot protocol is older than 2.08
+         * @exception KSystemError if reading of the kernel image failed
+         */
+        off_t x86PayloadOffset() const;
+
         /**
          * Extracts the kernel configuration from a IKCONFIG buffer.
          *
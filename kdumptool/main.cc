@@ -28,15 +28,18 @@
 #include "stringutil.h"
 
 // Subcommand initialization
+#include "convert_dump.h"
 #include "deletedumps.h"
 #include "dumpconfig.h"
 #include "findkernel.h"
 #include "identifykernel.h"
+#include "indexdumps.h"
 #include "ledblink.h"
 #include "multipath.h"
 #include "print_target.h"
 #include "read_ikconfig.h"
 #include "read_vmcoreinfo.h"
+#include "restore_dump.h"
 #include "savedump.h"
 #include "calibrate.h"
 
@@ -52,15 +55,18 @@ int main(int argc, char *argv[])
     bool exception = false;
 
     try {
+        kdt.addSubcommand(new ConvertDump);
         kdt.addSubcommand(new DeleteDumps);
         kdt.addSubcommand(new DumpConfig);
         kdt.addSubcommand(new FindKernel);
         kdt.addSubcommand(new IdentifyKernel);
+        kdt.addSubcommand(new IndexDumps);
         kdt.addSubcommand(new LedBlink);
         kdt.addSubcommand(new Multipath);
         kdt.addSubcommand(new PrintTarget);
         kdt.addSubcommand(new ReadIKConfig);
         kdt.addSubcommand(new ReadVmcoreinfo);
+        kdt.addSubcommand(new RestoreDump);
         kdt.addSubcommand(new SaveDump);
         kdt.addSubcommand(new Calibrate);
 
@@ -0,0 +1,839 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+
+#include <gelf.h>
+#include <zlib.h>
+
+#include "global.h"
+#if HAVE_LZO
+#   include <lzo/lzo1x.h>
+#endif
+#if HAVE_SNAPPY
+#   include <snappy-c.h>
+#endif
+#include "debug.h"
+#include "nativedump.h"
+#include "vmcore.h"
+#include "vmcoreinfo.h"
+#include "elfnotes.h"
+#include "progress.h"
+#include "stringutil.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+
+// Dump level bit for zero pages
+#define DL_EXCLUDE_ZERO         1
+
+// Dump level bits that need PageClassifier
+#define DL_EXCLUDE_CLASSIFIED   (2 | 4 | 8 | 16)
+
+// Maximum size of a flattened format record; keep them small, so that
+// readers can use a fixed-size buffer
+#define MDF_RECORD_SIZE         4096
+
+typedef std::pair<uint64_t, uint64_t> PfnRange;
+
+// -----------------------------------------------------------------------------
+static inline void setBit(vector<char> &bitmap, uint64_t bit)
+{
+    bitmap[bit / 8] |= 1 << (bit % 8);
+}
+
+// -----------------------------------------------------------------------------
+static inline void clearBit(vector<char> &bitmap, uint64_t bit)
+{
+    bitmap[bit / 8] &= ~(1 << (bit % 8));
+}
+
+// -----------------------------------------------------------------------------
+static inline bool testBit(const vector<char> &bitmap, uint64_t bit)
+{
+    return bitmap[bit / 8] & (1 << (bit % 8));
+}
+
+// -----------------------------------------------------------------------------
+static inline uint64_t divideUp(uint64_t x, uint64_t y)
+{
+    return (x + y - 1) / y;
+}
+
+// -----------------------------------------------------------------------------
+static void pwrite_all(int fd, const void *buf, size_t len, off_t offset)
+{
+    const char *p = static_cast<const char *>(buf);
+
+    while (len) {
+        ssize_t ret = pwrite(fd, p, len, offset);
+        if (ret < 0)
+            throw KSystemError("Cannot write dump file", errno);
+        len -= ret;
+        p += ret;
+        offset += ret;
+    }
+}
+
+//{{{ NativeDumpProvider -------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+NativeDumpProvider::NativeDumpProvider(const FilePath &dump, int dumplevel,
+                                       Compression compression,
+                                       unsigned threads)
+    : m_dump(dump), m_dumplevel(dumplevel), m_compression(compression),
+      m_numThreads(threads ? threads : 1), m_pagesize(0), m_bound(0),
+      m_prepared(false), m_maxMapnr(0), m_numDumpable(0), m_bitmapSize(0),
+      m_vmcoreinfoOffset(0), m_vmcoreinfoSize(0), m_nrCpus(0),
+      m_bitmapOffset(0), m_pdOffset(0), m_dataOffset(0),
+      m_state(ST_HEADER), m_cycle(0), m_numCycles(0), m_cycleStarted(false),
+      m_cacheSize(0), m_pfn(0), m_pagesDone(0),
+      m_zeroPages(0), m_stop(false), m_batches(2 * m_numThreads),
+      m_head(0), m_next(0), m_tail(0), m_eof(false), m_fd(-1), m_outPos(0)
+{
+    Debug::debug()->trace("NativeDumpProvider::NativeDumpProvider(%s, %d, "
+                          "%d, %u)", dump.c_str(), dumplevel,
+                          compression, threads);
+
+    switch (compression) {
+    case COMP_ZLIB:
+        break;
+
+    case COMP_LZO:
+#if HAVE_LZO
+        if (lzo_init() != LZO_E_OK)
+            throw KError("lzo_init() failed.");
+        break;
+#else
+        throw KError("kdumptool was built without LZO support.");
+#endif
+
+    case COMP_SNAPPY:
+#if HAVE_SNAPPY
+        break;
+#else
+        throw KError("kdumptool was built without snappy support.");
+#endif
+    }
+
+    memset(&m_header, 0, sizeof m_header);
+    memset(&m_subHeader, 0, sizeof m_subHeader);
+    memset(&m_zeroDesc, 0, sizeof m_zeroDesc);
+}
+
+// -----------------------------------------------------------------------------
+unsigned long long NativeDumpProvider::memoryNeeded(unsigned threads,
+                                                    unsigned long pagesize)
+{
+    // a batch holds the pages and their compressed data (which may
+    // be a bit bigger), and writeBatch() collects one more batch
+    unsigned long long batch = BATCH_PAGES *
+        (2ULL * pagesize + pagesize / 16 + 128);
+    if (!threads)
+        threads = 1;
+    return CYCLE_BITMAP_SIZE + CYCLE_CACHE_SIZE +
+        compressBound(CYCLE_BITMAP_SIZE) + (2ULL * threads + 1) * batch;
+}
+
+// -----------------------------------------------------------------------------
+NativeDumpProvider::~NativeDumpProvider()
+{
+    stopWorkers();
+}
+
+// -----------------------------------------------------------------------------
+bool NativeDumpProvider::init()
+{
+    Debug::debug()->trace("NativeDumpProvider::init()");
+
+    if (!m_classifier) {
+        m_vmcore.reset(new Vmcore(m_dump));
+        m_elfNotes.reset(new ElfNotes(*m_vmcore));
+        m_pagesize = sysconf(_SC_PAGESIZE);
+        try {
+            m_info.reset(new Vmcoreinfo);
+            m_info->readFromNotes(*m_elfNotes);
+            m_pagesize = m_info->getIntValue("PAGESIZE");
+        } catch (const KError &error) {
+            Debug::debug()->info("Cannot read VMCOREINFO: %s", error.what());
+            m_info.reset();
+        }
+
+        m_classifier.reset(new PageClassifier(*m_vmcore, m_info.get(),
+                                              m_pagesize));
+        m_classifier->init();
+    }
+
+    if ((m_dumplevel & DL_EXCLUDE_CLASSIFIED) &&
+        !m_classifier->havePageFlags()) {
+        Debug::debug()->info("Page types cannot be recognized in %s",
+                             m_dump.c_str());
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool NativeDumpProvider::excluded(PageClassifier::Class pc) const
+{
+    return PageClassifier::excluded(pc, m_dumplevel);
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::findRanges()
+{
+    // only whole pages
+    for (const auto &seg : m_vmcore->loadSegments()) {
+        uint64_t start = divideUp(seg.paddr, m_pagesize);
+        uint64_t end = (seg.paddr + seg.memsz) / m_pagesize;
+        if (start < end)
+            m_pfns.push_back(PfnRange(start, end));
+    }
+    std::sort(m_pfns.begin(), m_pfns.end());
+    vector<PfnRange> merged;
+    for (const auto &range : m_pfns) {
+        if (!merged.empty() && range.first <= merged.back().second)
+            merged.back().second = std::max(merged.back().second,
+                                            range.second);
+        else
+            merged.push_back(range);
+    }
+    m_pfns.swap(merged);
+
+    m_maxMapnr = m_pfns.empty() ? 0 : m_pfns.back().second;
+    m_bitmapSize = divideUp(divideUp(m_maxMapnr, 8), m_pagesize) *
+        m_pagesize;
+    m_numCycles = divideUp(m_maxMapnr, CYCLE_PFNS);
+    m_cycleBitmap.resize(std::min(uint64_t(CYCLE_BITMAP_SIZE),
+                                  m_bitmapSize));
+    if (m_dumplevel & DL_EXCLUDE_CLASSIFIED) {
+        m_cycleCache.resize(m_numCycles);
+        m_cacheBuf.resize(compressBound(m_cycleBitmap.size()));
+    }
+}
+
+// -----------------------------------------------------------------------------
+unsigned long long NativeDumpProvider::markCycle(uint64_t cycle, bool filter)
+{
+    uint64_t start = cycle * CYCLE_PFNS;
+    uint64_t end = std::min(start + CYCLE_PFNS, m_maxMapnr);
+    bool classify = filter && (m_dumplevel & DL_EXCLUDE_CLASSIFIED);
+    unsigned long long count = 0;
+
+    std::fill(m_cycleBitmap.begin(), m_cycleBitmap.end(), 0);
+    for (const auto &range : m_pfns) {
+        uint64_t first = std::max(range.first, start);
+        uint64_t last = std::min(range.second, end);
+        for (uint64_t pfn = first; pfn < last; ++pfn) {
+            if (classify && excluded(m_classifier->classify(pfn)))
+                continue;
+            setBit(m_cycleBitmap, pfn - start);
+            ++count;
+        }
+    }
+    return count;
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::cacheCycle(uint64_t cycle)
+{
+    uLongf size = m_cacheBuf.size();
+    if (compress2(reinterpret_cast<Bytef *>(m_cacheBuf.data()), &size,
+                  reinterpret_cast<const Bytef *>(m_cycleBitmap.data()),
+                  m_cycleBitmap.size(), Z_BEST_SPEED) != Z_OK ||
+        m_cacheSize + size > CYCLE_CACHE_SIZE)
+        return;
+
+    m_cycleCache[cycle].assign(m_cacheBuf.begin(), m_cacheBuf.begin() + size);
+    m_cacheSize += size;
+}
+
+// -----------------------------------------------------------------------------
+bool NativeDumpProvider::restoreCycle(uint64_t cycle)
+{
+    if (cycle >= m_cycleCache.size() || m_cycleCache[cycle].empty())
+        return false;
+
+    vector<char> &data = m_cycleCache[cycle];
+    uLongf size = m_cycleBitmap.size();
+    bool ok = uncompress(reinterpret_cast<Bytef *>(m_cycleBitmap.data()),
+                         &size, reinterpret_cast<const Bytef *>(data.data()),
+                         data.size()) == Z_OK &&
+        size == m_cycleBitmap.size();
+    m_cacheSize -= data.size();
+    vector<char>().swap(data);
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::emitCycle(uint64_t offset, uint64_t cycle)
+{
+    uint64_t pos = cycle * CYCLE_BITMAP_SIZE;
+    size_t len = std::min(uint64_t(m_cycleBitmap.size()), m_bitmapSize - pos);
+    emit(offset + pos, m_cycleBitmap.data(), len);
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::readNotes()
+{
+    m_notes = m_elfNotes->data();
+    m_nrCpus = m_elfNotes->numCpus();
+
+    const ElfNotes::Note *note = m_elfNotes->find("VMCOREINFO");
+    if (note) {
+        m_vmcoreinfoOffset = note->offset;
+        m_vmcoreinfoSize = note->size;
+    }
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::readUtsname()
+{
+    strncpy(m_header.utsname[0], "Linux", KDUMP_UTSNAME_LEN - 1);
+    if (!m_info)
+        return;
+
+    string release;
+    try {
+        release = m_info->getStringValue("OSRELEASE");
+        strncpy(m_header.utsname[2], release.c_str(), KDUMP_UTSNAME_LEN - 1);
+    } catch (const KError &) {
+    }
+
+    // the rest is only found in the kernel memory
+    try {
+        uint64_t addr = m_info->symbol("init_uts_ns");
+        if (m_info->hasKey("OFFSET(uts_namespace.name)"))
+            addr += m_info->offset("uts_namespace.name");
+        else
+            addr += sizeof(int);        // struct kref
+
+        char utsname[6][KDUMP_UTSNAME_LEN];
+        m_vmcore->readVirt(addr, utsname, sizeof utsname);
+        utsname[2][KDUMP_UTSNAME_LEN - 1] = '\0';
+        if (release.empty() || release == utsname[2])
+            memcpy(m_header.utsname, utsname, sizeof utsname);
+        else
+            Debug::debug()->dbg("init_uts_ns does not match OSRELEASE");
+    } catch (const KError &error) {
+        Debug::debug()->dbg("Cannot read init_uts_ns: %s", error.what());
+    }
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::buildHeader()
+{
+    memcpy(m_header.signature, KDUMP_SIGNATURE, sizeof m_header.signature);
+    m_header.header_version = KDUMP_HEADER_VERSION;
+    readUtsname();
+    if (m_info) {
+        if (m_info->hasKey("CRASHTIME"))
+            m_header.timestamp.tv_sec = m_info->getLLongValue("CRASHTIME");
+        if (m_info->hasKey("NUMBER(phys_base)"))
+            m_subHeader.phys_base = m_info->number("phys_base");
+    }
+
+    switch (m_compression) {
+    case COMP_ZLIB:
+        m_header.status = DUMP_DH_COMPRESSED_ZLIB;
+        break;
+    case COMP_LZO:
+        m_header.status = DUMP_DH_COMPRESSED_LZO;
+        break;
+    case COMP_SNAPPY:
+        m_header.status = DUMP_DH_COMPRESSED_SNAPPY;
+        break;
+    }
+
+    m_header.block_size = m_pagesize;
+    m_header.sub_hdr_size = divideUp(sizeof m_subHeader + m_notes.size(),
+                                     m_pagesize);
+    m_header.bitmap_blocks = 2 * m_bitmapSize / m_pagesize;
+    m_header.max_mapnr = std::min(m_maxMapnr, uint64_t(UINT_MAX));
+    m_header.nr_cpus = m_nrCpus ? m_nrCpus : 1;
+
+    m_subHeader.dump_level = m_dumplevel;
+    m_subHeader.end_pfn = std::min(m_maxMapnr, uint64_t(ULONG_MAX));
+    m_subHeader.offset_note = m_pagesize + sizeof m_subHeader;
+    m_subHeader.size_note = m_notes.size();
+    if (m_vmcoreinfoSize) {
+        m_subHeader.offset_vmcoreinfo = m_subHeader.offset_note +
+            m_vmcoreinfoOffset;
+        m_subHeader.size_vmcoreinfo = m_vmcoreinfoSize;
+    }
+    m_subHeader.end_pfn_64 = m_maxMapnr;
+    m_subHeader.max_mapnr_64 = m_maxMapnr;
+
+    // the page data offset is known after the pages are counted
+    m_bitmapOffset = uint64_t(1 + m_header.sub_hdr_size) * m_pagesize;
+    m_pdOffset = m_bitmapOffset + 2 * m_bitmapSize;
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::prepare()
+{
+    Debug::debug()->trace("NativeDumpProvider::prepare()");
+
+    AbstractDataProvider::prepare();
+
+    if (!init())
+        throw KError("Dump level " + StringUtil::number2string(m_dumplevel) +
+                     " needs struct page information in VMCOREINFO.");
+
+    findRanges();
+    readNotes();
+    buildHeader();
+
+    switch (m_compression) {
+    case COMP_ZLIB:
+        m_bound = compressBound(m_pagesize);
+        break;
+    case COMP_LZO:
+        m_bound = m_pagesize + m_pagesize / 16 + 64 + 3;
+        break;
+    case COMP_SNAPPY:
+#if HAVE_SNAPPY
+        m_bound = snappy_max_compressed_length(m_pagesize);
+#endif
+        break;
+    }
+    m_bound = std::max(m_bound, size_t(m_pagesize));
+
+    for (auto &batch : m_batches) {
+        batch.pfns.reserve(BATCH_PAGES);
+        batch.in.resize(BATCH_PAGES * m_pagesize);
+        batch.out.resize(BATCH_PAGES * m_bound);
+        batch.size.resize(BATCH_PAGES);
+        batch.flags.resize(BATCH_PAGES);
+        batch.done = false;
+    }
+
+    Debug::debug()->dbg("Starting %u compression threads", m_numThreads);
+    for (unsigned i = 0; i < m_numThreads; ++i)
+        m_threads.emplace_back(&NativeDumpProvider::worker, this);
+
+    Debug::debug()->dbg("%llu page frames in %llu cycles",
+                        (unsigned long long)m_maxMapnr,
+                        (unsigned long long)m_numCycles);
+    m_prepared = true;
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::compressBatch(Batch &batch, vector<char> &wrkmem)
+{
+    for (size_t i = 0; i < batch.pfns.size(); ++i) {
+        const char *page = batch.in.data() + i * m_pagesize;
+        char *out = batch.out.data() + i * m_bound;
+
+        batch.size[i] = 0;
+        batch.flags[i] = 0;
+        if (Util::isZero(page, m_pagesize))
+            continue;
+
+        size_t size = m_pagesize;
+        unsigned flags = 0;
+        switch (m_compression) {
+        case COMP_ZLIB: {
+            uLongf outlen = m_bound;
+            if (compress2(reinterpret_cast<Bytef *>(out), &outlen,
+                          reinterpret_cast<const Bytef *>(page), m_pagesize,
+                          Z_BEST_SPEED) == Z_OK) {
+                size = outlen;
+                flags = DUMP_DH_COMPRESSED_ZLIB;
+            }
+            break;
+        }
+
+#if HAVE_LZO
+        case COMP_LZO: {
+            lzo_uint outlen = m_bound;
+            if (lzo1x_1_compress(reinterpret_cast<lzo_bytep>(
+                                     const_cast<char *>(page)),
+                                 m_pagesize,
+                                 reinterpret_cast<lzo_bytep>(out),
+                                 &outlen, wrkmem.data()) == LZO_E_OK) {
+                size = outlen;
+                flags = DUMP_DH_COMPRESSED_LZO;
+            }
+            break;
+        }
+#endif
+
+#if HAVE_SNAPPY
+        case COMP_SNAPPY: {
+            size_t outlen = m_bound;
+            if (snappy_compress(page, m_pagesize, out, &outlen) ==
+                SNAPPY_OK) {
+                size = outlen;
+                flags = DUMP_DH_COMPRESSED_SNAPPY;
+            }
+            break;
+        }
+#endif
+
+        default:
+            break;
+        }
+
+        // store the page as is if it does not shrink
+        if (!flags || size >= m_pagesize) {
+            memcpy(out, page, m_pagesize);
+            size = m_pagesize;
+            flags = 0;
+        }
+        batch.size[i] = size;
+        batch.flags[i] = flags;
+    }
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::worker()
+{
+    vector<char> wrkmem;
+#if HAVE_LZO
+    if (m_compression == COMP_LZO)
+        wrkmem.resize(LZO1X_1_MEM_COMPRESS);
+#endif
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (true) {
+        while (!m_stop && m_next == m_tail)
+            m_work.wait(lock);
+        if (m_stop)
+            break;
+
+        Batch &batch = m_batches[m_next++ % m_batches.size()];
+        lock.unlock();
+
+        compressBatch(batch, wrkmem);
+
+        lock.lock();
+        batch.done = true;
+        m_done.notify_all();
+    }
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::fill()
+{
+    uint64_t start = m_cycle * CYCLE_PFNS;
+    uint64_t end = std::min(start + CYCLE_PFNS, m_maxMapnr);
+
+    while (!m_eof && m_tail - m_head < m_batches.size()) {
+        Batch &batch = m_batches[m_tail % m_batches.size()];
+
+        batch.pfns.clear();
+        while (batch.pfns.size() < BATCH_PAGES) {
+            if (m_pfn >= end) {
+                m_eof = true;
+                break;
+            }
+            uint64_t bit = m_pfn - start;
+            if (bit % 8 == 0 && !m_cycleBitmap[bit / 8]) {
+                m_pfn += 8;
+                continue;
+            }
+            if (testBit(m_cycleBitmap, bit))
+                batch.pfns.push_back(m_pfn);
+            ++m_pfn;
+        }
+        if (batch.pfns.empty())
+            break;
+
+        // read runs of consecutive page frames at once
+        size_t i = 0;
+        while (i < batch.pfns.size()) {
+            size_t j = i + 1;
+            while (j < batch.pfns.size() &&
+                   batch.pfns[j] == batch.pfns[j - 1] + 1)
+                ++j;
+            m_vmcore->readPhys(batch.pfns[i] * m_pagesize,
+                               batch.in.data() + i * m_pagesize,
+                               (j - i) * m_pagesize);
+            i = j;
+        }
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        batch.done = false;
+        ++m_tail;
+        m_work.notify_one();
+    }
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::writeBatch(Batch &batch)
+{
+    m_pdBuf.clear();
+    m_dataBuf.clear();
+
+    for (size_t i = 0; i < batch.pfns.size(); ++i) {
+        struct page_desc pd;
+
+        if (!batch.size[i]) {
+            if (m_dumplevel & DL_EXCLUDE_ZERO) {
+                clearBit(m_cycleBitmap,
+                         batch.pfns[i] - m_cycle * CYCLE_PFNS);
+                ++m_zeroPages;
+                continue;
+            }
+            pd = m_zeroDesc;
+        } else {
+            const char *data = batch.out.data() + i * m_bound;
+            memset(&pd, 0, sizeof pd);
+            pd.offset = m_dataOffset + m_dataBuf.size();
+            pd.size = batch.size[i];
+            pd.flags = batch.flags[i];
+            m_dataBuf.insert(m_dataBuf.end(), data, data + batch.size[i]);
+        }
+        const char *p = reinterpret_cast<const char *>(&pd);
+        m_pdBuf.insert(m_pdBuf.end(), p, p + sizeof pd);
+    }
+
+    emit(m_pdOffset, m_pdBuf.data(), m_pdBuf.size());
+    m_pdOffset += m_pdBuf.size();
+    emit(m_dataOffset, m_dataBuf.data(), m_dataBuf.size());
+    m_dataOffset += m_dataBuf.size();
+
+    m_pagesDone += batch.pfns.size();
+    if (getProgress())
+        getProgress()->progressed(m_pagesDone, m_numDumpable);
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::emit(uint64_t offset, const void *data, size_t len)
+{
+    if (m_fd >= 0) {
+        pwrite_all(m_fd, data, len, offset);
+        return;
+    }
+
+    const char *p = static_cast<const char *>(data);
+    while (len) {
+        size_t size = std::min(len, size_t(MDF_RECORD_SIZE));
+        struct makedumpfile_data_header dh;
+        dh.offset = htobe64(offset);
+        dh.buf_size = htobe64(size);
+        const char *hp = reinterpret_cast<const char *>(&dh);
+        m_out.insert(m_out.end(), hp, hp + sizeof dh);
+        m_out.insert(m_out.end(), p, p + size);
+        p += size;
+        offset += size;
+        len -= size;
+    }
+}
+
+// -----------------------------------------------------------------------------
+bool NativeDumpProvider::step()
+{
+    switch (m_state) {
+    case ST_HEADER:
+        if (m_fd < 0) {
+            struct makedumpfile_header fh;
+            memset(&fh, 0, sizeof fh);
+            strncpy(fh.signature, MDF_SIGNATURE, sizeof fh.signature);
+            fh.type = htobe64(MDF_TYPE_FLAT_HEADER);
+            fh.version = htobe64(MDF_VERSION_FLAT_HEADER);
+            m_out.resize(MDF_HEADER_SIZE);
+            memcpy(m_out.data(), &fh, sizeof fh);
+        }
+        emit(0, &m_header, sizeof m_header);
+        emit(m_pagesize, &m_subHeader, sizeof m_subHeader);
+        if (!m_notes.empty())
+            emit(m_subHeader.offset_note, m_notes.data(), m_notes.size());
+        m_state = ST_SCAN;
+        m_cycle = 0;
+        return true;
+
+    case ST_SCAN:
+        // write the 1st bitmap and count the dumpable pages
+        if (m_cycle < m_numCycles) {
+            unsigned long long count = markCycle(m_cycle, false);
+            emitCycle(m_bitmapOffset, m_cycle);
+            if (m_dumplevel & DL_EXCLUDE_CLASSIFIED) {
+                count = markCycle(m_cycle, true);
+                cacheCycle(m_cycle);
+            }
+            m_numDumpable += count;
+            ++m_cycle;
+            return true;
+        }
+        Debug::debug()->dbg("%llu pages before zero page check",
+                            m_numDumpable);
+
+        // The number of zero pages is not known before they are read, so
+        // there is room for a page descriptor for every page. The excess
+        // descriptors are never written and end up in a hole.
+        m_dataOffset = m_pdOffset + m_numDumpable * sizeof(struct page_desc);
+
+        // all zero pages share one copy
+        if (!(m_dumplevel & DL_EXCLUDE_ZERO)) {
+            vector<char> zero(m_pagesize, 0);
+            m_zeroDesc.offset = m_dataOffset;
+            m_zeroDesc.size = m_pagesize;
+            emit(m_dataOffset, zero.data(), zero.size());
+            m_dataOffset += m_pagesize;
+        }
+        m_state = ST_PAGES;
+        m_cycle = 0;
+        m_cycleStarted = false;
+        return true;
+
+    case ST_PAGES: {
+        if (m_cycle >= m_numCycles) {
+            m_state = ST_END;
+            return true;
+        }
+        if (!m_cycleStarted) {
+            if (!restoreCycle(m_cycle))
+                markCycle(m_cycle, true);
+            m_pfn = m_cycle * CYCLE_PFNS;
+            m_eof = false;
+            m_cycleStarted = true;
+        }
+
+        fill();
+        if (m_head == m_tail) {
+            // zero pages have been cleared meanwhile
+            emitCycle(m_bitmapOffset + m_bitmapSize, m_cycle);
+            ++m_cycle;
+            m_cycleStarted = false;
+            return true;
+        }
+
+        Batch &batch = m_batches[m_head % m_batches.size()];
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            while (!batch.done && !isAborted())
+                m_done.wait(lock);
+        }
+        checkAborted();
+
+        writeBatch(batch);
+        ++m_head;
+        return true;
+    }
+
+    case ST_END:
+        if (m_fd < 0) {
+            struct makedumpfile_data_header dh;
+            dh.offset = htobe64(int64_t(MDF_END_FLAG));
+            dh.buf_size = htobe64(int64_t(MDF_END_FLAG));
+            const char *p = reinterpret_cast<const char *>(&dh);
+            m_out.insert(m_out.end(), p, p + sizeof dh);
+        }
+        m_state = ST_DONE;
+        return true;
+
+    case ST_DONE:
+        break;
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::saveToFile(const StringVector &targets)
+{
+    Debug::debug()->trace("NativeDumpProvider::saveToFile([ \"%s\"%s ])",
+        targets.front().c_str(), targets.size() > 1 ? ", ...": "");
+
+    if (targets.size() > 1)
+        throw KError("Split dumps cannot be saved without makedumpfile.");
+
+    FileDescriptor fd(targets.front(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    m_fd = fd;
+    try {
+        if (!m_prepared)
+            prepare();
+        while (step())
+            checkAborted();
+    } catch (...) {
+        m_fd = -1;
+        setError(true);
+        finish();
+        throw;
+    }
+    m_fd = -1;
+    finish();
+}
+
+// -----------------------------------------------------------------------------
+size_t NativeDumpProvider::getData(char *buffer, size_t maxread)
+{
+    checkAborted();
+
+    while (m_outPos == m_out.size()) {
+        m_out.clear();
+        m_outPos = 0;
+        if (!step())
+            return 0;
+    }
+
+    size_t size = std::min(maxread, m_out.size() - m_outPos);
+    memcpy(buffer, m_out.data() + m_outPos, size);
+    m_outPos += size;
+    addBytesProvided(size);
+
+    return size;
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::abort(const string &reason)
+{
+    AbstractDataProvider::abort(reason);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_done.notify_all();
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+        m_work.notify_all();
+    }
+    for (auto &thread : m_threads)
+        thread.join();
+    m_threads.clear();
+}
+
+// -----------------------------------------------------------------------------
+void NativeDumpProvider::finish()
+{
+    Debug::debug()->trace("NativeDumpProvider::finish()");
+
+    stopWorkers();
+    AbstractDataProvider::finish();
+
+    Debug::debug()->dbg("Saved %llu pages, %llu zero pages excluded",
+                        m_pagesDone - m_zeroPages, m_zeroPages);
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,270 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef NATIVEDUMP_H
+#define NATIVEDUMP_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "global.h"
+#include "fileutil.h"
+#include "dataprovider.h"
+#include "diskdump.h"
+#include "pageclassifier.h"
+
+class Vmcore;
+class Vmcoreinfo;
+class ElfNotes;
+
+//{{{ NativeDumpProvider -------------------------------------------------------
+
+/**
+ * DataProvider that filters and compresses a dump in the kdump-compressed
+ * format of makedumpfile, without running makedumpfile.
+ *
+ * Zero pages are recognized by their contents; page cache, user and free
+ * pages are recognized by PageClassifier, so excluding them requires the
+ * struct page information in VMCOREINFO. The pages are compressed by a
+ * pool of worker threads.
+ *
+ * Physical memory is processed in cycles of CYCLE_PFNS page frames, so
+ * the memory needed does not depend on the size of the dump: the pages
+ * are counted in a first pass, and the bitmap of the dumped pages is
+ * needed again for each cycle in the second pass. The first pass keeps
+ * the bitmaps compressed in up to CYCLE_CACHE_SIZE bytes, so the pages
+ * of those cycles are classified only once.
+ *
+ * If the data is saved to a file, the file is written directly. Otherwise
+ * the data is provided in the makedumpfile flattened format, like
+ * "makedumpfile -F" does.
+ */
+class NativeDumpProvider : public AbstractDataProvider {
+
+    public:
+        /**
+         * Page compression.
+         */
+        enum Compression {
+            COMP_ZLIB,
+            COMP_LZO,
+            COMP_SNAPPY
+        };
+
+        /**
+         * Number of pages that are compressed by a thread at once.
+         */
+        static const unsigned BATCH_PAGES = 256;
+
+        /**
+         * Size of the page bitmap of a cycle in bytes.
+         */
+        static const size_t CYCLE_BITMAP_SIZE = 1 << 20;
+
+        /**
+         * Number of page frames in a cycle.
+         */
+        static const uint64_t CYCLE_PFNS = uint64_t(CYCLE_BITMAP_SIZE) * 8;
+
+        /**
+         * Maximum size of the compressed bitmaps kept from the first pass.
+         */
+        static const size_t CYCLE_CACHE_SIZE = 1 << 20;
+
+        /**
+         * Returns the memory needed for buffers, independent of the size
+         * of the dump.
+         *
+         * @param[in] threads number of compression threads
+         * @param[in] pagesize page size of the dumped kernel
+         * @return the size in bytes
+         */
+        static unsigned long long memoryNeeded(unsigned threads,
+                                               unsigned long pagesize);
+
+        /**
+         * Creates a new NativeDumpProvider.
+         *
+         * @param[in] dump the ELF dump file (e.g. /proc/vmcore)
+         * @param[in] dumplevel makedumpfile dump level
+         * @param[in] compression page compression
+         * @param[in] threads number of compression threads
+         * @exception KError if @p compression is not available
+         */
+        NativeDumpProvider(const FilePath &dump, int dumplevel,
+                           Compression compression, unsigned threads);
+
+        ~NativeDumpProvider();
+
+        /**
+         * Opens the dump and checks whether the pages can be filtered.
+         *
+         * @return @c true if all page types that @p dumplevel excludes
+         *         can be recognized, @c false otherwise
+         * @exception KError if the dump cannot be read
+         */
+        bool init();
+
+        /**
+         * Selects the pages to be dumped and starts the worker threads.
+         *
+         * @exception KError if the dump level cannot be honoured
+         * @see DataProvider::prepare()
+         */
+        void prepare();
+
+        /**
+         * Returns @c true, the dump file can be written directly.
+         */
+        bool canSaveToFile() const
+        { return true; }
+
+        /**
+         * Writes the dump to a file in kdump-compressed format.
+         *
+         * @param[in] targets the target file; splitting is not supported
+         * @exception KError if reading or writing fails
+         */
+        void saveToFile(const StringVector &targets);
+
+        /**
+         * Provides the dump in makedumpfile flattened format.
+         *
+         * @see DataProvider::getData()
+         */
+        size_t getData(char *buffer, size_t maxread);
+
+        /**
+         * Stops the worker threads.
+         */
+        void finish();
+
+        /**
+         * Aborts the compression.
+         */
+        void abort(const std::string &reason);
+
+    protected:
+        enum State {
+            ST_HEADER,
+            ST_SCAN,
+            ST_PAGES,
+            ST_END,
+            ST_DONE
+        };
+
+        struct Batch {
+            std::vector<uint64_t> pfns;
+            std::vector<char> in;
+            std::vector<char> out;
+            std::vector<uint32_t> size;         // 0 for zero pages
+            std::vector<uint32_t> flags;
+            bool done;
+        };
+
+        bool excluded(PageClassifier::Class pc) const;
+        void findRanges();
+        unsigned long long markCycle(uint64_t cycle, bool filter);
+        void cacheCycle(uint64_t cycle);
+        bool restoreCycle(uint64_t cycle);
+        void emitCycle(uint64_t offset, uint64_t cycle);
+        void readNotes();
+        void readUtsname();
+        void buildHeader();
+
+        void worker();
+        void compressBatch(Batch &batch, std::vector<char> &wrkmem);
+        void fill();
+        void writeBatch(Batch &batch);
+        void stopWorkers();
+
+        bool step();
+        void emit(uint64_t offset, const void *data, size_t len);
+
+    private:
+        FilePath m_dump;
+        int m_dumplevel;
+        Compression m_compression;
+        unsigned m_numThreads;
+        std::unique_ptr<Vmcore> m_vmcore;
+        std::unique_ptr<ElfNotes> m_elfNotes;
+        std::unique_ptr<Vmcoreinfo> m_info;
+        std::unique_ptr<PageClassifier> m_classifier;
+        unsigned long m_pagesize;
+        size_t m_bound;
+        bool m_prepared;
+
+        // dump layout
+        std::vector<std::pair<uint64_t, uint64_t> > m_pfns;
+        uint64_t m_maxMapnr;
+        unsigned long long m_numDumpable;
+        uint64_t m_bitmapSize;          // of each bitmap
+        std::vector<char> m_notes;
+        uint64_t m_vmcoreinfoOffset;
+        uint64_t m_vmcoreinfoSize;
+        int m_nrCpus;
+        struct disk_dump_header m_header;
+        struct kdump_sub_header m_subHeader;
+        uint64_t m_bitmapOffset;
+        uint64_t m_pdOffset;
+        uint64_t m_dataOffset;
+        struct page_desc m_zeroDesc;
+
+        // page iteration
+        State m_state;
+        uint64_t m_cycle;
+        uint64_t m_numCycles;
+        bool m_cycleStarted;
+        std::vector<char> m_cycleBitmap;
+        std::vector<std::vector<char> > m_cycleCache;
+        std::vector<char> m_cacheBuf;
+        size_t m_cacheSize;
+        uint64_t m_pfn;
+        unsigned long long m_pagesDone;
+        unsigned long long m_zeroPages;
+        std::vector<char> m_pdBuf;
+        std::vector<char> m_dataBuf;
+
+        // worker threads; batches are used round-robin
+        std::vector<std::thread> m_threads;
+        std::mutex m_lock;
+        std::condition_variable m_work;
+        std::condition_variable m_done;
+        bool m_stop;
+        std::vector<Batch> m_batches;
+        unsigned long m_head;           // next batch to write
+        unsigned long m_next;           // next batch to compress
+        unsigned long m_tail;           // next batch to fill
+        bool m_eof;
+
+        // output
+        int m_fd;
+        std::vector<char> m_out;
+        size_t m_outPos;
+};
+
+//}}}
+
+#endif /* NATIVEDUMP_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
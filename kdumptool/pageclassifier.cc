@@ -0,0 +1,545 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#include <gelf.h>
+
+#include "global.h"
+#include "debug.h"
+#include "pageclassifier.h"
+#include "vmcore.h"
+#include "vmcoreinfo.h"
+
+using std::string;
+using std::vector;
+
+// x86_64 paging
+#define X86_64_START_KERNEL_MAP     0xffffffff80000000ULL
+#define X86_64_VMEMMAP_L4           0xffffea0000000000ULL
+#define X86_64_VMEMMAP_L5           0xffd4000000000000ULL
+#define X86_64_PAGE_PRESENT         0x001ULL
+#define X86_64_PAGE_PSE             0x080ULL
+#define X86_64_PHYS_MASK            0x000ffffffffff000ULL
+#define X86_64_PTRS_PER_TABLE       512
+#define X86_64_TABLE_SIZE           4096
+
+// struct page.mapping of anonymous pages
+#define PAGE_MAPPING_ANON           0x1ULL
+
+// struct mem_section.section_mem_map
+#define SECTION_HAS_MEM_MAP         0x2ULL
+
+// largest kernel image mapping (KERNEL_IMAGE_SIZE on x86_64)
+#define MAX_KERNEL_SIZE             (1ULL << 30)
+
+// upper limit for the number of page tables read while walking
+#define MAX_TABLE_READS             (1UL << 20)
+
+//{{{ PageClassifier -----------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+PageClassifier::PageClassifier(Vmcore &vmcore, const Vmcoreinfo *info,
+                               unsigned long pagesize)
+    : m_vmcore(vmcore), m_info(info), m_pagesize(pagesize),
+      m_pgd(0), m_levels(0), m_havePageFlags(false), m_vmemmap(0),
+      m_structPageSize(0), m_flagsOff(0), m_mappingOff(0),
+      m_mapcountOff(-1), m_privateOff(-1), m_headOff(-1), m_pgSlab(-1),
+      m_pgLru(-1), m_pgPrivate(-1), m_pgSwapCache(-1), m_pgSwapBacked(-1),
+      m_haveSlabType(false),
+      m_slabType(0), m_haveBuddyType(false), m_buddyType(0),
+      m_freeStart(0), m_freeEnd(0), m_tableReads(0),
+      m_xlatVirt(0), m_xlatPhys(0), m_xlatSize(0),
+      m_reader(vmcore, X86_64_TABLE_SIZE)
+{}
+
+// -----------------------------------------------------------------------------
+const char *PageClassifier::className(Class pc)
+{
+    static const char *const names[PC_MAX] = {
+        "kernel", "pgtable", "memmap", "slab",
+        "other", "cache-private", "cache", "user", "free"
+    };
+    return pc < PC_MAX ? names[pc] : "unknown";
+}
+
+// -----------------------------------------------------------------------------
+bool PageClassifier::excluded(Class pc, int dumplevel)
+{
+    // same bits as makedumpfile -d
+    switch (pc) {
+    case PC_CACHE:
+        return dumplevel & (2 | 4);
+    case PC_CACHE_PRIVATE:
+        return dumplevel & 4;
+    case PC_USER:
+        return dumplevel & 8;
+    case PC_FREE:
+        return dumplevel & 16;
+    default:
+        return false;
+    }
+}
+
+// -----------------------------------------------------------------------------
+bool PageClassifier::hasKey(const string &key) const
+{
+    return m_info && m_info->hasKey(key.c_str());
+}
+
+// -----------------------------------------------------------------------------
+uint64_t PageClassifier::symbol(const char *name) const
+{
+    return m_info->symbol(name);
+}
+
+// -----------------------------------------------------------------------------
+long long PageClassifier::number(const char *name) const
+{
+    return m_info->number(name);
+}
+
+// -----------------------------------------------------------------------------
+unsigned long PageClassifier::offset(const char *name) const
+{
+    return m_info->offset(name);
+}
+
+// -----------------------------------------------------------------------------
+unsigned long PageClassifier::size(const char *name) const
+{
+    return m_info->size(name);
+}
+
+// -----------------------------------------------------------------------------
+bool PageClassifier::testFlag(uint64_t flags, long long bit)
+{
+    return bit >= 0 && bit < 64 && (flags & (1ULL << bit));
+}
+
+// -----------------------------------------------------------------------------
+void PageClassifier::addRange(vector<PfnRange> &ranges,
+                              uint64_t start, uint64_t end)
+{
+    if (start < end)
+        ranges.push_back(PfnRange(start, end));
+}
+
+// -----------------------------------------------------------------------------
+void PageClassifier::mergeRanges(vector<PfnRange> &ranges)
+{
+    std::sort(ranges.begin(), ranges.end());
+
+    vector<PfnRange> merged;
+    for (const auto &range : ranges) {
+        if (!merged.empty() && range.first <= merged.back().second)
+            merged.back().second = std::max(merged.back().second,
+                                            range.second);
+        else
+            merged.push_back(range);
+    }
+    ranges.swap(merged);
+}
+
+// -----------------------------------------------------------------------------
+bool PageClassifier::inRanges(const vector<PfnRange> &ranges, uint64_t pfn)
+{
+    auto it = std::upper_bound(ranges.begin(), ranges.end(),
+                               PfnRange(pfn, ~0ULL));
+    if (it == ranges.begin())
+        return false;
+    --it;
+    return pfn >= it->first && pfn < it->second;
+}
+
+// -----------------------------------------------------------------------------
+void PageClassifier::init()
+{
+    Debug::debug()->trace("PageClassifier::init()");
+
+    findKernel();
+
+    if (m_vmcore.machine() == EM_X86_64 && m_info) {
+        try {
+            initX86_64();
+        } catch (const KError &error) {
+            Debug::debug()->info("Cannot read page tables: %s",
+                                 error.what());
+            m_havePageFlags = false;
+        }
+    }
+
+    mergeRanges(m_kernel);
+    mergeRanges(m_pgtables);
+    mergeRanges(m_memmap);
+
+    Debug::debug()->dbg("Page classes: %zu kernel, %zu page table, "
+                        "%zu memmap ranges, struct page %s",
+                        m_kernel.size(), m_pgtables.size(), m_memmap.size(),
+                        m_havePageFlags ? "available" : "not available");
+    if (!m_havePageFlags)
+        Debug::debug()->info("Cannot read struct page. Slab, cache, user "
+                             "and free pages are classified as other.");
+}
+
+// -----------------------------------------------------------------------------
+void PageClassifier::findKernel()
+{
+    uint64_t stext = 0;
+    if (hasKey("SYMBOL(_stext)"))
+        stext = symbol("_stext");
+    else if (hasKey("SYMBOL(init_uts_ns)"))
+        stext = symbol("init_uts_ns");
+
+    for (const auto &seg : m_vmcore.loadSegments()) {
+        bool isKernel;
+        if (stext)
+            isKernel = stext >= seg.vaddr && stext - seg.vaddr < seg.memsz;
+        else
+            isKernel = m_vmcore.machine() == EM_X86_64 &&
+                seg.vaddr >= X86_64_START_KERNEL_MAP;
+        // a segment which maps all RAM is not the kernel image
+        if (isKernel && seg.memsz <= MAX_KERNEL_SIZE)
+            addRange(m_kernel, seg.paddr / m_pagesize,
+                     (seg.paddr + seg.memsz + m_pagesize - 1) / m_pagesize);
+    }
+}
+
+// -----------------------------------------------------------------------------
+void PageClassifier::initX86_64()
+{
+    uint64_t pgd;
+    if (hasKey("SYMBOL(init_top_pgt)"))
+        pgd = symbol("init_top_pgt");
+    else if (hasKey("SYMBOL(init_level4_pgt)"))
+        pgd = symbol("init_level4_pgt");
+    else {
+        Debug::debug()->dbg("No kernel page table in VMCOREINFO");
+        return;
+    }
+
+    // the top level table is part of the kernel image
+    for (const auto &seg : m_vmcore.loadSegments())
+        if (pgd >= seg.vaddr && pgd - seg.vaddr < seg.memsz) {
+            m_pgd = seg.paddr + (pgd - seg.vaddr);
+            break;
+        }
+    if (!m_pgd)
+        throw KError("Kernel page table is not in the dump.");
+
+    m_levels = 4;
+    if (hasKey("NUMBER(pgtable_l5_enabled)") &&
+        number("pgtable_l5_enabled"))
+        m_levels = 5;
+
+    addRange(m_pgtables, m_pgd / X86_64_TABLE_SIZE,
+             m_pgd / X86_64_TABLE_SIZE + 1);
+    walkTables(m_pgd, m_levels);
+
+    // struct page
+    if (!hasKey("SIZE(page)") || !hasKey("OFFSET(page.flags)") ||
+        !hasKey("OFFSET(page.mapping)")) {
+        Debug::debug()->dbg("No struct page layout in VMCOREINFO");
+        return;
+    }
+    m_structPageSize = size("page");
+    m_structPage.resize(m_structPageSize);
+    m_flagsOff = offset("page.flags");
+    m_mappingOff = offset("page.mapping");
+    if (hasKey("OFFSET(page._mapcount)"))
+        m_mapcountOff = offset("page._mapcount");
+    if (hasKey("OFFSET(page.private)"))
+        m_privateOff = offset("page.private");
+    if (hasKey("OFFSET(page.compound_head)"))
+        m_headOff = offset("page.compound_head");
+    if (hasKey("NUMBER(PG_slab)"))
+        m_pgSlab = number("PG_slab");
+    if (hasKey("NUMBER(PG_lru)"))
+        m_pgLru = number("PG_lru");
+    else
+        Debug::debug()->dbg("No PG_lru in VMCOREINFO, cannot find "
+                            "page cache");
+    if (hasKey("NUMBER(PG_private)"))
+        m_pgPrivate = number("PG_private");
+    if (hasKey("NUMBER(PG_swapcache)"))
+        m_pgSwapCache = number("PG_swapcache");
+    if (hasKey("NUMBER(PG_swapbacked)"))
+        m_pgSwapBacked = number("PG_swapbacked");
+    if (hasKey("NUMBER(PAGE_SLAB_MAPCOUNT_VALUE)")) {
+        m_haveSlabType = true;
+        m_slabType = number("PAGE_SLAB_MAPCOUNT_VALUE");
+    }
+    if (hasKey("NUMBER(PAGE_BUDDY_MAPCOUNT_VALUE)")) {
+        m_haveBuddyType = true;
+        m_buddyType = number("PAGE_BUDDY_MAPCOUNT_VALUE");
+    }
+
+    if (hasKey("NUMBER(vmemmap_base)"))
+        m_vmemmap = number("vmemmap_base");
+    else if (!(m_vmemmap = findVmemmap())) {
+        // only right without randomized memory layout (KASLR)
+        m_vmemmap = m_levels == 5 ? X86_64_VMEMMAP_L5 : X86_64_VMEMMAP_L4;
+        Debug::debug()->info("Cannot find vmemmap in mem_section, "
+                             "assuming 0x%llx",
+                             (unsigned long long)m_vmemmap);
+    }
+
+    // physical pages which back the struct page array
+    vector<PfnRange> present;
+    for (const auto &seg : m_vmcore.loadSegments())
+        addRange(present, seg.paddr / m_pagesize,
+                 (seg.paddr + seg.memsz + m_pagesize - 1) / m_pagesize);
+    mergeRanges(present);
+
+    for (const auto &range : present) {
+        uint64_t vaddr = (m_vmemmap + range.first * m_structPageSize) &
+            ~uint64_t(X86_64_TABLE_SIZE - 1);
+        uint64_t vend = m_vmemmap + range.second * m_structPageSize;
+        while (vaddr < vend) {
+            uint64_t paddr, pgsize;
+            bool ok = translate(vaddr, paddr, pgsize);
+            uint64_t skip = pgsize - (vaddr & (pgsize - 1));
+            if (ok) {
+                uint64_t pstart = paddr & ~(pgsize - 1);
+                addRange(m_memmap, pstart / m_pagesize,
+                         (pstart + pgsize) / m_pagesize);
+                m_havePageFlags = true;
+            }
+            vaddr += skip;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+uint64_t PageClassifier::findVmemmap()
+{
+    // With SPARSEMEM_VMEMMAP, section_mem_map holds the address of the
+    // struct page array minus the first PFN of the section, i.e. the
+    // vmemmap base, with some flags in the low bits (as in makedumpfile).
+    if (!hasKey("SYMBOL(mem_section)") || !hasKey("SIZE(mem_section)") ||
+        !hasKey("OFFSET(mem_section.section_mem_map)")) {
+        Debug::debug()->dbg("No mem_section in VMCOREINFO");
+        return 0;
+    }
+
+    uint64_t roots = symbol("mem_section");
+    unsigned long secSize = size("mem_section");
+    unsigned long mapOff = offset("mem_section.section_mem_map");
+    if (!secSize || mapOff + sizeof(uint64_t) > secSize)
+        return 0;
+    unsigned long perRoot = m_pagesize / secSize;
+    unsigned long nroots = hasKey("LENGTH(mem_section)")
+        ? m_info->getLLongValue("LENGTH(mem_section)") : 1;
+    if (!perRoot)
+        return 0;
+
+    vector<char> root(perRoot * secSize);
+    for (unsigned long i = 0; i < nroots; ++i) {
+        uint64_t rootAddr;
+        if (!readVirt(roots + i * sizeof rootAddr, &rootAddr,
+                      sizeof rootAddr))
+            return 0;
+        if (!rootAddr || !readVirt(rootAddr, root.data(), root.size()))
+            continue;
+
+        for (unsigned long j = 0; j < perRoot; ++j) {
+            uint64_t map;
+            memcpy(&map, root.data() + j * secSize + mapOff, sizeof map);
+            if (map & SECTION_HAS_MEM_MAP) {
+                map &= ~uint64_t(X86_64_TABLE_SIZE - 1);
+                Debug::debug()->dbg("vmemmap at 0x%llx from mem_section",
+                                    (unsigned long long)map);
+                return map;
+            }
+        }
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+void PageClassifier::walkTables(uint64_t table, int level)
+{
+    if (++m_tableReads > MAX_TABLE_READS)
+        return;
+
+    uint64_t entries[X86_64_PTRS_PER_TABLE];
+    try {
+        m_reader.readPhys(table, entries, sizeof entries);
+    } catch (const KError &error) {
+        Debug::debug()->dbg("%s", error.what());
+        return;
+    }
+
+    // only the kernel half of the top level table
+    int first = level == m_levels ? X86_64_PTRS_PER_TABLE / 2 : 0;
+    for (int i = first; i < X86_64_PTRS_PER_TABLE; ++i) {
+        uint64_t e = entries[i];
+        if (!(e & X86_64_PAGE_PRESENT))
+            continue;
+        if ((level == 2 || level == 3) && (e & X86_64_PAGE_PSE))
+            continue;           // huge page
+
+        uint64_t next = e & X86_64_PHYS_MASK;
+        addRange(m_pgtables, next / m_pagesize, next / m_pagesize + 1);
+        if (level > 2)
+            walkTables(next, level - 1);
+    }
+}
+
+// -----------------------------------------------------------------------------
+bool PageClassifier::translate(uint64_t vaddr, uint64_t &paddr,
+                               uint64_t &pgsize)
+{
+    if (m_xlatSize && vaddr - m_xlatVirt < m_xlatSize) {
+        paddr = m_xlatPhys + (vaddr - m_xlatVirt);
+        pgsize = m_xlatSize;
+        return true;
+    }
+
+    uint64_t table = m_pgd;
+    int shift = m_levels == 5 ? 48 : 39;
+    for (int level = m_levels; level > 0; --level, shift -= 9) {
+        uint64_t e;
+        unsigned idx = (vaddr >> shift) & (X86_64_PTRS_PER_TABLE - 1);
+        pgsize = 1ULL << shift;
+        try {
+            m_reader.readPhys(table + idx * sizeof e, &e, sizeof e);
+        } catch (const KError &) {
+            return false;
+        }
+        if (!(e & X86_64_PAGE_PRESENT))
+            return false;
+
+        if (level == 1 ||
+            ((level == 2 || level == 3) && (e & X86_64_PAGE_PSE))) {
+            m_xlatVirt = vaddr & ~(pgsize - 1);
+            m_xlatPhys = e & X86_64_PHYS_MASK & ~(pgsize - 1);
+            m_xlatSize = pgsize;
+            paddr = m_xlatPhys + (vaddr - m_xlatVirt);
+            return true;
+        }
+        table = e & X86_64_PHYS_MASK;
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+bool PageClassifier::readVirt(uint64_t vaddr, void *buf, size_t size)
+{
+    char *p = static_cast<char *>(buf);
+    size_t done = 0;
+
+    while (done < size) {
+        uint64_t paddr, pgsize;
+        if (!translate(vaddr, paddr, pgsize))
+            return false;
+
+        size_t len = std::min<uint64_t>(size - done,
+                                        pgsize - (vaddr & (pgsize - 1)));
+        try {
+            m_reader.readPhys(paddr, p + done, len);
+        } catch (const KError &) {
+            return false;
+        }
+        done += len;
+        vaddr += len;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool PageClassifier::readStructPage(uint64_t pfn, char *buf)
+{
+    return readVirt(m_vmemmap + pfn * m_structPageSize, buf, m_structPageSize);
+}
+
+// -----------------------------------------------------------------------------
+PageClassifier::Class PageClassifier::classify(uint64_t pfn)
+{
+    if (inRanges(m_kernel, pfn))
+        return PC_KERNEL;
+    if (inRanges(m_pgtables, pfn))
+        return PC_PGTABLE;
+    if (inRanges(m_memmap, pfn))
+        return PC_MEMMAP;
+    if (!m_havePageFlags)
+        return PC_OTHER;
+
+    // tail pages of a free block follow its first page
+    if (pfn >= m_freeStart && pfn < m_freeEnd)
+        return PC_FREE;
+
+    vector<char> &page = m_structPage;
+    if (!readStructPage(pfn, page.data()))
+        return PC_OTHER;
+
+    int32_t mapcount = 0;
+    if (m_mapcountOff >= 0)
+        memcpy(&mapcount, page.data() + m_mapcountOff, sizeof mapcount);
+    if (m_haveBuddyType && mapcount == m_buddyType) {
+        uint64_t order = 0;
+        if (m_privateOff >= 0)
+            memcpy(&order, page.data() + m_privateOff, sizeof order);
+        if (order < 64 - 12) {
+            m_freeStart = pfn;
+            m_freeEnd = pfn + (1ULL << order);
+        }
+        return PC_FREE;
+    }
+
+    // use the head of a compound page
+    if (m_headOff >= 0) {
+        uint64_t head;
+        memcpy(&head, page.data() + m_headOff, sizeof head);
+        if ((head & 1) && head - 1 >= m_vmemmap) {
+            uint64_t headPfn = (head - 1 - m_vmemmap) / m_structPageSize;
+            if (!readStructPage(headPfn, page.data()))
+                return PC_OTHER;
+            if (m_mapcountOff >= 0)
+                memcpy(&mapcount, page.data() + m_mapcountOff,
+                       sizeof mapcount);
+        }
+    }
+
+    uint64_t flags, mapping;
+    memcpy(&flags, page.data() + m_flagsOff, sizeof flags);
+    memcpy(&mapping, page.data() + m_mappingOff, sizeof mapping);
+
+    if (testFlag(flags, m_pgSlab))
+        return PC_SLAB;
+    if (m_haveSlabType && mapcount == m_slabType)
+        return PC_SLAB;
+
+    // same tests as makedumpfile
+    if (mapping & PAGE_MAPPING_ANON)
+        return PC_USER;
+    bool cache = testFlag(flags, m_pgLru);
+    // PG_swapcache is only valid together with PG_swapbacked (if known)
+    if (!cache && testFlag(flags, m_pgSwapCache))
+        cache = m_pgSwapBacked < 0 || testFlag(flags, m_pgSwapBacked);
+    if (cache)
+        return testFlag(flags, m_pgPrivate) ? PC_CACHE_PRIVATE : PC_CACHE;
+    return PC_OTHER;
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
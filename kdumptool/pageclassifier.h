@@ -0,0 +1,181 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef PAGECLASSIFIER_H
+#define PAGECLASSIFIER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "global.h"
+#include "pagereader.h"
+
+class Vmcore;
+class Vmcoreinfo;
+
+//{{{ PageClassifier -----------------------------------------------------------
+
+/**
+ * Sorts the page frames of a dump by their value for debugging.
+ *
+ * The kernel image is found from the PT_LOAD segment which maps the
+ * kernel text. On x86_64, the kernel page tables are walked to find
+ * the page table pages and the physical pages of the virtual memory map
+ * (vmemmap), whose base is taken from mem_section. The struct page of
+ * each page frame is then read to tell slab, page cache, anonymous user
+ * and free pages apart, with the same page flags as makedumpfile.
+ *
+ * If any of this information is missing from VMCOREINFO, the affected
+ * pages are classified as PC_OTHER.
+ */
+class PageClassifier {
+
+    public:
+        /**
+         * Page classes, from the most to the least valuable.
+         */
+        enum Class {
+            PC_KERNEL,          /**< kernel text and static data */
+            PC_PGTABLE,         /**< kernel page tables */
+            PC_MEMMAP,          /**< struct page array */
+            PC_SLAB,            /**< slab caches (incl. task structs) */
+            PC_OTHER,           /**< other kernel pages */
+            PC_CACHE_PRIVATE,   /**< page cache with private data */
+            PC_CACHE,           /**< page cache */
+            PC_USER,            /**< anonymous user pages */
+            PC_FREE,            /**< free pages */
+            PC_MAX
+        };
+
+        /**
+         * Creates a new classifier.
+         *
+         * @param[in] vmcore the dump
+         * @param[in] info VMCOREINFO of the dump, or @c NULL if not
+         *            available
+         * @param[in] pagesize page size of the crashed kernel
+         */
+        PageClassifier(Vmcore &vmcore, const Vmcoreinfo *info,
+                       unsigned long pagesize);
+
+        /**
+         * Locates the kernel image, page tables and the struct page
+         * array. Missing information is logged, not thrown.
+         */
+        void init();
+
+        /**
+         * Returns @c true if struct page can be read, i.e. slab, cache,
+         * user and free pages can be recognized.
+         */
+        bool havePageFlags() const
+        { return m_havePageFlags; }
+
+        /**
+         * Returns the class of a page frame.
+         *
+         * @param[in] pfn page frame number
+         */
+        Class classify(uint64_t pfn);
+
+        /**
+         * Returns a short name of a page class.
+         */
+        static const char *className(Class pc);
+
+        /**
+         * Checks whether a makedumpfile dump level excludes a page class.
+         *
+         * @param[in] pc page class
+         * @param[in] dumplevel makedumpfile dump level
+         */
+        static bool excluded(Class pc, int dumplevel);
+
+    protected:
+        typedef std::pair<uint64_t, uint64_t> PfnRange;
+
+        bool hasKey(const std::string &key) const;
+        uint64_t symbol(const char *name) const;
+        long long number(const char *name) const;
+        unsigned long offset(const char *name) const;
+        unsigned long size(const char *name) const;
+
+        void findKernel();
+        void initX86_64();
+        void walkTables(uint64_t table, int level);
+        uint64_t findVmemmap();
+        bool translate(uint64_t vaddr, uint64_t &paddr, uint64_t &pgsize);
+        bool readVirt(uint64_t vaddr, void *buf, size_t size);
+        bool readStructPage(uint64_t pfn, char *buf);
+
+        static bool testFlag(uint64_t flags, long long bit);
+        static void addRange(std::vector<PfnRange> &ranges,
+                             uint64_t start, uint64_t end);
+        static void mergeRanges(std::vector<PfnRange> &ranges);
+        static bool inRanges(const std::vector<PfnRange> &ranges,
+                             uint64_t pfn);
+
+    private:
+        Vmcore &m_vmcore;
+        const Vmcoreinfo *m_info;
+        unsigned long m_pagesize;
+
+        std::vector<PfnRange> m_kernel;
+        std::vector<PfnRange> m_pgtables;
+        std::vector<PfnRange> m_memmap;
+
+        // x86_64 page tables
+        uint64_t m_pgd;
+        int m_levels;
+
+        // struct page
+        bool m_havePageFlags;
+        uint64_t m_vmemmap;
+        unsigned long m_structPageSize;
+        unsigned long m_flagsOff;
+        unsigned long m_mappingOff;
+        long m_mapcountOff;
+        long m_privateOff;
+        long m_headOff;
+        long long m_pgSlab;
+        long long m_pgLru;
+        long long m_pgPrivate;
+        long long m_pgSwapCache;
+        long long m_pgSwapBacked;
+        bool m_haveSlabType;
+        int32_t m_slabType;
+        bool m_haveBuddyType;
+        int32_t m_buddyType;
+        uint64_t m_freeStart;
+        uint64_t m_freeEnd;
+        unsigned long m_tableReads;
+
+        // translation and page caches
+        uint64_t m_xlatVirt;
+        uint64_t m_xlatPhys;
+        uint64_t m_xlatSize;
+        PageReader m_reader;
+        std::vector<char> m_structPage;
+};
+
+//}}}
+
+#endif /* PAGECLASSIFIER_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,95 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstring>
+#include <algorithm>
+
+#include "global.h"
+#include "debug.h"
+#include "pagereader.h"
+#include "vmcore.h"
+
+//{{{ PageReader ---------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+PageReader::PageReader(Vmcore &vmcore, size_t pagesize, size_t cachePages)
+    : m_vmcore(vmcore), m_pagesize(pagesize),
+      m_cachePages(cachePages ? cachePages : 1), m_hits(0), m_misses(0)
+{}
+
+// -----------------------------------------------------------------------------
+const char *PageReader::page(uint64_t pfn)
+{
+    auto found = m_map.find(pfn);
+    if (found != m_map.end()) {
+        ++m_hits;
+        m_lru.splice(m_lru.begin(), m_lru, found->second);
+        return found->second->data.data();
+    }
+
+    // reuse the least recently used buffer if the cache is full
+    if (m_map.size() >= m_cachePages) {
+        m_map.erase(m_lru.back().pfn);
+        m_lru.splice(m_lru.begin(), m_lru, std::prev(m_lru.end()));
+    } else {
+        m_lru.push_front(Page());
+        m_lru.front().data.resize(m_pagesize);
+    }
+
+    Page &page = m_lru.front();
+    try {
+        m_vmcore.readPhys(pfn * m_pagesize, page.data.data(), m_pagesize);
+    } catch (...) {
+        m_lru.pop_front();
+        throw;
+    }
+    ++m_misses;
+    page.pfn = pfn;
+    m_map[pfn] = m_lru.begin();
+    return page.data.data();
+}
+
+// -----------------------------------------------------------------------------
+void PageReader::readPhys(uint64_t addr, void *buf, size_t len)
+{
+    char *p = static_cast<char *>(buf);
+
+    while (len) {
+        uint64_t pfn = addr / m_pagesize;
+        size_t off = addr % m_pagesize;
+        size_t chunk = std::min(len, m_pagesize - off);
+
+        const char *data = nullptr;
+        try {
+            data = page(pfn);
+        } catch (const KError &) {
+            // e.g. a segment which does not start at a page boundary
+            m_vmcore.readPhys(addr, p, chunk);
+        }
+        if (data)
+            memcpy(p, data + off, chunk);
+
+        p += chunk;
+        addr += chunk;
+        len -= chunk;
+    }
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
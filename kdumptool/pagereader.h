@@ -0,0 +1,114 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef PAGEREADER_H
+#define PAGEREADER_H
+
+#include <stdint.h>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "global.h"
+
+class Vmcore;
+
+//{{{ PageReader ---------------------------------------------------------------
+
+/**
+ * Reads physical memory from a dump through a small LRU page cache.
+ *
+ * Walking page tables or the struct page array reads small pieces of the
+ * same few pages over and over again. This class reads whole pages with
+ * pread(2) and keeps the most recently used ones, so repeated accesses
+ * do not go to the file. It is not thread-safe; use one object per
+ * thread.
+ */
+class PageReader {
+
+    public:
+        /**
+         * Default number of cached pages.
+         */
+        static const size_t DEFAULT_CACHE_PAGES = 64;
+
+        /**
+         * Creates a page reader.
+         *
+         * @param[in] vmcore the dump
+         * @param[in] pagesize page size (a power of two)
+         * @param[in] cachePages maximum number of cached pages
+         */
+        PageReader(Vmcore &vmcore, size_t pagesize,
+                   size_t cachePages = DEFAULT_CACHE_PAGES);
+
+        /**
+         * Returns the contents of a page frame. The pointer is valid until
+         * the next call to a method of this object.
+         *
+         * @param[in] pfn page frame number
+         * @exception KError if the page is not (completely) in the dump
+         */
+        const char *page(uint64_t pfn);
+
+        /**
+         * Reads memory at a physical address. The range may cross page
+         * boundaries. Pages which are only partially in the dump are read
+         * directly from the file.
+         *
+         * @param[in] addr physical address
+         * @param[out] buf destination buffer
+         * @param[in] len number of bytes to read
+         * @exception KError if the address range is not in the dump
+         */
+        void readPhys(uint64_t addr, void *buf, size_t len);
+
+        /**
+         * Returns the number of page lookups that were served from
+         * the cache.
+         */
+        unsigned long long hits() const
+        { return m_hits; }
+
+        /**
+         * Returns the number of pages read from the dump.
+         */
+        unsigned long long misses() const
+        { return m_misses; }
+
+    private:
+        struct Page {
+            uint64_t pfn;
+            std::vector<char> data;
+        };
+        typedef std::list<Page> PageList;
+
+        Vmcore &m_vmcore;
+        size_t m_pagesize;
+        size_t m_cachePages;
+        PageList m_lru;         // most recently used first
+        std::unordered_map<uint64_t, PageList::iterator> m_map;
+        unsigned long long m_hits;
+        unsigned long long m_misses;
+};
+
+//}}}
+
+#endif /* PAGEREADER_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
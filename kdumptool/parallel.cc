@@ -0,0 +1,123 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <algorithm>
+
+#include "global.h"
+#include "parallel.h"
+
+//{{{ ParallelFor --------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+ParallelFor::ParallelFor(size_t n, unsigned maxThreads, const Body &body)
+    : m_body(body), m_count(n), m_next(0), m_done(n, false), m_errors(n)
+{
+    unsigned nthreads = std::thread::hardware_concurrency();
+    nthreads = std::max(1U, std::min(nthreads, maxThreads));
+    if (nthreads > n)
+        nthreads = n;
+    try {
+        for (unsigned i = 0; i < nthreads; ++i)
+            m_threads.push_back(std::thread(&ParallelFor::worker, this));
+    } catch (...) {
+        cancel();
+        for (auto &t : m_threads)
+            t.join();
+        throw;
+    }
+}
+
+// -----------------------------------------------------------------------------
+ParallelFor::~ParallelFor()
+{
+    cancel();
+    for (auto &t : m_threads)
+        if (t.joinable())
+            t.join();
+}
+
+// -----------------------------------------------------------------------------
+void ParallelFor::worker()
+{
+    for (;;) {
+        size_t i;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_next >= m_count)
+                return;
+            i = m_next++;
+        }
+
+        std::exception_ptr error;
+        try {
+            m_body(i);
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_errors[i] = error;
+            m_done[i] = true;
+        }
+        m_cond.notify_all();
+    }
+}
+
+// -----------------------------------------------------------------------------
+void ParallelFor::wait(size_t i)
+{
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_cond.wait(lock, [this, i]() { return bool(m_done[i]); });
+        error = m_errors[i];
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// -----------------------------------------------------------------------------
+void ParallelFor::cancel()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_count = m_next;
+}
+
+// -----------------------------------------------------------------------------
+void ParallelFor::join()
+{
+    for (auto &t : m_threads)
+        if (t.joinable())
+            t.join();
+
+    for (const auto &error : m_errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+//}}}
+
+// -----------------------------------------------------------------------------
+void parallelFor(size_t n, unsigned maxThreads,
+                 const ParallelFor::Body &body)
+{
+    ParallelFor(n, maxThreads, body).join();
+}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
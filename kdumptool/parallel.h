@@ -0,0 +1,109 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstddef>
+#include <vector>
+#include <functional>
+#include <exception>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "global.h"
+
+//{{{ ParallelFor --------------------------------------------------------------
+
+/**
+ * Runs a function for the indices 0 to n-1 on a pool of threads.
+ *
+ * The indices are taken in ascending order, so the results of the first
+ * items are usually available first. An exception thrown by the function
+ * is stored and rethrown in the calling thread by wait() or join(); the
+ * remaining items are still processed. The destructor cancels the items
+ * which have not been started yet and waits for the running ones.
+ */
+class ParallelFor {
+
+    public:
+        /**
+         * Function that processes one item.
+         */
+        typedef std::function<void(size_t)> Body;
+
+        /**
+         * Starts the threads.
+         *
+         * @param[in] n number of items
+         * @param[in] maxThreads upper limit for the number of threads;
+         *            fewer are used if there are fewer CPUs or items
+         * @param[in] body item processing function
+         */
+        ParallelFor(size_t n, unsigned maxThreads, const Body &body);
+
+        ~ParallelFor();
+
+        /**
+         * Waits until item @p i is processed. The item must not have
+         * been cancelled.
+         *
+         * @exception the exception thrown by the body for item @p i
+         */
+        void wait(size_t i);
+
+        /**
+         * Does not start any more items.
+         */
+        void cancel();
+
+        /**
+         * Waits for all threads.
+         *
+         * @exception the exception thrown by the body for the item with
+         *            the lowest index
+         */
+        void join();
+
+    private:
+        void worker();
+
+        Body m_body;
+        size_t m_count;
+        size_t m_next;
+        std::vector<bool> m_done;
+        std::vector<std::exception_ptr> m_errors;
+        std::mutex m_lock;
+        std::condition_variable m_cond;
+        std::vector<std::thread> m_threads;
+};
+
+/**
+ * Runs @p body for the indices 0 to n-1 in parallel and waits for them.
+ *
+ * @see ParallelFor
+ */
+void parallelFor(size_t n, unsigned maxThreads,
+                 const ParallelFor::Body &body);
+
+//}}}
+
+#endif /* PARALLEL_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
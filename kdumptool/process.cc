@@ -26,6 +26,8 @@
 #include <unistd.h>
 #include <poll.h>
 #include <typeinfo>
+#include <iostream>
+#include <cstdio>
 
 #include "process.h"
 #include "global.h"
@@ -123,6 +125,51 @@ void SubProcess::spawn(const string &name, const StringVector &args)
     Debug::debug()->dbg("Forked child PID %d", m_pid);
 }
 
+// -----------------------------------------------------------------------------
+void SubProcess::spawn(std::function<int()> const &fn)
+{
+    Debug::debug()->trace("SubProcess::spawn(<function>)");
+
+    for (auto &elem : m_fdmap)
+        elem.second->prepare();
+
+    // do not duplicate buffered output in the child
+    std::cout.flush();
+    std::cerr.flush();
+    fflush(NULL);
+
+    pid_t child = fork();
+    if (child > 0) {		// parent code
+	m_pid = child;
+
+        for (auto &elem : m_fdmap)
+            elem.second->finalizeParent();
+
+    } else if (child == 0) {	// child code
+        int ret;
+        try {
+            for (auto &elem : m_fdmap)
+                elem.second->finalizeChild(elem.first);
+            ret = fn();
+        } catch (const std::exception &ex) {
+            std::cerr << ex.what() << std::endl;
+            ret = 1;
+        } catch (...) {
+            // never unwind into the code of the parent
+            ret = 1;
+        }
+        std::cout.flush();
+        std::cerr.flush();
+        fflush(NULL);
+        _exit(ret);
+
+    } else {                    // parent code failure
+        throw KSystemError("SubProcess::spawn(): fork failed", errno);
+    }
+
+    Debug::debug()->dbg("Forked child PID %d", m_pid);
+}
+
 // -----------------------------------------------------------------------------
 void SubProcess::kill(int sig)
 {
@@ -143,7 +190,10 @@ int SubProcess::wait(void)
     checkSpawned();
 
     int status;
-    pid_t ret = ::waitpid(m_pid, &status, 0);
+    pid_t ret;
+    do {
+        ret = ::waitpid(m_pid, &status, 0);
+    } while (ret == -1 && errno == EINTR);
 
     if (ret == -1)
 	throw KSystemError("SubProcess::wait(): cannot get state of PID "
@@ -22,6 +22,7 @@
 #include <stdint.h>
 #include <map>
 #include <memory>
+#include <functional>
 
 #include "global.h"
 #include "optionparser.h"
@@ -197,6 +198,19 @@ class SubProcess {
 	 */
 	void spawn(const std::string &name, const StringVector &args);
 
+	/**
+	 * Runs a function in a forked subprocess.
+	 *
+	 * The child exits with the return value of @p fn without running
+	 * any destructors or exit handlers, so it is safe to use objects
+	 * that release resources (e.g. mount points) on destruction.
+	 * If @p fn throws an exception, the child prints the error message
+	 * and exits with status 1.
+	 *
+	 * @param[in] fn function to run in the child
+	 */
+	void spawn(std::function<int()> const &fn);
+
 	/**
 	 * Get the child process ID.
 	 *
@@ -17,14 +17,19 @@
  * 02110-1301, USA.
  */
 #include <iostream>
+#include <string>
+#include <sys/stat.h>
 
 #include "subcommand.h"
 #include "debug.h"
 #include "read_ikconfig.h"
 #include "kerneltool.h"
 #include "util.h"
+#include "kernelbatch.h"
+#include "stringutil.h"
 
 using std::cout;
+using std::string;
 
 //{{{ ReadIKConfig -------------------------------------------------------------
 
@@ -49,9 +54,18 @@ void ReadIKConfig::parseArgs(const StringVector &args)
 {
     Debug::debug()->trace(__FUNCTION__);
 
-    if (args.size() != 1)
+    if (args.size() == 0)
         throw KError("kernel image required.");
 
+    struct stat st;
+    if (args.size() > 1 ||
+        (stat(args[0].c_str(), &st) == 0 && S_ISDIR(st.st_mode))) {
+        m_batchPaths = args;
+        Debug::debug()->dbg("batch mode, %lu paths",
+                            (unsigned long)m_batchPaths.size());
+        return;
+    }
+
     m_file = args[0];
     Debug::debug()->dbg("file=%s", m_file.c_str());
 }
@@ -59,6 +73,28 @@ void ReadIKConfig::parseArgs(const StringVector &args)
 // -----------------------------------------------------------------------------
 void ReadIKConfig::execute()
 {
+    if (!m_batchPaths.empty()) {
+        KernelBatch batch(m_batchPaths);
+        unsigned errors = batch.run([](const string &image) {
+                KernelTool kt(image);
+                KernelTool::KernelType type;
+                try {
+                    type = kt.getKernelType();
+                } catch (const KError &e) {
+                    Debug::debug()->dbg("%s: %s", image.c_str(), e.what());
+                    type = KernelTool::KT_NONE;
+                }
+                if (type == KernelTool::KT_NONE)
+                    return string();
+                return "{\"image\": " + StringUtil::jsonString(image) +
+                    ", \"config\": " +
+                    StringUtil::jsonString(kt.extractKernelConfig()) + "}";
+            }, cout);
+        if (errors)
+            setErrorCode(1);
+        return;
+    }
+
     KernelTool kt(m_file);
     cout << kt.extractKernelConfig();
 }
@@ -0,0 +1,108 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "subcommand.h"
+#include "debug.h"
+#include "restore_dump.h"
+#include "chunkstore.h"
+#include "fileutil.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::endl;
+
+//{{{ RestoreDump --------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+RestoreDump::RestoreDump()
+{}
+
+// -----------------------------------------------------------------------------
+const char *RestoreDump::getName() const
+{
+    return "restore_dump";
+}
+
+// -----------------------------------------------------------------------------
+bool RestoreDump::needsConfigfile() const
+{
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+void RestoreDump::parseArgs(const StringVector &args)
+{
+    Debug::debug()->trace(__FUNCTION__);
+
+    if (args.size() != 2)
+        throw KError("restore_dump requires 2 arguments.");
+
+    m_recipe = args[0];
+    m_output = args[1];
+
+    Debug::debug()->dbg("recipe=%s, output=%s",
+                        m_recipe.c_str(), m_output.c_str());
+}
+
+// -----------------------------------------------------------------------------
+void RestoreDump::execute()
+{
+    FilePath recipePath(m_recipe);
+    ChunkStore::Recipe recipe = ChunkStore::readRecipe(recipePath);
+    ChunkStore store(ChunkStore::forRecipe(recipePath));
+
+    FileDescriptor fd(m_output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    vector<char> data;
+    off_t offset = 0;
+    for (const auto &chunk : recipe) {
+        store.get(chunk.first, data);
+        if (data.size() != chunk.second)
+            throw KError("Chunk " + chunk.first + " has a wrong size.");
+
+        // leave zero chunks as holes
+        if (!Util::isZero(data.data(), data.size())) {
+            size_t done = 0;
+            while (done < data.size()) {
+                ssize_t ret = pwrite(fd, data.data() + done,
+                                     data.size() - done, offset + done);
+                if (ret < 0)
+                    throw KSystemError("Cannot write " + m_output, errno);
+                done += ret;
+            }
+        }
+        offset += data.size();
+    }
+    if (ftruncate(fd, offset) != 0)
+        throw KSystemError("Cannot set size of " + m_output, errno);
+
+    cout << "Restored " << recipe.size() << " chunks ("
+         << offset << " bytes)." << endl;
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,69 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef RESTORE_DUMP_H
+#define RESTORE_DUMP_H
+
+#include "subcommand.h"
+
+//{{{ RestoreDump --------------------------------------------------------------
+
+/**
+ * Subcommand to restore a dump from the chunk store.
+ */
+class RestoreDump : public Subcommand {
+
+    public:
+        /**
+         * Creates a new RestoreDump object.
+         */
+        RestoreDump();
+
+    public:
+        /**
+         * Returns the name of the subcommand (restore_dump).
+         */
+        const char *getName() const;
+
+        /**
+         * Parses the non-option arguments from the command line.
+         */
+        virtual void parseArgs(const StringVector &args);
+
+        /**
+         * That command does not need a config file.
+         */
+        bool needsConfigfile() const;
+
+        /**
+         * Executes the function.
+         *
+         * @throw KError on any error. No exception indicates success.
+         */
+        void execute();
+
+    private:
+        std::string m_recipe;
+        std::string m_output;
+};
+
+//}}}
+
+#endif /* RESTORE_DUMP_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
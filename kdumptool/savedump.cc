@@ -24,6 +24,16 @@
 #include <memory>
 #include <sstream>
 #include <fstream>
+#include <vector>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <cstddef>
+#include <cstring>
 
 #include "subcommand.h"
 #include "debug.h"
@@ -43,6 +53,18 @@
 #include "routable.h"
 #include "calibrate.h"
 #include "stringvector.h"
+#include "process.h"
+#include "vmcore.h"
+#include "elfnotes.h"
+#include "kernellog.h"
+#include "dumpestimate.h"
+#include "pageclassifier.h"
+#include "transfermonitor.h"
+#include "chunkeddump.h"
+#include "chunkstore.h"
+#include "zstdprovider.h"
+#include "diskdump.h"
+#include "nativedump.h"
 
 using std::string;
 using std::list;
@@ -55,13 +77,242 @@ using std::ifstream;
 
 #define KERNELCOMMANDLINE "/proc/cmdline"
 
+// amount of data written to measure the target write speed
+#define CALIBRATE_WRITE_SIZE    (8UL << 20)
+
+// assumed write speed if it cannot be measured (100 Mbit/s)
+#define DEFAULT_WRITE_SPEED     (100e6 / 8)
+
+// see linux/ioprio.h
+#define IOPRIO_CLASS_SHIFT      13
+#define IOPRIO_CLASS_BE         2
+#define IOPRIO_WHO_PROCESS      1
+#define IOPRIO_LOWEST_LEVEL     7
+
+// -----------------------------------------------------------------------------
+static void setLowIOPriority(void)
+{
+    int prio = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | IOPRIO_LOWEST_LEVEL;
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, prio) < 0)
+        Debug::debug()->dbg("Cannot set I/O priority: %s", strerror(errno));
+}
+
+// -----------------------------------------------------------------------------
+static StringVector localTargets(const RootDirURLVector &urlv,
+                                 const StringVector &targets)
+{
+    StringVector ret;
+
+    // targets are assigned to URLs round-robin, see FileTransfer::perform()
+    for (StringVector::size_type i = 0; i < targets.size(); ++i) {
+        const RootDirURL &url = urlv[i % urlv.size()];
+        if (url.getProtocol() == URLParser::PROT_FILE) {
+            FilePath fp = url.getRealPath();
+            ret.push_back(fp.appendPath(targets[i]));
+        }
+    }
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+static unsigned long long diskUsage(const StringVector &files)
+{
+    unsigned long long ret = 0;
+
+    for (const auto &file : files) {
+        struct stat st;
+        if (stat(file.c_str(), &st) == 0)
+            ret += (unsigned long long)st.st_blocks * 512;
+    }
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+static StatsTransfer::DirectBytes directBytes(const RootDirURLVector &urlv)
+{
+    return [urlv](const StringVector &targets) {
+        return diskUsage(localTargets(urlv, targets));
+    };
+}
+
+//{{{ DmesgExtraction ----------------------------------------------------------
+
+/**
+ * Extracts the kernel log from the dump.
+ *
+ * The log is read directly from the dump if possible. Otherwise,
+ * "makedumpfile --dump-dmesg" runs in the background, so the kernel log
+ * can be extracted while the dump itself is being saved. The log is then
+ * written to a private temporary directory and transferred afterwards.
+ */
+class DmesgExtraction {
+
+    public:
+        DmesgExtraction(const FilePath &dump)
+            : m_dump(dump), m_haveLog(false)
+        { }
+
+        ~DmesgExtraction();
+
+        /**
+         * Read the kernel log directly from the dump.
+         *
+         * @return @c true on success, @c false otherwise
+         */
+        bool readNative();
+
+        /**
+         * Spawn a background extraction process.
+         *
+         * @exception KError if the temporary directory cannot be created
+         *            or the process cannot be spawned
+         */
+        void startBackground();
+
+        /**
+         * Check whether the log has been read already.
+         */
+        bool haveLog() const
+        { return m_haveLog; }
+
+        /**
+         * Get a data provider for the kernel log.
+         *
+         * If a background extraction is running, wait for it to finish.
+         * If neither the native nor the background extraction succeeded,
+         * the returned provider runs makedumpfile synchronously.
+         *
+         * @return a newly allocated data provider
+         * @exception KError if makedumpfile failed in the background
+         */
+        DataProvider *getProvider();
+
+    private:
+        bool running()
+        { return m_process.getChildPID() != -1; }
+
+        FilePath m_dump;
+        FilePath m_tmpdir;
+        SubProcess m_process;
+        string m_log;
+        bool m_haveLog;
+};
+
+// -----------------------------------------------------------------------------
+DmesgExtraction::~DmesgExtraction()
+{
+    if (running()) {
+        try {
+            m_process.kill();
+            m_process.wait();
+        } catch (const KError &error) {
+            Debug::debug()->dbg("%s", error.what());
+        }
+    }
+
+    if (m_tmpdir.size()) {
+        try {
+            m_tmpdir.rmdir(true);
+        } catch (const KError &error) {
+            Debug::debug()->dbg("%s", error.what());
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+bool DmesgExtraction::readNative()
+{
+    Debug::debug()->trace("DmesgExtraction::readNative()");
+
+    try {
+        Vmcore vmcore(m_dump);
+        Vmcoreinfo vmcoreinfo;
+        vmcoreinfo.readFromNotes(ElfNotes(vmcore));
+        m_log = KernelLog(vmcore, vmcoreinfo).dump();
+        m_haveLog = true;
+    } catch (const KError &error) {
+        Debug::debug()->dbg("Cannot read kernel log from %s: %s",
+                            m_dump.c_str(), error.what());
+    }
+    return m_haveLog;
+}
+
+// -----------------------------------------------------------------------------
+void DmesgExtraction::startBackground()
+{
+    Debug::debug()->trace("DmesgExtraction::startBackground()");
+
+    const char *tmp = getenv("TMPDIR");
+    FilePath tmpl(tmp && *tmp ? tmp : "/tmp");
+    tmpl.appendPath("kdump-dmesg.XXXXXX");
+
+    std::vector<char> buf(tmpl.begin(), tmpl.end());
+    buf.push_back('\0');
+    if (!mkdtemp(buf.data()))
+        throw KSystemError("Cannot create temporary directory " + tmpl,
+                           errno);
+    m_tmpdir = buf.data();
+
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (devnull < 0)
+        throw KSystemError("Cannot open /dev/null", errno);
+    m_process.setChildFD(STDOUT_FILENO,
+                         std::make_shared<SubProcessRedirect>(devnull));
+
+    FilePath logfile = m_tmpdir;
+    logfile.appendPath("dmesg.txt");
+
+    StringVector args;
+    args.push_back("--dump-dmesg");
+    args.push_back(m_dump);
+    args.push_back(logfile);
+    try {
+        m_process.spawn("makedumpfile", args);
+    } catch (...) {
+        close(devnull);
+        throw;
+    }
+    close(devnull);
+}
+
+// -----------------------------------------------------------------------------
+DataProvider *DmesgExtraction::getProvider()
+{
+    Debug::debug()->trace("DmesgExtraction::getProvider()");
+
+    if (m_haveLog)
+        return new BufferDataProvider(m_log.c_str(), m_log.size());
+
+    if (running()) {
+        int status = m_process.wait();
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            throw KError("makedumpfile --dump-dmesg failed with status " +
+                         StringUtil::number2string(status));
+
+        FilePath logfile = m_tmpdir;
+        logfile.appendPath("dmesg.txt");
+        return new FileDataProvider(logfile.c_str());
+    }
+
+    string directCmdline = "makedumpfile --dump-dmesg " + m_dump;
+    string pipeCmdline = "makedumpfile --dump-dmesg -F " + m_dump;
+    return new ProcessDataProvider(pipeCmdline.c_str(), directCmdline.c_str());
+}
+
+//}}}
 //{{{ SaveDump -----------------------------------------------------------------
 
 // -----------------------------------------------------------------------------
 SaveDump::SaveDump()
     : m_dump(DEFAULT_DUMP), m_transfer(NULL), m_usedDirectSave(false),
-      m_useMakedumpfile(false), m_split(0), m_threads(0), m_crashtime(0),
-      m_nomail(false)
+      m_useMakedumpfile(false), m_nativeDump(false), m_split(0),
+      m_threads(0), m_crashtime(0),
+      m_nomail(false), m_dumplevel(0), m_estimatedSize(0),
+      m_estimateFailed(false), m_truncated(false), m_abortedBytes(0),
+      m_targetHung(false), m_autoFormat(false),
+      m_numTargets(1), m_canSplit(false), m_failover(false),
+      m_dedup(false), m_dedupTotal(0), m_dedupNew(0),
+      m_startTime(std::chrono::steady_clock::now()), m_copyStatsFd(-1)
 {
     Debug::debug()->trace("SaveDump::SaveDump()");
 
@@ -82,6 +333,8 @@ SaveDump::~SaveDump()
 {
     Debug::debug()->trace("SaveDump::~SaveDump()");
 
+    if (m_copyStatsFd >= 0)
+        close(m_copyStatsFd);
     delete m_transfer;
 }
 
@@ -101,19 +354,23 @@ void SaveDump::execute()
         m_hostname.c_str(), int(m_nomail));
 
     Configuration *config = Configuration::config();
+    m_startTime = std::chrono::steady_clock::now();
 
     // check if the dump file actually exists
     if (!m_dump.exists())
         throw KError("The dump file " + m_dump + " does not exist.");
 
     try {
+        SaveStats::Timer timer(m_stats, SaveStats::PHASE, "vmcoreinfo");
         fillVmcoreinfo();
+        timer.succeed();
     } catch (const KError &error) {
         Debug::debug()->dbg("Error when reading VMCOREINFO: %s", error.what());
     }
 
     // build the transfer object
     // prepend a time stamp to the save dir
+    SaveStats::Clock::time_point start = SaveStats::Clock::now();
     string subdir = StringUtil::formatUnixTime(ISO_DATETIME, m_crashtime);
     RootDirURLVector urlv;
     std::istringstream iss(config->KDUMP_SAVEDIR.value());
@@ -132,7 +389,35 @@ void SaveDump::execute()
         urlv.push_back(RootDirURL(elem, m_rootdir));
     }
 
-    m_transfer = getTransfer(urlv);
+    // with FAILOVER, save to the first target and keep the others
+    // in case it fails
+    if (config->kdumptoolContainsFlag("FAILOVER") && urlv.size() > 1) {
+        m_failover = true;
+        m_failoverTargets.assign(urlv.begin() + 1, urlv.end());
+        urlv.erase(urlv.begin() + 1, urlv.end());
+    }
+
+    m_transfer = new StatsTransfer(getTransfer(urlv), m_stats,
+                                   directBytes(urlv));
+    m_stats.addPhase("targets", start, true);
+
+    // if we have no VMCOREINFO, then try to command line to get the
+    // kernel version
+    if (m_crashrelease.size() == 0) {
+        try {
+            m_crashrelease = getKernelReleaseCommandline();
+        } catch (const KError &error) {
+            Debug::debug()->dbg("Unable to retrieve kernel version: %s",
+                    error.what());
+        }
+    }
+
+    // copy the kernel while the dump is being saved, unless the target
+    // may still change
+    if (m_crashrelease.size() > 0 && config->KDUMP_COPY_KERNEL.value() &&
+        m_failoverTargets.empty())
+        startCopyKernel(urlv);
+    bool copyInBackground = m_copyWorker.getChildPID() != -1;
 
     // save the dump
     try {
@@ -142,6 +427,15 @@ void SaveDump::execute()
 
         sendNotification(true, urlv);
 
+        // the dump directory may be deleted, so the copy must finish first
+        if (copyInBackground) {
+            try {
+                finishCopyKernel();
+            } catch (const KError &error) {
+                cout << error.what() << endl;
+            }
+        }
+
         // run checkAndDelete() in any case
         try {
             checkAndDelete(urlv);
@@ -151,18 +445,48 @@ void SaveDump::execute()
 
         if (config->KDUMP_CONTINUE_ON_ERROR.value())
             cout << error.what() << endl;
-        else
+        else {
+            // record how far the save got
+            try {
+                generateInfo();
+            } catch (const KError &error) {
+                cout << error.what() << endl;
+            }
+            try {
+                writeStats();
+            } catch (const KError &error) {
+                cout << error.what() << endl;
+            }
             throw;
+        }
     }
 
     // send the email afterwards
+    start = SaveStats::Clock::now();
     sendNotification(false, urlv);
+    m_stats.addPhase("notification", start, true);
+
+    // the copy uses disk space and writes into the dump directory, so
+    // it must finish before the free space is checked
+    if (m_copyWorker.getChildPID() != -1) {
+        try {
+            finishCopyKernel();
+        } catch (const KError &error) {
+            setErrorCode(1);
+            if (config->KDUMP_CONTINUE_ON_ERROR.value())
+                cout << error.what() << endl;
+            else
+                throw;
+        }
+    }
 
     // because we don't know the file size in advance, check
     // afterwards if the disk space is not sufficient and delete
     // the dump again
     try {
+        SaveStats::Timer timer(m_stats, SaveStats::PHASE, "check_and_delete");
         checkAndDelete(urlv);
+        timer.succeed();
     } catch (const KError &error) {
         setErrorCode(1);
         if (config->KDUMP_CONTINUE_ON_ERROR.value())
@@ -173,8 +497,12 @@ void SaveDump::execute()
 
     // copy the makedumpfile-R.pl
     try {
-        if (!m_usedDirectSave && m_useMakedumpfile)
+        if (!m_usedDirectSave && m_useMakedumpfile) {
+            SaveStats::Timer timer(m_stats, SaveStats::PHASE,
+                                   "makedumpfile_r");
             copyMakedumpfile();
+            timer.succeed();
+        }
     } catch (const KError &error) {
         setErrorCode(1);
         if (config->KDUMP_CONTINUE_ON_ERROR.value())
@@ -183,20 +511,11 @@ void SaveDump::execute()
             throw;
     }
 
-    // if we have no VMCOREINFO, then try to command line to get the
-    // kernel version
-    if (m_crashrelease.size() == 0) {
-        try {
-            m_crashrelease = getKernelReleaseCommandline();
-        } catch (const KError &error) {
-            Debug::debug()->dbg("Unable to retrieve kernel version: %s",
-                    error.what());
-        }
-    }
-
     // generate the README file
     try {
+        SaveStats::Timer timer(m_stats, SaveStats::PHASE, "readme");
         generateInfo();
+        timer.succeed();
     } catch (const KError &error) {
         setErrorCode(1);
         if (config->KDUMP_CONTINUE_ON_ERROR.value())
@@ -205,11 +524,17 @@ void SaveDump::execute()
             throw;
     }
 
-    // copy kernel
-    if (m_crashrelease.size() > 0) {
+    // copy kernel, unless it has been copied in the background
+    if (copyInBackground) {
+        Debug::debug()->dbg("Kernel has been copied in the background.");
+    } else if (m_crashrelease.size() > 0) {
         try {
-            if (config->KDUMP_COPY_KERNEL.value())
-                copyKernel();
+            if (config->KDUMP_COPY_KERNEL.value()) {
+                SaveStats::Timer timer(m_stats, SaveStats::PHASE,
+                                       "copy_kernel");
+                copyKernel(true);
+                timer.succeed();
+            }
         } catch (const KError &error) {
             setErrorCode(1);
             if (config->KDUMP_CONTINUE_ON_ERROR.value())
@@ -221,19 +546,47 @@ void SaveDump::execute()
         Debug::debug()->info("Don't copy the kernel and System.map because of missing "
             "crash kernel release.");
     }
+
+    // write the statistics last, so they cover all steps
+    try {
+        writeStats();
+    } catch (const KError &error) {
+        cout << error.what() << endl;
+    }
 }
 
 // -----------------------------------------------------------------------------
-void SaveDump::saveDump(const RootDirURLVector &urlv)
+void SaveDump::writeStats()
+{
+    Configuration *config = Configuration::config();
+
+    string const& s = m_stats.toJSON();
+    if (m_targetHung) {
+        cout << "Dump target does not respond. Statistics:" << endl << s;
+        return;
+    }
+    BufferDataProvider provider(s.c_str(), s.size());
+    TerminalProgress progress("Saving statistics");
+    if (config->KDUMP_VERBOSE.value()
+	& Configuration::VERB_PROGRESS)
+        provider.setProgress(&progress);
+    else
+        cout << "Saving statistics" << endl;
+    m_transfer->perform(&provider, "stats.json", NULL);
+}
+
+// -----------------------------------------------------------------------------
+void SaveDump::saveDump(RootDirURLVector &urlv)
 {
     Configuration *config = Configuration::config();
 
     // build the data provider object
-    int dumplevel = config->KDUMP_DUMPLEVEL.value();
-    if (dumplevel < 0 || dumplevel > 31) {
-        Debug::debug()->info("Dumplevel %d is invalid. Using 0.", dumplevel);
-        dumplevel = 0;
+    m_dumplevel = config->KDUMP_DUMPLEVEL.value();
+    if (m_dumplevel < 0 || m_dumplevel > 31) {
+        Debug::debug()->info("Dumplevel %d is invalid. Using 0.", m_dumplevel);
+        m_dumplevel = 0;
     }
+    m_dumpformat = config->KDUMP_DUMPFORMAT.value();
 
     // check if the vmcore file does exist and has a size of > 0
     if (!m_dump.exists()) {
@@ -245,41 +598,121 @@ void SaveDump::saveDump(const RootDirURLVector &urlv)
 
     Terminal terminal;
 
-    // Save a copy of dmesg
+    // Save a copy of dmesg. If it cannot be read directly from the dump,
+    // extract it in the background while the dump is being saved.
+    cout << "Extracting dmesg" << endl;
+    DmesgExtraction dmesg(m_dump);
+    if (dmesg.readNative()) {
+        saveDmesg(dmesg, terminal);
+    } else {
+        try {
+            dmesg.startBackground();
+        } catch (const KError &error) {
+            Debug::debug()->dbg("Cannot extract dmesg in background: %s",
+                                error.what());
+        }
+    }
+
+    // the log must be saved again if the target changes
+    size_t failures = m_failedTargets.size();
     try {
-        string directCmdline = "makedumpfile --dump-dmesg " + m_dump;
-	string pipeCmdline = "makedumpfile --dump-dmesg -F " + m_dump;
-	ProcessDataProvider logProvider(
-	    pipeCmdline.c_str(), directCmdline.c_str());
+        saveVmcore(urlv, terminal);
+    } catch (...) {
+        if (!dmesg.haveLog() || m_failedTargets.size() != failures)
+            saveDmesg(dmesg, terminal);
+        throw;
+    }
+    if (!dmesg.haveLog() || m_failedTargets.size() != failures)
+        saveDmesg(dmesg, terminal);
+}
+
+// -----------------------------------------------------------------------------
+void SaveDump::saveDmesg(DmesgExtraction &dmesg, Terminal &terminal)
+{
+    Configuration *config = Configuration::config();
+
+    if (m_targetHung) {
+        cout << "Dump target does not respond, not saving dmesg." << endl;
+        return;
+    }
+
+    SaveStats::Timer timer(m_stats, SaveStats::PHASE, "dmesg");
+    try {
+        std::unique_ptr<DataProvider> logProvider(dmesg.getProvider());
 
-	cout << "Extracting dmesg" << endl;
 	terminal.printLine();
 	TerminalProgress logProgress("Saving dmesg");
         if (config->KDUMP_VERBOSE.value()
 	    & Configuration::VERB_PROGRESS)
-            logProvider.setProgress(&logProgress);
+            logProvider->setProgress(&logProgress);
         else
             cout << "Saving dmesg ..." << endl;
-        m_transfer->perform(&logProvider, "dmesg.txt", NULL);
+        m_transfer->perform(logProvider.get(), "dmesg.txt", NULL);
 	terminal.printLine();
+        timer.setBytes(logProvider->bytesProvided());
+        timer.succeed();
     } catch (const KError &error) {
 	cout << error.what() << endl;
     } catch (...) {
 	cout << "Extracting failed." << endl;
     }
+}
 
-    // dump format
-    const string &dumpformat = config->KDUMP_DUMPFORMAT.value();
-    DataProvider *provider;
+// -----------------------------------------------------------------------------
+void SaveDump::planTargets(const RootDirURLVector &urlv)
+{
+    m_numTargets = urlv.size();
+
+    // only transfers based on FileTransfer let makedumpfile write the
+    // dump files directly, which is required for --split
+    switch (urlv.front().getProtocol()) {
+    case URLParser::PROT_FILE:
+    case URLParser::PROT_NFS:
+    case URLParser::PROT_CIFS:
+        m_canSplit = true;
+        break;
+    default:
+        m_canSplit = false;
+        break;
+    }
 
-    bool noDump = strcasecmp(dumpformat.c_str(), "none") == 0;
-    bool useElf = strcasecmp(dumpformat.c_str(), "elf") == 0;
-    bool useCompressed = strcasecmp(dumpformat.c_str(), "compressed") == 0;
-    bool useLZO = strcasecmp(dumpformat.c_str(), "lzo") == 0;
-    bool useSnappy = strcasecmp(dumpformat.c_str(), "snappy") == 0;
+    // the chunk store takes a single stream
+    m_dedup = Configuration::config()->kdumptoolContainsFlag("DEDUP") &&
+        urlv.front().getProtocol() == URLParser::PROT_FILE;
+    if (m_dedup) {
+        if (m_numTargets > 1)
+            cerr << "The chunk store uses only the first dump target."
+                 << endl;
+        m_numTargets = 1;
+        m_canSplit = false;
+
+        // Compressed and flattened streams change completely if a single
+        // page changes, so only plain memory deduplicates well. Read
+        // /proc/vmcore as is, with every page at a fixed offset.
+        if (strcasecmp(m_dumpformat.c_str(), "elf") != 0 || m_dumplevel) {
+            cerr << "WARNING: The chunk store (DEDUP) saves the dump in ELF "
+                    "format with dump level 0. Ignoring KDUMP_DUMPFORMAT="
+                 << m_dumpformat << " and KDUMP_DUMPLEVEL=" << m_dumplevel
+                 << "." << endl;
+            m_dumpformat = "ELF";
+            m_dumplevel = 0;
+        }
+    }
 
-    if (noDump)
-	return;			// nothing to be done
+    Debug::debug()->dbg("%lu dump targets, direct save %spossible",
+                        m_numTargets, m_canSplit ? "" : "not ");
+}
+
+// -----------------------------------------------------------------------------
+void SaveDump::planCPUs(bool verbose)
+{
+    Configuration *config = Configuration::config();
+    bool useElf = strcasecmp(m_dumpformat.c_str(), "elf") == 0;
+    bool useChunked = strcasecmp(m_dumpformat.c_str(), "chunked") == 0;
+    bool useZstd = strcasecmp(m_dumpformat.c_str(), "zstd") == 0;
+
+    m_split = 0;
+    m_threads = 0;
 
     unsigned long cpus = config->KDUMP_CPUS.value();
     unsigned long online_cpus = 0;
@@ -290,48 +723,475 @@ void SaveDump::saveDump(const RootDirURLVector &urlv)
         if (cpus > online_cpus)
             cpus = online_cpus;
     }
-    if (!config->kdumptoolContainsFlag("SINGLE") &&
-        cpus > 1) {
+    if (config->kdumptoolContainsFlag("SINGLE"))
+        return;
 
-        /* The check for NOSPLIT is for backward compatibility */
-        if (config->kdumptoolContainsFlag("SPLIT") &&
-            !config->kdumptoolContainsFlag("NOSPLIT")) {
-            if (!useElf)
-                m_split = cpus;
-            else
-                cerr << "Splitting ELF dumps is not supported." << endl;
-        } else {
-            if (!useElf)
-                m_threads = cpus - 1;
-            else
-                cerr << "Multithreading is unavailable for ELF dumps" << endl;
+    /* The check for NOSPLIT is for backward compatibility */
+    bool wantSplit = config->kdumptoolContainsFlag("SPLIT") &&
+        !config->kdumptoolContainsFlag("NOSPLIT");
+    bool multiTarget = m_canSplit && m_numTargets > 1;
+
+    // zstd and the native engine compress in kdumptool itself, so
+    // KDUMP_CPUS=0 ("all CPUs") means all CPUs online now
+    if (!cpus && (useZstd || config->kdumptoolContainsFlag("NATIVE")))
+        cpus = SystemCPU().numOnline();
+
+    if (cpus <= 1 && !multiTarget)
+        return;
+
+    if (useElf) {
+        if (verbose && multiTarget)
+            cerr << "Splitting ELF dumps is not supported. "
+                "Only the first dump target is used." << endl;
+        else if (verbose && wantSplit)
+            cerr << "Splitting ELF dumps is not supported." << endl;
+        else if (verbose)
+            cerr << "Multithreading is unavailable for ELF dumps" << endl;
+        return;
+    }
+
+    if (useZstd) {
+        if (verbose && multiTarget)
+            cerr << "Splitting zstd dumps is not supported. "
+                "Only the first dump target is used." << endl;
+        else if (verbose && wantSplit)
+            cerr << "Splitting zstd dumps is not supported." << endl;
+        // kdumptool compresses with all CPUs
+        m_threads = cpus;
+        if (verbose)
+            Debug::debug()->info("Using %lu zstd compression threads",
+                                 m_threads);
+        return;
+    }
+
+    if (useChunked) {
+        if (verbose && multiTarget)
+            cerr << "Splitting chunked dumps is not supported. "
+                "Only the first dump target is used." << endl;
+        else if (verbose && wantSplit)
+            cerr << "Splitting chunked dumps is not supported." << endl;
+        return;
+    }
+
+    if (config->kdumptoolContainsFlag("NATIVE")) {
+        if (verbose && multiTarget)
+            cerr << "Splitting is not supported without makedumpfile. "
+                "Only the first dump target is used." << endl;
+        else if (verbose && wantSplit)
+            cerr << "Splitting is not supported without makedumpfile. "
+                "Using threads instead." << endl;
+        m_threads = cpus > 1 ? cpus - 1 : 0;
+        if (verbose)
+            Debug::debug()->info("Using %lu compression threads",
+                                 m_threads ? m_threads : 1);
+        return;
+    }
+
+    if (wantSplit && !m_canSplit && verbose)
+        cerr << "Splitting is not supported for this dump target. "
+            "Using threads instead." << endl;
+
+    if (multiTarget || (wantSplit && m_canSplit)) {
+        // Use at least one process per target, so no target is idle,
+        // and a multiple of the target count, so parts are assigned to
+        // targets evenly (see FileTransfer::perform()).
+        m_split = cpus - cpus % m_numTargets;
+        if (m_split < m_numTargets)
+            m_split = m_numTargets;
+    } else
+        m_threads = cpus - 1;
+
+    if (verbose)
+        Debug::debug()->info("Using %lu CPUs: %lu split parts, %lu threads",
+                             cpus, m_split, m_threads);
+}
+
+// -----------------------------------------------------------------------------
+static bool fitsOnDisk(const RootDirURLVector &urlv, unsigned long parts,
+                       unsigned long long size, unsigned long long reserve,
+                       RootDirURLVector::const_iterator *full)
+{
+    RootDirURLVector::const_iterator it;
+    unsigned long idx = 0;
+
+    for (it = urlv.begin(); it != urlv.end(); ++it, ++idx) {
+        if (it->getProtocol() != URLParser::PROT_FILE)
+            continue;
+
+        // parts are assigned to targets round-robin
+        unsigned long myparts = parts / urlv.size() +
+            (idx < parts % urlv.size() ? 1 : 0);
+        if (!myparts)
+            continue;
+
+        FilePath path = it->getRealPath();
+        unsigned long long freeSize = path.freeDiskSize();
+        unsigned long long need = size / parts * myparts + reserve;
+        Debug::debug()->dbg("%s: need %llu MiB, free %llu MiB",
+                            path.c_str(), bytes_to_megabytes(need),
+                            bytes_to_megabytes(freeSize));
+        if (freeSize < need) {
+            if (full)
+                *full = it;
+            return false;
         }
     }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+static void collectChunks(const FilePath &savedir)
+{
+    FilePath store = savedir;
+    store.appendPath(ChunkStore::STORE_DIR);
+    if (!store.exists())
+        return;
+
+    try {
+        ChunkStore(savedir).collectGarbage(false);
+    } catch (const KError &error) {
+        cerr << error.what() << endl;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static bool deleteOldestDump(const RootDirURL &url)
+{
+    FilePath dir = FilePath(url.getRealPath()).dirName();
+    StringVector contents = dir.listDir(FilterKdumpDirs());
+    if (contents.empty())
+        return false;
+
+    FilePath fp = dir;
+    fp.appendPath(contents.front());
+    cout << "Deleting old dump " << fp << " to make room." << endl;
+    fp.rmdir(true);
+    collectChunks(dir);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+DumpEstimate *SaveDump::getEstimate()
+{
+    if (m_estimate || m_estimateFailed)
+        return m_estimate.get();
+
+    unsigned long pagesize = sysconf(_SC_PAGESIZE);
+    Vmcoreinfo vm;
+    bool haveInfo = false;
+    try {
+        vm.readFromELF(m_dump.c_str());
+        pagesize = vm.getIntValue("PAGESIZE");
+        haveInfo = true;
+    } catch (const KError &error) {
+        Debug::debug()->dbg("Error getting PAGESIZE: %s", error.what());
+    }
+
+    try {
+        m_vmcore.reset(new Vmcore(m_dump));
+        m_estimate.reset(new DumpEstimate(*m_vmcore, pagesize));
+
+        // the sampled classes estimate cache, user and free pages
+        PageClassifier classifier(*m_vmcore, haveInfo ? &vm : NULL,
+                                  pagesize);
+        classifier.init();
+        m_estimate->sample(DumpEstimate::DEFAULT_SAMPLES, &classifier);
+    } catch (const KError &error) {
+        Debug::debug()->dbg("Cannot estimate dump size: %s", error.what());
+        m_estimate.reset();
+        m_vmcore.reset();
+        m_estimateFailed = true;
+    }
+    return m_estimate.get();
+}
+
+// -----------------------------------------------------------------------------
+unsigned long long SaveDump::estimateSize(bool sparse, int dumplevel)
+{
+    DumpEstimate *estimate = getEstimate();
+    if (!estimate)
+        return 0;
+
+    bool useElf = strcasecmp(m_dumpformat.c_str(), "elf") == 0;
+    return estimate->estimate(dumplevel,
+        useElf ? DumpEstimate::FMT_ELF : DumpEstimate::FMT_COMPRESSED,
+        sparse);
+}
+
+// -----------------------------------------------------------------------------
+unsigned long long SaveDump::estimateDedupSize(const RootDirURL &url)
+{
+    DumpEstimate *estimate = getEstimate();
+    if (!estimate)
+        return 0;
+
+    // zero pages share a single chunk, and only new chunks are written
+    FilePath savedir = FilePath(url.getRealPath()).dirName();
+    return estimate->nonZeroBytes(0) * ChunkStore::newRatio(savedir);
+}
+
+// -----------------------------------------------------------------------------
+bool SaveDump::levelReducesSize(int dumplevel)
+{
+    // without an estimate, assume that makedumpfile finds something
+    if (!getEstimate())
+        return true;
+
+    // cache, user and free pages are only known from struct page
+    return estimateSize(true, dumplevel) < estimateSize(true, m_dumplevel);
+}
+
+// -----------------------------------------------------------------------------
+void SaveDump::chooseFormat()
+{
+    Debug::debug()->trace("SaveDump::chooseFormat()");
+
+    Configuration *config = Configuration::config();
+    bool sparse = !config->kdumptoolContainsFlag("NOSPARSE");
+
+    m_dumpformat = "compressed";
+    m_autoFormat = true;
+
+    DumpEstimate *estimate = getEstimate();
+    if (!estimate) {
+        cout << "Cannot calibrate the dump format. Using "
+             << m_dumpformat << "." << endl;
+        return;
+    }
+
+    // number of CPUs available for compression
+    planCPUs();
+    unsigned long cpus = m_split ? m_split : m_threads + 1;
+
+    // write speed of the target, using incompressible data
+    std::vector<char> data(CALIBRATE_WRITE_SIZE);
+    unsigned long seed = 1;
+    for (auto &c : data) {
+        seed = seed * 1103515245 + 12345;
+        c = seed >> 16;
+    }
+    double writeSpeed = 0.0;
+    try {
+        writeSpeed = m_transfer->measureThroughput(data.data(), data.size());
+    } catch (const KError &error) {
+        Debug::debug()->dbg("Cannot measure write speed: %s", error.what());
+    }
+    if (writeSpeed > 0)
+        Debug::debug()->info("Target write speed: %.1f MiB/s",
+                             writeSpeed / (1024 * 1024));
+    else {
+        writeSpeed = DEFAULT_WRITE_SPEED;
+        Debug::debug()->info("Target write speed unknown, assuming "
+                             "%.1f MiB/s", writeSpeed / (1024 * 1024));
+    }
+
+    // compression and writing overlap, so the slower one wins
+    DumpEstimate::Format best = DumpEstimate::FMT_COMPRESSED;
+    double bestTime = -1.0;
+    unsigned long long bestSize = 0;
+    for (int fmt = 0; fmt < DumpEstimate::FMT_MAX; ++fmt) {
+        DumpEstimate::Format format = DumpEstimate::Format(fmt);
+        if (!estimate->haveFormat(format))
+            continue;
+
+        unsigned long long size = estimate->estimate(m_dumplevel, format,
+                                                     sparse);
+        double ioTime = size / writeSpeed;
+        double cpuTime = 0.0;
+        if (format != DumpEstimate::FMT_ELF) {
+            double speed = estimate->compressionSpeed(format);
+            if (speed <= 0)
+                continue;
+            cpuTime = estimate->nonZeroBytes(m_dumplevel) / (speed * cpus);
+        }
+        double time = std::max(ioTime, cpuTime);
+
+        Debug::debug()->info("Format %s: ratio %.2f, size %llu MiB, "
+                             "compression %.1f s, writing %.1f s",
+                             DumpEstimate::formatName(format),
+                             estimate->compressionRatio(format),
+                             bytes_to_megabytes(size), cpuTime, ioTime);
+
+        if (bestTime < 0 || time < bestTime ||
+            (time == bestTime && size < bestSize)) {
+            best = format;
+            bestTime = time;
+            bestSize = size;
+        }
+    }
+
+    m_dumpformat = DumpEstimate::formatName(best);
+    cout << "Using dump format " << m_dumpformat
+         << " (estimated " << (unsigned long long)bestTime << " s)" << endl;
+}
+
+// -----------------------------------------------------------------------------
+void SaveDump::checkFreeSpace(const RootDirURLVector &urlv)
+{
+    Debug::debug()->trace("SaveDump::checkFreeSpace()");
+
+    Configuration *config = Configuration::config();
+    RootDirURLVector::const_iterator it;
+
+    for (it = urlv.begin(); it != urlv.end(); ++it)
+        if (it->getProtocol() == URLParser::PROT_FILE)
+            break;
+    if (it == urlv.end() || !getEstimate())
+        return;
+
+    bool sparse = !config->kdumptoolContainsFlag("NOSPARSE");
+    unsigned long long reserve =
+        (unsigned long long)config->KDUMP_FREE_DISK_SIZE.value() << 20;
+    RootDirURLVector::const_iterator full;
+
+    while (true) {
+        bool useElf = strcasecmp(m_dumpformat.c_str(), "elf") == 0;
+        m_estimatedSize = m_dedup
+            ? estimateDedupSize(urlv.front())
+            : estimateSize(sparse, m_dumplevel);
+        planCPUs();
+
+        if (fitsOnDisk(urlv, m_split ? m_split : 1, m_estimatedSize,
+                       reserve, &full))
+            break;
+
+        // first try to make the dump smaller; the chunk store needs
+        // plain ELF at dump level 0 (see planTargets())
+        if (useElf && !m_dedup) {
+            cout << "Dump does not fit on disk. "
+                "Switching to compressed format." << endl;
+            m_dumpformat = "compressed";
+            continue;
+        }
+        if (!m_dedup && m_dumplevel != 31 && levelReducesSize(31)) {
+            cout << "Dump does not fit on disk. "
+                "Switching to dump level 31." << endl;
+            m_dumplevel = 31;
+            continue;
+        }
+
+        // then delete old dumps if allowed
+        if (config->kdumptoolContainsFlag("ROTATE") &&
+            deleteOldestDump(*full))
+            continue;
+
+        cerr << "WARNING: Estimated dump size ("
+             << bytes_to_megabytes(m_estimatedSize)
+             << " MiB) exceeds free disk space." << endl;
+        break;
+    }
+
+    Debug::debug()->dbg("Estimated dump size: %llu MiB",
+                        bytes_to_megabytes(m_estimatedSize));
+}
+
+// -----------------------------------------------------------------------------
+bool SaveDump::reduceForTime(bool apply)
+{
+    // the chunk store needs plain ELF at dump level 0
+    if (m_dedup)
+        return false;
+
+    bool useElf = strcasecmp(m_dumpformat.c_str(), "elf") == 0;
+    bool useCompressed = strcasecmp(m_dumpformat.c_str(), "compressed") == 0;
+
+    // fewer pages help regardless of where the bottleneck is
+    if (m_dumplevel != 31 && levelReducesSize(31)) {
+        if (apply) {
+            cout << "Switching to dump level 31 to meet the time budget."
+                 << endl;
+            m_dumplevel = 31;
+        }
+        return true;
+    }
+
+    // LZO is much faster than zlib and still reduces the amount of data
+    if (useElf || useCompressed) {
+        if (apply) {
+            cout << "Switching to LZO compression to meet the time budget."
+                 << endl;
+            m_dumpformat = "lzo";
+            planCPUs();
+        }
+        return true;
+    }
+
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+DataProvider *SaveDump::createProvider()
+{
+    Configuration *config = Configuration::config();
+    DataProvider *provider;
+
+    // dump format
+    bool useElf = strcasecmp(m_dumpformat.c_str(), "elf") == 0;
+    bool useCompressed = strcasecmp(m_dumpformat.c_str(), "compressed") == 0;
+    bool useLZO = strcasecmp(m_dumpformat.c_str(), "lzo") == 0;
+    bool useSnappy = strcasecmp(m_dumpformat.c_str(), "snappy") == 0;
+    bool useChunked = strcasecmp(m_dumpformat.c_str(), "chunked") == 0;
+    bool useZstd = strcasecmp(m_dumpformat.c_str(), "zstd") == 0;
+
+#if !HAVE_ZSTD
+    if (useZstd)
+        throw KError("kdumptool was built without zstd support.");
+#endif
 
     bool excludeDomU = false;
     if (!config->kdumptoolContainsFlag("XENALLDOMAINS") &&
 	Util::isXenCoreDump(m_dump.c_str()))
       excludeDomU = true;
 
-    if (useElf && dumplevel == 0 && !excludeDomU) {
+    // filter and compress in kdumptool?
+    provider = NULL;
+    m_nativeDump = false;
+    if (config->kdumptoolContainsFlag("NATIVE") && !excludeDomU &&
+        !m_split && (useCompressed || useLZO || useSnappy)) {
+        NativeDumpProvider::Compression compression =
+            useLZO ? NativeDumpProvider::COMP_LZO :
+            useSnappy ? NativeDumpProvider::COMP_SNAPPY :
+            NativeDumpProvider::COMP_ZLIB;
+        try {
+            std::unique_ptr<NativeDumpProvider> native(
+                new NativeDumpProvider(m_dump, m_dumplevel, compression,
+                                       m_threads));
+            if (native->init()) {
+                provider = native.release();
+                m_nativeDump = true;
+            } else
+                cerr << "Dump level " << m_dumplevel << " needs struct page "
+                    "information. Using makedumpfile." << endl;
+        } catch (const KError &error) {
+            cerr << error.what() << " Using makedumpfile." << endl;
+        }
+    }
+
+    if (m_nativeDump) {
+        // same output as makedumpfile
+        m_useMakedumpfile = true;
+    } else if ((useElf || useZstd) && m_dumplevel == 0 && !excludeDomU) {
         // use file source?
         provider = new FileDataProvider(m_dump.c_str());
         m_useMakedumpfile = false;
+    } else if (useChunked) {
+        provider = new ChunkedDataProvider(m_dump, m_dumplevel);
+        m_useMakedumpfile = false;
     } else {
         // use makedumpfile
         ostringstream cmdline;
         cmdline << "makedumpfile ";
 	if (m_split)
 	    cmdline << "--split ";
-        if (m_threads) {
+        if (m_threads && !useZstd) {
 	    SystemCPU syscpu;
             cmdline << "--num-threads " << m_threads << " ";
         }
         cmdline << config->MAKEDUMPFILE_OPTIONS.value() << " ";
-        cmdline << "-d " << config->KDUMP_DUMPLEVEL.value() << " ";
+        cmdline << "-d " << m_dumplevel << " ";
 	if (excludeDomU)
 	    cmdline << "-X ";
-        if (useElf)
+        if (useElf || useZstd)
             cmdline << "-E ";
         if (useCompressed)
             cmdline << "-c ";
@@ -349,33 +1209,304 @@ void SaveDump::saveDump(const RootDirURLVector &urlv)
         m_useMakedumpfile = true;
     }
 
-    try {
-        if (m_useMakedumpfile) {
-            cout << "Saving dump using makedumpfile" << endl;
-            terminal.printLine();
-        }
-        TerminalProgress progress("Saving dump");
-        if (config->KDUMP_VERBOSE.value()
-	    & Configuration::VERB_PROGRESS)
-            provider->setProgress(&progress);
-        else
-            cout << "Saving dump ..." << endl;
+#if HAVE_ZSTD
+    if (useZstd)
+        provider = new ZstdDataProvider(provider, m_threads);
+#endif
+
+    return provider;
+}
+
+// -----------------------------------------------------------------------------
+static void markIncomplete(const FilePath &file)
+{
+    FileDescriptor fd(file, O_RDWR);
+    struct disk_dump_header hdr;
+
+    if (pread(fd, &hdr, sizeof hdr, 0) != sizeof hdr ||
+        memcmp(hdr.signature, KDUMP_SIGNATURE, sizeof hdr.signature)) {
+        Debug::debug()->dbg("%s is not in kdump-compressed format",
+                            file.c_str());
+        return;
+    }
+
+    hdr.status |= DUMP_DH_COMPRESSED_INCOMPLETE;
+    if (pwrite(fd, &hdr.status, sizeof hdr.status,
+               offsetof(struct disk_dump_header, status)) < 0)
+        throw KSystemError("Cannot mark " + file + " incomplete", errno);
+}
+
+// -----------------------------------------------------------------------------
+void SaveDump::saveVmcore(RootDirURLVector &urlv, Terminal &terminal)
+{
+    Configuration *config = Configuration::config();
+
+    if (strcasecmp(m_dumpformat.c_str(), "none") == 0)
+	return;			// nothing to be done
+
+    SaveStats::Timer timer(m_stats, SaveStats::PHASE, "vmcore");
+    planTargets(urlv);
+    if (strcasecmp(m_dumpformat.c_str(), "auto") == 0)
+        chooseFormat();
+
+    checkFreeSpace(urlv);
+    planCPUs(true);
+
+    int budget = config->KDUMP_TIME_BUDGET.value();
+    bool sparse = !config->kdumptoolContainsFlag("NOSPARSE");
+    unsigned stallTimeout = config->KDUMP_STALL_TIMEOUT.value();
+    unsigned long long minRate = config->KDUMP_MIN_THROUGHPUT.value();
+
+    while (true) {
+        DataProvider *provider = createProvider();
+
+        StringVector targets;
 	if (m_split) {
-	    StringVector targets;
 	    for (unsigned long i = 1; i <= m_split; ++i) {
 		ostringstream ss;
 		ss << "vmcore" << i;
 		targets.push_back(ss.str());
 	    }
-	    m_transfer->perform(provider, targets, &m_usedDirectSave);
-	} else {
-	    m_transfer->perform(provider, "vmcore", &m_usedDirectSave);
-	}
-        if (m_useMakedumpfile)
-            terminal.printLine();
-    } catch (...) {
+	} else
+            targets.push_back("vmcore");
+        StringVector localFiles = localTargets(urlv, targets);
+
+        // only FileTransfer lets makedumpfile write the files directly
+        bool direct = provider->canSaveToFile() && m_canSplit;
+        std::function<unsigned long long()> done;
+        if (direct)
+            done = [localFiles]{ return diskUsage(localFiles); };
+        else
+            done = [provider]{ return provider->bytesProvided(); };
+
+        // watch the free disk space while saving
+        TransferMonitor monitor(provider);
+        unsigned long long minFree = config->KDUMP_FREE_DISK_SIZE.value();
+        if (minFree > 0) {
+            RootDirURLVector::const_iterator it;
+            for (it = urlv.begin(); it != urlv.end(); ++it)
+                if (it->getProtocol() == URLParser::PROT_FILE)
+                    monitor.addCheck(new FreeSpaceCheck(it->getRealPath(),
+                                                        minFree));
+        }
+
+        // and the time budget; leave 10% for the remaining steps
+        TimeBudgetCheck *budgetCheck = NULL;
+        if (budget > 0) {
+            unsigned long long total;
+            if (direct)
+                total = estimateSize(sparse, m_dumplevel);
+            else
+                total = m_useMakedumpfile
+                    ? estimateSize(false, m_dumplevel) : m_dump.fileSize();
+            if (direct && localFiles.size() != targets.size())
+                total = 0;      // cannot measure remote files
+
+            budgetCheck = new TimeBudgetCheck(
+                m_startTime + std::chrono::milliseconds(budget * 900),
+                done, total, reduceForTime(false));
+            monitor.addCheck(budgetCheck);
+        }
+
+        // and the progress; makedumpfile writes nothing while it builds
+        // its bitmaps, so its CPU time counts as progress, too
+        StallCheck *stallCheck = NULL;
+        bool measurable = !direct || localFiles.size() == targets.size();
+        if (stallTimeout > 0 || minRate > 0) {
+            if (!measurable)
+                Debug::debug()->info("Cannot watch progress of dump files "
+                                     "on remote targets.");
+            else {
+                std::function<unsigned long long()> busy;
+                ProcessDataProvider *process =
+                    dynamic_cast<ProcessDataProvider *>(provider);
+                if (direct && process)
+                    busy = [process]{ return process->cpuTime(); };
+                stallCheck = new StallCheck(done, stallTimeout,
+                    minRate * 1024, stallTimeout ? stallTimeout : 60, busy);
+                monitor.addCheck(stallCheck);
+            }
+        }
+
+        // if the transfer cannot be interrupted after an abort,
+        // give up after another stall timeout without progress
+        if (measurable)
+            monitor.setHangTimeout(stallTimeout ? stallTimeout : 60, done);
+
+        // the transfer thread must not refer to anything on the stack,
+        // because it keeps running if it is abandoned
+        struct Outcome {
+            bool direct;
+            unsigned long long dedupTotal, dedupNew;
+        };
+        std::shared_ptr<Outcome> outcome = std::make_shared<Outcome>();
+        *outcome = Outcome{ false, 0, 0 };
+        Transfer *transfer = m_transfer;
+        bool dedup = m_dedup;
+        RootDirURLVector dedupURLs(urlv);
+
+        try {
+            if (m_useMakedumpfile && !m_nativeDump) {
+                cout << "Saving dump using makedumpfile" << endl;
+                terminal.printLine();
+            }
+            TerminalProgress progress("Saving dump");
+            if (config->KDUMP_VERBOSE.value()
+                & Configuration::VERB_PROGRESS)
+                provider->setProgress(&progress);
+            else
+                cout << "Saving dump ..." << endl;
+            try {
+                monitor.perform([=]() {
+                    if (dedup) {
+                        DedupTransfer dedupTransfer(dedupURLs);
+                        dedupTransfer.perform(provider, targets,
+                                              &outcome->direct);
+                        outcome->dedupTotal = dedupTransfer.bytesTotal();
+                        outcome->dedupNew = dedupTransfer.bytesNew();
+                    } else
+                        transfer->perform(provider, targets,
+                                          &outcome->direct);
+                });
+            } catch (...) {
+                if (monitor.abandoned())
+                    provider->setProgress(NULL);
+                throw;
+            }
+            m_usedDirectSave = outcome->direct;
+            m_dedupTotal = outcome->dedupTotal;
+            m_dedupNew = outcome->dedupNew;
+            if (m_useMakedumpfile && !m_nativeDump)
+                terminal.printLine();
+        } catch (...) {
+            unsigned long long progress = done();
+            if (monitor.abandoned()) {
+                // still in use by the transfer thread
+                m_targetHung = true;
+            } else
+                delete provider;
+            if (budgetCheck && budgetCheck->escalate() &&
+                !monitor.abandoned()) {
+                cout << monitor.abortReason() << endl;
+                reduceForTime(true);
+                for (const auto &file : localFiles)
+                    unlink(file.c_str());
+                continue;
+            }
+            if (budgetCheck && budgetCheck->exhausted() &&
+                !monitor.abandoned()) {
+                m_usedDirectSave = direct;
+                timer.setDirect(direct);
+                timer.setBytes(progress);
+                finishTruncated(localFiles);
+                return;
+            }
+            string reason = monitor.abortReason();
+            timer.setDirect(direct);
+            timer.setBytes(progress);
+            if (!m_failoverTargets.empty()) {
+                try {
+                    throw;
+                } catch (const KError &error) {
+                    if (reason.empty() || monitor.abandoned())
+                        reason = error.what();
+                }
+                failover(urlv, reason);
+                continue;
+            }
+            if (!reason.empty()) {
+                m_saveAborted = monitor.abandoned()
+                    ? string("Transfer cannot be interrupted: ") + reason
+                    : reason;
+                m_abortedBytes = progress;
+                m_usedDirectSave = direct;
+                throw KError(m_saveAborted);
+            }
+            throw;
+        }
+        timer.setDirect(m_usedDirectSave);
+        timer.setBytes(m_usedDirectSave
+                       ? diskUsage(localFiles) : provider->bytesProvided());
+        timer.succeed();
         delete provider;
-        throw;
+        if (config->kdumptoolContainsFlag("LOADINDEX"))
+            writeLoadIndex(localFiles);
+        m_targetURL = urlv.front().getURL();
+        break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+void SaveDump::failover(RootDirURLVector &urlv, string reason)
+{
+    Debug::debug()->trace("SaveDump::failover(%s)", reason.c_str());
+
+    while (true) {
+        cerr << "WARNING: Saving to " << urlv.front().getURL()
+             << " failed: " << reason << endl;
+        m_failedTargets.push_back(urlv.front().getURL() + " (" + reason + ")");
+        if (m_failoverTargets.empty())
+            throw KError(reason);
+
+        urlv.assign(1, m_failoverTargets.front());
+        m_failoverTargets.erase(m_failoverTargets.begin());
+        cout << "Saving to next target " << urlv.front().getURL() << endl;
+
+        try {
+            // an abandoned transfer may still use the old object
+            if (!m_targetHung)
+                delete m_transfer;
+            m_targetHung = false;
+            m_transfer = NULL;
+            m_transfer = new StatsTransfer(getTransfer(urlv), m_stats,
+                                           directBytes(urlv));
+            planTargets(urlv);
+            checkFreeSpace(urlv);
+            planCPUs(true);
+            return;
+        } catch (const KError &error) {
+            reason = error.what();
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+void SaveDump::finishTruncated(const StringVector &localFiles)
+{
+    bool useElf = strcasecmp(m_dumpformat.c_str(), "elf") == 0;
+
+    m_truncated = true;
+    setErrorCode(1);
+    cerr << "WARNING: Time budget exhausted. The dump is truncated." << endl;
+
+    if (!m_usedDirectSave || useElf || !m_useMakedumpfile)
+        return;
+
+    for (const auto &file : localFiles) {
+        try {
+            markIncomplete(file);
+        } catch (const KError &error) {
+            cerr << error.what() << endl;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+void SaveDump::writeLoadIndex(const StringVector &localFiles)
+{
+    bool useElf = strcasecmp(m_dumpformat.c_str(), "elf") == 0;
+
+    if (!useElf || m_dedup || localFiles.size() != 1) {
+        Debug::debug()->dbg("No load index for this dump format or target");
+        return;
+    }
+
+    FilePath file = localFiles.front();
+    try {
+        Vmcore vmcore(file);
+        vmcore.writeIndex(file + Vmcore::INDEX_SUFFIX);
+    } catch (const KError &error) {
+        cerr << "Cannot write load index: " << error.what() << endl;
     }
 }
 
@@ -508,21 +1639,82 @@ void SaveDump::generateInfo()
     if (m_crashrelease.size() > 0)
         infoLine(ss, "Kernel version", m_crashrelease);
     infoLine(ss, "Host", m_hostname);
-    infoLine(ss, "Dump level", config->KDUMP_DUMPLEVEL.value());
-    infoLine(ss, "Dump format", config->KDUMP_DUMPFORMAT.value());
+    infoLine(ss, "Dump level", m_dumplevel);
+    infoLine(ss, "Dump format", m_autoFormat
+             ? m_dumpformat + " (auto)" : m_dumpformat);
+    if (m_estimatedSize)
+        infoLine(ss, "Estimated size",
+                 StringUtil::number2string(
+                     bytes_to_megabytes(m_estimatedSize)) + " MiB");
     if (m_split && m_usedDirectSave)
         infoLine(ss, "Split parts", m_split);
+    if (m_dedup)
+        infoLine(ss, "Chunk store",
+                 StringUtil::number2string(bytes_to_megabytes(m_dedupNew)) +
+                 " of " +
+                 StringUtil::number2string(bytes_to_megabytes(m_dedupTotal)) +
+                 " MiB new");
+    if (m_failover) {
+        if (!m_targetURL.empty())
+            infoLine(ss, "Dump target", m_targetURL);
+        for (const auto &failed : m_failedTargets)
+            infoLine(ss, "Failed target", failed);
+    }
+    int budget = config->KDUMP_TIME_BUDGET.value();
+    if (budget > 0) {
+        std::chrono::seconds elapsed =
+            std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::steady_clock::now() - m_startTime);
+        infoLine(ss, "Time budget", StringUtil::number2string(budget) + " s");
+        infoLine(ss, "Time used",
+                 StringUtil::number2string(elapsed.count()) + " s");
+    }
+    if (m_truncated)
+        infoLine(ss, "Truncated", "yes (time budget exhausted)");
+    if (!m_saveAborted.empty()) {
+        infoLine(ss, "Aborted", m_saveAborted);
+        infoLine(ss, "Saved",
+                 StringUtil::number2string(
+                     bytes_to_megabytes(m_abortedBytes)) + " MiB");
+    }
     ss << endl;
 
-    if (m_useMakedumpfile && !m_usedDirectSave) {
+    if (m_dedup) {
+        ss << "NOTE:" << endl;
+        ss << "This dump was saved in the chunk store." << endl;
+        ss << "To restore the dump file, run "
+            "\"kdumptool restore_dump vmcore.recipe vmcore\" first." << endl;
+    }
+    bool useZstd = strcasecmp(m_dumpformat.c_str(), "zstd") == 0;
+    if (m_useMakedumpfile && !m_usedDirectSave && !useZstd) {
         ss << "NOTE:" << endl;
         ss << "This dump was saved in makedumpfile flattened format." << endl;
         ss << "To read the dump with crash, run \"sh rearrange.sh\" before."
            << endl;
     }
+    if (strcasecmp(m_dumpformat.c_str(), "zstd") == 0) {
+        ss << "NOTE:" << endl;
+        ss << "This dump was compressed with zstd (seekable format)." << endl;
+        ss << "To read the dump with crash, run \""
+           << (m_useMakedumpfile
+               ? "zstd -dc vmcore | makedumpfile -R vmcore.elf"
+               : "zstd -d -o vmcore.elf vmcore")
+           << "\" before." << endl;
+    }
+    if (strcasecmp(m_dumpformat.c_str(), "chunked") == 0) {
+        ss << "NOTE:" << endl;
+        ss << "This dump was saved in chunked format." << endl;
+        ss << "To read the dump with crash, run "
+            "\"kdumptool convert_dump vmcore vmcore.elf\" before." << endl;
+    }
 
-    TerminalProgress progress("Generating README");
     string const& s = ss.str();
+    if (m_targetHung) {
+        cout << "Dump target does not respond. README:" << endl << s;
+        return;
+    }
+
+    TerminalProgress progress("Generating README");
     BufferDataProvider provider(s.c_str(), s.size());
     if (config->KDUMP_VERBOSE.value()
 	& Configuration::VERB_PROGRESS)
@@ -533,11 +1725,13 @@ void SaveDump::generateInfo()
 }
 
 // -----------------------------------------------------------------------------
-void SaveDump::copyKernel()
+void SaveDump::copyKernel(bool showProgress)
 {
-    Debug::debug()->trace("SaveDump::copyKernel()");
+    Debug::debug()->trace("SaveDump::copyKernel(%d)", int(showProgress));
 
     Configuration *config = Configuration::config();
+    showProgress = showProgress &&
+        (config->KDUMP_VERBOSE.value() & Configuration::VERB_PROGRESS);
 
     FilePath mapfile = findMapfile();
     FilePath kernel = findKernel();
@@ -547,8 +1741,7 @@ void SaveDump::copyKernel()
     TerminalProgress mapProgress("Copying System.map");
     (fp = m_rootdir).appendPath(mapfile);
     FileDataProvider mapProvider(fp.c_str());
-    if (config->KDUMP_VERBOSE.value()
-	& Configuration::VERB_PROGRESS)
+    if (showProgress)
         mapProvider.setProgress(&mapProgress);
     else
         cout << "Copying System.map" << endl;
@@ -557,14 +1750,82 @@ void SaveDump::copyKernel()
     TerminalProgress kernelProgress("Copying kernel");
     (fp = m_rootdir).appendPath(kernel);
     FileDataProvider kernelProvider(fp.c_str());
-    if (config->KDUMP_VERBOSE.value()
-	& Configuration::VERB_PROGRESS)
+    if (showProgress)
         kernelProvider.setProgress(&kernelProgress);
     else
         cout << "Copying kernel" << endl;
     m_transfer->perform(&kernelProvider, kernel.baseName().c_str());
 }
 
+// -----------------------------------------------------------------------------
+void SaveDump::startCopyKernel(const RootDirURLVector &urlv)
+{
+    Debug::debug()->trace("SaveDump::startCopyKernel()");
+
+    // FTP and SSH transfers use a single connection, which cannot be
+    // shared with another process
+    URLParser::Protocol prot = urlv.begin()->getProtocol();
+    if (prot != URLParser::PROT_FILE && prot != URLParser::PROT_NFS &&
+        prot != URLParser::PROT_CIFS) {
+        Debug::debug()->dbg("Cannot copy kernel in background over %s",
+                            urlv.begin()->getProtocolAsString().c_str());
+        return;
+    }
+
+    // the child passes its transfer statistics through a pipe
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) != 0) {
+        Debug::debug()->dbg("Cannot copy kernel in background: %s",
+                            strerror(errno));
+        return;
+    }
+
+    try {
+        m_copyStart = SaveStats::Clock::now();
+        size_t first = m_stats.count();
+        int fd = pipefd[1];
+        m_copyWorker.spawn([this, first, fd]() {
+            setLowIOPriority();
+            try {
+                copyKernel(false);
+            } catch (...) {
+                m_stats.writeEntries(fd, first);
+                throw;
+            }
+            m_stats.writeEntries(fd, first);
+            return 0;
+        });
+        m_copyStatsFd = pipefd[0];
+    } catch (const KError &error) {
+        Debug::debug()->dbg("Cannot copy kernel in background: %s",
+                            error.what());
+        close(pipefd[0]);
+    }
+    close(pipefd[1]);
+}
+
+// -----------------------------------------------------------------------------
+void SaveDump::finishCopyKernel()
+{
+    Debug::debug()->trace("SaveDump::finishCopyKernel()");
+
+    if (m_copyWorker.getChildPID() == -1)
+        return;
+
+    // the copy cannot finish if the target does not respond
+    if (m_targetHung)
+        m_copyWorker.kill();
+
+    int status = m_copyWorker.wait();
+    bool success = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    unsigned long long bytes = m_stats.readEntries(m_copyStatsFd);
+    close(m_copyStatsFd);
+    m_copyStatsFd = -1;
+    m_stats.addPhase("copy_kernel", m_copyStart, success, bytes);
+    if (!success)
+        throw KError("Copying kernel and System.map failed.");
+}
+
 // -----------------------------------------------------------------------------
 string SaveDump::findKernel()
 {
@@ -642,6 +1903,11 @@ string SaveDump::findMapfile()
 // -----------------------------------------------------------------------------
 void SaveDump::checkAndDelete(const RootDirURLVector &urlv)
 {
+    if (m_targetHung) {
+        Debug::debug()->info("Dump target does not respond, not checking.");
+        return;
+    }
+
     RootDirURLVector::const_iterator it;
     for (it = urlv.begin(); it != urlv.end(); ++it)
 	check_one(*it);
@@ -670,6 +1936,7 @@ void SaveDump::check_one(const RootDirURL &parser)
 
     if (bytes_to_megabytes(freeSize) < targetDiskSize) {
         path.rmdir(true);
+        collectChunks(path.dirName());
         throw KError("Dump too large. Aborting. Check KDUMP_FREE_DISK_SIZE.");
     }
 }
@@ -19,12 +19,22 @@
 #ifndef SAVE_DUMP_H
 #define SAVE_DUMP_H
 
+#include <memory>
+#include <chrono>
+
 #include "fileutil.h"
 #include "subcommand.h"
 #include "urlparser.h"
 #include "rootdirurl.h"
+#include "process.h"
+#include "savestats.h"
 
 class Transfer;
+class Terminal;
+class DmesgExtraction;
+class DataProvider;
+class Vmcore;
+class DumpEstimate;
 
 //{{{ SaveDump -----------------------------------------------------------------
 
@@ -58,7 +68,37 @@ class SaveDump : public Subcommand {
         void execute();
 
     protected:
-        void saveDump(const RootDirURLVector &urlv);
+        void saveDump(RootDirURLVector &urlv);
+
+        void saveVmcore(RootDirURLVector &urlv, Terminal &terminal);
+
+        void planTargets(const RootDirURLVector &urlv);
+
+        void planCPUs(bool verbose = false);
+
+        void chooseFormat();
+
+        void checkFreeSpace(const RootDirURLVector &urlv);
+
+        DumpEstimate *getEstimate();
+
+        unsigned long long estimateSize(bool sparse, int dumplevel);
+
+        unsigned long long estimateDedupSize(const RootDirURL &url);
+
+        bool levelReducesSize(int dumplevel);
+
+        bool reduceForTime(bool apply);
+
+        DataProvider *createProvider();
+
+        void finishTruncated(const StringVector &localFiles);
+
+        void writeLoadIndex(const StringVector &localFiles);
+
+        void failover(RootDirURLVector &urlv, std::string reason);
+
+        void saveDmesg(DmesgExtraction &dmesg, Terminal &terminal);
 
         void copyMakedumpfile();
 
@@ -68,7 +108,11 @@ class SaveDump : public Subcommand {
 
         void fillVmcoreinfo();
 
-        void copyKernel();
+        void copyKernel(bool showProgress);
+
+        void startCopyKernel(const RootDirURLVector &urlv);
+
+        void finishCopyKernel();
 
         std::string findKernel();
 
@@ -78,6 +122,8 @@ class SaveDump : public Subcommand {
 
         void sendNotification(bool failure, const RootDirURLVector &urlv);
 
+        void writeStats();
+
         std::string getKernelReleaseCommandline();
 
         /**
@@ -96,6 +142,7 @@ class SaveDump : public Subcommand {
         Transfer *m_transfer;
         bool m_usedDirectSave;
         bool m_useMakedumpfile;
+        bool m_nativeDump;
 	unsigned long m_split;
 	unsigned long m_threads;
         unsigned long long m_crashtime;
@@ -103,6 +150,31 @@ class SaveDump : public Subcommand {
         std::string m_rootdir;
         std::string m_hostname;
         bool m_nomail;
+        SubProcess m_copyWorker;
+        int m_dumplevel;
+        std::string m_dumpformat;
+        unsigned long long m_estimatedSize;
+        std::unique_ptr<Vmcore> m_vmcore;
+        std::unique_ptr<DumpEstimate> m_estimate;
+        bool m_estimateFailed;
+        bool m_truncated;
+        std::string m_saveAborted;
+        unsigned long long m_abortedBytes;
+        bool m_targetHung;
+        bool m_autoFormat;
+        unsigned long m_numTargets;
+        bool m_canSplit;
+        bool m_failover;
+        RootDirURLVector m_failoverTargets;
+        StringVector m_failedTargets;
+        std::string m_targetURL;
+        bool m_dedup;
+        unsigned long long m_dedupTotal;
+        unsigned long long m_dedupNew;
+        std::chrono::steady_clock::time_point m_startTime;
+        SaveStats m_stats;
+        SaveStats::Clock::time_point m_copyStart;
+        int m_copyStatsFd;
 
         void check_one(const RootDirURL &parser);
 };
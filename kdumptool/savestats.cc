@@ -0,0 +1,244 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <string>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <cerrno>
+#include <unistd.h>
+
+#include "global.h"
+#include "debug.h"
+#include "savestats.h"
+#include "dataprovider.h"
+#include "stringvector.h"
+#include "stringutil.h"
+
+using std::string;
+using std::ostringstream;
+
+//{{{ SaveStats ----------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+SaveStats::Timer::Timer(SaveStats &stats, Kind kind, const string &name)
+    : m_stats(stats)
+{
+    m_entry.kind = kind;
+    m_entry.name = name;
+    m_entry.start = Clock::now();
+    m_entry.bytes = 0;
+    m_entry.direct = false;
+    m_entry.success = false;
+}
+
+// -----------------------------------------------------------------------------
+SaveStats::Timer::~Timer()
+{
+    m_entry.end = Clock::now();
+    m_stats.add(m_entry);
+}
+
+// -----------------------------------------------------------------------------
+SaveStats::SaveStats()
+    : m_start(Clock::now()), m_startTime(std::time(NULL))
+{}
+
+// -----------------------------------------------------------------------------
+void SaveStats::add(const Entry &entry)
+{
+    m_entries.push_back(entry);
+    if (m_entries.back().end <= entry.start)
+        m_entries.back().end = Clock::now();
+
+    std::chrono::duration<double> secs = m_entries.back().end - entry.start;
+    Debug::debug()->dbg("%s %s: %.3f s, %llu bytes, %s",
+                        entry.kind == PHASE ? "Phase" : "Transfer",
+                        entry.name.c_str(), secs.count(), entry.bytes,
+                        entry.success ? "ok" : "failed");
+}
+
+// -----------------------------------------------------------------------------
+void SaveStats::addPhase(const string &name, Clock::time_point start,
+                         bool success, unsigned long long bytes)
+{
+    Entry entry;
+    entry.kind = PHASE;
+    entry.name = name;
+    entry.start = start;
+    entry.end = Clock::now();
+    entry.bytes = bytes;
+    entry.direct = false;
+    entry.success = success;
+    add(entry);
+}
+
+// -----------------------------------------------------------------------------
+void SaveStats::writeEntries(int fd, size_t first) const
+{
+    // one entry per line, the name last; the clock is the same in a child
+    ostringstream ss;
+    for (size_t i = first; i < m_entries.size(); ++i) {
+        const Entry &entry = m_entries[i];
+        ss << int(entry.kind) << ' '
+           << (long long)entry.start.time_since_epoch().count() << ' '
+           << (long long)entry.end.time_since_epoch().count() << ' '
+           << entry.bytes << ' ' << int(entry.direct) << ' '
+           << int(entry.success) << ' ' << entry.name << '\n';
+    }
+
+    string s = ss.str();
+    const char *p = s.c_str();
+    size_t len = s.size();
+    while (len) {
+        ssize_t ret = write(fd, p, len);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            throw KSystemError("Cannot write statistics", errno);
+        }
+        p += ret;
+        len -= ret;
+    }
+}
+
+// -----------------------------------------------------------------------------
+unsigned long long SaveStats::readEntries(int fd)
+{
+    string s;
+    char buf[4096];
+    ssize_t ret;
+    while ((ret = read(fd, buf, sizeof buf)) != 0) {
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            Debug::debug()->dbg("Cannot read statistics: %s",
+                                strerror(errno));
+            break;
+        }
+        s.append(buf, ret);
+    }
+
+    unsigned long long bytes = 0;
+    std::istringstream in(s);
+    string line;
+    while (std::getline(in, line)) {
+        std::istringstream ls(line);
+        int kind, direct, success;
+        long long start, end;
+        Entry entry;
+        if (!(ls >> kind >> start >> end >> entry.bytes >> direct >> success))
+            continue;
+        ls.get();
+        std::getline(ls, entry.name);
+        entry.kind = Kind(kind);
+        entry.start = Clock::time_point(Clock::duration(start));
+        entry.end = Clock::time_point(Clock::duration(end));
+        entry.direct = direct;
+        entry.success = success;
+        add(entry);
+        if (entry.kind == TRANSFER)
+            bytes += entry.bytes;
+    }
+    return bytes;
+}
+
+// -----------------------------------------------------------------------------
+string SaveStats::toJSON() const
+{
+    typedef std::chrono::duration<double> Seconds;
+
+    ostringstream ss;
+    ss << std::fixed << std::setprecision(6);
+
+    ss << "{" << std::endl;
+    ss << "  \"version\": 1," << std::endl;
+    ss << "  \"kdump_version\": " << StringUtil::jsonString(PACKAGE_VERSION) << ","
+       << std::endl;
+    ss << "  \"start_time\": " << (long long)m_startTime << "," << std::endl;
+    ss << "  \"total_seconds\": "
+       << Seconds(Clock::now() - m_start).count() << "," << std::endl;
+
+    for (int kind = PHASE; kind <= TRANSFER; ++kind) {
+        ss << "  " << (kind == PHASE ? "\"phases\"" : "\"transfers\"")
+           << ": [";
+
+        bool first = true;
+        for (const auto &entry : m_entries) {
+            if (entry.kind != kind)
+                continue;
+
+            double start = Seconds(entry.start - m_start).count();
+            double end = Seconds(entry.end - m_start).count();
+            double secs = end - start;
+
+            ss << (first ? "" : ",") << std::endl;
+            first = false;
+            ss << "    { \"name\": " << StringUtil::jsonString(entry.name)
+               << ", \"start\": " << start
+               << ", \"end\": " << end
+               << ", \"seconds\": " << secs
+               << ", \"bytes\": " << entry.bytes
+               << ", \"throughput\": "
+               << (secs > 0 ? (unsigned long long)(entry.bytes / secs) : 0);
+            if (kind == TRANSFER)
+                ss << ", \"direct\": " << (entry.direct ? "true" : "false");
+            ss << ", \"status\": " << (entry.success ? "\"ok\"" : "\"failed\"")
+               << " }";
+        }
+        ss << std::endl << "  ]" << (kind == PHASE ? "," : "") << std::endl;
+    }
+    ss << "}" << std::endl;
+
+    return ss.str();
+}
+
+//}}}
+//{{{ StatsTransfer ------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+void StatsTransfer::perform(DataProvider *dataprovider,
+                            const StringVector &target_files,
+                            bool *directSave)
+{
+    string name;
+    for (const auto &file : target_files)
+        name += (name.empty() ? "" : " ") + file;
+
+    SaveStats::Timer timer(m_stats, SaveStats::TRANSFER, name);
+    bool direct = false;
+    try {
+        m_transfer->perform(dataprovider, target_files, &direct);
+    } catch (...) {
+        timer.setBytes(dataprovider->bytesProvided());
+        throw;
+    }
+    if (directSave)
+        *directSave = direct;
+
+    // a direct save does not pass the data through the provider
+    timer.setBytes(direct && m_directBytes
+                   ? m_directBytes(target_files)
+                   : dataprovider->bytesProvided());
+    timer.setDirect(direct);
+    timer.succeed();
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,224 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef SAVESTATS_H
+#define SAVESTATS_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ctime>
+#include <functional>
+
+#include "global.h"
+#include "transfer.h"
+
+//{{{ SaveStats ----------------------------------------------------------------
+
+/**
+ * Collects timing and throughput of the individual steps of saving a dump.
+ *
+ * All times are taken from a monotonic clock and stored relative to the
+ * creation of the object.
+ */
+class SaveStats {
+
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        /**
+         * Kind of a recorded entry.
+         */
+        enum Kind {
+            PHASE,              /**< a step of SaveDump */
+            TRANSFER            /**< a single Transfer::perform() call */
+        };
+
+        /**
+         * A recorded entry.
+         */
+        struct Entry {
+            Kind kind;
+            std::string name;
+            Clock::time_point start;
+            Clock::time_point end;
+            unsigned long long bytes;
+            bool direct;
+            bool success;
+        };
+
+        /**
+         * Measures one entry. The entry is recorded when the timer is
+         * destroyed. Unless succeed() has been called, it is recorded as
+         * failed.
+         */
+        class Timer {
+
+            public:
+                /**
+                 * Starts the timer.
+                 *
+                 * @param[in] stats where the entry is recorded
+                 * @param[in] kind kind of the entry
+                 * @param[in] name name of the phase or target file
+                 */
+                Timer(SaveStats &stats, Kind kind, const std::string &name);
+
+                /**
+                 * Records the entry.
+                 */
+                ~Timer();
+
+                /**
+                 * Sets the number of bytes transferred.
+                 */
+                void setBytes(unsigned long long bytes)
+                { m_entry.bytes = bytes; }
+
+                /**
+                 * Sets whether the data was saved directly to a file.
+                 */
+                void setDirect(bool direct)
+                { m_entry.direct = direct; }
+
+                /**
+                 * Marks the entry as successful.
+                 */
+                void succeed()
+                { m_entry.success = true; }
+
+            private:
+                SaveStats &m_stats;
+                Entry m_entry;
+        };
+
+        /**
+         * Creates an empty statistics object and starts the clock.
+         */
+        SaveStats();
+
+        /**
+         * Records an entry.
+         *
+         * @param[in] entry the entry; @c entry.end is set to the current
+         *            time if it is not after @c entry.start
+         */
+        void add(const Entry &entry);
+
+        /**
+         * Records a phase that was started earlier.
+         *
+         * @param[in] name name of the phase
+         * @param[in] start start time of the phase
+         * @param[in] success @c true if the phase succeeded
+         * @param[in] bytes number of bytes saved in the phase
+         */
+        void addPhase(const std::string &name, Clock::time_point start,
+                      bool success, unsigned long long bytes = 0);
+
+        /**
+         * Returns the number of recorded entries.
+         */
+        size_t count() const
+        { return m_entries.size(); }
+
+        /**
+         * Writes entries to a file descriptor, so that a forked child can
+         * pass them to its parent.
+         *
+         * @param[in] fd where the entries are written
+         * @param[in] first index of the first entry to write
+         * @exception KError if writing fails
+         */
+        void writeEntries(int fd, size_t first) const;
+
+        /**
+         * Records the entries written by writeEntries().
+         *
+         * @param[in] fd where the entries are read from
+         * @return the number of bytes of all transfers that were read
+         */
+        unsigned long long readEntries(int fd);
+
+        /**
+         * Formats the statistics as a JSON document.
+         *
+         * @return the JSON text
+         */
+        std::string toJSON() const;
+
+    private:
+        Clock::time_point m_start;
+        std::time_t m_startTime;
+        std::vector<Entry> m_entries;
+};
+
+//}}}
+//{{{ StatsTransfer ------------------------------------------------------------
+
+/**
+ * Transfer that records every Transfer::perform() call in SaveStats
+ * and passes it to another Transfer.
+ */
+class StatsTransfer : public Transfer {
+
+    public:
+        /**
+         * Returns the number of bytes saved directly to the given target
+         * files, e.g. their disk usage.
+         */
+        typedef std::function<unsigned long long(const StringVector &)>
+            DirectBytes;
+
+        /**
+         * Creates a new StatsTransfer object. It takes ownership of
+         * @p transfer.
+         *
+         * @param[in] transfer the actual transfer
+         * @param[in] stats where the calls are recorded
+         * @param[in] directBytes counts the bytes if the data provider
+         *            saved the files directly
+         */
+        StatsTransfer(Transfer *transfer, SaveStats &stats,
+                      DirectBytes directBytes = DirectBytes())
+            : m_transfer(transfer), m_stats(stats), m_directBytes(directBytes)
+        { }
+
+        ~StatsTransfer()
+        { delete m_transfer; }
+
+        using Transfer::perform;
+
+        void perform(DataProvider *dataprovider,
+                     const StringVector &target_files,
+                     bool *directSave);
+
+        double measureThroughput(const char *data, size_t size)
+        { return m_transfer->measureThroughput(data, size); }
+
+    private:
+        Transfer *m_transfer;
+        SaveStats &m_stats;
+        DirectBytes m_directBytes;
+};
+
+//}}}
+
+#endif /* SAVESTATS_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -43,6 +43,30 @@ string StringUtil::formatUnixTime(const char *formatstring, time_t value)
     return string(buffer);
 }
 
+// -----------------------------------------------------------------------------
+string StringUtil::jsonString(const string &s)
+{
+    std::ostringstream ss;
+
+    ss << '"';
+    for (unsigned char c : s) {
+        switch (c) {
+        case '"':   ss << "\\\""; break;
+        case '\\':  ss << "\\\\"; break;
+        case '\n':  ss << "\\n"; break;
+        case '\t':  ss << "\\t"; break;
+        default:
+            if (c < 0x20)
+                ss << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+                   << int(c) << std::dec;
+            else
+                ss << c;
+        }
+    }
+    ss << '"';
+    return ss.str();
+}
+
 // -----------------------------------------------------------------------------
 int StringUtil::hex2int(char c)
 {
@@ -65,6 +65,14 @@ class StringUtil {
         static std::string formatUnixTime(const char *formatstring,
                                           time_t value);
 
+        /**
+         * Quotes a string for use in JSON output.
+         *
+         * @param[in] s the string
+         * @return @p s in double quotes, with special characters escaped
+         */
+        static std::string jsonString(const std::string &s);
+
 	static int hex2int(char c);
 };
 
@@ -0,0 +1,193 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "global.h"
+#include "debug.h"
+#include "chunkeddump.h"
+#include "vmcore.h"
+#include "testutil.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+// -----------------------------------------------------------------------------
+static void saveChunked(const FilePath &vmcore, const FilePath &dump,
+                        int dumplevel)
+{
+    ChunkedDataProvider provider(vmcore, dumplevel);
+    std::ofstream out(dump.c_str(), std::ios::binary | std::ios::trunc);
+    char buf[1000];
+    size_t len;
+
+    provider.prepare();
+    while ( (len = provider.getData(buf, sizeof buf)) )
+        out.write(buf, len);
+    provider.finish();
+    if (!out)
+        throw KError("Cannot write " + dump);
+}
+
+// -----------------------------------------------------------------------------
+// Checks that all pages which are in the ELF file have the right content
+// and returns the number of non-zero pages found.
+static size_t checkElf(const FilePath &elf, const PageMap &pages)
+{
+    Vmcore vmcore(elf);
+    vector<char> page(TEST_PAGE_SIZE);
+    size_t found = 0;
+
+    for (const auto &seg : vmcore.loadSegments()) {
+        for (uint64_t addr = seg.paddr; addr < seg.paddr + seg.memsz;
+             addr += TEST_PAGE_SIZE) {
+            auto it = pages.find(addr / TEST_PAGE_SIZE);
+            if (it == pages.end())
+                throw KError("Page not in the original dump");
+            vmcore.readPhys(addr, page.data(), page.size());
+            if (page != it->second)
+                throw KError("Page content differs");
+            if (addr / TEST_PAGE_SIZE % 4 != 0)
+                ++found;
+        }
+    }
+    return found;
+}
+
+// -----------------------------------------------------------------------------
+// Returns the page class of each page chunk in file order.
+static vector<uint32_t> chunkClasses(const FilePath &dump)
+{
+    vector<uint32_t> ret;
+    std::ifstream in(dump.c_str(), std::ios::binary);
+    in.seekg(sizeof(struct chunked_header));
+
+    struct chunked_chunk hdr;
+    while (in.read(reinterpret_cast<char *>(&hdr), sizeof hdr)) {
+        if (hdr.type == CHUNK_PAGES)
+            ret.push_back(hdr.pclass);
+        in.seekg(hdr.size, std::ios::cur);
+    }
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+int main()
+{
+    int result = EXIT_SUCCESS;
+
+    Debug::debug()->setStderrLevel(Debug::DL_TRACE);
+    try {
+        TestRun test;
+
+        TempDir dir("chunkeddump");
+        FilePath vmcore = dir.file("vmcore.elf");
+        FilePath dump = dir.file("vmcore.chunked");
+        FilePath elf = dir.file("vmcore.converted");
+
+        PageMap pages;
+        makeVmcore(vmcore, pages, ChunkedDataProvider::CYCLE_PFNS);
+        size_t nonzero = 0;
+        for (const auto &page : pages)
+            if (page.first % 4 != 0)
+                ++nonzero;
+
+        test.check("Complete dump stores all non-zero pages",
+                   [&]() {
+                       saveChunked(vmcore, dump, 31);
+                       ChunkedDump chunked(dump);
+                       return chunked.isComplete() &&
+                           chunked.classCount()[PageClassifier::PC_OTHER] ==
+                           pages.size();
+                   });
+
+        test.check("Converted dump has the original pages",
+                   [&]() {
+                       ChunkedDump(dump).writeElf(elf);
+                       return checkElf(elf, pages) == nonzero;
+                   });
+
+        test.check("Truncated dump can be converted",
+                   [&]() {
+                       struct stat st;
+                       if (stat(dump.c_str(), &st) != 0 ||
+                           truncate(dump.c_str(), st.st_size - 100) != 0)
+                           throw KSystemError("Cannot truncate " + dump,
+                                              errno);
+                       ChunkedDump chunked(dump);
+                       if (chunked.isComplete() ||
+                           chunked.pageCount() >= pages.size())
+                           return false;
+                       chunked.writeElf(elf);
+                       size_t found = checkElf(elf, pages);
+                       return found > 0 && found < nonzero;
+                   });
+
+        // user pages in the first cycle, slab pages in the second
+        FilePath typed = dir.file("vmcore-typed.elf");
+        PageMap typedPages;
+        const uint64_t cycle = ChunkedDataProvider::CYCLE_PFNS;
+        vector<std::pair<uint64_t, uint64_t> > ranges;
+        ranges.push_back(std::make_pair(uint64_t(TEST_SYSTEM_PFNS),
+                                        uint64_t(TEST_SYSTEM_PFNS + 32)));
+        ranges.push_back(std::make_pair(cycle, cycle + 32));
+        std::map<uint64_t, TestStructPage> structPages;
+        for (const auto &range : ranges)
+            for (uint64_t pfn = range.first; pfn < range.second; ++pfn) {
+                TestStructPage &sp = structPages[pfn];
+                memset(&sp, 0, sizeof sp);
+                if (pfn < cycle) {
+                    sp.flags = TEST_PG_LRU;
+                    sp.mapping = 0xffff888000200001ULL;
+                } else
+                    sp.flags = TEST_PG_SLAB;
+            }
+        makeClassifiedVmcore(typed, typedPages, ranges, structPages);
+
+        test.check("Pages are ordered by class across cycles",
+                   [&]() {
+                       saveChunked(typed, dump, 0);
+                       vector<uint32_t> classes = chunkClasses(dump);
+                       ChunkedDump chunked(dump);
+                       return chunked.isComplete() &&
+                           chunked.classCount()[PageClassifier::PC_SLAB] &&
+                           chunked.classCount()[PageClassifier::PC_USER] &&
+                           std::is_sorted(classes.begin(), classes.end());
+                   });
+
+        result = test.result();
+
+    } catch (const std::exception &ex) {
+        cerr << "Fatal exception: " << ex.what() << endl;
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
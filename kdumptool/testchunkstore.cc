@@ -0,0 +1,184 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "global.h"
+#include "debug.h"
+#include "chunkstore.h"
+#include "dataprovider.h"
+#include "rootdirurl.h"
+#include "testutil.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+// -----------------------------------------------------------------------------
+static string sha256(const string &s)
+{
+    Sha256 sha;
+    sha.update(s.data(), s.size());
+    return sha.hexDigest();
+}
+
+// -----------------------------------------------------------------------------
+static vector<char> testData(size_t size)
+{
+    vector<char> ret(size);
+    unsigned long x = 1;
+    for (auto &c : ret) {
+        x = x * 6364136223846793005UL + 1442695040888963407UL;
+        c = x >> 56;
+    }
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+static unsigned long long save(const FilePath &dir, const vector<char> &data)
+{
+    RootDirURLVector urlv;
+    urlv.push_back(RootDirURL("file://" + dir, ""));
+    DedupTransfer transfer(urlv);
+    BufferDataProvider provider(data.data(), data.size());
+    StringVector targets;
+    targets.push_back("vmcore");
+    transfer.perform(&provider, targets, NULL);
+    return transfer.bytesNew();
+}
+
+// -----------------------------------------------------------------------------
+static bool restore(const FilePath &dir, const vector<char> &data)
+{
+    FilePath recipe = dir;
+    recipe.appendPath(string("vmcore") + ChunkStore::RECIPE_SUFFIX);
+    ChunkStore store(ChunkStore::forRecipe(recipe));
+
+    vector<char> out, chunk;
+    for (const auto &entry : ChunkStore::readRecipe(recipe)) {
+        store.get(entry.first, chunk);
+        out.insert(out.end(), chunk.begin(), chunk.end());
+    }
+    return out == data;
+}
+
+// -----------------------------------------------------------------------------
+int main()
+{
+    int result = EXIT_SUCCESS;
+
+    Debug::debug()->setStderrLevel(Debug::DL_TRACE);
+    try {
+        TestRun test;
+
+        test.check("SHA-256 of an empty string",
+                   []() {
+                       return sha256("") ==
+                           "e3b0c44298fc1c149afbf4c8996fb924"
+                           "27ae41e4649b934ca495991b7852b855";
+                   });
+
+        test.check("SHA-256 of \"abc\"",
+                   []() {
+                       return sha256("abc") ==
+                           "ba7816bf8f01cfea414140de5dae2223"
+                           "b00361a396177a9cb410ff61f20015ad";
+                   });
+
+        test.check("SHA-256 of a two-block message",
+                   []() {
+                       return sha256("abcdbcdecdefdefgefghfghighijhijk"
+                                     "ijkljklmklmnlmnomnopnopq") ==
+                           "248d6a61d20638b8e5c026930c3e6039"
+                           "a33ce45964ff2167f6ecedd419db06c1";
+                   });
+
+        vector<char> data = testData(4 << 20);
+
+        test.check("Chunk size is within limits",
+                   [&data]() {
+                       size_t len = ChunkStore::cutPoint(data.data(),
+                                                         data.size());
+                       return len >= ChunkStore::MIN_CHUNK &&
+                           len <= ChunkStore::MAX_CHUNK;
+                   });
+
+        TempDir tmpdir("chunkstore");
+        FilePath savedir = tmpdir.file("save");
+        FilePath first = savedir, second = savedir;
+        first.appendPath("2021-01-01-00:00");
+        second.appendPath("2021-01-02-00:00");
+
+        // insert some bytes in the middle
+        vector<char> changed = data;
+        changed.insert(changed.begin() + changed.size() / 2, 100, 'x');
+
+        test.check("Without an older dump, everything is new",
+                   [&savedir]() {
+                       return ChunkStore::newRatio(savedir) == 1.0;
+                   });
+
+        test.check("First dump is saved completely",
+                   [&first, &data]() {
+                       return save(first, data) == data.size();
+                   });
+
+        test.check("Changed dump saves only a few chunks",
+                   [&second, &changed]() {
+                       return save(second, changed) < changed.size() / 8;
+                   });
+
+        test.check("Ratio of new chunks follows the newest dump",
+                   [&savedir]() {
+                       return ChunkStore::newRatio(savedir) < 1.0 / 8;
+                   });
+
+        test.check("Changed dump is restored",
+                   [&second, &changed]() {
+                       return restore(second, changed);
+                   });
+
+        test.check("Nothing to collect while all dumps exist",
+                   [&savedir]() {
+                       return ChunkStore(savedir).collectGarbage(false) == 0;
+                   });
+
+        test.check("Chunks of a deleted dump are collected",
+                   [&savedir, &first]() {
+                       first.rmdir(true);
+                       return ChunkStore(savedir).collectGarbage(false) > 0;
+                   });
+
+        test.check("Remaining dump is still restored",
+                   [&second, &changed]() {
+                       return restore(second, changed);
+                   });
+
+        result = test.result();
+
+    } catch (const std::exception &ex) {
+        cerr << "Fatal exception: " << ex.what() << endl;
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
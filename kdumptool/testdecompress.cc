@@ -0,0 +1,264 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <zlib.h>
+
+#include "global.h"
+
+#if HAVE_LZMA
+#include <lzma.h>
+#endif
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+#if HAVE_LZ4
+#include <lz4.h>
+#include <lz4frame.h>
+#endif
+
+#include "debug.h"
+#include "fileutil.h"
+#include "decompress.h"
+#include "kerneltool.h"
+#include "testutil.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+/**
+ * Size of the synthetic kernel image.
+ */
+#define SYNTHETIC_SIZE  (12UL << 20)
+
+// -----------------------------------------------------------------------------
+static string testConfig()
+{
+    string ret;
+    for (int i = 0; i < 500; ++i)
+        ret += "CONFIG_OPTION_" + std::to_string(i) + "=y\n";
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+static vector<char> compress(const vector<char> &data,
+                             Decompressor::Format format)
+{
+    vector<char> ret;
+
+    switch (format) {
+        case Decompressor::FMT_PLAIN:
+            ret = data;
+            break;
+
+        case Decompressor::FMT_GZIP: {
+            z_stream stream;
+            memset(&stream, 0, sizeof stream);
+            if (deflateInit2(&stream, 1, Z_DEFLATED, 16 + MAX_WBITS,
+                             8, Z_DEFAULT_STRATEGY) != Z_OK)
+                throw KError("deflateInit2() failed");
+            ret.resize(deflateBound(&stream, data.size()));
+            stream.next_in = (Bytef *)data.data();
+            stream.avail_in = data.size();
+            stream.next_out = (Bytef *)ret.data();
+            stream.avail_out = ret.size();
+            if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+                throw KError("deflate() failed");
+            ret.resize(stream.total_out);
+            deflateEnd(&stream);
+            break;
+        }
+
+#if HAVE_LZMA
+        case Decompressor::FMT_XZ: {
+            size_t pos = 0;
+            ret.resize(lzma_stream_buffer_bound(data.size()));
+            if (lzma_easy_buffer_encode(0, LZMA_CHECK_CRC32, NULL,
+                                        (const uint8_t *)data.data(),
+                                        data.size(),
+                                        (uint8_t *)ret.data(), &pos,
+                                        ret.size()) != LZMA_OK)
+                throw KError("lzma_easy_buffer_encode() failed");
+            ret.resize(pos);
+            break;
+        }
+#endif
+
+#if HAVE_ZSTD
+        case Decompressor::FMT_ZSTD: {
+            ret.resize(ZSTD_compressBound(data.size()));
+            size_t len = ZSTD_compress(ret.data(), ret.size(),
+                                       data.data(), data.size(), 1);
+            if (ZSTD_isError(len))
+                throw KError("ZSTD_compress() failed");
+            ret.resize(len);
+            break;
+        }
+#endif
+
+#if HAVE_LZ4
+        case Decompressor::FMT_LZ4: {
+            ret.resize(LZ4F_compressFrameBound(data.size(), NULL));
+            size_t len = LZ4F_compressFrame(ret.data(), ret.size(),
+                                            data.data(), data.size(), NULL);
+            if (LZ4F_isError(len))
+                throw KError("LZ4F_compressFrame() failed");
+            ret.resize(len);
+            break;
+        }
+
+        case Decompressor::FMT_LZ4_LEGACY: {
+            static const char magic[] = { 0x02, 0x21, 0x4c, 0x18 };
+            const size_t blocksize = 8 << 20;
+            ret.assign(magic, magic + sizeof magic);
+            for (size_t off = 0; off < data.size(); off += blocksize) {
+                int len = std::min(blocksize, data.size() - off);
+                vector<char> block(LZ4_compressBound(len));
+                int clen = LZ4_compress_default(data.data() + off,
+                                                block.data(), len,
+                                                block.size());
+                for (int i = 0; i < 4; ++i)
+                    ret.push_back(char(clen >> (8 * i)));
+                ret.insert(ret.end(), block.begin(), block.begin() + clen);
+            }
+            // uncompressed size, as appended to a kernel payload
+            for (int i = 0; i < 4; ++i)
+                ret.push_back(char(data.size() >> (8 * i)));
+            break;
+        }
+#endif
+
+        default:
+            throw KError("Unsupported format");
+    }
+
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+static vector<char> readAll(const FilePath &path, size_t chunk)
+{
+    FileDescriptor fd(path, O_RDONLY);
+    Decompressor dec(fd);
+    vector<char> ret;
+    vector<char> buf(chunk);
+    size_t len;
+    while ((len = dec.read(buf.data(), buf.size())) > 0)
+        ret.insert(ret.end(), buf.begin(), buf.begin() + len);
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+int main()
+{
+    int result = EXIT_SUCCESS;
+
+    Debug::debug()->setStderrLevel(Debug::DL_INFO);
+    try {
+        TestRun test;
+
+        string config = testConfig();
+        vector<char> image = syntheticKernel(SYNTHETIC_SIZE, config,
+                                             SYNTHETIC_SIZE / 2);
+
+        TempDir tmpdir("decompress");
+
+        struct {
+            Decompressor::Format format;
+            KernelTool::KernelType type;
+        } formats[] = {
+            { Decompressor::FMT_PLAIN, KernelTool::KT_ELF },
+            { Decompressor::FMT_GZIP, KernelTool::KT_ELF_GZ },
+            { Decompressor::FMT_XZ, KernelTool::KT_ELF_XZ },
+            { Decompressor::FMT_ZSTD, KernelTool::KT_ELF_ZSTD },
+            { Decompressor::FMT_LZ4, KernelTool::KT_ELF_LZ4 },
+            { Decompressor::FMT_LZ4_LEGACY, KernelTool::KT_ELF_LZ4 },
+        };
+
+        for (const auto &f : formats) {
+            if (!Decompressor::isSupported(f.format)) {
+                cout << Decompressor::formatName(f.format)
+                     << ": not supported, skipped" << endl;
+                continue;
+            }
+
+            string name = Decompressor::formatName(f.format);
+            if (f.format == Decompressor::FMT_LZ4_LEGACY)
+                name += " legacy";
+
+            vector<char> compressed = compress(image, f.format);
+            FilePath path = tmpdir.file("vmlinux-" +
+                                        std::to_string(f.format));
+            writeFile(path, compressed);
+
+            test.check((name + " is detected").c_str(),
+                       [&path, &f]() {
+                           KernelTool kt(path);
+                           return kt.getKernelType() == f.type;
+                       });
+
+            test.check((name + " decompresses").c_str(),
+                       [&path, &image]() {
+                           return readAll(path, 65536) == image;
+                       });
+
+            test.check((name + " decompresses in odd chunks").c_str(),
+                       [&path, &image]() {
+                           return readAll(path, 4093) == image;
+                       });
+
+            test.check((name + " config is found").c_str(),
+                       [&path, &config]() {
+                           KernelTool kt(path);
+                           return kt.extractKernelConfig() == config;
+                       });
+
+            if (f.format == Decompressor::FMT_PLAIN)
+                continue;
+
+            compressed.resize(compressed.size() * 3 / 4);
+            FilePath truncated = path + ".truncated";
+            writeFile(truncated, compressed);
+
+            test.check((name + " truncated file gives a prefix").c_str(),
+                       [&truncated, &image]() {
+                           vector<char> data = readAll(truncated, 65536);
+                           return data.size() > 0 &&
+                               data.size() < image.size() &&
+                               memcmp(data.data(), image.data(),
+                                      data.size()) == 0;
+                       });
+        }
+
+        result = test.result();
+
+    } catch (const std::exception &ex) {
+        cerr << "Fatal exception: " << ex.what() << endl;
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
@@ -0,0 +1,259 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "global.h"
+#include "debug.h"
+#include "fileutil.h"
+#include "dumpindex.h"
+#include "diskdump.h"
+#include "chunkeddump.h"
+#include "testutil.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+#define BLOCK_SIZE      4096
+
+// -----------------------------------------------------------------------------
+static string asString(const void *data, size_t len)
+{
+    return string(static_cast<const char *>(data), len);
+}
+
+// -----------------------------------------------------------------------------
+static string elfDump(const vector<char> &notes)
+{
+    Elf64_Ehdr ehdr = coreHeader(1);
+
+    Elf64_Phdr phdr;
+    memset(&phdr, 0, sizeof phdr);
+    phdr.p_type = PT_NOTE;
+    phdr.p_offset = sizeof ehdr + sizeof phdr;
+    phdr.p_filesz = notes.size();
+
+    return asString(&ehdr, sizeof ehdr) + asString(&phdr, sizeof phdr) +
+        asString(notes.data(), notes.size());
+}
+
+// -----------------------------------------------------------------------------
+static string kdumpDump(const vector<char> &notes)
+{
+    struct disk_dump_header header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.signature, KDUMP_SIGNATURE, sizeof header.signature);
+    header.header_version = KDUMP_HEADER_VERSION;
+    header.block_size = BLOCK_SIZE;
+    header.sub_hdr_size = 1;
+
+    struct kdump_sub_header sub;
+    memset(&sub, 0, sizeof sub);
+    sub.offset_note = BLOCK_SIZE + sizeof sub;
+    sub.size_note = notes.size();
+
+    string data = asString(&header, sizeof header);
+    data.resize(BLOCK_SIZE);
+    return data + asString(&sub, sizeof sub) +
+        asString(notes.data(), notes.size());
+}
+
+// -----------------------------------------------------------------------------
+static string chunkedDump(const vector<char> &notes)
+{
+    struct chunked_header header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, CHUNKED_MAGIC, sizeof header.magic);
+    header.version = CHUNKED_VERSION;
+    header.page_size = BLOCK_SIZE;
+
+    struct chunked_chunk chunk;
+    memset(&chunk, 0, sizeof chunk);
+    chunk.type = CHUNK_NOTES;
+    chunk.size = notes.size();
+
+    return asString(&header, sizeof header) + asString(&chunk, sizeof chunk) +
+        asString(notes.data(), notes.size());
+}
+
+// -----------------------------------------------------------------------------
+static FilePath makeDump(const FilePath &dir, const char *name)
+{
+    FilePath dumpdir(dir);
+    dumpdir.appendPath(name);
+    dumpdir.mkdir(false);
+    return dumpdir;
+}
+
+// -----------------------------------------------------------------------------
+static FilePath child(const FilePath &dir, const char *name)
+{
+    FilePath path(dir);
+    path.appendPath(name);
+    return path;
+}
+
+// -----------------------------------------------------------------------------
+static bool checkEntry(const DumpIndex::Entry &entry, const char *name,
+                       const char *format, unsigned parts,
+                       const char *release, time_t crashtime)
+{
+    return entry.name == name && entry.format == format &&
+        entry.parts == parts && entry.release == release &&
+        entry.crashtime == crashtime;
+}
+
+// -----------------------------------------------------------------------------
+int main()
+{
+    int result = EXIT_SUCCESS;
+
+    Debug::debug()->setStderrLevel(Debug::DL_TRACE);
+    try {
+        TestRun test;
+
+        TempDir tmpdir("dumpindex");
+        const FilePath &dir = tmpdir.path();
+
+        FilePath dump = makeDump(dir, "2026-01-01-10:00");
+        writeFile(child(dump, "vmcore"),
+                  elfDump(vmcoreinfoNote("6.4.0-1-default", 1767261600)));
+
+        dump = makeDump(dir, "2026-01-02-10:00");
+        writeFile(child(dump, "vmcore"),
+                  chunkedDump(vmcoreinfoNote("6.4.0-2-default", 1767348000)));
+
+        dump = makeDump(dir, "2026-01-03-10:00");
+        string split = kdumpDump(vmcoreinfoNote("6.4.0-3-default",
+                                                1767434400));
+        writeFile(child(dump, "vmcore1"), split);
+        writeFile(child(dump, "vmcore2"), split);
+
+        dump = makeDump(dir, "2026-01-04-10:00");
+        writeFile(child(dump, "vmcore.recipe"), "recipe\n");
+        writeFile(child(dump, "README.txt"),
+                  "Kernel crashdump\n"
+                  "----------------\n"
+                  "\n"
+                  "Kernel version : 6.4.0-4-default\n");
+
+        // not a dump
+        makeDump(dir, "other");
+
+        vector<DumpIndex> indexes;
+        indexes.push_back(DumpIndex(dir));
+
+        test.check("All dumps are read the first time",
+                   [&]() {
+                       return DumpIndex::update(indexes) == 4 &&
+                           indexes[0].getEntries().size() == 4;
+                   });
+
+        test.check("Format, release and crash time are extracted",
+                   [&]() {
+                       const vector<DumpIndex::Entry> &e =
+                           indexes[0].getEntries();
+                       return checkEntry(e[0], "2026-01-01-10:00", "ELF", 1,
+                                         "6.4.0-1-default", 1767261600) &&
+                           checkEntry(e[1], "2026-01-02-10:00", "chunked", 1,
+                                      "6.4.0-2-default", 1767348000) &&
+                           checkEntry(e[2], "2026-01-03-10:00", "kdump", 2,
+                                      "6.4.0-3-default", 1767434400) &&
+                           e[2].size == 2 * split.size() &&
+                           checkEntry(e[3], "2026-01-04-10:00", "dedup", 1,
+                                      "6.4.0-4-default", 0);
+                   });
+
+        test.check("The index file is read back",
+                   [&]() {
+                       indexes[0].write();
+                       DumpIndex index(dir);
+                       const vector<DumpIndex::Entry> &a =
+                           indexes[0].getEntries();
+                       const vector<DumpIndex::Entry> &b = index.getEntries();
+                       if (a.size() != b.size())
+                           return false;
+                       for (size_t i = 0; i < a.size(); ++i)
+                           if (!checkEntry(b[i], a[i].name.c_str(),
+                                           a[i].format.c_str(), a[i].parts,
+                                           a[i].release.c_str(),
+                                           a[i].crashtime) ||
+                               b[i].mtime != a[i].mtime ||
+                               b[i].size != a[i].size)
+                               return false;
+                       return true;
+                   });
+
+        test.check("Unchanged dumps are not read again",
+                   [&]() {
+                       vector<DumpIndex> again;
+                       again.push_back(DumpIndex(dir));
+                       return DumpIndex::update(again) == 0 &&
+                           again[0].getEntries().size() == 4 &&
+                           again[0].getEntries()[0].release ==
+                               "6.4.0-1-default";
+                   });
+
+        test.check("Changed and removed dumps are detected",
+                   [&]() {
+                       writeFile(child(child(dir, "2026-01-01-10:00"),
+                                       "vmcore"),
+                                 elfDump(vmcoreinfoNote("6.4.0-100-default",
+                                                        1767261600)));
+                       child(dir, "2026-01-02-10:00").rmdir(true);
+
+                       vector<DumpIndex> again;
+                       again.push_back(DumpIndex(dir));
+                       const vector<DumpIndex::Entry> &e =
+                           again[0].getEntries();
+                       return DumpIndex::update(again) == 1 &&
+                           e.size() == 3 &&
+                           e[0].release == "6.4.0-100-default" &&
+                           e[1].name == "2026-01-03-10:00";
+                   });
+
+        test.check("Forced update reads all dumps",
+                   [&]() {
+                       vector<DumpIndex> again;
+                       again.push_back(DumpIndex(dir));
+                       return DumpIndex::update(again, true) == 3;
+                   });
+
+        test.check("A corrupt index file is ignored",
+                   [&]() {
+                       writeFile(child(dir, DumpIndex::INDEX_FILE),
+                                 "# kdump dump index 1\ngarbage\n");
+                       return DumpIndex(dir).getEntries().empty();
+                   });
+
+        result = test.result();
+
+    } catch (const std::exception &ex) {
+        cerr << "Fatal exception: " << ex.what() << endl;
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
@@ -0,0 +1,188 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "global.h"
+#include "debug.h"
+#include "vmcore.h"
+#include "vmcoreinfo.h"
+#include "elfnotes.h"
+#include "testutil.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+// -----------------------------------------------------------------------------
+// Writes a core file with one PT_NOTE segment for each element of @notes.
+static void makeVmcore(const FilePath &path, const vector<vector<char> > &notes)
+{
+    Elf64_Ehdr ehdr = coreHeader(notes.size());
+
+    vector<Elf64_Phdr> phdrs(notes.size());
+    memset(phdrs.data(), 0, phdrs.size() * sizeof(Elf64_Phdr));
+    uint64_t offset = sizeof ehdr + phdrs.size() * sizeof(Elf64_Phdr);
+    for (size_t i = 0; i < notes.size(); ++i) {
+        phdrs[i].p_type = PT_NOTE;
+        phdrs[i].p_offset = offset;
+        phdrs[i].p_filesz = notes[i].size();
+        offset += notes[i].size();
+    }
+
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&ehdr), sizeof ehdr);
+    out.write(reinterpret_cast<const char *>(phdrs.data()),
+              phdrs.size() * sizeof(Elf64_Phdr));
+    for (const auto &n : notes)
+        out.write(n.data(), n.size());
+    if (!out)
+        throw KError("Cannot write " + path);
+}
+
+// -----------------------------------------------------------------------------
+static string descString(const ElfNotes &notes, const ElfNotes::Note *note)
+{
+    if (!note)
+        return string();
+    return string(notes.desc(*note), note->size);
+}
+
+// -----------------------------------------------------------------------------
+int main()
+{
+    int result = EXIT_SUCCESS;
+
+    Debug::debug()->setStderrLevel(Debug::DL_TRACE);
+    try {
+        TestRun test;
+
+        TempDir dir("elfnotes");
+        FilePath path = dir.file("vmcore");
+
+        // per-CPU notes first, terminated by an empty note,
+        // VMCOREINFO only in the second segment
+        vector<vector<char> > segments(2);
+        appendNote(segments[0], NT_PRSTATUS, "CORE", "cpu0");
+        appendNote(segments[0], NT_PRSTATUS, "CORE", "cpu1");
+        segments[0].resize(segments[0].size() + sizeof(Elf64_Nhdr), 0);
+        appendNote(segments[1], NT_PRSTATUS, "CORE", "cpu2");
+        appendNote(segments[1], 0x1000001, "Xen", "xen");
+        appendNote(segments[1], 0, "VMCOREINFO",
+                   "OSRELEASE=" TEST_RELEASE "\n"
+                   "PAGESIZE=65536\n"
+                   "PAGESIZE=4096\n"
+                   "SYMBOL(init_uts_ns)=ffffffff82a13440\n"
+                   "OFFSET(uts_namespace.name)=4\n"
+                   "SIZE(page)=64\n"
+                   "NUMBER(phys_base)=-2097152\n"
+                   "NUMBER(kimage_voffset)=0xffff800000000000\n"
+                   "LENGTH(mem_section)=0x800\n"
+                   "KERNELOFFSET=1e000000\n"
+                   "CRASHTIME=4294967296\n");
+        makeVmcore(path, segments);
+
+        Vmcore vmcore(path);
+        ElfNotes notes(vmcore);
+
+        test.check("All notes in all segments are indexed",
+                   [&]() { return notes.notes().size() == 5; });
+
+        test.check("Every PRSTATUS note is a CPU",
+                   [&]() {
+                       return notes.numCpus() == 3 &&
+                           descString(notes, notes.prstatus(0)) == "cpu0" &&
+                           descString(notes, notes.prstatus(2)) == "cpu2" &&
+                           !notes.prstatus(3);
+                   });
+
+        test.check("Notes are found by name and type",
+                   [&]() {
+                       return descString(notes, notes.find("Xen", 0x1000001))
+                           == "xen" &&
+                           !notes.find("Xen", 0) &&
+                           notes.find("VMCOREINFO") ==
+                               notes.find("VMCOREINFO", 0);
+                   });
+
+        test.check("Data contains all segments",
+                   [&]() {
+                       return notes.data().size() ==
+                           segments[0].size() + segments[1].size();
+                   });
+
+        test.check("VMCOREINFO is found in a later segment",
+                   [&]() {
+                       Vmcoreinfo info;
+                       info.readFromELF(path.c_str());
+                       return info.getStringValue("OSRELEASE") ==
+                               TEST_RELEASE &&
+                           info.getIntValue("PAGESIZE") == 4096 &&
+                           !info.isXenVmcoreinfo();
+                   });
+
+        test.check("VMCOREINFO values are parsed by type",
+                   [&]() {
+                       Vmcoreinfo info;
+                       info.readFromNotes(notes);
+                       return info.symbol("init_uts_ns") ==
+                               0xffffffff82a13440ULL &&
+                           info.offset("uts_namespace.name") == 4 &&
+                           info.size("page") == 64 &&
+                           info.number("phys_base") == -2097152 &&
+                           info.getLLongValue("CRASHTIME") == 4294967296LL &&
+                           info.hasKey("SIZE(page)") &&
+                           !info.hasKey("SIZE(pag)") &&
+                           info.getKeys().size() == 10;
+                   });
+
+        test.check("Hexadecimal VMCOREINFO values are recognized",
+                   [&]() {
+                       Vmcoreinfo info;
+                       info.readFromNotes(notes);
+                       return (uint64_t)info.number("kimage_voffset") ==
+                               0xffff800000000000ULL &&
+                           info.getLLongValue("LENGTH(mem_section)") ==
+                               2048 &&
+                           info.getLLongValue("KERNELOFFSET") ==
+                               0x1e000000;
+                   });
+
+        test.check("Truncated notes are ignored",
+                   [&]() {
+                       const vector<char> &seg = segments[1];
+                       ElfNotes partial(seg.data(), seg.size() - 4);
+                       return partial.notes().size() == 2 &&
+                           !partial.find("VMCOREINFO");
+                   });
+
+        result = test.result();
+
+    } catch (const std::exception &ex) {
+        cerr << "Fatal exception: " << ex.what() << endl;
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
@@ -0,0 +1,143 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "global.h"
+#include "debug.h"
+#include "ikconfig.h"
+#include "kerneltool.h"
+#include "testutil.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+/**
+ * Size of the synthetic kernel image.
+ */
+#define SYNTHETIC_SIZE  (4UL << 20)
+
+// -----------------------------------------------------------------------------
+static string testConfig()
+{
+    string ret;
+    for (int i = 0; i < 2000; ++i)
+        ret += "CONFIG_OPTION_" + std::to_string(i) + "=y\n";
+    ret += "CONFIG_NR_CPUS=8192\n";
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+static bool scanInChunks(const vector<char> &data, size_t chunk,
+                         const string &expect)
+{
+    IkconfigScanner scanner;
+    for (size_t off = 0; off < data.size() && !scanner.found(); off += chunk)
+        scanner.feed(data.data() + off, std::min(chunk, data.size() - off));
+    return scanner.found() && scanner.data() == expect;
+}
+
+// -----------------------------------------------------------------------------
+int main()
+{
+    int result = EXIT_SUCCESS;
+
+    Debug::debug()->setStderrLevel(Debug::DL_INFO);
+    try {
+        TestRun test;
+
+        test.check("Pattern spanning three chunks",
+                   []() {
+                       PatternScanner scanner("abcd", 4);
+                       return scanner.scan("xxa", 3) < 0 &&
+                           scanner.scan("b", 1) < 0 &&
+                           scanner.scan("cdy", 3) == 2 &&
+                           scanner.matchOffset() == 2;
+                   });
+
+        test.check("Pattern at the start of a chunk",
+                   []() {
+                       PatternScanner scanner("abcd", 4);
+                       return scanner.scan("xyz", 3) < 0 &&
+                           scanner.scan("abcd", 4) == 4 &&
+                           scanner.matchOffset() == 3;
+                   });
+
+        string config = testConfig();
+        vector<char> image = syntheticKernel(SYNTHETIC_SIZE, config,
+            SYNTHETIC_SIZE - IkconfigScanner::BUFSIZE);
+        string expect = gzipped(config);
+
+        test.check("Scan in large chunks",
+                   [&image, &expect]() {
+                       return scanInChunks(image, IkconfigScanner::BUFSIZE,
+                                           expect);
+                   });
+
+        test.check("Scan in odd-sized chunks",
+                   [&image, &expect]() {
+                       return scanInChunks(image, 4093, expect);
+                   });
+
+        test.check("Markers split at every position",
+                   [&image, &expect]() {
+                       size_t pos = SYNTHETIC_SIZE - IkconfigScanner::BUFSIZE
+                           - (expect.size() + 16) / 2;
+                       vector<char> part(image.begin() + pos - 16,
+                                         image.begin() + pos + expect.size()
+                                         + 32);
+                       for (size_t chunk = 1; chunk <= 16; ++chunk)
+                           if (!scanInChunks(part, chunk, expect))
+                               return false;
+                       return true;
+                   });
+
+        TempDir tmpdir("ikconfig");
+        FilePath vmlinux = tmpdir.file("vmlinux");
+        FilePath vmlinuxgz = tmpdir.file("vmlinux.gz");
+        writeFile(vmlinux, image);
+        writeGzipFile(vmlinuxgz, image);
+
+        test.check("Config from a synthetic vmlinux",
+                   [&vmlinux, &config]() {
+                       return KernelTool(vmlinux).extractKernelConfig()
+                           == config;
+                   });
+
+        test.check("Config from a synthetic vmlinux.gz",
+                   [&vmlinuxgz, &config]() {
+                       return KernelTool(vmlinuxgz).extractKernelConfig()
+                           == config;
+                   });
+
+        result = test.result();
+
+    } catch (const std::exception &ex) {
+        cerr << "Fatal exception: " << ex.what() << endl;
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
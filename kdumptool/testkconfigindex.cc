@@ -0,0 +1,146 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "global.h"
+#include "debug.h"
+#include "kconfig.h"
+#include "testutil.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+
+static const char config[] =
+    "#\n"
+    "# Automatically generated file; DO NOT EDIT.\n"
+    "#\n"
+    "CONFIG_SMP=y\n"
+    "CONFIG_EXT4_FS=m\n"
+    "# CONFIG_KEXEC is not set\n"
+    "CONFIG_NR_CPUS=8192\n"
+    "CONFIG_LOCALVERSION=\"-default\"\n"
+    "\n"
+    "CONFIG_BROKEN=\n"
+    "CONFIG_CRASH_DUMP=y\n";
+
+// -----------------------------------------------------------------------------
+static bool isTristate(const Kconfig &kconfig, const string &option,
+                       KconfigValue::Tristate value)
+{
+    KconfigValue v = kconfig.get(option);
+    return v.getType() == KconfigValue::T_TRISTATE &&
+        v.getTristateValue() == value;
+}
+
+// -----------------------------------------------------------------------------
+int main()
+{
+    int result = EXIT_SUCCESS;
+
+    Debug::debug()->setStderrLevel(Debug::DL_TRACE);
+    try {
+        TestRun test;
+
+        Kconfig kconfig;
+        kconfig.readFromString(config);
+
+        test.check("Built-in option",
+                   [&kconfig]() {
+                       return isTristate(kconfig, "CONFIG_SMP",
+                                         KconfigValue::ON);
+                   });
+
+        test.check("Module option",
+                   [&kconfig]() {
+                       return isTristate(kconfig, "CONFIG_EXT4_FS",
+                                         KconfigValue::MODULE);
+                   });
+
+        test.check("Option which is not set",
+                   [&kconfig]() {
+                       return isTristate(kconfig, "CONFIG_KEXEC",
+                                         KconfigValue::OFF);
+                   });
+
+        test.check("Integer option",
+                   [&kconfig]() {
+                       KconfigValue v = kconfig.get("CONFIG_NR_CPUS");
+                       return v.getType() == KconfigValue::T_INTEGER &&
+                           v.getIntValue() == 8192;
+                   });
+
+        test.check("String option",
+                   [&kconfig]() {
+                       KconfigValue v = kconfig.get("CONFIG_LOCALVERSION");
+                       return v.getType() == KconfigValue::T_STRING &&
+                           v.getStringValue() == "-default";
+                   });
+
+        test.check("Unknown options and prefixes are invalid",
+                   [&kconfig]() {
+                       return kconfig.get("CONFIG_MISSING").getType() ==
+                               KconfigValue::T_INVALID &&
+                           kconfig.get("CONFIG_SM").getType() ==
+                               KconfigValue::T_INVALID &&
+                           kconfig.get("CONFIG_SMPX").getType() ==
+                               KconfigValue::T_INVALID;
+                   });
+
+        test.check("Invalid line is reported when its option is queried",
+                   [&kconfig]() {
+                       try {
+                           kconfig.get("CONFIG_BROKEN");
+                       } catch (const KError &) {
+                           return true;
+                       }
+                       return false;
+                   });
+
+        test.check("Option after an invalid line is found",
+                   [&kconfig]() {
+                       return isTristate(kconfig, "CONFIG_CRASH_DUMP",
+                                         KconfigValue::ON);
+                   });
+
+        test.check("Later lines override earlier ones",
+                   []() {
+                       Kconfig kc;
+                       kc.readFromString(config);
+                       kc.get("CONFIG_SMP");    // build the index
+                       kc.readFromString("# CONFIG_SMP is not set\n"
+                                         "CONFIG_NR_CPUS=64");
+                       return isTristate(kc, "CONFIG_SMP",
+                                         KconfigValue::OFF) &&
+                           kc.get("CONFIG_NR_CPUS").getIntValue() == 64 &&
+                           isTristate(kc, "CONFIG_EXT4_FS",
+                                      KconfigValue::MODULE);
+                   });
+
+        result = test.result();
+
+    } catch (const std::exception &ex) {
+        cerr << "Fatal exception: " << ex.what() << endl;
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
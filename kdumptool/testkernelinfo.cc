@@ -0,0 +1,149 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "global.h"
+#include "debug.h"
+#include "fileutil.h"
+#include "kernelinfo.h"
+#include "testutil.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+// -----------------------------------------------------------------------------
+static const char *const images[] = {
+    "kernel-bzImage-x86_64",
+    "kernel-ELFgz-x86_64",
+    "kernel-ELF-x86_64",
+    "kernel-ELFgz-ia64",
+    "kernel-ELF-ia64",
+    "kernel-ELF-aarch64",
+    NULL
+};
+
+// -----------------------------------------------------------------------------
+static string describe(KernelInfo &info)
+{
+    string ret = std::to_string(info.getKernelType());
+
+    try {
+        ret += info.isRelocatable() ? " reloc" : " noreloc";
+    } catch (KError &e) {
+        ret += string(" [") + e.what() + "]";
+    }
+
+    for (const char *const *p = KernelInfo::CONFIG_OPTIONS; *p; ++p) {
+        try {
+            ret += " " + info.getConfig(*p).toString();
+        } catch (KError &e) {
+            ret += string(" [") + e.what() + "]";
+        }
+    }
+
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    int result = EXIT_SUCCESS;
+
+    if (argc != 2) {
+        cerr << "Usage: " << argv[0] << " dir" << endl;
+        return EXIT_FAILURE;
+    }
+
+    Debug::debug()->setStderrLevel(Debug::DL_TRACE);
+    try {
+        TestRun test;
+
+        FilePath datadir(argv[1]);
+        TempDir tmpdir("kernelinfo");
+        KernelInfo::setCacheDir(tmpdir.file("cache"));
+
+        for (const char *const *p = images; *p; ++p) {
+            FilePath image = datadir;
+            image.appendPath(*p);
+            string fresh;
+
+            test.check((string(*p) + " is computed").c_str(),
+                       [&image, &fresh]() {
+                           KernelInfo info(image);
+                           fresh = describe(info);
+                           return !info.isCached();
+                       });
+
+            test.check((string(*p) + " is cached").c_str(),
+                       [&image, &fresh]() {
+                           KernelInfo info(image);
+                           return info.isCached() && describe(info) == fresh;
+                       });
+        }
+
+        FilePath copy = tmpdir.file("vmlinux");
+        {
+            FilePath image = datadir;
+            image.appendPath("kernel-ELF-x86_64");
+            FileDescriptor in(image, O_RDONLY);
+            FileDescriptor out(copy, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            vector<char> buf(65536);
+            ssize_t n;
+            while ((n = read(in, buf.data(), buf.size())) > 0)
+                if (write(out, buf.data(), n) != n)
+                    throw KSystemError("Cannot write " + copy, errno);
+        }
+
+        test.check("Only the queried property is computed",
+                   [&copy]() {
+                       KernelInfo info(copy);
+                       info.getKernelType();
+                       KernelInfo cached(copy);
+                       return cached.isCached() &&
+                           cached.getKernelType() == KernelTool::KT_ELF;
+                   });
+
+        test.check("Modified image is not cached",
+                   [&copy]() {
+                       struct timeval tv[2] = { { 1, 0 }, { 1, 0 } };
+                       if (utimes(copy.c_str(), tv) != 0)
+                           throw KSystemError("Cannot touch " + copy, errno);
+                       KernelInfo info(copy);
+                       return !info.isCached();
+                   });
+
+        result = test.result();
+
+    } catch (const std::exception &ex) {
+        cerr << "Fatal exception: " << ex.what() << endl;
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
@@ -0,0 +1,405 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "global.h"
+#include "debug.h"
+#include "kernellog.h"
+#include "vmcore.h"
+#include "vmcoreinfo.h"
+#include "testutil.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+// memory of the test dumps, mapped where 32-bit pointers reach it
+// (PAGE_OFFSET of i386)
+#define MEM_PADDR       0x100000ULL
+#define MEM_BASE        (0xc0000000ULL + MEM_PADDR)
+#define MEM_SIZE        0x4000
+
+// variables, structures and buffers in that memory
+#define VAR_LOG_BUF     (MEM_BASE + 0x00)
+#define VAR_BUF_LEN     (MEM_BASE + 0x10)
+#define VAR_FIRST_IDX   (MEM_BASE + 0x14)
+#define VAR_NEXT_IDX    (MEM_BASE + 0x18)
+#define VAR_LOG_END     (MEM_BASE + 0x1c)
+#define RINGBUFFER      (MEM_BASE + 0x100)
+#define DESCS           (MEM_BASE + 0x1000)
+#define INFOS           (MEM_BASE + 0x2000)
+#define DATA            (MEM_BASE + 0x3000)
+
+// lockless ring buffer
+#define COUNT_BITS      3
+#define SIZE_BITS       8
+#define DATA_SIZE       (1UL << SIZE_BITS)
+#define INFO_SIZE       32
+#define DESC_RESERVED   0
+#define DESC_COMMITTED  1
+#define DESC_FINALIZED  2
+
+// printk_log records
+#define LOG_BUF_LEN     256
+#define LOG_HDR_SIZE    16
+
+// -----------------------------------------------------------------------------
+static void put(vector<char> &mem, uint64_t addr, const void *data,
+                size_t len)
+{
+    if (addr < MEM_BASE || addr - MEM_BASE + len > mem.size())
+        throw KError("Test data outside of the test memory");
+    memcpy(&mem[addr - MEM_BASE], data, len);
+}
+
+// -----------------------------------------------------------------------------
+static void putInt(vector<char> &mem, uint64_t addr, uint64_t val,
+                   size_t size)
+{
+    if (size == 8) {
+        put(mem, addr, &val, size);
+    } else if (size == 4) {
+        uint32_t v32 = val;
+        put(mem, addr, &v32, size);
+    } else {
+        uint16_t v16 = val;
+        put(mem, addr, &v16, size);
+    }
+}
+
+// -----------------------------------------------------------------------------
+static void writeDump(const FilePath &path, const vector<char> &mem,
+                      const string &vmcoreinfo,
+                      unsigned machine = EM_X86_64)
+{
+    vector<TestSegment> segments(1);
+    segments[0].paddr = MEM_PADDR;
+    segments[0].vaddr = MEM_BASE;
+    segments[0].data = mem;
+    writeVmcore(path, "OSRELEASE=" TEST_RELEASE "\n" + vmcoreinfo,
+                segments, machine);
+}
+
+// -----------------------------------------------------------------------------
+static string kernelLog(const FilePath &path)
+{
+    Vmcore vmcore(path);
+    Vmcoreinfo info;
+    info.readFromELF(path.c_str());
+    return KernelLog(vmcore, info).dump();
+}
+
+// -----------------------------------------------------------------------------
+static bool rejected(const FilePath &path)
+{
+    try {
+        kernelLog(path);
+    } catch (const KError &error) {
+        cerr << "Expected error: " << error.what() << endl;
+        return true;
+    }
+    return false;
+}
+
+//{{{ Lockless ring buffer -----------------------------------------------------
+
+struct LocklessRecord {
+    uint64_t id;                // descriptor ID
+    unsigned state;
+    uint64_t descId;            // ID in state_var (stale if != id)
+    uint64_t begin, next;       // logical positions of the data block
+    uint64_t ts;
+    const char *text;
+};
+
+static const char WRAPPED_TEXT[] = "this record wraps to the start";
+
+// tail 8, head 13; 9, 11 and 12 must be skipped
+static const LocklessRecord locklessRecords[] = {
+    { 8, DESC_FINALIZED, 8, 320, 336, 1500000000, "first" },
+    { 9, DESC_FINALIZED, 9, 1, 1, 1600000000, "" },
+    { 10, DESC_COMMITTED, 10, 336, 352, 2000000000, "second\x01" },
+    { 11, DESC_RESERVED, 11, 352, 368, 2500000000, "reserved" },
+    { 12, DESC_FINALIZED, 4, 368, 384, 2600000000, "stale" },
+    { 13, DESC_FINALIZED, 13, 496, 512 + 38, 3000000000, WRAPPED_TEXT },
+};
+
+static const char locklessLog[] =
+    "[    1.500000] first\n"
+    "[    2.000000] second\\x01\n"
+    "[    3.000000] this record wraps to the start\n";
+
+// -----------------------------------------------------------------------------
+// Writes a lockless ring buffer with longs of longsz bytes.
+static void makeLockless(const FilePath &path, size_t longsz,
+                         unsigned machine, uint64_t headId,
+                         unsigned countBits = COUNT_BITS)
+{
+    const size_t L = longsz;
+    vector<char> mem(MEM_SIZE);
+
+    putInt(mem, MEM_BASE, RINGBUFFER, L);
+
+    // struct prb_desc_ring and struct prb_data_ring
+    uint64_t descRing = RINGBUFFER, dataRing = RINGBUFFER + 5 * L;
+    putInt(mem, descRing, countBits, 4);
+    putInt(mem, descRing + L, DESCS, L);
+    putInt(mem, descRing + 2 * L, INFOS, L);
+    putInt(mem, descRing + 3 * L, headId, L);
+    putInt(mem, descRing + 4 * L, locklessRecords[0].id, L);
+    putInt(mem, dataRing, SIZE_BITS, 4);
+    putInt(mem, dataRing + L, DATA, L);
+
+    for (const auto &rec : locklessRecords) {
+        size_t idx = rec.id & ((1UL << COUNT_BITS) - 1);
+        uint64_t desc = DESCS + idx * 3 * L;
+        uint64_t info = INFOS + idx * INFO_SIZE;
+        uint64_t sv = (uint64_t(rec.state) << (8 * L - 2)) | rec.descId;
+        putInt(mem, desc, sv, L);
+        putInt(mem, desc + L, rec.begin, L);
+        putInt(mem, desc + 2 * L, rec.next, L);
+        putInt(mem, info + 8, rec.ts, 8);
+        putInt(mem, info + 16, strlen(rec.text), 2);
+
+        if ((rec.begin & 1) && (rec.next & 1))
+            continue;           // data-less
+        uint64_t block = (rec.begin >> SIZE_BITS) == (rec.next >> SIZE_BITS)
+            ? rec.begin & (DATA_SIZE - 1) : 0;
+        putInt(mem, DATA + block, rec.id, L);
+        put(mem, DATA + block + L, rec.text, strlen(rec.text));
+    }
+
+    std::ostringstream info;
+    info << "SYMBOL(prb)=" << std::hex << MEM_BASE << std::dec << "\n"
+         << "SIZE(printk_ringbuffer)=" << 9 * L << "\n"
+         << "OFFSET(printk_ringbuffer.desc_ring)=0\n"
+         << "OFFSET(printk_ringbuffer.text_data_ring)=" << 5 * L << "\n"
+         << "SIZE(prb_desc_ring)=" << 5 * L << "\n"
+         << "OFFSET(prb_desc_ring.count_bits)=0\n"
+         << "OFFSET(prb_desc_ring.descs)=" << L << "\n"
+         << "OFFSET(prb_desc_ring.infos)=" << 2 * L << "\n"
+         << "OFFSET(prb_desc_ring.head_id)=" << 3 * L << "\n"
+         << "OFFSET(prb_desc_ring.tail_id)=" << 4 * L << "\n"
+         << "SIZE(prb_data_ring)=" << 4 * L << "\n"
+         << "OFFSET(prb_data_ring.size_bits)=0\n"
+         << "OFFSET(prb_data_ring.data)=" << L << "\n"
+         << "SIZE(prb_desc)=" << 3 * L << "\n"
+         << "OFFSET(prb_desc.state_var)=0\n"
+         << "OFFSET(prb_desc.text_blk_lpos)=" << L << "\n"
+         << "OFFSET(prb_data_blk_lpos.begin)=0\n"
+         << "OFFSET(prb_data_blk_lpos.next)=" << L << "\n"
+         << "SIZE(printk_info)=" << INFO_SIZE << "\n"
+         << "OFFSET(printk_info.seq)=0\n"
+         << "OFFSET(printk_info.ts_nsec)=8\n"
+         << "OFFSET(printk_info.text_len)=16\n"
+         << "OFFSET(atomic_long_t.counter)=0\n";
+    writeDump(path, mem, info.str(), machine);
+}
+
+//}}}
+//{{{ Variable-length records --------------------------------------------------
+
+struct LogRecord {
+    uint32_t idx;
+    uint16_t len;               // 0 marks the wrap-around
+    uint64_t ts;
+    const char *text;
+};
+
+static const char LONG_TEXT[] = "a record which ends just before the wrap";
+
+// first 160, next 24
+static const LogRecord logRecords[] = {
+    { 160, 24, 1000000, "alpha" },
+    { 184, 56, 2000000, LONG_TEXT },
+    { 240, 0, 0, "" },
+    { 0, 24, 3000000, "gamma" },
+};
+
+static const char recordLog[] =
+    "[    0.001000] alpha\n"
+    "[    0.002000] a record which ends just before the wrap\n"
+    "[    0.003000] gamma\n";
+
+// -----------------------------------------------------------------------------
+// Writes a printk_log buffer; the struct is named prefix, and the text
+// length of the last record is lastTextLen.
+static void makeRecords(const FilePath &path, const string &prefix,
+                        uint32_t nextIdx, uint16_t lastTextLen)
+{
+    vector<char> mem(MEM_SIZE);
+
+    putInt(mem, VAR_LOG_BUF, DATA, 8);
+    putInt(mem, VAR_BUF_LEN, LOG_BUF_LEN, 4);
+    putInt(mem, VAR_FIRST_IDX, logRecords[0].idx, 4);
+    putInt(mem, VAR_NEXT_IDX, nextIdx, 4);
+
+    for (const auto &rec : logRecords) {
+        uint64_t hdr = DATA + rec.idx;
+        size_t textLen = &rec == &logRecords[3]
+            ? lastTextLen : strlen(rec.text);
+        putInt(mem, hdr, rec.ts, 8);
+        putInt(mem, hdr + 8, rec.len, 2);
+        putInt(mem, hdr + 10, textLen, 2);
+        put(mem, hdr + LOG_HDR_SIZE, rec.text, strlen(rec.text));
+    }
+
+    std::ostringstream info;
+    info << std::hex
+         << "SYMBOL(log_buf)=" << VAR_LOG_BUF << "\n"
+         << "SYMBOL(log_buf_len)=" << VAR_BUF_LEN << "\n"
+         << "SYMBOL(log_first_idx)=" << VAR_FIRST_IDX << "\n"
+         << "SYMBOL(log_next_idx)=" << VAR_NEXT_IDX << "\n"
+         << std::dec
+         << "SIZE(" << prefix << ")=" << LOG_HDR_SIZE << "\n"
+         << "OFFSET(" << prefix << ".ts_nsec)=0\n"
+         << "OFFSET(" << prefix << ".len)=8\n"
+         << "OFFSET(" << prefix << ".text_len)=10\n";
+    writeDump(path, mem, info.str());
+}
+
+//}}}
+//{{{ Plain buffer -------------------------------------------------------------
+
+#define PLAIN_BUF_LEN   64
+
+// -----------------------------------------------------------------------------
+static string plainText()
+{
+    string ret;
+    for (int i = 0; i < PLAIN_BUF_LEN; ++i)
+        ret += char('a' + i % 26);
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+static void makePlain(const FilePath &path, uint32_t logEnd)
+{
+    vector<char> mem(MEM_SIZE);
+    string text = plainText();
+
+    putInt(mem, VAR_LOG_BUF, DATA, 8);
+    putInt(mem, VAR_BUF_LEN, PLAIN_BUF_LEN, 4);
+    putInt(mem, VAR_LOG_END, logEnd, 4);
+    put(mem, DATA, text.data(), text.size());
+
+    std::ostringstream info;
+    info << std::hex
+         << "SYMBOL(log_buf)=" << VAR_LOG_BUF << "\n"
+         << "SYMBOL(log_buf_len)=" << VAR_BUF_LEN << "\n"
+         << "SYMBOL(log_end)=" << VAR_LOG_END << "\n";
+    writeDump(path, mem, info.str());
+}
+
+//}}}
+
+// -----------------------------------------------------------------------------
+int main()
+{
+    int result = EXIT_SUCCESS;
+
+    try {
+        TestRun test;
+
+        TempDir dir("kernellog");
+        FilePath path = dir.file("vmcore");
+
+        test.check("Lockless ring buffer",
+                   [&path]() {
+                       makeLockless(path, 8, EM_X86_64, 13);
+                       return kernelLog(path) == locklessLog;
+                   });
+
+        test.check("Lockless ring buffer of an i386 kernel",
+                   [&path]() {
+                       makeLockless(path, 4, EM_386, 13);
+                       return kernelLog(path) == locklessLog;
+                   });
+
+        test.check("Lockless ring buffer ends without the head ID",
+                   [&path]() {
+                       makeLockless(path, 8, EM_X86_64, 100);
+                       return kernelLog(path) == locklessLog;
+                   });
+
+        test.check("Invalid ring buffer size is rejected",
+                   [&path]() {
+                       makeLockless(path, 8, EM_X86_64, 13, 64);
+                       return rejected(path);
+                   });
+
+        test.check("Records wrap around",
+                   [&path]() {
+                       makeRecords(path, "printk_log", 24, 5);
+                       return kernelLog(path) == recordLog;
+                   });
+
+        test.check("Records of struct log (before Linux 3.11)",
+                   [&path]() {
+                       makeRecords(path, "log", 24, 5);
+                       return kernelLog(path) == recordLog;
+                   });
+
+        test.check("Records that form a loop are rejected",
+                   [&path]() {
+                       makeRecords(path, "printk_log", 8, 5);
+                       return rejected(path);
+                   });
+
+        test.check("Text beyond the buffer is rejected",
+                   [&path]() {
+                       makeRecords(path, "printk_log", 24, 300);
+                       return rejected(path);
+                   });
+
+        test.check("Plain buffer before the first wrap",
+                   [&path]() {
+                       makePlain(path, 20);
+                       return kernelLog(path) == plainText().substr(0, 20);
+                   });
+
+        test.check("Plain buffer after a wrap",
+                   [&path]() {
+                       makePlain(path, 3 * PLAIN_BUF_LEN + 10);
+                       string text = plainText();
+                       return kernelLog(path) ==
+                           text.substr(10) + text.substr(0, 10);
+                   });
+
+        test.check("Dump without a log buffer is rejected",
+                   [&path]() {
+                       writeDump(path, vector<char>(MEM_SIZE), "");
+                       return rejected(path);
+                   });
+
+        result = test.result();
+
+    } catch (const std::exception &ex) {
+        cerr << "Fatal exception: " << ex.what() << endl;
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
@@ -0,0 +1,387 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "global.h"
+#include "debug.h"
+#include "nativedump.h"
+#include "diskdump.h"
+#include "stringvector.h"
+#include "testutil.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+#define MAX_MAPNR       (NativeDumpProvider::CYCLE_PFNS + 16)
+
+// a non-anonymous address_space and an anon_vma
+#define FILE_MAPPING    0xffff888000100000ULL
+#define ANON_MAPPING    0xffff888000200001ULL
+
+// Page types and the dump level bits that make makedumpfile exclude
+// them (see __exclude_unnecessary_pages() in makedumpfile.c).
+struct TypedPage {
+    const char *what;
+    TestStructPage page;
+    int excludedBy;
+};
+
+static const TypedPage typedPages[] = {
+    { "other kernel page", { 0, 0, 0, 0 }, 0 },
+    { "non-LRU page with a mapping", { 0, FILE_MAPPING, 0, 0 }, 0 },
+    { "slab page", { TEST_PG_SLAB, 0, 0, 0 }, 0 },
+    { "page cache", { TEST_PG_LRU, FILE_MAPPING, 0, 0 }, 2 | 4 },
+    { "page cache with private data",
+      { TEST_PG_LRU | TEST_PG_PRIVATE, FILE_MAPPING, 0, 0 }, 4 },
+    { "swap cache",
+      { TEST_PG_SWAPCACHE | TEST_PG_SWAPBACKED, FILE_MAPPING, 0, 0 },
+      2 | 4 },
+    { "PG_owner_priv_1 without PG_swapbacked",
+      { TEST_PG_SWAPCACHE, FILE_MAPPING, 0, 0 }, 0 },
+    { "anonymous page", { TEST_PG_LRU, ANON_MAPPING, 0, 0 }, 8 },
+    { "anonymous swap cache",
+      { TEST_PG_SWAPCACHE | TEST_PG_SWAPBACKED, ANON_MAPPING, 0, 0 }, 8 },
+    // order 2, so the tail pages with a zero struct page are free, too
+    { "free pages", { 0, 0, 2, TEST_PAGE_BUDDY }, 16 },
+};
+#define NTYPES          (sizeof(typedPages) / sizeof(typedPages[0]))
+
+// each type gets this many page frames, one of them a zero page
+#define TYPE_PFNS       4
+
+// -----------------------------------------------------------------------------
+static vector<char> readFile(const FilePath &path)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    return vector<char>(std::istreambuf_iterator<char>(in),
+                        std::istreambuf_iterator<char>());
+}
+
+// -----------------------------------------------------------------------------
+static bool testBit(const char *bitmap, uint64_t bit)
+{
+    return bitmap[bit / 8] & (1 << (bit % 8));
+}
+
+// -----------------------------------------------------------------------------
+static vector<char> subRange(const vector<char> &file, uint64_t offset,
+                             size_t size)
+{
+    if (offset + size > file.size())
+        throw KError("Dump file is truncated");
+    return vector<char>(file.begin() + offset, file.begin() + offset + size);
+}
+
+// -----------------------------------------------------------------------------
+// Reads a kdump-compressed file the way crash does.
+static PageMap readKdump(const vector<char> &file,
+                         struct disk_dump_header &dh,
+                         struct kdump_sub_header &kh)
+{
+    PageMap ret;
+
+    memcpy(&dh, subRange(file, 0, sizeof dh).data(), sizeof dh);
+    if (memcmp(dh.signature, KDUMP_SIGNATURE, sizeof dh.signature))
+        throw KError("Bad signature");
+    uint64_t bs = dh.block_size;
+    memcpy(&kh, subRange(file, bs, sizeof kh).data(), sizeof kh);
+
+    uint64_t bitmapOffset = bs * (1 + dh.sub_hdr_size);
+    uint64_t bitmapLen = bs * dh.bitmap_blocks / 2;
+    vector<char> bitmap1 = subRange(file, bitmapOffset, bitmapLen);
+    vector<char> bitmap2 = subRange(file, bitmapOffset + bitmapLen,
+                                    bitmapLen);
+
+    uint64_t pdOffset = bitmapOffset + 2 * bitmapLen;
+    for (uint64_t pfn = 0; pfn < kh.max_mapnr_64; ++pfn) {
+        if (!testBit(bitmap2.data(), pfn))
+            continue;
+        if (!testBit(bitmap1.data(), pfn))
+            throw KError("Dumped page is not in memory");
+
+        struct page_desc pd;
+        memcpy(&pd, subRange(file, pdOffset, sizeof pd).data(), sizeof pd);
+        pdOffset += sizeof pd;
+
+        vector<char> data = subRange(file, pd.offset, pd.size);
+        vector<char> page(bs);
+        if (pd.flags & DUMP_DH_COMPRESSED_ZLIB) {
+            uLongf len = page.size();
+            if (uncompress(reinterpret_cast<Bytef *>(page.data()), &len,
+                           reinterpret_cast<const Bytef *>(data.data()),
+                           data.size()) != Z_OK || len != bs)
+                throw KError("Cannot uncompress a page");
+        } else if (pd.size == bs)
+            page = data;
+        else
+            throw KError("Bad page descriptor");
+        ret[pfn] = page;
+    }
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+// Rearranges a flattened file like makedumpfile -R.
+static vector<char> rearrange(const vector<char> &flat)
+{
+    vector<char> ret;
+
+    struct makedumpfile_header fh;
+    memcpy(&fh, subRange(flat, 0, sizeof fh).data(), sizeof fh);
+    if (strcmp(fh.signature, MDF_SIGNATURE) ||
+        be64toh(fh.type) != MDF_TYPE_FLAT_HEADER ||
+        be64toh(fh.version) != MDF_VERSION_FLAT_HEADER)
+        throw KError("Bad flattened header");
+
+    uint64_t pos = MDF_HEADER_SIZE;
+    while (true) {
+        struct makedumpfile_data_header dh;
+        memcpy(&dh, subRange(flat, pos, sizeof dh).data(), sizeof dh);
+        pos += sizeof dh;
+        int64_t offset = be64toh(dh.offset);
+        int64_t size = be64toh(dh.buf_size);
+        if (offset == MDF_END_FLAG && size == MDF_END_FLAG)
+            break;
+
+        if (uint64_t(offset + size) > ret.size())
+            ret.resize(offset + size);
+        vector<char> data = subRange(flat, pos, size);
+        std::copy(data.begin(), data.end(), ret.begin() + offset);
+        pos += size;
+    }
+    if (pos != flat.size())
+        throw KError("Data after the end of flattened file");
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+static vector<char> saveDirect(const FilePath &vmcore, const FilePath &dump,
+                               int dumplevel, unsigned threads)
+{
+    NativeDumpProvider provider(vmcore, dumplevel,
+                                NativeDumpProvider::COMP_ZLIB, threads);
+    StringVector targets;
+    targets.push_back(dump);
+    provider.saveToFile(targets);
+    return readFile(dump);
+}
+
+// -----------------------------------------------------------------------------
+static vector<char> saveFlattened(const FilePath &vmcore, int dumplevel,
+                                  unsigned threads)
+{
+    NativeDumpProvider provider(vmcore, dumplevel,
+                                NativeDumpProvider::COMP_ZLIB, threads);
+    vector<char> ret;
+    char buf[1000];
+    size_t len;
+
+    provider.prepare();
+    while ( (len = provider.getData(buf, sizeof buf)) )
+        ret.insert(ret.end(), buf, buf + len);
+    provider.finish();
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+static bool checkPages(const PageMap &dumped, const PageMap &pages,
+                       bool excludeZero)
+{
+    for (const auto &page : pages) {
+        bool zero = page.first % 4 == 0;
+        auto it = dumped.find(page.first);
+        if (it == dumped.end()) {
+            if (!zero || !excludeZero)
+                return false;
+        } else if ((zero && excludeZero) || it->second != page.second)
+            return false;
+    }
+    return dumped.size() <= pages.size();
+}
+
+// -----------------------------------------------------------------------------
+// Writes a vmcore with TYPE_PFNS page frames of each typedPages entry.
+static void makeTypedVmcore(const FilePath &path, PageMap &pages,
+                            std::map<uint64_t, const TypedPage *> &types)
+{
+    std::map<uint64_t, TestStructPage> structPages;
+    uint64_t pfn = TEST_SYSTEM_PFNS;
+    for (const auto &type : typedPages) {
+        // a free block is described by its first struct page
+        bool buddy = type.page.mapcount == TEST_PAGE_BUDDY;
+        for (int i = 0; i < TYPE_PFNS; ++i) {
+            if (!i || !buddy)
+                structPages[pfn] = type.page;
+            types[pfn++] = &type;
+        }
+    }
+
+    vector<std::pair<uint64_t, uint64_t> > ranges;
+    ranges.push_back(std::make_pair(uint64_t(TEST_SYSTEM_PFNS), pfn));
+    makeClassifiedVmcore(path, pages, ranges, structPages);
+}
+
+// -----------------------------------------------------------------------------
+// Checks that exactly the pages kept by makedumpfile at dumplevel
+// are in the dump.
+static bool checkLevel(const PageMap &dumped, const PageMap &pages,
+                       const std::map<uint64_t, const TypedPage *> &types,
+                       int dumplevel)
+{
+    for (const auto &page : pages) {
+        bool zero = std::all_of(page.second.begin(), page.second.end(),
+                                [](char c) { return c == 0; });
+        auto type = types.find(page.first);
+        int excludedBy = type != types.end() ? type->second->excludedBy : 0;
+        bool keep = !(zero && (dumplevel & 1)) && !(excludedBy & dumplevel);
+
+        auto it = dumped.find(page.first);
+        if (keep != (it != dumped.end())) {
+            cerr << "Dump level " << dumplevel << ": page frame "
+                 << page.first << " ("
+                 << (type != types.end() ? type->second->what : "system")
+                 << ") " << (keep ? "missing" : "not excluded") << endl;
+            return false;
+        }
+        if (keep && it->second != page.second)
+            return false;
+    }
+    return dumped.size() <= pages.size();
+}
+
+// -----------------------------------------------------------------------------
+int main()
+{
+    int result = EXIT_SUCCESS;
+
+    try {
+        TestRun test;
+
+        TempDir dir("nativedump");
+        FilePath vmcore = dir.file("vmcore.elf");
+        FilePath dump = dir.file("vmcore");
+
+        PageMap pages;
+        makeVmcore(vmcore, pages, NativeDumpProvider::CYCLE_PFNS);
+
+        test.check("Zero pages can be excluded without VMCOREINFO struct page",
+                   [&vmcore]() {
+                       NativeDumpProvider provider(vmcore, 1,
+                           NativeDumpProvider::COMP_ZLIB, 1);
+                       return provider.init();
+                   });
+
+        test.check("User pages cannot be excluded without struct page",
+                   [&vmcore]() {
+                       NativeDumpProvider provider(vmcore, 31,
+                           NativeDumpProvider::COMP_ZLIB, 1);
+                       return !provider.init();
+                   });
+
+        vector<char> direct;
+        struct disk_dump_header dh;
+        struct kdump_sub_header kh;
+
+        test.check("Dump level 1 keeps all non-zero pages",
+                   [&]() {
+                       direct = saveDirect(vmcore, dump, 1, 3);
+                       return checkPages(readKdump(direct, dh, kh),
+                                         pages, true);
+                   });
+
+        test.check("Header describes the dump",
+                   [&]() {
+                       return dh.header_version == KDUMP_HEADER_VERSION &&
+                           dh.status == DUMP_DH_COMPRESSED_ZLIB &&
+                           dh.block_size == TEST_PAGE_SIZE &&
+                           dh.nr_cpus == 2 &&
+                           dh.max_mapnr == MAX_MAPNR &&
+                           dh.timestamp.tv_sec == 1600000000 &&
+                           !strcmp(dh.utsname[2], TEST_RELEASE) &&
+                           kh.dump_level == 1 &&
+                           kh.max_mapnr_64 == MAX_MAPNR;
+                   });
+
+        test.check("VMCOREINFO is found in the header",
+                   [&]() {
+                       string info(direct.data() + kh.offset_vmcoreinfo,
+                                   kh.size_vmcoreinfo);
+                       return info.compare(0, 10, "OSRELEASE=") == 0;
+                   });
+
+        test.check("Flattened format matches the direct file",
+                   [&]() {
+                       vector<char> flat = rearrange(
+                           saveFlattened(vmcore, 1, 2));
+                       return flat == direct;
+                   });
+
+        test.check("Dump level 0 keeps zero pages",
+                   [&]() {
+                       vector<char> file = saveDirect(vmcore, dump, 0, 1);
+                       return checkPages(readKdump(file, dh, kh),
+                                         pages, false);
+                   });
+
+        FilePath typed = dir.file("vmcore-typed.elf");
+        PageMap typedMem;
+        std::map<uint64_t, const TypedPage *> types;
+        makeTypedVmcore(typed, typedMem, types);
+
+        test.check("Struct page is found through the kernel page tables",
+                   [&typed]() {
+                       NativeDumpProvider provider(typed, 31,
+                           NativeDumpProvider::COMP_ZLIB, 1);
+                       return provider.init();
+                   });
+
+        static const int levels[] = { 2, 4, 8, 16, 2 | 8, 31 };
+        for (int level : levels) {
+            string what = "Dump level " + std::to_string(level) +
+                " keeps the pages that makedumpfile keeps";
+            test.check(what.c_str(),
+                       [&, level]() {
+                           vector<char> file = saveDirect(typed, dump,
+                                                          level, 2);
+                           return checkLevel(readKdump(file, dh, kh),
+                                             typedMem, types, level);
+                       });
+        }
+
+        result = test.result();
+
+    } catch (const std::exception &ex) {
+        cerr << "Fatal exception: " << ex.what() << endl;
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
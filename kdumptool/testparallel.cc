@@ -0,0 +1,144 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstdlib>
+#include <iostream>
+#include <atomic>
+#include <new>
+#include <vector>
+
+#include "global.h"
+#include "debug.h"
+#include "parallel.h"
+#include "testutil.h"
+
+using std::cerr;
+using std::endl;
+using std::vector;
+
+#define NUM_ITEMS       1000
+#define MAX_THREADS     4
+
+// -----------------------------------------------------------------------------
+static bool checkAllItems(void)
+{
+    vector<std::atomic<int> > count(NUM_ITEMS);
+    for (auto &c : count)
+        c = 0;
+
+    parallelFor(NUM_ITEMS, MAX_THREADS, [&count](size_t i) {
+        ++count[i];
+    });
+
+    for (const auto &c : count)
+        if (c != 1)
+            return false;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+static bool checkWait(void)
+{
+    vector<size_t> result(NUM_ITEMS);
+    ParallelFor pool(NUM_ITEMS, MAX_THREADS, [&result](size_t i) {
+        result[i] = i * i;
+    });
+
+    for (size_t i = 0; i < NUM_ITEMS; ++i) {
+        pool.wait(i);
+        if (result[i] != i * i)
+            return false;
+    }
+    pool.join();
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+static bool checkException(void)
+{
+    try {
+        parallelFor(NUM_ITEMS, MAX_THREADS, [](size_t i) {
+            if (i == NUM_ITEMS / 2)
+                throw std::bad_alloc();
+        });
+    } catch (const std::bad_alloc &) {
+        return true;
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+static bool checkWaitException(void)
+{
+    ParallelFor pool(NUM_ITEMS, MAX_THREADS, [](size_t i) {
+        if (i == 1)
+            throw KError("item 1");
+    });
+
+    pool.wait(0);
+    try {
+        pool.wait(1);
+    } catch (const KError &) {
+        return true;
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+static bool checkCancel(void)
+{
+    std::atomic<size_t> processed(0);
+    {
+        ParallelFor pool(NUM_ITEMS, MAX_THREADS, [&processed](size_t) {
+            ++processed;
+        });
+        pool.wait(0);
+        pool.cancel();
+    }
+    return processed >= 1 && processed <= NUM_ITEMS;
+}
+
+// -----------------------------------------------------------------------------
+int main()
+{
+    int result = EXIT_SUCCESS;
+
+    Debug::debug()->setStderrLevel(Debug::DL_TRACE);
+    try {
+        TestRun test;
+
+        test.check("All items are processed once", checkAllItems);
+        test.check("Items can be awaited in order", checkWait);
+        test.check("Exceptions are rethrown by join", checkException);
+        test.check("Exceptions are rethrown by wait", checkWaitException);
+        test.check("Cancelled pool is destroyed", checkCancel);
+        test.check("Empty range", []() {
+            parallelFor(0, MAX_THREADS, [](size_t) {
+                throw KError("unexpected item");
+            });
+            return true;
+        });
+
+        result = test.result();
+    } catch(KError &ke) {
+        cerr << ke.what() << endl;
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
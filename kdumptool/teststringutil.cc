@@ -24,50 +24,12 @@
 #include "global.h"
 #include "debug.h"
 #include "stringutil.h"
+#include "testutil.h"
 
 using std::cerr;
-using std::cout;
 using std::endl;
 using std::string;
 
-//{{{ TestRun -----------------------------------------------------------------
-
-class TestRun {
-    int m_result;
-
-public:
-    TestRun()
-        : m_result(EXIT_SUCCESS)
-    { }
-
-    int result(void)
-    { return m_result; }
-
-    template<typename check_fn>
-    void check(const char *what, check_fn fn);
-};
-
-// -----------------------------------------------------------------------------
-template<typename check_fn>
-void TestRun::check(const char *what, check_fn fn)
-{
-    cout << what << ": ";
-    try {
-        if (fn()) {
-            cout << "OK";
-        } else {
-            cout << "FAILED";
-            m_result = EXIT_FAILURE;
-        }
-        cout << endl;
-    } catch (KError &e) {
-        cout << "EXCEPTION" << endl;
-        cerr << e.what() << endl;
-        m_result = EXIT_FAILURE;
-    }
-}
-//}}}
-
 // -----------------------------------------------------------------------------
 int main(int argc, char *argv[])
 {
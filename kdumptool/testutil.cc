@@ -0,0 +1,394 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <endian.h>
+#include <zlib.h>
+
+#include "global.h"
+#include "testutil.h"
+
+using std::string;
+using std::vector;
+
+//{{{ TempDir ------------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+TempDir::TempDir(const string &name)
+{
+    const char *tmp = getenv("TMPDIR");
+    FilePath tmpl(tmp && *tmp ? tmp : "/tmp");
+    tmpl.appendPath("kdumptool-" + name + ".XXXXXX");
+
+    vector<char> buf(tmpl.begin(), tmpl.end());
+    buf.push_back('\0');
+    if (!mkdtemp(buf.data()))
+        throw KSystemError("Cannot create temporary directory " + tmpl,
+                           errno);
+    m_path = buf.data();
+}
+
+// -----------------------------------------------------------------------------
+TempDir::~TempDir()
+{
+    try {
+        m_path.rmdir(true);
+    } catch (KError &e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+// -----------------------------------------------------------------------------
+FilePath TempDir::file(const string &name) const
+{
+    FilePath ret = m_path;
+    return ret.appendPath(name);
+}
+
+//}}}
+//{{{ Dump fixtures ------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+void appendNote(vector<char> &notes, uint32_t type, const char *name,
+                const string &desc)
+{
+    Elf64_Nhdr nhdr;
+    nhdr.n_namesz = strlen(name) + 1;
+    nhdr.n_descsz = desc.size();
+    nhdr.n_type = type;
+
+    const char *p = reinterpret_cast<const char *>(&nhdr);
+    notes.insert(notes.end(), p, p + sizeof nhdr);
+    notes.insert(notes.end(), name, name + nhdr.n_namesz);
+    notes.resize((notes.size() + 3) & ~3);
+    notes.insert(notes.end(), desc.begin(), desc.end());
+    notes.resize((notes.size() + 3) & ~3);
+}
+
+// -----------------------------------------------------------------------------
+vector<char> vmcoreinfoNote(const string &release, long crashtime)
+{
+    vector<char> notes;
+    appendNote(notes, 0, "VMCOREINFO",
+               "OSRELEASE=" + release + "\n" +
+               "CRASHTIME=" + std::to_string(crashtime) + "\n");
+    return notes;
+}
+
+// -----------------------------------------------------------------------------
+Elf64_Ehdr coreHeader(unsigned phnum)
+{
+    Elf64_Ehdr ehdr;
+    memset(&ehdr, 0, sizeof ehdr);
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+#else
+    ehdr.e_ident[EI_DATA] = ELFDATA2MSB;
+#endif
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_type = ET_CORE;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_phoff = sizeof ehdr;
+    ehdr.e_ehsize = sizeof ehdr;
+    ehdr.e_phentsize = sizeof(Elf64_Phdr);
+    ehdr.e_phnum = phnum;
+    return ehdr;
+}
+
+// -----------------------------------------------------------------------------
+vector<char> makePage(uint64_t pfn)
+{
+    vector<char> page(TEST_PAGE_SIZE, 0);
+
+    switch (pfn % 4) {
+    case 0:                     // zero
+        break;
+    case 1: {                   // incompressible
+        unsigned long x = pfn + 1;
+        for (auto &c : page) {
+            x = x * 6364136223846793005UL + 1442695040888963407UL;
+            c = x >> 56;
+        }
+        break;
+    }
+    default:                    // compressible
+        snprintf(page.data(), page.size(), "page frame %llu",
+                 (unsigned long long)pfn);
+        break;
+    }
+    return page;
+}
+
+// -----------------------------------------------------------------------------
+void writeVmcore(const FilePath &path, const string &vmcoreinfo,
+                 const vector<TestSegment> &segments, unsigned machine)
+{
+    vector<char> notes;
+    appendNote(notes, NT_PRSTATUS, "CORE", string(32, '\0'));
+    appendNote(notes, NT_PRSTATUS, "CORE", string(32, '\0'));
+    appendNote(notes, 0, "VMCOREINFO", vmcoreinfo);
+
+    unsigned phnum = segments.size() + 1;
+    Elf64_Ehdr ehdr = coreHeader(phnum);
+    ehdr.e_machine = machine;
+
+    vector<Elf64_Phdr> phdrs(phnum);
+    memset(phdrs.data(), 0, phdrs.size() * sizeof(Elf64_Phdr));
+    phdrs[0].p_type = PT_NOTE;
+    phdrs[0].p_offset = sizeof ehdr + phnum * sizeof(Elf64_Phdr);
+    phdrs[0].p_filesz = notes.size();
+
+    // memory starts at a page boundary after the notes
+    uint64_t dataStart = (phdrs[0].p_offset + notes.size() +
+                          TEST_PAGE_SIZE - 1) & ~uint64_t(TEST_PAGE_SIZE - 1);
+    uint64_t offset = dataStart;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        Elf64_Phdr &phdr = phdrs[i + 1];
+        phdr.p_type = PT_LOAD;
+        phdr.p_offset = offset;
+        phdr.p_paddr = segments[i].paddr;
+        phdr.p_vaddr = segments[i].vaddr;
+        phdr.p_filesz = phdr.p_memsz = segments[i].data.size();
+        offset += phdr.p_filesz;
+    }
+
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&ehdr), sizeof ehdr);
+    out.write(reinterpret_cast<const char *>(phdrs.data()),
+              phdrs.size() * sizeof(Elf64_Phdr));
+    out.write(notes.data(), notes.size());
+    out.seekp(dataStart);
+    for (const auto &seg : segments)
+        out.write(seg.data.data(), seg.data.size());
+    if (!out)
+        throw KError("Cannot write " + path);
+}
+
+// -----------------------------------------------------------------------------
+void makeVmcore(const FilePath &path, PageMap &pages, uint64_t cyclePfns)
+{
+    // two memory ranges with a gap, the second one in two cycles
+    const uint64_t ranges[][2] = {
+        { 0, 40 },
+        { cyclePfns - 20, cyclePfns + 16 }
+    };
+
+    vector<TestSegment> segments;
+    for (const auto &range : ranges) {
+        TestSegment seg;
+        seg.paddr = range[0] * TEST_PAGE_SIZE;
+        seg.vaddr = TEST_DIRECT_MAP + seg.paddr;
+        for (uint64_t pfn = range[0]; pfn < range[1]; ++pfn) {
+            vector<char> page = makePage(pfn);
+            seg.data.insert(seg.data.end(), page.begin(), page.end());
+            pages[pfn] = page;
+        }
+        segments.push_back(seg);
+    }
+
+    writeVmcore(path,
+                "OSRELEASE=" TEST_RELEASE "\n"
+                "PAGESIZE=4096\n"
+                "CRASHTIME=1600000000\n",
+                segments);
+}
+
+// -----------------------------------------------------------------------------
+void makeClassifiedVmcore(const FilePath &path, PageMap &pages,
+                          const vector<std::pair<uint64_t, uint64_t> > &ranges,
+                          const std::map<uint64_t, TestStructPage> &structPages)
+{
+    // struct page layout of Linux 5.14
+    const size_t flagsOff = 0, mappingOff = 24, privateOff = 40,
+        mapcountOff = 48;
+    const uint64_t present = 0x3;       // _PAGE_PRESENT | _PAGE_RW
+
+    // page frame 0 is the kernel text, 1 the top level page table
+    PageMap mem;
+    for (uint64_t pfn = 0; pfn < TEST_SYSTEM_PFNS; ++pfn)
+        mem[pfn] = vector<char>(TEST_PAGE_SIZE, 0);
+    strcpy(mem[0].data(), "kernel text");
+    uint64_t nextFree = 2;
+
+    auto allocPage = [&nextFree]() -> uint64_t {
+        if (nextFree >= TEST_SYSTEM_PFNS)
+            throw KError("Too many page tables for the test vmcore");
+        return nextFree++;
+    };
+
+    // maps the page at vaddr and returns its page frame
+    auto mapPage = [&mem, &allocPage, present](uint64_t vaddr) -> uint64_t {
+        uint64_t table = 1;
+        for (int shift = 39; shift >= 12; shift -= 9) {
+            unsigned idx = (vaddr >> shift) & 511;
+            uint64_t *entry =
+                reinterpret_cast<uint64_t *>(mem[table].data()) + idx;
+            if (!*entry)
+                *entry = allocPage() * TEST_PAGE_SIZE | present;
+            table = *entry / TEST_PAGE_SIZE;
+        }
+        return table;
+    };
+
+    vector<std::pair<uint64_t, uint64_t> > all;
+    all.push_back(std::make_pair(uint64_t(0), uint64_t(TEST_SYSTEM_PFNS)));
+    for (const auto &range : ranges) {
+        if (range.first < TEST_SYSTEM_PFNS)
+            throw KError("Test memory overlaps the system page frames");
+        all.push_back(range);
+    }
+
+    // the struct page of every page frame, zero unless given
+    for (const auto &range : all) {
+        for (uint64_t pfn = range.first; pfn < range.second; ++pfn) {
+            uint64_t vaddr = TEST_VMEMMAP + pfn * TEST_STRUCT_PAGE_SIZE;
+            vector<char> &memmap = mem[mapPage(vaddr)];
+            char *page = memmap.data() + vaddr % TEST_PAGE_SIZE;
+            auto it = structPages.find(pfn);
+            if (it == structPages.end())
+                continue;
+            const TestStructPage &sp = it->second;
+            memcpy(page + flagsOff, &sp.flags, sizeof sp.flags);
+            memcpy(page + mappingOff, &sp.mapping, sizeof sp.mapping);
+            memcpy(page + privateOff, &sp.priv, sizeof sp.priv);
+            memcpy(page + mapcountOff, &sp.mapcount, sizeof sp.mapcount);
+        }
+    }
+
+    vector<TestSegment> segments;
+    TestSegment kernel;
+    kernel.paddr = 0;
+    kernel.vaddr = TEST_KERNEL_MAP;
+    for (uint64_t pfn = 0; pfn < 2; ++pfn)
+        kernel.data.insert(kernel.data.end(), mem[pfn].begin(),
+                           mem[pfn].end());
+    segments.push_back(kernel);
+
+    for (const auto &range : all) {
+        TestSegment seg;
+        seg.paddr = range.first * TEST_PAGE_SIZE;
+        seg.vaddr = TEST_DIRECT_MAP + seg.paddr;
+        for (uint64_t pfn = range.first; pfn < range.second; ++pfn) {
+            vector<char> page = pfn < TEST_SYSTEM_PFNS
+                ? mem[pfn] : makePage(pfn);
+            seg.data.insert(seg.data.end(), page.begin(), page.end());
+            pages[pfn] = page;
+        }
+        segments.push_back(seg);
+    }
+
+    std::ostringstream info;
+    info << "OSRELEASE=" TEST_RELEASE "\n"
+         << "PAGESIZE=" << TEST_PAGE_SIZE << "\n"
+         << "CRASHTIME=1600000000\n"
+         << "SYMBOL(init_top_pgt)=" << std::hex
+         << TEST_KERNEL_MAP + TEST_PAGE_SIZE
+         << std::dec << "\n"
+         << "SIZE(page)=" << TEST_STRUCT_PAGE_SIZE << "\n"
+         << "OFFSET(page.flags)=" << flagsOff << "\n"
+         << "OFFSET(page.mapping)=" << mappingOff << "\n"
+         << "OFFSET(page.private)=" << privateOff << "\n"
+         << "OFFSET(page._mapcount)=" << mapcountOff << "\n"
+         << "NUMBER(PG_lru)=4\n"
+         << "NUMBER(PG_slab)=9\n"
+         << "NUMBER(PG_swapcache)=10\n"
+         << "NUMBER(PG_private)=13\n"
+         << "NUMBER(PG_swapbacked)=19\n"
+         << "NUMBER(PAGE_BUDDY_MAPCOUNT_VALUE)=" << TEST_PAGE_BUDDY << "\n"
+         << "NUMBER(vmemmap_base)=" << (long long)TEST_VMEMMAP << "\n";
+    writeVmcore(path, info.str(), segments);
+}
+
+// -----------------------------------------------------------------------------
+string gzipped(const string &data)
+{
+    static const char header[10] = { 0x1f, (char)0x8b, 0x08 };
+    string ret(header, sizeof header);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof stream);
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                     8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw KError("deflateInit2() failed");
+
+    vector<char> out(deflateBound(&stream, data.size()));
+    stream.next_in = (Bytef *)data.data();
+    stream.avail_in = data.size();
+    stream.next_out = (Bytef *)out.data();
+    stream.avail_out = out.size();
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+        throw KError("deflate() failed");
+    ret.append(out.data(), stream.total_out);
+    deflateEnd(&stream);
+
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+vector<char> syntheticKernel(size_t size, const string &config, size_t center)
+{
+    vector<char> ret(size);
+    unsigned long x = 1;
+    for (auto &c : ret) {
+        x = x * 6364136223846793005UL + 1442695040888963407UL;
+        c = x >> 60;
+    }
+    memcpy(ret.data(), ELFMAG, SELFMAG);
+
+    string blob = "IKCFG_ST" + gzipped(config) + "IKCFG_ED";
+    if (center < SELFMAG + blob.size() / 2 ||
+        center - blob.size() / 2 + blob.size() > size)
+        throw KError("IKCONFIG does not fit into the synthetic kernel");
+    memcpy(ret.data() + center - blob.size() / 2, blob.data(), blob.size());
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+void writeFile(const FilePath &path, const string &data)
+{
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(data.data(), data.size());
+    if (!out)
+        throw KError("Cannot write " + path);
+}
+
+// -----------------------------------------------------------------------------
+void writeFile(const FilePath &path, const vector<char> &data)
+{
+    writeFile(path, string(data.data(), data.size()));
+}
+
+// -----------------------------------------------------------------------------
+void writeGzipFile(const FilePath &path, const vector<char> &data)
+{
+    gzFile fp = gzopen(path.c_str(), "wb1");
+    if (!fp)
+        throw KError("Cannot create " + path);
+    int ret = gzwrite(fp, data.data(), data.size());
+    if (gzclose(fp) != Z_OK || ret != int(data.size()))
+        throw KError("Cannot write " + path);
+}
+
+//}}}
@@ -0,0 +1,266 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef TESTUTIL_H
+#define TESTUTIL_H
+
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <gelf.h>
+
+#include "global.h"
+#include "fileutil.h"
+
+/*
+ * Helpers shared by the unit tests.
+ */
+
+//{{{ TestRun ------------------------------------------------------------------
+
+/**
+ * Runs the checks of a test program and collects the result.
+ */
+class TestRun {
+    int m_result;
+
+public:
+    TestRun()
+        : m_result(EXIT_SUCCESS)
+    { }
+
+    int result(void)
+    { return m_result; }
+
+    /**
+     * Prints @p what and runs @p fn. The check fails if @p fn
+     * returns false or throws a KError.
+     */
+    template<typename check_fn>
+    void check(const char *what, check_fn fn);
+};
+
+// -----------------------------------------------------------------------------
+template<typename check_fn>
+void TestRun::check(const char *what, check_fn fn)
+{
+    std::cout << what << ": ";
+    try {
+        if (fn()) {
+            std::cout << "OK";
+        } else {
+            std::cout << "FAILED";
+            m_result = EXIT_FAILURE;
+        }
+        std::cout << std::endl;
+    } catch (KError &e) {
+        std::cout << "EXCEPTION" << std::endl;
+        std::cerr << e.what() << std::endl;
+        m_result = EXIT_FAILURE;
+    }
+}
+
+//}}}
+//{{{ TempDir ------------------------------------------------------------------
+
+/**
+ * Scratch directory under $TMPDIR (or /tmp), which is removed with
+ * all its content by the destructor.
+ */
+class TempDir {
+
+    public:
+        /**
+         * Creates a directory named kdumptool-@p name.XXXXXX.
+         *
+         * @exception KSystemError if the directory cannot be created
+         */
+        TempDir(const std::string &name);
+
+        ~TempDir();
+
+        /**
+         * Returns the directory path.
+         */
+        const FilePath &path() const
+        { return m_path; }
+
+        /**
+         * Returns the path of @p name inside the directory.
+         */
+        FilePath file(const std::string &name) const;
+
+    private:
+        FilePath m_path;
+
+        // not copyable
+        TempDir(const TempDir &);
+        TempDir &operator=(const TempDir &);
+};
+
+//}}}
+//{{{ Dump fixtures ------------------------------------------------------------
+
+#define TEST_PAGE_SIZE  4096
+#define TEST_RELEASE    "5.14.21-test"
+#define TEST_DIRECT_MAP 0xffff888000000000ULL
+
+/**
+ * Page contents by page frame number.
+ */
+typedef std::map<uint64_t, std::vector<char> > PageMap;
+
+/**
+ * Appends an ELF note to @p notes.
+ */
+void appendNote(std::vector<char> &notes, uint32_t type, const char *name,
+                const std::string &desc);
+
+/**
+ * Returns a note segment with a VMCOREINFO note of @p release and
+ * @p crashtime.
+ */
+std::vector<char> vmcoreinfoNote(const std::string &release, long crashtime);
+
+/**
+ * Returns the ELF header of a 64-bit x86_64 core file in host byte
+ * order with @p phnum program headers following the ELF header.
+ */
+Elf64_Ehdr coreHeader(unsigned phnum);
+
+/**
+ * Returns the content of page frame @p pfn in makeVmcore(): a zero
+ * page, an incompressible page or a short text, depending on @p pfn.
+ */
+std::vector<char> makePage(uint64_t pfn);
+
+/**
+ * Writes an ELF vmcore with two memory ranges: 40 page frames at 0 and
+ * the page frames from @p cyclePfns - 20 to @p cyclePfns + 16, so the
+ * second range crosses a cycle boundary of the dump engines. It has
+ * two CPU notes and a VMCOREINFO note of TEST_RELEASE.
+ *
+ * @param[in] path file name
+ * @param[out] pages content of all page frames
+ * @param[in] cyclePfns page frames per cycle
+ * @exception KError if the file cannot be written
+ */
+void makeVmcore(const FilePath &path, PageMap &pages, uint64_t cyclePfns);
+
+/**
+ * A PT_LOAD segment of writeVmcore().
+ */
+struct TestSegment {
+    uint64_t paddr;
+    uint64_t vaddr;
+    std::vector<char> data;
+};
+
+/**
+ * Writes an ELF64 vmcore with two CPU notes, a VMCOREINFO note with
+ * @p vmcoreinfo and a PT_LOAD segment for each of @p segments.
+ *
+ * @param[in] machine ELF machine type of the crashed kernel
+ * @exception KError if the file cannot be written
+ */
+void writeVmcore(const FilePath &path, const std::string &vmcoreinfo,
+                 const std::vector<TestSegment> &segments,
+                 unsigned machine = EM_X86_64);
+
+// kernel layout of makeClassifiedVmcore(), as in Linux 5.14
+#define TEST_KERNEL_MAP         0xffffffff81000000ULL
+#define TEST_VMEMMAP            0xffffea8000000000ULL
+#define TEST_STRUCT_PAGE_SIZE   64
+#define TEST_SYSTEM_PFNS        16
+
+#define TEST_PG_LRU             (1ULL << 4)
+#define TEST_PG_SLAB            (1ULL << 9)
+#define TEST_PG_SWAPCACHE       (1ULL << 10)
+#define TEST_PG_PRIVATE         (1ULL << 13)
+#define TEST_PG_SWAPBACKED      (1ULL << 19)
+#define TEST_PAGE_BUDDY         (-129)
+
+/**
+ * Content of a struct page in makeClassifiedVmcore().
+ */
+struct TestStructPage {
+    uint64_t flags;
+    uint64_t mapping;
+    uint64_t priv;
+    int32_t mapcount;
+};
+
+/**
+ * Writes an x86_64 ELF vmcore with the kernel page tables and a struct
+ * page array, so that PageClassifier can read the struct page of every
+ * page frame.
+ *
+ * The page frames below TEST_SYSTEM_PFNS hold the kernel image (with
+ * the top level page table in page frame 1), the other page tables and
+ * the struct page array. The page frames of @p ranges contain
+ * makePage() and must not start below TEST_SYSTEM_PFNS.
+ *
+ * @param[in] path file name
+ * @param[out] pages content of all page frames
+ * @param[in] ranges page frame ranges [first, last)
+ * @param[in] structPages struct page by page frame number; all other
+ *            struct pages are zero
+ * @exception KError if the file cannot be written or the page tables
+ *            and struct page array do not fit below TEST_SYSTEM_PFNS
+ */
+void makeClassifiedVmcore(
+    const FilePath &path, PageMap &pages,
+    const std::vector<std::pair<uint64_t, uint64_t> > &ranges,
+    const std::map<uint64_t, TestStructPage> &structPages);
+
+/**
+ * Returns @p data compressed with a minimal gzip header followed by
+ * a raw deflate stream, as in the IKCONFIG blob of a kernel.
+ */
+std::string gzipped(const std::string &data);
+
+/**
+ * Returns a pseudo-random ELF kernel image of @p size bytes, which
+ * compresses roughly like kernel code, with an IKCONFIG blob of
+ * @p config centred at offset @p center.
+ */
+std::vector<char> syntheticKernel(size_t size, const std::string &config,
+                                  size_t center);
+
+/**
+ * Writes @p data to the file @p path.
+ *
+ * @exception KError if the file cannot be written
+ */
+void writeFile(const FilePath &path, const std::string &data);
+void writeFile(const FilePath &path, const std::vector<char> &data);
+
+/**
+ * Writes @p data gzip-compressed to the file @p path.
+ *
+ * @exception KError if the file cannot be written
+ */
+void writeGzipFile(const FilePath &path, const std::vector<char> &data);
+
+//}}}
+
+#endif /* TESTUTIL_H */
@@ -0,0 +1,236 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "global.h"
+#include "debug.h"
+#include "vmcore.h"
+#include "pagereader.h"
+#include "testutil.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+#define DIRECT_MAP      TEST_DIRECT_MAP
+#define KERNEL_MAP      0xffffffff81000000ULL
+
+struct Segment {
+    uint64_t paddr, vaddr, filesz, memsz;
+    char fill;
+};
+
+// the kernel image is listed first and overlaps the direct mapping
+static const Segment segments[] = {
+    { 0x100000, KERNEL_MAP, 0x10000, 0x10000, 'k' },
+    { 0, DIRECT_MAP, 0x400000, 0x400000, 'd' },
+    { 0x800000, DIRECT_MAP + 0x800000, 0x1000, 0x3000, 'z' },
+};
+#define NSEGMENTS   (sizeof(segments) / sizeof(segments[0]))
+
+// -----------------------------------------------------------------------------
+static vector<uint64_t> makeVmcore(const FilePath &path,
+                                   unsigned machine = EM_X86_64)
+{
+    Elf64_Ehdr ehdr = coreHeader(NSEGMENTS);
+    ehdr.e_machine = machine;
+
+    vector<Elf64_Phdr> phdrs(NSEGMENTS);
+    vector<uint64_t> offsets;
+    memset(phdrs.data(), 0, phdrs.size() * sizeof(Elf64_Phdr));
+    uint64_t offset = TEST_PAGE_SIZE;
+    for (size_t i = 0; i < NSEGMENTS; ++i) {
+        phdrs[i].p_type = PT_LOAD;
+        phdrs[i].p_offset = offset;
+        phdrs[i].p_paddr = segments[i].paddr;
+        phdrs[i].p_vaddr = segments[i].vaddr;
+        phdrs[i].p_filesz = segments[i].filesz;
+        phdrs[i].p_memsz = segments[i].memsz;
+        offsets.push_back(offset);
+        offset += segments[i].filesz;
+    }
+
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&ehdr), sizeof ehdr);
+    out.write(reinterpret_cast<const char *>(phdrs.data()),
+              phdrs.size() * sizeof(Elf64_Phdr));
+    out.seekp(TEST_PAGE_SIZE);
+    for (size_t i = 0; i < NSEGMENTS; ++i) {
+        string data(segments[i].filesz, segments[i].fill);
+        out.write(data.data(), data.size());
+    }
+    if (!out)
+        throw KError("Cannot write " + path);
+    return offsets;
+}
+
+// -----------------------------------------------------------------------------
+static char physByte(Vmcore &vmcore, uint64_t addr)
+{
+    char c;
+    vmcore.readPhys(addr, &c, 1);
+    return c;
+}
+
+// -----------------------------------------------------------------------------
+int main()
+{
+    int result = EXIT_SUCCESS;
+
+    Debug::debug()->setStderrLevel(Debug::DL_TRACE);
+    try {
+        TestRun test;
+
+        TempDir dir("vmcore");
+        FilePath path = dir.file("vmcore");
+        vector<uint64_t> offsets = makeVmcore(path);
+
+        Vmcore vmcore(path);
+
+        test.check("The first segment wins where segments overlap",
+                   [&]() {
+                       return physByte(vmcore, 0x100000) == 'k' &&
+                           physByte(vmcore, 0x10ffff) == 'k' &&
+                           physByte(vmcore, 0xfffff) == 'd' &&
+                           physByte(vmcore, 0x110000) == 'd' &&
+                           physByte(vmcore, 0x3fffff) == 'd';
+                   });
+
+        test.check("Reads cross interval boundaries",
+                   [&]() {
+                       char buf[4];
+                       vmcore.readPhys(0x10fffe, buf, sizeof buf);
+                       return memcmp(buf, "kkdd", 4) == 0;
+                   });
+
+        test.check("Virtual addresses are translated",
+                   [&]() {
+                       char buf[2];
+                       vmcore.readVirt(DIRECT_MAP + 0x100000, buf, 1);
+                       vmcore.readVirt(KERNEL_MAP, buf + 1, 1);
+                       return buf[0] == 'd' && buf[1] == 'k';
+                   });
+
+        test.check("Memory beyond p_filesz reads as zeroes",
+                   [&]() {
+                       return physByte(vmcore, 0x800fff) == 'z' &&
+                           physByte(vmcore, 0x801000) == 0 &&
+                           physByte(vmcore, 0x802fff) == 0;
+                   });
+
+        test.check("Pointer size follows the machine type",
+                   [&]() {
+                       FilePath i386 = dir.file("vmcore-i386");
+                       makeVmcore(i386, EM_386);
+                       Vmcore ia32(i386);
+                       return vmcore.pointerSize() == 8 &&
+                           ia32.isElf64() && ia32.pointerSize() == 4;
+                   });
+
+        test.check("Addresses outside the dump are rejected",
+                   [&]() {
+                       try {
+                           physByte(vmcore, 0x803000);
+                       } catch (const KError &) {
+                           try {
+                               physByte(vmcore, 0x400000);
+                           } catch (const KError &) {
+                               return true;
+                           }
+                       }
+                       return false;
+                   });
+
+        test.check("Index file lists the ranges with file offsets",
+                   [&]() {
+                       FilePath index = path + Vmcore::INDEX_SUFFIX;
+                       vmcore.writeIndex(index);
+
+                       std::ifstream in(index.c_str());
+                       string line;
+                       vector<string> lines;
+                       while (getline(in, line))
+                           if (line.compare(0, 5, "size=") != 0 &&
+                               line.compare(0, 6, "mtime=") != 0)
+                               lines.push_back(line);
+
+                       std::ostringstream ss;
+                       ss << std::hex;
+                       ss << "0 100000 " << offsets[1] << "\n"
+                          << "100000 110000 " << offsets[0] << "\n"
+                          << "110000 400000 " << offsets[1] + 0x110000 << "\n"
+                          << "800000 801000 " << offsets[2] << "\n"
+                          << "801000 803000 -\n";
+                       string expect = ss.str();
+
+                       string got;
+                       for (size_t i = 1; i < lines.size(); ++i)
+                           got += lines[i] + "\n";
+                       return lines.size() == 6 &&
+                           lines[0] == "# kdump load index 1" &&
+                           got == expect;
+                   });
+
+        test.check("Page reader serves repeated reads from the cache",
+                   [&]() {
+                       PageReader reader(vmcore, TEST_PAGE_SIZE, 2);
+                       char buf[8];
+                       reader.readPhys(0x100010, buf, sizeof buf);
+                       reader.readPhys(0x100020, buf, sizeof buf);
+                       return reader.hits() == 1 && reader.misses() == 1 &&
+                           memcmp(buf, "kkkkkkkk", 8) == 0;
+                   });
+
+        test.check("Page reader evicts the least recently used page",
+                   [&]() {
+                       PageReader reader(vmcore, TEST_PAGE_SIZE, 2);
+                       reader.page(0);
+                       reader.page(1);
+                       reader.page(0);     // 1 is now the oldest
+                       reader.page(2);
+                       reader.page(0);
+                       reader.page(1);
+                       return reader.hits() == 2 && reader.misses() == 4;
+                   });
+
+        test.check("Page reader falls back for partial pages",
+                   [&]() {
+                       // 0x800000-0x803000 is in the dump, 0x803000 is not
+                       PageReader reader(vmcore, 0x4000, 4);
+                       char c;
+                       reader.readPhys(0x800000, &c, 1);
+                       return c == 'z' && reader.misses() == 0;
+                   });
+
+        result = test.result();
+
+    } catch (const std::exception &ex) {
+        cerr << "Fatal exception: " << ex.what() << endl;
+        result = EXIT_FAILURE;
+    }
+
+    return result;
+}
@@ -0,0 +1,237 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "global.h"
+#include "debug.h"
+#include "testutil.h"
+
+#if HAVE_ZSTD
+#include <zstd.h>
+
+#include "dataprovider.h"
+#include "zstdprovider.h"
+#endif
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+#if HAVE_ZSTD
+
+#define ZSTD_SKIPPABLE_MAGIC    0x184D2A5E
+#define ZSTD_SEEKABLE_MAGIC     0x8F92EAB1
+
+#define NUM_THREADS     3
+#define DATA_SIZE       (5 * ZstdDataProvider::FRAME_SIZE / 2)
+
+struct SeekEntry {
+    uint32_t compressed;
+    uint32_t decompressed;
+};
+
+// -----------------------------------------------------------------------------
+static uint32_t getLE32(const vector<char> &buf, size_t pos)
+{
+    uint32_t val = 0;
+    for (int i = 3; i >= 0; --i)
+        val = (val << 8) | (unsigned char)buf[pos + i];
+    return val;
+}
+
+// -----------------------------------------------------------------------------
+static vector<char> makeData(void)
+{
+    // compressible text interleaved with pseudo-random runs
+    vector<char> data(DATA_SIZE);
+    unsigned long long seed = 0x2545F4914F6CDD1DULL;
+    for (size_t i = 0; i < data.size(); ++i) {
+        if ((i >> 12) & 1) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            data[i] = char(seed);
+        } else
+            data[i] = "kdump zstd frame "[i % 17];
+    }
+    return data;
+}
+
+// -----------------------------------------------------------------------------
+static vector<char> compress(const vector<char> &data)
+{
+    ZstdDataProvider provider(
+        new BufferDataProvider(data.data(), data.size()), NUM_THREADS);
+    vector<char> out;
+    char buf[65536];
+    size_t len;
+
+    provider.prepare();
+    while ( (len = provider.getData(buf, sizeof buf)) )
+        out.insert(out.end(), buf, buf + len);
+    provider.finish();
+    return out;
+}
+
+// -----------------------------------------------------------------------------
+static bool readSeekTable(const vector<char> &out, vector<SeekEntry> &table,
+                          size_t &tableStart)
+{
+    if (out.size() < 17)
+        return false;
+    if (getLE32(out, out.size() - 4) != ZSTD_SEEKABLE_MAGIC) {
+        cerr << "Seekable magic not found" << endl;
+        return false;
+    }
+    if (out[out.size() - 5] != 0) {
+        cerr << "Unexpected seek table descriptor" << endl;
+        return false;
+    }
+
+    uint32_t n = getLE32(out, out.size() - 9);
+    size_t frameSize = n * 8 + 9;
+    if (frameSize + 8 > out.size())
+        return false;
+    tableStart = out.size() - frameSize - 8;
+    if (getLE32(out, tableStart) != ZSTD_SKIPPABLE_MAGIC ||
+        getLE32(out, tableStart + 4) != frameSize) {
+        cerr << "Bad skippable frame header" << endl;
+        return false;
+    }
+
+    table.clear();
+    for (uint32_t i = 0; i < n; ++i) {
+        SeekEntry entry;
+        entry.compressed = getLE32(out, tableStart + 8 + i * 8);
+        entry.decompressed = getLE32(out, tableStart + 12 + i * 8);
+        table.push_back(entry);
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+static bool checkFrames(const vector<char> &data, const vector<char> &out)
+{
+    vector<SeekEntry> table;
+    size_t tableStart;
+    if (!readSeekTable(out, table, tableStart))
+        return false;
+
+    size_t expected = (data.size() + ZstdDataProvider::FRAME_SIZE - 1) /
+        ZstdDataProvider::FRAME_SIZE;
+    if (table.size() != expected) {
+        cerr << "Expected " << expected << " frames, seek table has "
+             << table.size() << endl;
+        return false;
+    }
+
+    vector<char> frame(ZstdDataProvider::FRAME_SIZE);
+    size_t inPos = 0, outPos = 0;
+    for (size_t i = 0; i < table.size(); ++i) {
+        const SeekEntry &entry = table[i];
+        if (outPos + entry.compressed > tableStart)
+            return false;
+
+        size_t size = ZSTD_findFrameCompressedSize(out.data() + outPos,
+                                                   entry.compressed);
+        if (ZSTD_isError(size) || size != entry.compressed) {
+            cerr << "Frame " << i << ": bad compressed size" << endl;
+            return false;
+        }
+
+        size = ZSTD_decompress(frame.data(), frame.size(),
+                               out.data() + outPos, entry.compressed);
+        if (ZSTD_isError(size)) {
+            cerr << "Frame " << i << ": " << ZSTD_getErrorName(size) << endl;
+            return false;
+        }
+        if (size != entry.decompressed ||
+            memcmp(frame.data(), data.data() + inPos, size) != 0) {
+            cerr << "Frame " << i << ": data mismatch" << endl;
+            return false;
+        }
+        inPos += entry.decompressed;
+        outPos += entry.compressed;
+    }
+    return inPos == data.size() && outPos == tableStart;
+}
+
+// -----------------------------------------------------------------------------
+static bool checkStream(const vector<char> &data, const vector<char> &out)
+{
+    // a plain zstd decoder must skip the seek table
+    vector<char> decoded(data.size() + 1);
+    size_t size = ZSTD_decompress(decoded.data(), decoded.size(),
+                                  out.data(), out.size());
+    if (ZSTD_isError(size)) {
+        cerr << ZSTD_getErrorName(size) << endl;
+        return false;
+    }
+    return size == data.size() &&
+        memcmp(decoded.data(), data.data(), size) == 0;
+}
+
+#endif // HAVE_ZSTD
+
+// -----------------------------------------------------------------------------
+int main()
+{
+    int result = EXIT_SUCCESS;
+
+#if HAVE_ZSTD
+    Debug::debug()->setStderrLevel(Debug::DL_TRACE);
+    try {
+        TestRun test;
+
+        vector<char> data = makeData();
+        vector<char> out = compress(data);
+
+        test.check("Seek table matches the frames", [&data, &out]() {
+            return checkFrames(data, out);
+        });
+        test.check("Stream decompresses as a whole", [&data, &out]() {
+            return checkStream(data, out);
+        });
+
+        vector<char> empty;
+        vector<char> emptyOut = compress(empty);
+        test.check("Empty input has an empty seek table", [&emptyOut]() {
+            vector<SeekEntry> table;
+            size_t tableStart;
+            return readSeekTable(emptyOut, table, tableStart) &&
+                table.empty() && tableStart == 0;
+        });
+
+        result = test.result();
+    } catch(KError &ke) {
+        cerr << ke.what() << endl;
+        result = EXIT_FAILURE;
+    }
+#else
+    cout << "Built without zstd support, nothing to test" << endl;
+#endif
+
+    return result;
+}
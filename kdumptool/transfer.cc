@@ -24,6 +24,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <cstring>
+#include <chrono>
+#include <vector>
+#include <unistd.h>
+#include <cstdlib>
 
 #include <curl/curl.h>
 
@@ -139,6 +143,49 @@ void FileTransfer::perform(DataProvider *dataprovider,
     }
 }
 
+// -----------------------------------------------------------------------------
+double FileTransfer::measureThroughput(const char *data, size_t size)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    Debug::debug()->trace("FileTransfer::measureThroughput(%p, %zu)",
+                          data, size);
+
+    FilePath path = getURLVector().front().getRealPath();
+    path.appendPath("kdump-speed.XXXXXX");
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+
+    int fd = mkstemp(name.data());
+    if (fd < 0)
+        throw KSystemError("Cannot create " + path, errno);
+
+    Clock::time_point start = Clock::now();
+    int err = 0;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t ret = write(fd, data + done, size - done);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            err = errno;
+            break;
+        }
+        done += ret;
+    }
+    if (!err && fdatasync(fd) != 0)
+        err = errno;
+    Clock::time_point end = Clock::now();
+
+    ::close(fd);
+    unlink(name.data());
+    if (err)
+        throw KSystemError("Cannot write to " + path, err);
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    return seconds > 0 ? size / seconds : 0.0;
+}
+
 // -----------------------------------------------------------------------------
 void FileTransfer::performFile(DataProvider *dataprovider,
 			       const StringVector &target_files)
@@ -80,6 +80,19 @@ class Transfer {
 	void perform(DataProvider *dataprovider,
 		     const std::string &target_file,
 		     bool *directSave=NULL);
+
+        /**
+         * Measures how fast data can be written to the target. The data
+         * is written to a temporary file, which is removed afterwards.
+         *
+         * @param[in] data the data to be written
+         * @param[in] size size of @p data in bytes
+         * @return throughput in bytes per second, or zero if the
+         *         throughput cannot be measured for this target
+         * @exception KError if writing the data fails
+         */
+        virtual double measureThroughput(const char *data, size_t size)
+        { return 0.0; }
 };
 
 //}}}
@@ -150,6 +163,13 @@ class FileTransfer : public URLTransfer {
                      const StringVector &target_files,
                      bool *directSave);
 
+        /**
+         * Writes to the first target directory and syncs the file.
+         *
+         * @see Transfer::measureThroughput()
+         */
+        double measureThroughput(const char *data, size_t size);
+
     protected:
 
         void performFile(DataProvider *dataprovider,
@@ -240,6 +260,14 @@ class NFSTransfer : public URLTransfer {
                      const StringVector &target_files,
                      bool *directSave);
 
+        /**
+         * Measures the throughput of the mounted share.
+         *
+         * @see Transfer::measureThroughput()
+         */
+        double measureThroughput(const char *data, size_t size)
+        { return m_fileTransfer->measureThroughput(data, size); }
+
     protected:
         void close();
 
@@ -287,6 +315,14 @@ class CIFSTransfer : public URLTransfer {
                      const StringVector &target_files,
                      bool *directSave);
 
+        /**
+         * Measures the throughput of the mounted share.
+         *
+         * @see Transfer::measureThroughput()
+         */
+        double measureThroughput(const char *data, size_t size)
+        { return m_fileTransfer->measureThroughput(data, size); }
+
     protected:
         void close();
 
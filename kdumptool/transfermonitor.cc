@@ -0,0 +1,309 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "global.h"
+#include "debug.h"
+#include "dataprovider.h"
+#include "transfermonitor.h"
+#include "stringutil.h"
+
+using std::string;
+
+// -----------------------------------------------------------------------------
+static void interruptHandler(int)
+{
+    // only interrupts a blocking system call
+}
+
+// -----------------------------------------------------------------------------
+static string formatMiB(unsigned long long bytes)
+{
+    return StringUtil::number2string(bytes / (1024 * 1024)) + " MiB";
+}
+
+//{{{ TransferMonitor ----------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+TransferMonitor::TransferMonitor(DataProvider *provider, unsigned interval)
+    : m_provider(provider), m_interval(interval), m_hangTimeout(0),
+      m_handlerInstalled(false), m_abandoned(false)
+{}
+
+// -----------------------------------------------------------------------------
+TransferMonitor::~TransferMonitor()
+{
+    if (m_handlerInstalled)
+        sigaction(SIGUSR1, &m_oldAction, NULL);
+}
+
+// -----------------------------------------------------------------------------
+void TransferMonitor::addCheck(Check *check)
+{
+    m_checks.emplace_back(check);
+}
+
+// -----------------------------------------------------------------------------
+void TransferMonitor::setHangTimeout(unsigned timeout,
+                                     std::function<unsigned long long()> done)
+{
+    m_hangTimeout = std::chrono::seconds(timeout);
+    m_done = done;
+}
+
+// -----------------------------------------------------------------------------
+string TransferMonitor::runChecks()
+{
+    string reason;
+    for (auto &check : m_checks) {
+        try {
+            reason = check->check();
+        } catch (const KError &error) {
+            Debug::debug()->dbg("Transfer check failed: %s", error.what());
+        }
+        if (!reason.empty())
+            break;
+    }
+    return reason;
+}
+
+// -----------------------------------------------------------------------------
+void TransferMonitor::perform(std::function<void()> transfer)
+{
+    Debug::debug()->trace("TransferMonitor::perform(), %zu checks",
+                          m_checks.size());
+
+    if (m_checks.empty()) {
+        transfer();
+        return;
+    }
+
+    // no SA_RESTART, so that blocking calls fail with EINTR
+    if (!m_handlerInstalled) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof sa);
+        sa.sa_handler = interruptHandler;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGUSR1, &sa, &m_oldAction) != 0)
+            throw KSystemError("Cannot install SIGUSR1 handler", errno);
+        m_handlerInstalled = true;
+    }
+
+    // shared with the transfer thread, which may outlive the monitor
+    struct State {
+        std::mutex lock;
+        std::condition_variable cond;
+        bool done;
+        std::exception_ptr error;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    state->done = false;
+
+    std::thread thread([state, transfer]() {
+        try {
+            transfer();
+        } catch (...) {
+            state->error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(state->lock);
+        state->done = true;
+        state->cond.notify_all();
+    });
+    pthread_t target = thread.native_handle();
+
+    Clock::time_point lastProgress;
+    unsigned long long lastDone = 0;
+
+    std::unique_lock<std::mutex> lock(state->lock);
+    while (!state->cond.wait_for(lock, m_interval,
+                                 [&state]{ return state->done; })) {
+        lock.unlock();
+
+        if (m_abortReason.empty()) {
+            string reason = runChecks();
+            if (!reason.empty()) {
+                Debug::debug()->info("Aborting transfer: %s", reason.c_str());
+                m_abortReason = reason;
+                m_provider->abort(reason);
+                lastProgress = Clock::now();
+                if (m_done)
+                    lastDone = m_done();
+            }
+        } else if (m_hangTimeout.count()) {
+            // aborted, but the transfer has not returned yet
+            unsigned long long done = m_done();
+            if (done != lastDone) {
+                lastDone = done;
+                lastProgress = Clock::now();
+            } else if (Clock::now() - lastProgress >= m_hangTimeout) {
+                Debug::debug()->info("Abandoning transfer after %lld s "
+                                     "without progress",
+                                     (long long)m_hangTimeout.count());
+                m_abandoned = true;
+                thread.detach();
+                throw KError("Transfer cannot be interrupted: " +
+                             m_abortReason);
+            }
+        }
+
+        if (!m_abortReason.empty())
+            pthread_kill(target, SIGUSR1);
+
+        lock.lock();
+    }
+    lock.unlock();
+
+    thread.join();
+    if (state->error)
+        std::rethrow_exception(state->error);
+}
+
+//}}}
+//{{{ FreeSpaceCheck -----------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+string FreeSpaceCheck::check()
+{
+    unsigned long long freeSize = bytes_to_megabytes(m_path.freeDiskSize());
+
+    if (freeSize < m_minFree)
+        return "Free disk space on " + m_path + " dropped to " +
+            StringUtil::number2string(freeSize) + " MiB. Aborting. "
+            "Check KDUMP_FREE_DISK_SIZE.";
+
+    return string();
+}
+
+//}}}
+//{{{ TimeBudgetCheck ----------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+TimeBudgetCheck::TimeBudgetCheck(Clock::time_point deadline,
+                                 std::function<unsigned long long()> done,
+                                 unsigned long long total, bool canEscalate)
+    : m_start(Clock::now()), m_deadline(deadline), m_done(done),
+      m_total(total), m_canEscalate(canEscalate), m_escalate(false),
+      m_exhausted(false), m_throughput(0.0)
+{}
+
+// -----------------------------------------------------------------------------
+string TimeBudgetCheck::check()
+{
+    using std::chrono::duration;
+
+    Clock::time_point now = Clock::now();
+    if (now >= m_deadline) {
+        m_exhausted = true;
+        return "Time budget exhausted.";
+    }
+
+    double elapsed = duration<double>(now - m_start).count();
+    double available = duration<double>(m_deadline - m_start).count();
+    unsigned long long done = m_done();
+    if (!done || elapsed <= 0)
+        return string();
+
+    m_throughput = done / elapsed;
+    Debug::debug()->dbg("Transferred %llu bytes in %.1f s (%.1f MiB/s)",
+                        done, elapsed, m_throughput / (1024 * 1024));
+
+    if (!m_canEscalate || !m_total || elapsed * 2 > available)
+        return string();
+
+    double projected = m_total / m_throughput;
+    if (projected > available) {
+        m_escalate = true;
+        return "Saving the dump would take " +
+            StringUtil::number2string((unsigned long long)projected) +
+            " s, but only " +
+            StringUtil::number2string((unsigned long long)available) +
+            " s are left.";
+    }
+
+    return string();
+}
+
+//}}}
+//{{{ StallCheck ---------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+StallCheck::StallCheck(std::function<unsigned long long()> done,
+                       unsigned timeout, unsigned long long minRate,
+                       unsigned window,
+                       std::function<unsigned long long()> busy)
+    : m_done(done), m_busy(busy), m_timeout(timeout), m_minRate(minRate),
+      m_window(window), m_last(0), m_lastBusy(0), m_lastChange(Clock::now()),
+      m_windowBytes(0), m_windowStart(m_lastChange)
+{}
+
+// -----------------------------------------------------------------------------
+string StallCheck::check()
+{
+    using std::chrono::duration;
+
+    Clock::time_point now = Clock::now();
+    unsigned long long done = m_done();
+    unsigned long long busy = m_busy ? m_busy() : 0;
+
+    if (done != m_last) {
+        m_last = done;
+        m_lastBusy = busy;
+        m_lastChange = now;
+    } else if (busy != m_lastBusy) {
+        // working on something else, e.g. makedumpfile bitmaps
+        m_lastBusy = busy;
+        m_lastChange = now;
+        m_windowBytes = done;
+        m_windowStart = now;
+        return string();
+    } else if (m_timeout.count() && now - m_lastChange >= m_timeout) {
+        return "No progress for " +
+            StringUtil::number2string((unsigned long long)m_timeout.count()) +
+            " s after saving " + formatMiB(done) + ".";
+    }
+
+    if (!m_minRate || now - m_windowStart < m_window)
+        return string();
+
+    double elapsed = duration<double>(now - m_windowStart).count();
+    unsigned long long rate = (done - m_windowBytes) / elapsed;
+    Debug::debug()->dbg("Throughput %llu KiB/s over the last %.1f s",
+                        rate / 1024, elapsed);
+    if (rate < m_minRate)
+        return "Throughput dropped to " +
+            StringUtil::number2string(rate / 1024) + " KiB/s after saving " +
+            formatMiB(done) + ". Check KDUMP_MIN_THROUGHPUT.";
+
+    m_windowBytes = done;
+    m_windowStart = now;
+    return string();
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -0,0 +1,294 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef TRANSFERMONITOR_H
+#define TRANSFERMONITOR_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <signal.h>
+
+#include "global.h"
+#include "fileutil.h"
+
+class DataProvider;
+
+//{{{ TransferMonitor ----------------------------------------------------------
+
+/**
+ * Runs a transfer in a separate thread and checks periodically whether
+ * it may continue. The DataProvider is aborted as soon as any check fails.
+ *
+ * Aborting the DataProvider does not help if the transfer is blocked in
+ * a system call, e.g. writing to a network target which does not respond.
+ * The monitor therefore also sends a signal to the transfer thread until
+ * it returns. This interrupts most blocking calls. If the transfer makes
+ * no progress even then, it can be abandoned, so the caller can record
+ * how far it got and fail over to another target.
+ */
+class TransferMonitor {
+
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        /**
+         * A single condition checked by the monitor.
+         */
+        class Check {
+            public:
+                virtual ~Check()
+                { }
+
+                /**
+                 * Check the condition.
+                 *
+                 * @return empty string if the transfer may continue,
+                 *         otherwise the reason for aborting it
+                 */
+                virtual std::string check() = 0;
+        };
+
+        /**
+         * Creates a new monitor.
+         *
+         * @param[in] provider the data provider to abort
+         * @param[in] interval check interval in milliseconds
+         */
+        TransferMonitor(DataProvider *provider, unsigned interval = 1000);
+
+        /**
+         * Restores the previous SIGUSR1 handler.
+         */
+        ~TransferMonitor();
+
+        /**
+         * Adds a check. The monitor takes ownership of @p check.
+         * Checks must be added before perform() is called.
+         *
+         * @param[in] check the check
+         */
+        void addCheck(Check *check);
+
+        /**
+         * Returns @c true if no checks have been added.
+         */
+        bool empty() const
+        { return m_checks.empty(); }
+
+        /**
+         * Abandons the transfer if it makes no progress after it has been
+         * aborted. This is the only way out if the transfer is blocked in
+         * an uninterruptible system call.
+         *
+         * @param[in] timeout time in seconds without progress after the
+         *            abort, or zero to wait forever (the default)
+         * @param[in] done returns the number of bytes done so far
+         */
+        void setHangTimeout(unsigned timeout,
+                            std::function<unsigned long long()> done);
+
+        /**
+         * Runs @p transfer in a separate thread and checks the conditions
+         * until it returns. Without any checks, @p transfer is called
+         * directly.
+         *
+         * If the transfer is abandoned, its thread keeps running, so
+         * @p transfer must not refer to anything that is destroyed when
+         * this method throws.
+         *
+         * @param[in] transfer the transfer
+         * @exception KError if the transfer has been abandoned, or any
+         *            exception thrown by @p transfer
+         */
+        void perform(std::function<void()> transfer);
+
+        /**
+         * Returns the reason why the transfer was aborted, or an empty
+         * string if it was not aborted by this monitor.
+         */
+        std::string abortReason() const
+        { return m_abortReason; }
+
+        /**
+         * Returns @c true if the transfer has been abandoned.
+         */
+        bool abandoned() const
+        { return m_abandoned; }
+
+    protected:
+        std::string runChecks();
+
+    private:
+        DataProvider *m_provider;
+        std::chrono::milliseconds m_interval;
+        std::chrono::seconds m_hangTimeout;
+        std::function<unsigned long long()> m_done;
+        std::vector<std::unique_ptr<Check>> m_checks;
+        bool m_handlerInstalled;
+        struct sigaction m_oldAction;
+        bool m_abandoned;
+        std::string m_abortReason;
+};
+
+//}}}
+//{{{ FreeSpaceCheck -----------------------------------------------------------
+
+/**
+ * Fails if the free disk space drops below a limit.
+ */
+class FreeSpaceCheck : public TransferMonitor::Check {
+
+    public:
+        /**
+         * @param[in] path any path on the monitored file system
+         * @param[in] minFree minimum free space in megabytes
+         */
+        FreeSpaceCheck(const FilePath &path, unsigned long long minFree)
+            : m_path(path), m_minFree(minFree)
+        { }
+
+        std::string check();
+
+    private:
+        FilePath m_path;
+        unsigned long long m_minFree;
+};
+
+//}}}
+//{{{ TimeBudgetCheck ----------------------------------------------------------
+
+/**
+ * Fails if the transfer cannot finish before a deadline.
+ *
+ * The throughput is measured from the number of bytes done so far. While
+ * less than half of the available time has elapsed, the check fails as
+ * soon as the projected finish time is past the deadline, so the caller
+ * can restart with settings that produce less data. After that, the
+ * check fails only when the deadline is reached.
+ */
+class TimeBudgetCheck : public TransferMonitor::Check {
+
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        /**
+         * @param[in] deadline time when the transfer must be finished
+         * @param[in] done returns the number of bytes done so far
+         * @param[in] total expected total number of bytes, or zero if
+         *            unknown
+         * @param[in] canEscalate @c true if the check should fail early
+         *            when the projected finish time is past the deadline
+         */
+        TimeBudgetCheck(Clock::time_point deadline,
+                        std::function<unsigned long long()> done,
+                        unsigned long long total, bool canEscalate);
+
+        std::string check();
+
+        /**
+         * Returns @c true if the check failed because the projected
+         * finish time is past the deadline.
+         */
+        bool escalate() const
+        { return m_escalate; }
+
+        /**
+         * Returns @c true if the check failed because the deadline
+         * has been reached.
+         */
+        bool exhausted() const
+        { return m_exhausted; }
+
+        /**
+         * Returns the last measured throughput in bytes per second.
+         */
+        double throughput() const
+        { return m_throughput; }
+
+    private:
+        Clock::time_point m_start;
+        Clock::time_point m_deadline;
+        std::function<unsigned long long()> m_done;
+        unsigned long long m_total;
+        bool m_canEscalate;
+        bool m_escalate;
+        bool m_exhausted;
+        double m_throughput;
+};
+
+//}}}
+//{{{ StallCheck ---------------------------------------------------------------
+
+/**
+ * Fails if the transfer makes no progress for too long, or if its
+ * throughput drops below a minimum. While the writer is busy but has
+ * not produced any new output, neither condition is checked.
+ */
+class StallCheck : public TransferMonitor::Check {
+
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        /**
+         * @param[in] done returns the number of bytes done so far
+         * @param[in] timeout maximum time in seconds without any
+         *            progress, or zero to allow any time
+         * @param[in] minRate minimum throughput in bytes per second,
+         *            or zero for no minimum
+         * @param[in] window time in seconds over which the throughput
+         *            is averaged
+         * @param[in] busy returns a counter that increases while the
+         *            writer is working without producing output (e.g. the
+         *            CPU time of makedumpfile while it builds its bitmaps),
+         *            or an empty function
+         */
+        StallCheck(std::function<unsigned long long()> done,
+                   unsigned timeout, unsigned long long minRate,
+                   unsigned window,
+                   std::function<unsigned long long()> busy =
+                   std::function<unsigned long long()>());
+
+        std::string check();
+
+        /**
+         * Returns the number of bytes done at the last check.
+         */
+        unsigned long long bytesDone() const
+        { return m_last; }
+
+    private:
+        std::function<unsigned long long()> m_done;
+        std::function<unsigned long long()> m_busy;
+        std::chrono::seconds m_timeout;
+        unsigned long long m_minRate;
+        std::chrono::seconds m_window;
+        unsigned long long m_last;
+        unsigned long long m_lastBusy;
+        Clock::time_point m_lastChange;
+        unsigned long long m_windowBytes;
+        Clock::time_point m_windowStart;
+};
+
+//}}}
+
+#endif /* TRANSFERMONITOR_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -36,6 +36,7 @@
 #include "util.h"
 #include "debug.h"
 #include "fileutil.h"
+#include "decompress.h"
 
 using std::string;
 using std::strerror;
@@ -100,34 +101,20 @@ bool Util::isGzipFile(const string &file)
 // -----------------------------------------------------------------------------
 bool Util::isElfFile(int fd)
 {
-    int     dupfd;
-    gzFile  fp = NULL;
-    int     err;
-    char    buffer[EI_MAG3+1];
-    
-    Debug::debug()->trace("isElfFile(%d)", fd);
+    unsigned char buffer[EI_MAG3+1];
 
-    // the dup() is because we want to keep the fd open on gzclose()
-    dupfd = dup(fd);
-    if (dupfd < 0) {
-        throw KError("gzfile dup failed");
-    }
-    lseek(dupfd, 0, SEEK_SET);
+    Debug::debug()->trace("isElfFile(%d)", fd);
 
-    fp = gzdopen(dupfd, "r");
-    if (!fp) {
-        close(dupfd);
-        throw KError("gzopen failed");
+    if (lseek(fd, 0, SEEK_SET) == (off_t)-1) {
+        throw KSystemError("Cannot lseek() in Util::isElfFile()", errno);
     }
 
-    err = gzread(fp, buffer, EI_MAG3+1);
-    if (err != (EI_MAG3+1)) {
-        gzclose(fp);
+    // only the first bytes are decompressed
+    Decompressor dec(fd);
+    if (dec.read(buffer, sizeof buffer) != sizeof buffer) {
         throw KError("IdentifyKernel::isElfFile: Couldn't read bytes");
     }
 
-    gzclose(fp);
-
     return buffer[EI_MAG0] == ELFMAG0 && buffer[EI_MAG1] == ELFMAG1 &&
             buffer[EI_MAG2] == ELFMAG2 && buffer[EI_MAG3] == ELFMAG3;
 }
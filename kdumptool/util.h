@@ -69,7 +69,8 @@ class Util {
         static bool isGzipFile(const std::string &file);
 
         /**
-         * Checks if @p filename is an ELF file.
+         * Checks if @p filename is an ELF file. The file may be compressed
+         * in any format supported by Decompressor.
          *
          * @param[in] filename the file to check
          * @return @c true if it's an ELF file, @c false otherwise
@@ -78,7 +79,8 @@ class Util {
         static bool isElfFile(const std::string &filename);
 
         /**
-         * Checks if @p filename is an ELF file.
+         * Checks if @p filename is an ELF file. The file may be compressed
+         * in any format supported by Decompressor.
          *
          * @param[in] fd a file descriptor
          * @return @c true if it's an ELF file, @c false otherwise
@@ -0,0 +1,377 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/stat.h>
+
+#include <gelf.h>
+
+#include "global.h"
+#include "debug.h"
+#include "vmcore.h"
+#include "stringutil.h"
+
+using std::string;
+using std::vector;
+
+#define INDEX_HEADER    "# kdump load index 1"
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+# define ELFDATA_NATIVE ELFDATA2LSB
+#else
+# define ELFDATA_NATIVE ELFDATA2MSB
+#endif
+
+// -----------------------------------------------------------------------------
+static void pread_all(int fd, void *buf, size_t len, off_t offset)
+{
+    char *p = static_cast<char *>(buf);
+
+    while (len) {
+        ssize_t bytes_read = pread(fd, p, len, offset);
+        if (bytes_read < 0)
+            throw KSystemError("Cannot read dump at offset " +
+                               StringUtil::number2string(offset), errno);
+        else if (!bytes_read)
+            throw KError("Unexpected EOF while reading dump at offset " +
+                         StringUtil::number2string(offset));
+
+        len -= bytes_read;
+        p += bytes_read;
+        offset += bytes_read;
+    }
+}
+
+//{{{ Vmcore -------------------------------------------------------------------
+
+const char Vmcore::INDEX_SUFFIX[] = ".index";
+
+// -----------------------------------------------------------------------------
+Vmcore::Vmcore(const FilePath &path)
+    : m_path(path), m_fd(path, O_RDONLY), m_elf64(false), m_machine(EM_NONE)
+{
+    Debug::debug()->trace("Vmcore::Vmcore(%s)", path.c_str());
+
+    unsigned char ident[EI_NIDENT];
+    pread_all(m_fd, ident, sizeof ident, 0);
+    if (memcmp(ident, ELFMAG, SELFMAG))
+        throw KError(path + " is no ELF file.");
+    if (ident[EI_DATA] != ELFDATA_NATIVE)
+        throw KError(path + " does not have native byte order.");
+
+    uint64_t phoff;
+    unsigned phentsize, phnum;
+    switch (ident[EI_CLASS]) {
+    case ELFCLASS32: {
+        Elf32_Ehdr ehdr;
+        pread_all(m_fd, &ehdr, sizeof ehdr, 0);
+        phoff = ehdr.e_phoff;
+        phentsize = ehdr.e_phentsize;
+        phnum = ehdr.e_phnum;
+        m_machine = ehdr.e_machine;
+        if (phentsize < sizeof(Elf32_Phdr))
+            throw KError(path + ": invalid program header size.");
+        break;
+    }
+
+    case ELFCLASS64: {
+        Elf64_Ehdr ehdr;
+        pread_all(m_fd, &ehdr, sizeof ehdr, 0);
+        phoff = ehdr.e_phoff;
+        phentsize = ehdr.e_phentsize;
+        phnum = ehdr.e_phnum;
+        m_machine = ehdr.e_machine;
+        if (phentsize < sizeof(Elf64_Phdr))
+            throw KError(path + ": invalid program header size.");
+        m_elf64 = true;
+        break;
+    }
+
+    default:
+        throw KError(path + ": unrecognized ELF class.");
+    }
+
+    vector<char> phdrs(size_t(phentsize) * phnum);
+    pread_all(m_fd, phdrs.data(), phdrs.size(), phoff);
+
+    for (unsigned i = 0; i < phnum; ++i) {
+        const char *p = phdrs.data() + size_t(i) * phentsize;
+        LoadSegment seg;
+
+        if (m_elf64) {
+            Elf64_Phdr phdr;
+            memcpy(&phdr, p, sizeof phdr);
+            if (phdr.p_type == PT_NOTE)
+                m_notes.push_back(std::make_pair(uint64_t(phdr.p_offset),
+                                                 uint64_t(phdr.p_filesz)));
+            if (phdr.p_type != PT_LOAD)
+                continue;
+            seg.vaddr = phdr.p_vaddr;
+            seg.paddr = phdr.p_paddr;
+            seg.offset = phdr.p_offset;
+            seg.filesz = phdr.p_filesz;
+            seg.memsz = phdr.p_memsz;
+        } else {
+            Elf32_Phdr phdr;
+            memcpy(&phdr, p, sizeof phdr);
+            if (phdr.p_type == PT_NOTE)
+                m_notes.push_back(std::make_pair(uint64_t(phdr.p_offset),
+                                                 uint64_t(phdr.p_filesz)));
+            if (phdr.p_type != PT_LOAD)
+                continue;
+            seg.vaddr = phdr.p_vaddr;
+            seg.paddr = phdr.p_paddr;
+            seg.offset = phdr.p_offset;
+            seg.filesz = phdr.p_filesz;
+            seg.memsz = phdr.p_memsz;
+        }
+        m_loads.push_back(seg);
+    }
+
+    buildIndex(&LoadSegment::vaddr, m_virtIndex);
+    buildIndex(&LoadSegment::paddr, m_physIndex);
+
+    Debug::debug()->dbg("%s: ELF%d with %zu PT_LOAD segments",
+                        path.c_str(), m_elf64 ? 64 : 32, m_loads.size());
+}
+
+// -----------------------------------------------------------------------------
+void Vmcore::buildIndex(uint64_t LoadSegment::*addr,
+                        vector<Interval> &index) const
+{
+    // start address -> interval; only gaps are filled, so the first
+    // segment which maps an address wins
+    std::map<uint64_t, Interval> covered;
+
+    for (size_t i = 0; i < m_loads.size(); ++i) {
+        const LoadSegment &seg = m_loads[i];
+        if (!seg.memsz)
+            continue;
+
+        uint64_t cur = seg.*addr;
+        uint64_t end = cur + seg.memsz;
+        if (end < cur)
+            end = ~uint64_t(0);
+
+        auto it = covered.upper_bound(cur);
+        if (it != covered.begin()) {
+            auto prev = std::prev(it);
+            if (prev->second.end > cur)
+                cur = prev->second.end;
+        }
+        while (cur < end) {
+            uint64_t next = end;
+            if (it != covered.end() && it->first < end)
+                next = it->first;
+            if (cur < next)
+                covered[cur] = Interval{ cur, next, i };
+            if (it == covered.end() || it->first >= end)
+                break;
+            cur = std::max(cur, it->second.end);
+            ++it;
+        }
+    }
+
+    index.clear();
+    index.reserve(covered.size());
+    for (const auto &entry : covered)
+        index.push_back(entry.second);
+}
+
+// -----------------------------------------------------------------------------
+const Vmcore::LoadSegment *Vmcore::lookup(const vector<Interval> &index,
+                                          uint64_t addr) const
+{
+    auto it = std::upper_bound(index.begin(), index.end(), addr,
+        [](uint64_t addr, const Interval &iv) { return addr < iv.start; });
+    if (it == index.begin())
+        return nullptr;
+    --it;
+    return addr < it->end ? &m_loads[it->seg] : nullptr;
+}
+
+// -----------------------------------------------------------------------------
+void Vmcore::writeIndex(const FilePath &path) const
+{
+    struct stat st;
+    if (fstat(m_fd, &st) != 0)
+        throw KSystemError("Cannot stat " + m_path, errno);
+
+    std::ofstream out(path.c_str());
+    if (!out)
+        throw KSystemError("Cannot create " + path, errno);
+
+    out << INDEX_HEADER << "\n";
+    out << "size=" << st.st_size << "\n";
+    out << "mtime=" << st.st_mtim.tv_sec << "." << st.st_mtim.tv_nsec << "\n";
+    out << std::hex;
+    for (const auto &iv : m_physIndex) {
+        const LoadSegment &seg = m_loads[iv.seg];
+        uint64_t segoff = iv.start - seg.paddr;
+
+        // the part of the range which is in the file
+        uint64_t split = iv.end;
+        if (segoff >= seg.filesz)
+            split = iv.start;
+        else if (seg.filesz - segoff < iv.end - iv.start)
+            split = iv.start + (seg.filesz - segoff);
+
+        if (iv.start < split)
+            out << iv.start << " " << split << " "
+                << seg.offset + segoff << "\n";
+        if (split < iv.end)
+            out << split << " " << iv.end << " -\n";
+    }
+
+    out.close();
+    if (!out)
+        throw KSystemError("Cannot write " + path, errno);
+}
+
+// -----------------------------------------------------------------------------
+void Vmcore::readFile(uint64_t offset, void *buf, size_t len)
+{
+    pread_all(m_fd, buf, len, offset);
+}
+
+// -----------------------------------------------------------------------------
+const Vmcore::LoadSegment *Vmcore::findVirt(uint64_t addr) const
+{
+    return lookup(m_virtIndex, addr);
+}
+
+// -----------------------------------------------------------------------------
+const Vmcore::LoadSegment *Vmcore::findPhys(uint64_t addr) const
+{
+    return lookup(m_physIndex, addr);
+}
+
+// -----------------------------------------------------------------------------
+void Vmcore::readSegment(const LoadSegment &seg, uint64_t segoff,
+                         char *buf, size_t len)
+{
+    size_t infile = 0;
+    if (segoff < seg.filesz) {
+        infile = len;
+        if (infile > seg.filesz - segoff)
+            infile = seg.filesz - segoff;
+        pread_all(m_fd, buf, infile, seg.offset + segoff);
+    }
+    memset(buf + infile, 0, len - infile);
+}
+
+// -----------------------------------------------------------------------------
+void Vmcore::readVirt(uint64_t addr, void *buf, size_t len)
+{
+    char *p = static_cast<char *>(buf);
+
+    while (len) {
+        const LoadSegment *seg = findVirt(addr);
+        if (!seg)
+            throw KError("Address " + StringUtil::number2hex(addr) +
+                         " is not in " + m_path);
+
+        uint64_t segoff = addr - seg->vaddr;
+        size_t chunk = len;
+        if (chunk > seg->memsz - segoff)
+            chunk = seg->memsz - segoff;
+        readSegment(*seg, segoff, p, chunk);
+
+        p += chunk;
+        addr += chunk;
+        len -= chunk;
+    }
+}
+
+// -----------------------------------------------------------------------------
+void Vmcore::readPhys(uint64_t addr, void *buf, size_t len)
+{
+    char *p = static_cast<char *>(buf);
+
+    while (len) {
+        const LoadSegment *seg = findPhys(addr);
+        if (!seg)
+            throw KError("Physical address " + StringUtil::number2hex(addr) +
+                         " is not in " + m_path);
+
+        uint64_t segoff = addr - seg->paddr;
+        size_t chunk = len;
+        if (chunk > seg->memsz - segoff)
+            chunk = seg->memsz - segoff;
+        readSegment(*seg, segoff, p, chunk);
+
+        p += chunk;
+        addr += chunk;
+        len -= chunk;
+    }
+}
+
+// -----------------------------------------------------------------------------
+size_t Vmcore::pointerSize() const
+{
+    switch (m_machine) {
+        case EM_386:
+        case EM_ARM:
+        case EM_PPC:
+            return 4;
+
+        case EM_X86_64:
+        case EM_AARCH64:
+        case EM_PPC64:
+        case EM_IA_64:
+            return 8;
+
+        default:
+            return m_elf64 ? 8 : 4;
+    }
+}
+
+// -----------------------------------------------------------------------------
+uint64_t Vmcore::readPointer(uint64_t addr)
+{
+    if (pointerSize() == 8) {
+        uint64_t val;
+        readVirt(addr, &val, sizeof val);
+        return val;
+    } else {
+        uint32_t val;
+        readVirt(addr, &val, sizeof val);
+        return val;
+    }
+}
+
+// -----------------------------------------------------------------------------
+uint32_t Vmcore::readU32(uint64_t addr)
+{
+    uint32_t val;
+    readVirt(addr, &val, sizeof val);
+    return val;
+}
+
+//}}}
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
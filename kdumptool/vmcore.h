@@ -0,0 +1,207 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef VMCORE_H
+#define VMCORE_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "global.h"
+#include "fileutil.h"
+
+//{{{ Vmcore -------------------------------------------------------------------
+
+/**
+ * Read access to kernel memory in an ELF dump file (e.g. /proc/vmcore).
+ *
+ * The ELF and program headers are read with pread(2), so this also works
+ * for files which cannot be memory-mapped.
+ *
+ * Address lookups use sorted arrays of non-overlapping intervals, one for
+ * physical and one for virtual addresses, so they take logarithmic time
+ * even for dumps with thousands of PT_LOAD segments. Where segments
+ * overlap, the first one in program header order is used.
+ */
+class Vmcore {
+
+    public:
+
+        /**
+         * A PT_LOAD segment of the dump.
+         */
+        struct LoadSegment {
+            uint64_t vaddr;
+            uint64_t paddr;
+            uint64_t offset;
+            uint64_t filesz;
+            uint64_t memsz;
+        };
+
+        /**
+         * Opens a dump file and reads its program headers.
+         *
+         * @param[in] path the dump file
+         * @exception KError if the file is not an ELF core dump with
+         *            the native byte order
+         */
+        Vmcore(const FilePath &path);
+
+        /**
+         * Returns @c true for ELF64 dumps and @c false for ELF32 dumps.
+         */
+        bool isElf64() const
+        { return m_elf64; }
+
+        /**
+         * Returns the size of a pointer (and of a C long) in bytes.
+         *
+         * The size is derived from the machine type, because the ELF
+         * class does not match the kernel (e.g. i386 kernels produce
+         * an ELF64 /proc/vmcore).
+         */
+        size_t pointerSize() const;
+
+        /**
+         * Returns the ELF machine type (e_machine) of the dump.
+         */
+        unsigned machine() const
+        { return m_machine; }
+
+        /**
+         * Returns the PT_LOAD segments in program header order.
+         */
+        const std::vector<LoadSegment> &loadSegments() const
+        { return m_loads; }
+
+        /**
+         * Returns the PT_NOTE segments as (offset, size) pairs.
+         */
+        const std::vector<std::pair<uint64_t, uint64_t> > &noteSegments() const
+        { return m_notes; }
+
+        /**
+         * Suffix of the index file written by writeIndex().
+         */
+        static const char INDEX_SUFFIX[];
+
+        /**
+         * Writes the physical address index to a text file, so that other
+         * tools can translate physical addresses to file offsets without
+         * parsing the ELF headers.
+         *
+         * The file starts with a "# kdump load index" header line and
+         * the size and modification time of the dump (as size= and
+         * mtime= lines), followed by one line per address range with
+         * the start address, end address (exclusive) and file offset in
+         * hex. Ranges which are not present in the file (p_memsz larger
+         * than p_filesz) have "-" instead of the offset.
+         *
+         * @param[in] path the index file
+         * @exception KError if the file cannot be written
+         */
+        void writeIndex(const FilePath &path) const;
+
+        /**
+         * Reads raw data from the dump file.
+         *
+         * @param[in] offset file offset
+         * @param[out] buf destination buffer
+         * @param[in] len number of bytes to read
+         * @exception KError if reading fails or hits end of file
+         */
+        void readFile(uint64_t offset, void *buf, size_t len);
+
+        /**
+         * Reads kernel memory at a virtual address.
+         *
+         * Addresses are translated using the virtual addresses of the
+         * PT_LOAD segments. Memory that is present in a segment but not
+         * in the file (p_memsz > p_filesz) reads as zeroes.
+         *
+         * @param[in] addr kernel virtual address
+         * @param[out] buf destination buffer
+         * @param[in] len number of bytes to read
+         * @exception KError if the address range is not in the dump
+         */
+        void readVirt(uint64_t addr, void *buf, size_t len);
+
+        /**
+         * Reads a pointer (or a C long) at a virtual address.
+         *
+         * @param[in] addr kernel virtual address
+         * @return the value, zero-extended to 64 bits
+         * @exception KError if the address is not in the dump
+         */
+        uint64_t readPointer(uint64_t addr);
+
+        /**
+         * Reads memory at a physical address.
+         *
+         * @param[in] addr physical address
+         * @param[out] buf destination buffer
+         * @param[in] len number of bytes to read
+         * @exception KError if the address range is not in the dump
+         */
+        void readPhys(uint64_t addr, void *buf, size_t len);
+
+        /**
+         * Reads a 32-bit unsigned integer at a virtual address.
+         *
+         * @param[in] addr kernel virtual address
+         * @return the value
+         * @exception KError if the address is not in the dump
+         */
+        uint32_t readU32(uint64_t addr);
+
+    protected:
+        /**
+         * Address range [start, end) mapped by m_loads[seg].
+         */
+        struct Interval {
+            uint64_t start, end;
+            size_t seg;
+        };
+
+        void buildIndex(uint64_t LoadSegment::*addr,
+                        std::vector<Interval> &index) const;
+        const LoadSegment *lookup(const std::vector<Interval> &index,
+                                  uint64_t addr) const;
+
+        const LoadSegment *findVirt(uint64_t addr) const;
+        const LoadSegment *findPhys(uint64_t addr) const;
+
+        void readSegment(const LoadSegment &seg, uint64_t segoff,
+                         char *buf, size_t len);
+
+    private:
+        FilePath m_path;
+        FileDescriptor m_fd;
+        bool m_elf64;
+        unsigned m_machine;
+        std::vector<LoadSegment> m_loads;
+        std::vector<std::pair<uint64_t, uint64_t> > m_notes;
+        std::vector<Interval> m_virtIndex;
+        std::vector<Interval> m_physIndex;
+};
+
+//}}}
+
+#endif /* VMCORE_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
@@ -18,301 +18,250 @@
  */
 
 #include <string>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <cerrno>
-#include <sys/mman.h>
+#include <vector>
+#include <algorithm>
 #include <cstring>
-
-#include <gelf.h>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
 
 #include "global.h"
 #include "debug.h"
-#include "elf.h"
 #include "vmcoreinfo.h"
+#include "vmcore.h"
+#include "elfnotes.h"
 #include "stringutil.h"
-#include "stringvector.h"
-#include "fileutil.h"
 
 using std::string;
-using std::min;
 
 #define VMCOREINFO_NOTE_NAME           "VMCOREINFO"
-#define VMCOREINFO_NOTE_NAME_BYTES     (sizeof(VMCOREINFO_NOTE_NAME))
-#define VMCOREINFO_XEN_NOTE_NAME	   "VMCOREINFO_XEN"
-#define VMCOREINFO_XEN_NOTE_NAME_BYTES (sizeof(VMCOREINFO_XEN_NOTE_NAME))
+#define VMCOREINFO_XEN_NOTE_NAME       "VMCOREINFO_XEN"
+
+// -----------------------------------------------------------------------------
+static bool hasPrefix(const char *key, size_t keyLen, const char *prefix)
+{
+    size_t len = strlen(prefix);
+    return keyLen >= len && memcmp(key, prefix, len) == 0;
+}
 
-#define ELF_HEADER_MAPSIZE          (100*1024)
+// -----------------------------------------------------------------------------
+// Returns the strtoull() base of a value, see the kernel's vmcoreinfo macros.
+static int numberBase(const char *key, size_t keyLen)
+{
+    if (hasPrefix(key, keyLen, "SYMBOL(") ||
+        (keyLen == 12 && memcmp(key, "KERNELOFFSET", 12) == 0))
+        return 16;
+    if (hasPrefix(key, keyLen, "NUMBER(") ||
+        hasPrefix(key, keyLen, "OFFSET(") ||
+        hasPrefix(key, keyLen, "SIZE(") ||
+        hasPrefix(key, keyLen, "LENGTH("))
+        return 0;
+    return 10;
+}
 
 //{{{ Vmcoreinfo ---------------------------------------------------------------
 
 // -----------------------------------------------------------------------------
 Vmcoreinfo::Vmcoreinfo()
     : m_xenVmcoreinfo(false)
-{
-    // check that there are no version inconsitencies
-    if (elf_version(EV_CURRENT) == EV_NONE )
-        throw KError("libelf is out of date.");
-}
+{}
 
 // -----------------------------------------------------------------------------
 void Vmcoreinfo::readFromELF(const char *elf_file)
 {
     Debug::debug()->trace("Vmcoreinfo::readFromELF(%s)", elf_file);
 
-    StringVector lines = KString(readElfNote(elf_file)).split('\n');
-
-    for (StringVector::const_iterator it = lines.begin();
-            it != lines.end(); ++it) {
-        KString line = *it;
-
-        Debug::debug()->trace("Line: %s", line.c_str());
-
-        // skip empty lines
-        if (line.trim().size() == 0 || line[0] == '\0') {
-            continue;
-        }
-
-        string::size_type equal = line.find("=");
-        if (equal == string::npos) {
-            Debug::debug()->info("VMCOREINFO line contains no '='. "
-                "Skipping. (%s)sz=%d", line.c_str(), (line).size() );
-            continue;
-        }
-
-        string key = line.substr(0, equal);
-        string value = line.substr(equal+1);
-
-        m_map[key] = value;
-        Debug::debug()->trace("%s=%s", key.c_str(), value.c_str());
-    }
+    Vmcore vmcore(elf_file);
+    ElfNotes notes(vmcore);
+    readFromNotes(notes);
 }
 
 // -----------------------------------------------------------------------------
-ByteVector Vmcoreinfo::readElfNote(const char *file)
+void Vmcoreinfo::readFromNotes(const ElfNotes &notes)
 {
-    Elf *elf = NULL;
-    FileDescriptor fd(file, O_RDONLY);
-    GElf_Off offset = 0;
-    GElf_Xword size = 0;
-    char *buffer = NULL;
-    bool isElf64;
-    void *map = MAP_FAILED;
-    char map_copy[ELF_HEADER_MAPSIZE];
-
-    try {
-        // memory-map by hand because the default implementation maps the
-        // whole file which fails for dumps on 32 bit systems because they
-        // can be larger then the address space
-        map = mmap(NULL, ELF_HEADER_MAPSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
-        if (map != MAP_FAILED) {
-            elf = elf_memory(reinterpret_cast<char *>(map), ELF_HEADER_MAPSIZE);
-            if (!elf)
-                throw KError("Vmcoreinfo: elf_begin() failed.");
-
-        } else {
-            // currently, mmap() on /proc/vmcore does not work
-            // so copy it to memory
-
-            for (size_t already_read = 0; already_read < ELF_HEADER_MAPSIZE; ) {
-
-                size_t to_read = min(size_t(BUFSIZ),
-                    size_t(ELF_HEADER_MAPSIZE-already_read));
-                size_t currently_read = read(fd, map_copy+already_read, to_read);
-                if (currently_read == 0)
-                    throw KSystemError("Error when reading from dump.", errno);
-
-                already_read += currently_read;
-            }
-
-            elf = elf_memory(map_copy, ELF_HEADER_MAPSIZE);
-            if (!elf)
-                throw KError("Vmcoreinfo: elf_begin() failed.");
-        }
-
-        // check the type
-        Elf_Kind ek = elf_kind(elf);
-        if (ek != ELF_K_ELF)
-            throw KError(string(file) + " is no ELF object.");
-
-        // check elf32 vs. elf64
-        int clazz = gelf_getclass(elf);
-        if (clazz == ELFCLASSNONE)
-            throw KError("Vmcoreinfo: Invalid ELF class.");
-
-        isElf64 = clazz == ELFCLASS64;
-
-        // get the number of program header entries
-        size_t n;
-        int ret = elf_getphdrnum(elf, &n);
-        if (ret < 0)
-            throw KELFError("elf_getphdrnum() failed.", elf_errno());
+    Debug::debug()->trace("Vmcoreinfo::readFromNotes()");
+
+    // VMCOREINFO_XEN is used only if it comes first or if there is
+    // no VMCOREINFO note at all
+    const ElfNotes::Note *note = notes.find(VMCOREINFO_NOTE_NAME);
+    const ElfNotes::Note *xen = notes.find(VMCOREINFO_XEN_NOTE_NAME);
+    m_xenVmcoreinfo = xen && (!note || xen < note);
+    if (!note)
+        note = xen;
+    if (!note)
+        throw KError("VMCOREINFO not found.");
 
-        // iterate over that entries to find offset and size of the
-        // notes section
-        for (unsigned int i = 0; i < n; i++) {
-            GElf_Phdr phdr;
+    Debug::debug()->dbg("Found %s, offset: %zu, size: %zu",
+        note->name.c_str(), note->offset, note->size);
 
-            if (gelf_getphdr(elf, i, &phdr) != &phdr)
-                throw KELFError("getphdr() failed.", elf_errno());
+    parse(string(notes.desc(*note), note->size));
+}
 
-            if (phdr.p_type == PT_NOTE) {
-                offset = phdr.p_offset;
-                size = phdr.p_filesz;
-                break;
+// -----------------------------------------------------------------------------
+void Vmcoreinfo::parse(const string &text)
+{
+    size_t base = m_text.size();
+    m_text += text;
+    m_text += '\n';
+
+    const char *data = m_text.data();
+    size_t pos = base, end = m_text.size();
+    std::vector<IndexEntry> entries;
+
+    while (pos < end) {
+        const char *eol = static_cast<const char *>(
+            memchr(data + pos, '\n', end - pos));
+        size_t lineEnd = eol ? eol - data : end;
+        const char *line = data + pos;
+
+        // the note is padded with NUL bytes
+        size_t lineLen = strnlen(line, lineEnd - pos);
+        while (lineLen && isspace((unsigned char)line[lineLen - 1]))
+            --lineLen;
+
+        if (lineLen) {
+            const char *equal = static_cast<const char *>(
+                memchr(line, '=', lineLen));
+            if (!equal) {
+                Debug::debug()->info("VMCOREINFO line contains no '='. "
+                    "Skipping. (%.*s)", int(lineLen), line);
+            } else {
+                IndexEntry entry;
+                entry.key = pos;
+                entry.keyLen = equal - line;
+                entry.value = pos + entry.keyLen + 1;
+                entry.valueLen = lineLen - entry.keyLen - 1;
+
+                // the value is followed by whitespace or NUL, so the
+                // conversion cannot run into the next line
+                const char *value = data + entry.value;
+                int base = numberBase(line, entry.keyLen);
+                if (!entry.valueLen)
+                    entry.number = 0;
+                else if (*value == '-')
+                    entry.number = strtoll(value, NULL, base);
+                else
+                    entry.number = strtoull(value, NULL, base);
+
+                entries.push_back(entry);
+                Debug::debug()->trace("%.*s", int(lineLen), line);
             }
         }
 
-        if (offset == 0 && size == 0)
-            throw KError(string(file) + " contains no PT_NOTE segment.");
-
-        Debug::debug()->dbg("PT_NOTE size: %lld, offset: %lld",
-            (unsigned long long)size, (unsigned long long)offset);
-
-        buffer = new char[size];
-
-        // seek to the position
-        off_t oret = lseek(fd, offset, SEEK_SET);
-        if (oret == (off_t)-1)
-            throw KSystemError("Vmcoreinfo: lseek() failed.", errno);
-
-        // read the bytes
-        ssize_t bytes_read = read(fd, buffer, size);
-        if (bytes_read != ssize_t(size))
-            throw KSystemError("Vmcoreinfo: Unable to read " +
-                StringUtil::number2string(size) +
-                " bytes.", errno);
-    } catch (...) {
-        if (map != MAP_FAILED)
-            munmap(map, ELF_HEADER_MAPSIZE);
-        if (elf)
-            elf_end(elf);
-        if (buffer)
-            delete[] buffer;
-
-        throw;
+        pos = lineEnd + 1;
     }
 
-    if (map != MAP_FAILED)
-        munmap(map, ELF_HEADER_MAPSIZE);
-    if (elf)
-        elf_end(elf);
-
-    ByteVector ret;
-    try {
-        ret = readVmcoreinfoFromNotes(buffer, size, isElf64);
-    } catch (...) {
-        delete[] buffer;
-        throw;
+    // later values override earlier ones
+    m_index.insert(m_index.end(), entries.begin(), entries.end());
+    std::stable_sort(m_index.begin(), m_index.end(),
+        [data](const IndexEntry &a, const IndexEntry &b) {
+            int cmp = memcmp(data + a.key, data + b.key,
+                             std::min(a.keyLen, b.keyLen));
+            return cmp ? cmp < 0 : a.keyLen < b.keyLen;
+        });
+    std::vector<IndexEntry> unique;
+    for (const auto &e : m_index) {
+        if (!unique.empty() && unique.back().keyLen == e.keyLen &&
+            memcmp(data + unique.back().key, data + e.key, e.keyLen) == 0)
+            unique.back() = e;
+        else
+            unique.push_back(e);
     }
-
-    delete[] buffer;
-
-    return ret;
+    m_index.swap(unique);
 }
 
 // -----------------------------------------------------------------------------
-ByteVector Vmcoreinfo::readVmcoreinfoFromNotes(const char *buffer, size_t size,
-                                               bool isElf64)
+const Vmcoreinfo::IndexEntry *Vmcoreinfo::find(const char *key,
+                                               size_t len) const
 {
+    const char *data = m_text.data();
+    auto it = std::lower_bound(m_index.begin(), m_index.end(), len,
+        [data, key](const IndexEntry &e, size_t len) {
+            int cmp = memcmp(data + e.key, key,
+                             std::min(size_t(e.keyLen), len));
+            return cmp ? cmp < 0 : e.keyLen < len;
+        });
+    if (it == m_index.end() || it->keyLen != len ||
+        memcmp(data + it->key, key, len) != 0)
+        return nullptr;
+    return &*it;
+}
 
-    Elf64_Nhdr *note64;
-    Elf32_Nhdr *note32;
-
-    loff_t offset = 0;
-
-    unsigned long long offset_vmcoreinfo = 0, size_vmcoreinfo = 0;
-
-    while (offset < loff_t(size)) {
-
-        loff_t add_offset;
-
-        if (isElf64) {
-            note64 = (Elf64_Nhdr *)(buffer + offset);
-            add_offset = sizeof(Elf64_Nhdr);
-        } else {
-            note32 = (Elf32_Nhdr *)(buffer + offset);
-            add_offset = sizeof(Elf32_Nhdr);
-        }
-
-        if (!strncmp(VMCOREINFO_XEN_NOTE_NAME, buffer+offset+add_offset,
-		        VMCOREINFO_XEN_NOTE_NAME_BYTES)) {
-			if (isElf64) {
-                offset_vmcoreinfo = offset +
-				    (sizeof(*note64) + ((note64->n_namesz + 3) & ~3));
-				size_vmcoreinfo = note64->n_descsz;
-			} else {
-				offset_vmcoreinfo = offset +
-                    (sizeof(*note32) + ((note32->n_namesz + 3) & ~3));
-				size_vmcoreinfo = note32->n_descsz;
-			}
-            m_xenVmcoreinfo = true;
-        } else if (!strncmp(VMCOREINFO_NOTE_NAME, buffer+offset+add_offset,
-                    VMCOREINFO_NOTE_NAME_BYTES)) {
-            if (isElf64) {
-                offset_vmcoreinfo = offset +
-                    (sizeof(*note64) + ((note64->n_namesz + 3) & ~3));
-                size_vmcoreinfo = note64->n_descsz;
-            } else {
-                offset_vmcoreinfo = offset  +
-                    (sizeof(*note32) + ((note32->n_namesz + 3) & ~3));
-                size_vmcoreinfo = note32->n_descsz;
-            }
+// -----------------------------------------------------------------------------
+const Vmcoreinfo::IndexEntry &Vmcoreinfo::get(const char *key) const
+{
+    const IndexEntry *e = find(key, strlen(key));
+    if (!e)
+        throw KError("Vmcoreinfo: key " + string(key) + " not found.");
+    return *e;
+}
 
-            break;
-        }
+// -----------------------------------------------------------------------------
+const Vmcoreinfo::IndexEntry &Vmcoreinfo::get(const char *type,
+                                              const char *name) const
+{
+    char buf[128];
+    int len = snprintf(buf, sizeof buf, "%s(%s)", type, name);
+    if (len >= 0 && size_t(len) < sizeof buf)
+        return get(buf);
+    return get((string(type) + "(" + name + ")").c_str());
+}
 
-        if (isElf64)
-            offset += sizeof(Elf64_Nhdr) + ((note64->n_namesz + 3) & ~3)
-                      + ((note64->n_descsz + 3) & ~3);
-        else
-            offset += sizeof(Elf32_Nhdr) + ((note32->n_namesz + 3) & ~3)
-                      + ((note32->n_descsz + 3) & ~3);
-    }
+// -----------------------------------------------------------------------------
+KString Vmcoreinfo::getStringValue(const char *key) const
+{
+    const IndexEntry &e = get(key);
+    return KString(m_text, e.value, e.valueLen);
+}
 
-    if (offset_vmcoreinfo == 0 && size_vmcoreinfo == 0)
-        throw KError("VMCOREINFO not found.");
+// -----------------------------------------------------------------------------
+int Vmcoreinfo::getIntValue(const char *key) const
+{
+    return get(key).number;
+}
 
-    Debug::debug()->dbg("Found VMCOREINFO, offset: %lld, size: %lld",
-        offset_vmcoreinfo, size_vmcoreinfo);
+// -----------------------------------------------------------------------------
+long long Vmcoreinfo::getLLongValue(const char *key) const
+{
+    return get(key).number;
+}
 
-    ByteVector ret;
-    ret.insert(ret.end(), buffer + offset_vmcoreinfo,
-                          buffer + offset_vmcoreinfo + size_vmcoreinfo);
-    return ret;
+// -----------------------------------------------------------------------------
+bool Vmcoreinfo::hasKey(const char *key) const
+{
+    return find(key, strlen(key)) != nullptr;
 }
 
 // -----------------------------------------------------------------------------
-KString Vmcoreinfo::getStringValue(const char *key) const
+uint64_t Vmcoreinfo::symbol(const char *name) const
 {
-    StringStringMap::const_iterator pos = m_map.find(string(key));
-    if (pos == m_map.end())
-        throw KError("Vmcoreinfo: key " + string(key) + " not found.");
+    return get("SYMBOL", name).number;
+}
 
-    return pos->second;
+// -----------------------------------------------------------------------------
+unsigned long Vmcoreinfo::offset(const char *name) const
+{
+    return get("OFFSET", name).number;
 }
 
 // -----------------------------------------------------------------------------
-int Vmcoreinfo::getIntValue(const char *key) const
+unsigned long Vmcoreinfo::size(const char *name) const
 {
-    return getStringValue(key).asInt();
+    return get("SIZE", name).number;
 }
 
 // -----------------------------------------------------------------------------
-int Vmcoreinfo::getLLongValue(const char *key) const
+long long Vmcoreinfo::number(const char *name) const
 {
-    return getStringValue(key).asLongLong();
+    return get("NUMBER", name).number;
 }
 
 // -----------------------------------------------------------------------------
 StringList Vmcoreinfo::getKeys() const
 {
     StringList ret;
-    for (StringStringMap::const_iterator it = m_map.begin();
-            it != m_map.end(); ++it)
-        ret.push_back(it->first);
+    for (const auto &e : m_index)
+        ret.push_back(m_text.substr(e.key, e.keyLen));
     return ret;
 }
 
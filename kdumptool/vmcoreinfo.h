@@ -21,14 +21,26 @@
 
 #include <iostream>
 #include <ctime>
+#include <string>
+#include <vector>
+#include <stdint.h>
 
 #include "global.h"
 #include "stringutil.h"
 
+class ElfNotes;
+
 //{{{ Vmcoreinfo ---------------------------------------------------------------
 
 /**
  * Represents the VMCOREINFO of makedumpfile.
+ *
+ * The note text is kept in memory and indexed by a sorted array of key
+ * and value locations, so lookups do not copy any strings. Numeric values
+ * are parsed once when the text is read; SYMBOL() and KERNELOFFSET values
+ * are hexadecimal, NUMBER(), OFFSET(), SIZE() and LENGTH() values may have
+ * a 0x prefix, all other values are decimal. The object is not modified by
+ * lookups, so it can be shared by multiple threads.
  */
 class Vmcoreinfo {
 
@@ -36,8 +48,6 @@ class Vmcoreinfo {
 
         /**
          * Creates a new Vmcoreinfo object.
-         *
-         * @exception KError if the libelf library is out of date
          */
         Vmcoreinfo();
 
@@ -55,6 +65,14 @@ class Vmcoreinfo {
          */
         void readFromELF(const char *elf_file);
 
+        /**
+         * Reads the vmcoreinfo from ELF notes that have already been read.
+         *
+         * @param[in] notes the notes of the dump
+         * @exception KError if there is no VMCOREINFO note
+         */
+        void readFromNotes(const ElfNotes &notes);
+
         /**
          * Gets all keys.
          *
@@ -81,13 +99,49 @@ class Vmcoreinfo {
         int getIntValue(const char *key) const;
 
         /**
-         * Returns an integer value.
+         * Returns a long long value.
          *
          * @param[in] the key
          * @return the value for @p key
          * @exception KError if the value has not been found
          */
-        int getLLongValue(const char *key) const;
+        long long getLLongValue(const char *key) const;
+
+        /**
+         * Checks whether a key is present.
+         *
+         * @param[in] key the key, e.g. "SYMBOL(prb)"
+         * @return @c true if @p key has a value
+         */
+        bool hasKey(const char *key) const;
+
+        /**
+         * Returns the address of a symbol, i.e. SYMBOL(@p name).
+         *
+         * @exception KError if the value has not been found
+         */
+        uint64_t symbol(const char *name) const;
+
+        /**
+         * Returns the offset of a structure member, i.e. OFFSET(@p name).
+         *
+         * @exception KError if the value has not been found
+         */
+        unsigned long offset(const char *name) const;
+
+        /**
+         * Returns the size of a type, i.e. SIZE(@p name).
+         *
+         * @exception KError if the value has not been found
+         */
+        unsigned long size(const char *name) const;
+
+        /**
+         * Returns a constant, i.e. NUMBER(@p name).
+         *
+         * @exception KError if the value has not been found
+         */
+        long long number(const char *name) const;
 
         /**
          * Returns true if the VMCOREINFO is VMCOREINFO_XEN, and false
@@ -98,13 +152,23 @@ class Vmcoreinfo {
         bool isXenVmcoreinfo() const;
 
     protected:
-        ByteVector readElfNote(const char *file);
+        /**
+         * Location of one key and its value in m_text.
+         */
+        struct IndexEntry {
+            uint32_t key, keyLen;
+            uint32_t value, valueLen;
+            unsigned long long number;
+        };
 
-        ByteVector readVmcoreinfoFromNotes(const char *buffer, size_t size,
-                                           bool isElf64);
+        void parse(const std::string &text);
+        const IndexEntry *find(const char *key, size_t len) const;
+        const IndexEntry &get(const char *key) const;
+        const IndexEntry &get(const char *type, const char *name) const;
 
     private:
-        StringStringMap m_map;
+        std::string m_text;
+        std::vector<IndexEntry> m_index;
         bool m_xenVmcoreinfo;
 };
 
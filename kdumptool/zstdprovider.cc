@@ -0,0 +1,264 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#include <cstring>
+
+#include "global.h"
+
+#if HAVE_ZSTD
+#define ZSTD_STATIC_LINKING_ONLY    // ZSTD_estimateCCtxSize()
+#include <zstd.h>
+
+#include "debug.h"
+#include "zstdprovider.h"
+
+using std::string;
+
+// zstd seekable format
+#define ZSTD_SKIPPABLE_MAGIC    0x184D2A5E
+#define ZSTD_SEEKABLE_MAGIC     0x8F92EAB1
+
+//{{{ ZstdDataProvider ---------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+static void putLE32(std::vector<char> &buf, uint32_t val)
+{
+    for (int i = 0; i < 4; ++i)
+        buf.push_back(char(val >> (8 * i)));
+}
+
+// -----------------------------------------------------------------------------
+ZstdDataProvider::ZstdDataProvider(DataProvider *source, unsigned threads,
+                                   int level)
+    : m_source(source), m_numThreads(threads ? threads : 1), m_level(level),
+      m_stop(false), m_frames(2 * m_numThreads), m_head(0), m_next(0),
+      m_tail(0), m_eof(false), m_finished(false), m_outPos(0)
+{
+    Debug::debug()->trace("ZstdDataProvider::ZstdDataProvider(%p, %u, %d)",
+                          source, threads, level);
+}
+
+// -----------------------------------------------------------------------------
+unsigned long long ZstdDataProvider::memoryNeeded(unsigned threads, int level)
+{
+    if (!threads)
+        threads = 1;
+    unsigned long long frame = FRAME_SIZE + ZSTD_compressBound(FRAME_SIZE);
+    return (2ULL * threads + 1) * frame +
+        (unsigned long long)threads * ZSTD_estimateCCtxSize(level);
+}
+
+// -----------------------------------------------------------------------------
+ZstdDataProvider::~ZstdDataProvider()
+{
+    stopWorkers();
+}
+
+// -----------------------------------------------------------------------------
+void ZstdDataProvider::setProgress(Progress *progress)
+{
+    m_source->setProgress(progress);
+}
+
+// -----------------------------------------------------------------------------
+void ZstdDataProvider::abort(const string &reason)
+{
+    AbstractDataProvider::abort(reason);
+    m_source->abort(reason);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_done.notify_all();
+}
+
+// -----------------------------------------------------------------------------
+void ZstdDataProvider::prepare()
+{
+    Debug::debug()->trace("ZstdDataProvider::prepare()");
+
+    m_source->prepare();
+
+    for (auto &frame : m_frames) {
+        frame.in.resize(FRAME_SIZE);
+        frame.out.resize(ZSTD_compressBound(FRAME_SIZE));
+        frame.done = false;
+    }
+
+    Debug::debug()->dbg("Starting %u zstd compression threads", m_numThreads);
+    for (unsigned i = 0; i < m_numThreads; ++i)
+        m_threads.emplace_back(&ZstdDataProvider::worker, this);
+}
+
+// -----------------------------------------------------------------------------
+void ZstdDataProvider::worker()
+{
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    if (cctx) {
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, m_level);
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+    }
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (true) {
+        while (!m_stop && m_next == m_tail)
+            m_work.wait(lock);
+        if (m_stop)
+            break;
+
+        Frame &frame = m_frames[m_next++ % m_frames.size()];
+        lock.unlock();
+
+        string error;
+        size_t ret = 0;
+        if (!cctx)
+            error = "Cannot allocate zstd context";
+        else {
+            ret = ZSTD_compress2(cctx, frame.out.data(), frame.out.size(),
+                                 frame.in.data(), frame.inSize);
+            if (ZSTD_isError(ret))
+                error = string("zstd compression failed: ") +
+                    ZSTD_getErrorName(ret);
+        }
+
+        lock.lock();
+        frame.outSize = ret;
+        frame.error = error;
+        frame.done = true;
+        m_done.notify_all();
+    }
+    lock.unlock();
+
+    ZSTD_freeCCtx(cctx);
+}
+
+// -----------------------------------------------------------------------------
+void ZstdDataProvider::fill()
+{
+    while (!m_eof && m_tail - m_head < m_frames.size()) {
+        Frame &frame = m_frames[m_tail % m_frames.size()];
+
+        frame.inSize = 0;
+        while (frame.inSize < FRAME_SIZE) {
+            size_t ret = m_source->getData(frame.in.data() + frame.inSize,
+                                           FRAME_SIZE - frame.inSize);
+            if (!ret) {
+                m_eof = true;
+                break;
+            }
+            frame.inSize += ret;
+        }
+        if (!frame.inSize)
+            break;
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        frame.done = false;
+        ++m_tail;
+        m_work.notify_one();
+    }
+}
+
+// -----------------------------------------------------------------------------
+void ZstdDataProvider::appendSeekTable()
+{
+    uint32_t size = m_seekTable.size() * 8 + 9;
+
+    putLE32(m_out, ZSTD_SKIPPABLE_MAGIC);
+    putLE32(m_out, size);
+    for (const auto &entry : m_seekTable) {
+        putLE32(m_out, entry.first);
+        putLE32(m_out, entry.second);
+    }
+    putLE32(m_out, m_seekTable.size());
+    m_out.push_back(0);         // no checksums in the seek table
+    putLE32(m_out, ZSTD_SEEKABLE_MAGIC);
+}
+
+// -----------------------------------------------------------------------------
+size_t ZstdDataProvider::getData(char *buffer, size_t maxread)
+{
+    checkAborted();
+
+    while (m_outPos == m_out.size()) {
+        m_out.clear();
+        m_outPos = 0;
+
+        fill();
+        if (m_head == m_tail) {
+            if (m_finished)
+                return 0;
+            appendSeekTable();
+            m_finished = true;
+            break;
+        }
+
+        Frame &frame = m_frames[m_head % m_frames.size()];
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            while (!frame.done && !isAborted())
+                m_done.wait(lock);
+        }
+        checkAborted();
+        if (!frame.error.empty())
+            throw KError(frame.error);
+
+        // swap buffers rather than copy
+        m_out.swap(frame.out);
+        frame.out.resize(ZSTD_compressBound(FRAME_SIZE));
+        m_out.resize(frame.outSize);
+        m_seekTable.push_back(std::make_pair(uint32_t(frame.outSize),
+                                             uint32_t(frame.inSize)));
+        ++m_head;
+    }
+
+    size_t size = std::min(maxread, m_out.size() - m_outPos);
+    memcpy(buffer, m_out.data() + m_outPos, size);
+    m_outPos += size;
+    addBytesProvided(size);
+
+    return size;
+}
+
+// -----------------------------------------------------------------------------
+void ZstdDataProvider::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+        m_work.notify_all();
+    }
+    for (auto &thread : m_threads)
+        thread.join();
+    m_threads.clear();
+}
+
+// -----------------------------------------------------------------------------
+void ZstdDataProvider::finish()
+{
+    Debug::debug()->trace("ZstdDataProvider::finish()");
+
+    stopWorkers();
+    m_source->finish();
+
+    Debug::debug()->dbg("Compressed %lu frames to %llu bytes",
+                        (unsigned long)m_seekTable.size(), bytesProvided());
+}
+
+//}}}
+
+#endif /* HAVE_ZSTD */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
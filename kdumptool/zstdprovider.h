@@ -0,0 +1,146 @@
+/*
+ * (c) 2021, Petr Tesarik <ptesarik@suse.com>, SUSE Software Solutions Germany, GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+#ifndef ZSTDPROVIDER_H
+#define ZSTDPROVIDER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "global.h"
+#include "dataprovider.h"
+
+//{{{ ZstdDataProvider ---------------------------------------------------------
+
+/**
+ * DataProvider that compresses the data of another DataProvider with zstd.
+ *
+ * The data is cut into frames of FRAME_SIZE bytes, which are compressed
+ * independently by a pool of worker threads and provided in order. The
+ * output ends with a seek table in the zstd seekable format, so tools
+ * can decompress any range without reading the whole file. It is also
+ * a valid zstd stream for the zstd command line tool.
+ */
+class ZstdDataProvider : public AbstractDataProvider {
+
+    public:
+        /**
+         * Uncompressed size of a frame.
+         */
+        static const size_t FRAME_SIZE = 1 << 20;
+
+        /**
+         * Creates a new ZstdDataProvider.
+         *
+         * @param[in] source the data to be compressed; the object takes
+         *            ownership of it
+         * @param[in] threads number of compression threads
+         * @param[in] level zstd compression level
+         */
+        ZstdDataProvider(DataProvider *source, unsigned threads,
+                         int level = 3);
+
+        /**
+         * Estimates the memory used for compression: two frames with
+         * their input and output buffers per thread, the output buffer
+         * being provided, and a compression context per thread.
+         *
+         * @param[in] threads number of compression threads
+         * @param[in] level zstd compression level
+         * @return memory size in bytes
+         */
+        static unsigned long long memoryNeeded(unsigned threads,
+                                               int level = 3);
+
+        ~ZstdDataProvider();
+
+        /**
+         * Prepares the source and starts the worker threads.
+         */
+        void prepare();
+
+        /**
+         * Provides the compressed data.
+         *
+         * @see DataProvider::getData()
+         */
+        size_t getData(char *buffer, size_t maxread);
+
+        /**
+         * Stops the worker threads and finishes the source.
+         */
+        void finish();
+
+        /**
+         * Progress is reported by the source.
+         */
+        void setProgress(Progress *progress);
+
+        /**
+         * Aborts the source and the compression.
+         */
+        void abort(const std::string &reason);
+
+    protected:
+        struct Frame {
+            std::vector<char> in;
+            std::vector<char> out;
+            size_t inSize;
+            size_t outSize;
+            bool done;
+            std::string error;
+        };
+
+        void worker();
+        void fill();
+        void stopWorkers();
+        void appendSeekTable();
+
+    private:
+        std::unique_ptr<DataProvider> m_source;
+        unsigned m_numThreads;
+        int m_level;
+
+        std::vector<std::thread> m_threads;
+        std::mutex m_lock;
+        std::condition_variable m_work;
+        std::condition_variable m_done;
+        bool m_stop;
+
+        // frames are used round-robin; m_head <= m_next <= m_tail
+        std::vector<Frame> m_frames;
+        unsigned long m_head;           // next frame to provide
+        unsigned long m_next;           // next frame to compress
+        unsigned long m_tail;           // next frame to fill
+        bool m_eof;
+        bool m_finished;
+
+        std::vector<char> m_out;
+        size_t m_outPos;
+        std::vector<std::pair<uint32_t, uint32_t> > m_seekTable;
+};
+
+//}}}
+
+#endif /* ZSTDPROVIDER_H */
+
+// vim: set sw=4 ts=4 fdm=marker et: :collapseFolds=1:
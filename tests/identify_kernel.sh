@@ -53,13 +53,16 @@ TYPE=(         "x86"
 
 KDUMPTOOL=$1
 DIR=$2
-KDUMPOPT="-F $2/empty.conf"
 
 if [ -z "$DIR" ] || [ -z "$KDUMPTOOL" ] ; then
     echo "Usage: $0 kdumptool directory"
     exit 1
 fi
 
+CACHEDIR=$(mktemp -d "${TMPDIR:-/tmp}/kdump-cache.XXXXXX") || exit 1
+trap 'rm -rf "$CACHEDIR"' EXIT
+KDUMPOPT="-F $2/empty.conf -K $CACHEDIR"
+
 case `uname -m` in
     i?86|x86_64)
 	x86=yes
@@ -129,6 +132,41 @@ for kernel in ${KERNEL_IMAGES[@]}; do
     fi
 done
 
+#
+# Batch mode must report the same results as single-image invocations.
+#
+echo -n "Testing batch mode "
+batch_images=()
+i=0
+for kernel in ${KERNEL_IMAGES[@]}; do
+    type=${TYPE[$i]}
+    i=$[$i+1]
+    [ "$type" = "x86" -a "$x86" != "yes" ] && continue
+    [ -f "$DIR/$kernel" ] && batch_images+=("$DIR/$kernel")
+done
+batch_output=$($KDUMPTOOL $KDUMPOPT identify_kernel "${batch_images[@]}")
+batch_exit=$?
+echo "($batch_exit)"
+if [ "$batch_exit" -ne 0 ] ; then
+    echo "batch mode exitstatus is '$batch_exit'"
+    errornumber=$[$errornumber+1]
+fi
+i=0
+for kernel in ${KERNEL_IMAGES[@]}; do
+    reloc=${RELOCATABLE[$i]}
+    type=${TYPE[$i]}
+    i=$[$i+1]
+    [ "$type" = "x86" -a "$x86" != "yes" ] && continue
+    [ -f "$DIR/$kernel" ] || continue
+    if (( $reloc )) ; then reloc=true ; else reloc=false ; fi
+    record=$(echo "$batch_output" | grep -F "\"image\": \"$DIR/$kernel\"")
+    if ! echo "$record" | grep -qF "\"type\": \"$type\"" ||
+       ! echo "$record" | grep -qF "\"relocatable\": $reloc" ; then
+        echo "Batch record for $kernel is wrong: $record"
+        errornumber=$[$errornumber+1]
+    fi
+done
+
 if [ "$errornumber" -eq 0 ] ; then
     echo "PASSED"
 else